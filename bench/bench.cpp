@@ -0,0 +1,713 @@
+/**
+ * Benchmark harness of the ingest, train and predict hot paths.
+ *
+ * Usage: K_Means_bench [examples directory] [-t N]
+ *
+ * Measures:
+ *  - image decode and downsample throughput on each image set of the examples directory, serial and on a worker pool.
+ *  - the same throughput with the files read ahead of the decoders on io_uring and on reader threads.
+ *  - stbir_resize_uint8 and box filter downsampling cost, and the difference between their outputs.
+ *  - per-image cost of the feature extractors, decode included, against the 20x20 greyscale pixels.
+ *  - centroids CSV write and parse cost, and binary centroids file map cost.
+ *  - training data matrix fill cost, allocations, and peak bytes, grown with push_back or reserved up front.
+ *  - K-Means Lloyd time per iteration as the number of points N, clusters K and dimensions D vary.
+ *  - k-means++ and k-means|| seeding time, and the inertia of the seeds and of the converged centroids.
+ *  - closest centroid prediction latency.
+ *
+ * The results are written to stdout as a single JSON document so that runs can be tracked over time and
+ * the x86 and ARM builds compared. Progress and errors are written to stderr.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include <dkm.hpp>
+
+#include "stb_image.h"
+#include "stb_image_resize.h"
+
+#include "error_codes.hpp"
+#include "ingest.hpp"
+#include "geometry.hpp"
+#include "feature_extractor.hpp"
+#include "kmeans.hpp"
+#include "distance.hpp"
+#include "downsample.hpp"
+#include "model.hpp"
+#include "centroid_file.hpp"
+#include "parallel.hpp"
+#include "read_ahead.hpp"
+
+using namespace std;
+
+/* Number of timed repetitions of each measurement, the median is reported */
+#define BENCH_REPETITIONS                                                                             5
+
+/* Fixed number of Lloyd iterations so that runs with different data are comparable */
+#define BENCH_LLOYD_ITERATIONS                                                                        10
+
+/* Number of reads kept in flight by the read-ahead stage */
+#define BENCH_READ_AHEAD                                                                              32
+
+/* Seed of the synthetic data */
+#define BENCH_SEED                                                                                    42
+
+/**
+ * Seconds elapsed since the given time point.
+ */
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Median of the timings of a measurement.
+ */
+static double median(vector<double> timings)
+{
+    sort(timings.begin(), timings.end());
+    return timings[timings.size() / 2];
+}
+
+/**
+ * Calls fn() BENCH_REPETITIONS times and returns the median duration in seconds.
+ */
+template <typename F>
+static double timeMedian(F fn)
+{
+    vector<double> timings;
+    for(int r = 0; r < BENCH_REPETITIONS; r++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        fn();
+        timings.push_back(secondsSince(start));
+    }
+
+    return median(timings);
+}
+
+/**
+ * Uniformly distributed synthetic points in [0, 1).
+ */
+template <size_t N>
+static vector<array<float, N>> syntheticPoints(size_t count, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    vector<array<float, N>> points(count);
+    for(array<float, N> &point : points)
+    {
+        for(float &value : point)
+        {
+            value = uniform(rng);
+        }
+    }
+
+    return points;
+}
+
+/**
+ * Decode and downsample throughput of an image set, serially with createImgDataBuffer and on a worker pool.
+ */
+static void benchDecode(string imgDirPath, string setName, int threadCount, vector<string> *pRecords)
+{
+    vector<string> imgFileNameVector;
+    if(listImgFiles(imgDirPath, &imgFileNameVector) != NO_ERROR || imgFileNameVector.empty())
+    {
+        std::cerr << "Skipping image set without images: " << imgDirPath << endl;
+        return;
+    }
+
+    /* Bytes read from disk per pass */
+    uint64_t bytes = 0;
+    for(const string &imgFileName : imgFileNameVector)
+    {
+        struct stat st;
+        if(stat((imgDirPath + "/" + imgFileName).c_str(), &st) == 0)
+        {
+            bytes += st.st_size;
+        }
+    }
+
+    vector<uint8_t> imgDataBuffer(Geometry20x20Grey::size);
+    size_t decodedCount = 0;
+
+    double serialSeconds = timeMedian([&]()
+    {
+        decodedCount = 0;
+        for(const string &imgFileName : imgFileNameVector)
+        {
+            if(decodeImgDataBuffer((imgDirPath + "/" + imgFileName).c_str(), Geometry20x20Grey::width, Geometry20x20Grey::height,
+                Geometry20x20Grey::channels, Geometry20x20Grey::extractor, imgDataBuffer.data()) == NO_ERROR)
+            {
+                decodedCount++;
+            }
+        }
+    });
+
+    double pooledSeconds = timeMedian([&]()
+    {
+        ImgBatch imgBatch;
+        ingestImgDir(imgDirPath, Geometry20x20Grey::width, Geometry20x20Grey::height, Geometry20x20Grey::channels, Geometry20x20Grey::extractor,
+            threadCount, &imgBatch);
+    });
+
+    ostringstream record;
+    record << "{\"set\": \"" << setName << "\", \"files\": " << imgFileNameVector.size() << ", \"decoded\": " << decodedCount
+        << ", \"bytes\": " << bytes << ", \"geometry\": \"" << geometryName(GEOMETRY_20X20_GREY) << "\""
+        << ", \"serial_seconds\": " << serialSeconds << ", \"serial_images_per_second\": " << imgFileNameVector.size() / serialSeconds
+        << ", \"serial_mb_per_second\": " << bytes / serialSeconds / 1e6
+        << ", \"workers\": " << resolveThreadCount(threadCount) << ", \"pooled_seconds\": " << pooledSeconds
+        << ", \"pooled_images_per_second\": " << imgFileNameVector.size() / pooledSeconds << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Ingest throughput of an image set with the files read by the decoders themselves, serially as in the default
+ * path and on a worker pool, and with the files read ahead of the worker pool on io_uring and on reader threads.
+ * Only the first pass reads from storage, later passes read the page cache: drop the caches to measure slow storage.
+ */
+static void benchReadAhead(string imgDirPath, string setName, int threadCount, vector<string> *pRecords)
+{
+    typedef Geometry20x20Grey G;
+
+    vector<string> imgFileNameVector;
+    if(listImgFiles(imgDirPath, &imgFileNameVector) != NO_ERROR || imgFileNameVector.empty())
+    {
+        return;
+    }
+
+    auto ingestSeconds = [&](int workerCount, int readAhead, int readEngine)
+    {
+        setImgReadAhead(readAhead, readEngine);
+        double seconds = timeMedian([&]()
+        {
+            ImgBatch imgBatch;
+            ingestImgDir(imgDirPath, G::width, G::height, G::channels, G::extractor, workerCount, &imgBatch);
+        });
+        setImgReadAhead(0, READ_ENGINE_IO_URING);
+
+        return seconds;
+    };
+
+    const double serialSeconds = ingestSeconds(1, 0, READ_ENGINE_IO_URING);
+    const double pooledSeconds = ingestSeconds(threadCount, 0, READ_ENGINE_IO_URING);
+    const double uringSeconds = ingestSeconds(threadCount, BENCH_READ_AHEAD, READ_ENGINE_IO_URING);
+    const double threadsSeconds = ingestSeconds(threadCount, BENCH_READ_AHEAD, READ_ENGINE_THREADS);
+
+    const size_t imgCount = imgFileNameVector.size();
+
+    ostringstream record;
+    record << "{\"set\": \"" << setName << "\", \"files\": " << imgCount << ", \"workers\": " << resolveThreadCount(threadCount)
+        << ", \"read_ahead\": " << BENCH_READ_AHEAD << ", \"io_uring_available\": " << (readAheadIoUringAvailable() ? "true" : "false")
+        << ", \"serial_images_per_second\": " << imgCount / serialSeconds << ", \"pooled_images_per_second\": " << imgCount / pooledSeconds
+        << ", \"io_uring_images_per_second\": " << imgCount / uringSeconds << ", \"threads_images_per_second\": " << imgCount / threadsSeconds
+        << ", \"io_uring_speedup_over_serial\": " << serialSeconds / uringSeconds << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Downsampling cost of stbir_resize_uint8 and of the box filter on the decoded images of a set,
+ * and the per-pixel absolute difference between both outputs.
+ */
+static void benchResize(string imgDirPath, string setName, vector<string> *pRecords)
+{
+    typedef Geometry20x20Grey G;
+
+    vector<string> imgFileNameVector;
+    if(listImgFiles(imgDirPath, &imgFileNameVector) != NO_ERROR)
+    {
+        return;
+    }
+
+    double stbSeconds = 0;
+    double boxSeconds = 0;
+    uint64_t diffSum = 0;
+    uint64_t pixelCount = 0;
+    int maxDiff = 0;
+    size_t imgCount = 0;
+    uint64_t decodedBytes = 0;
+
+    vector<uint8_t> stbBuffer(G::size);
+    vector<uint8_t> boxBuffer(G::size);
+
+    for(const string &imgFileName : imgFileNameVector)
+    {
+        int w, h, c;
+        uint8_t *pImg = stbi_load((imgDirPath + "/" + imgFileName).c_str(), &w, &h, &c, G::channels);
+        if(pImg == NULL)
+        {
+            continue;
+        }
+
+        stbSeconds += timeMedian([&]() { stbir_resize_uint8(pImg, w, h, 0, stbBuffer.data(), G::width, G::height, 0, G::channels); });
+        boxSeconds += timeMedian([&]() { boxDownsampleUint8(pImg, w, h, G::channels, boxBuffer.data(), G::width, G::height); });
+        stbi_image_free(pImg);
+
+        for(size_t i = 0; i < G::size; i++)
+        {
+            int diff = abs((int)stbBuffer[i] - (int)boxBuffer[i]);
+            diffSum += diff;
+            maxDiff = max(maxDiff, diff);
+        }
+
+        pixelCount += G::size;
+        decodedBytes += (uint64_t)w * h * G::channels;
+        imgCount++;
+    }
+
+    if(imgCount == 0)
+    {
+        return;
+    }
+
+    ostringstream record;
+    record << "{\"set\": \"" << setName << "\", \"images\": " << imgCount << ", \"geometry\": \"" << geometryName(GEOMETRY_20X20_GREY) << "\""
+        << ", \"decoded_bytes_per_image\": " << decodedBytes / imgCount
+        << ", \"stb_microseconds_per_image\": " << stbSeconds / imgCount * 1e6 << ", \"box_microseconds_per_image\": " << boxSeconds / imgCount * 1e6
+        << ", \"box_working_bytes\": " << G::width * G::channels * sizeof(uint32_t) + (G::width + 1) * sizeof(int)
+        << ", \"mean_abs_diff\": " << (double)diffSum / pixelCount << ", \"max_abs_diff\": " << maxDiff << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Serial decode cost per image of an image set into the given geometry, NaN if no image could be decoded.
+ */
+template <typename G>
+static double decodeMicrosecondsPerImage(string imgDirPath, const vector<string> &imgFileNameVector)
+{
+    vector<uint8_t> imgDataBuffer(G::size);
+    size_t decodedCount = 0;
+
+    double seconds = timeMedian([&]()
+    {
+        decodedCount = 0;
+        for(const string &imgFileName : imgFileNameVector)
+        {
+            if(decodeImgDataBuffer((imgDirPath + "/" + imgFileName).c_str(), G::width, G::height, G::channels, G::extractor,
+                imgDataBuffer.data()) == NO_ERROR)
+            {
+                decodedCount++;
+            }
+        }
+    });
+
+    return (decodedCount == 0) ? NAN : seconds / decodedCount * 1e6;
+}
+
+/**
+ * Per-image cost of each feature extractor on an image set, decode and downsample included, and its ratio to the
+ * cost of the 20x20 greyscale pixels.
+ */
+static void benchExtract(string imgDirPath, string setName, vector<string> *pRecords)
+{
+    vector<string> imgFileNameVector;
+    if(listImgFiles(imgDirPath, &imgFileNameVector) != NO_ERROR || imgFileNameVector.empty())
+    {
+        return;
+    }
+
+    const double pixelMicroseconds = decodeMicrosecondsPerImage<Geometry20x20Grey>(imgDirPath, imgFileNameVector);
+    if(std::isnan(pixelMicroseconds))
+    {
+        return;
+    }
+
+    const int extractors[] = {FEATURE_EXTRACTOR_COLOUR_HISTOGRAM, FEATURE_EXTRACTOR_EDGE_HISTOGRAM, FEATURE_EXTRACTOR_TEXTURE};
+    const double extractorMicroseconds[] = {
+        decodeMicrosecondsPerImage<GeometryColourHistogram>(imgDirPath, imgFileNameVector),
+        decodeMicrosecondsPerImage<GeometryEdgeHistogram>(imgDirPath, imgFileNameVector),
+        decodeMicrosecondsPerImage<GeometryTexture>(imgDirPath, imgFileNameVector)
+    };
+
+    ostringstream record;
+    record << "{\"set\": \"" << setName << "\", \"images\": " << imgFileNameVector.size()
+        << ", \"pixels_microseconds_per_image\": " << pixelMicroseconds;
+    for(size_t e = 0; e < sizeof(extractors) / sizeof(extractors[0]); e++)
+    {
+        record << ", \"" << featureExtractorName(extractors[e]) << "_microseconds_per_image\": " << extractorMicroseconds[e]
+            << ", \"" << featureExtractorName(extractors[e]) << "_cost_ratio\": " << extractorMicroseconds[e] / pixelMicroseconds;
+    }
+    record << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Centroids CSV write and parse cost for a number of rows, and cost of mapping the same rows from a binary centroids file.
+ */
+static void benchCsv(size_t rowCount, vector<string> *pRecords)
+{
+    typedef Geometry20x20Grey G;
+
+    tuple<vector<array<float, G::size>>, vector<uint32_t>> clusterData(syntheticPoints<G::size>(rowCount, BENCH_SEED), vector<uint32_t>());
+    vector<array<float, G::size>> parsed;
+
+    string csvFilePath = "/tmp/K_Means_bench_" + to_string(getpid()) + ".csv";
+
+    double writeSeconds = timeMedian([&]() { writeCentroidsToCsvFile<G>(&clusterData, 1, csvFilePath); });
+    double parseSeconds = timeMedian([&]() { loadCentroidsFromCsvFile<G>(csvFilePath, 1, &parsed); });
+
+    struct stat st;
+    uint64_t bytes = (stat(csvFilePath.c_str(), &st) == 0) ? st.st_size : 0;
+    unlink(csvFilePath.c_str());
+
+    /* Binary centroids file, mapped and checksummed but used in place */
+    string binaryFilePath = "/tmp/K_Means_bench_" + to_string(getpid()) + ".kmc";
+    writeCentroidFileFromVector<G>(&get<0>(clusterData), 1, binaryFilePath);
+
+    CentroidFileMap centroidFileMap;
+    double mapSeconds = timeMedian([&]()
+    {
+        if(mapCentroidFileChecked<G>(binaryFilePath, 1, &centroidFileMap) == NO_ERROR)
+        {
+            unmapCentroidFile(&centroidFileMap);
+        }
+    });
+
+    uint64_t binaryBytes = (stat(binaryFilePath.c_str(), &st) == 0) ? st.st_size : 0;
+    unlink(binaryFilePath.c_str());
+
+    ostringstream record;
+    record << "{\"rows\": " << rowCount << ", \"dimensions\": " << G::size << ", \"bytes\": " << bytes
+        << ", \"write_seconds\": " << writeSeconds << ", \"write_mb_per_second\": " << bytes / writeSeconds / 1e6
+        << ", \"parse_seconds\": " << parseSeconds << ", \"parse_mb_per_second\": " << bytes / parseSeconds / 1e6
+        << ", \"binary_bytes\": " << binaryBytes << ", \"map_seconds\": " << mapSeconds << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Lloyd time per iteration of the parallel engine, single-threaded and on all threads, of the Hamerly engine, and total dkm time.
+ */
+template <size_t N>
+static void benchLloyd(size_t pointCount, uint32_t k, int threadCount, vector<string> *pRecords)
+{
+    /* dkm only takes standard vectors, the parallel engines take the training data matrix */
+    vector<array<float, N>> points = syntheticPoints<N>(pointCount, BENCH_SEED);
+    FeatureMatrix<N> matrix(points.begin(), points.end());
+
+    KmeansParams params;
+    params.k = k;
+    params.seed = BENCH_SEED;
+    params.maxIterations = BENCH_LLOYD_ITERATIONS;
+    params.batchSize = 0;
+    params.abandonAfter = 0;
+    params.abandonInertia = 0;
+    params.init = KMEANS_INIT_PLUS_PLUS;
+    params.oversampling = 2.0f;
+
+    KmeansStats stats;
+
+    params.threadCount = 1;
+    double serialSeconds = timeMedian([&]() { kmeansLloydParallel<N>(matrix, &params, &stats); });
+    double serialIterationSeconds = serialSeconds / max<uint64_t>(1, stats.iterations);
+
+    params.threadCount = threadCount;
+    double parallelSeconds = timeMedian([&]() { kmeansLloydParallel<N>(matrix, &params, &stats); });
+    double parallelIterationSeconds = parallelSeconds / max<uint64_t>(1, stats.iterations);
+
+    /* Same iterations with the triangle inequality bounds */
+    double hamerlySeconds = timeMedian([&]() { kmeansHamerlyParallel<N>(matrix, &params, &stats); });
+    double hamerlyIterationSeconds = hamerlySeconds / max<uint64_t>(1, stats.iterations);
+    double skippedRatio = (double)stats.skippedDistanceEvaluations / max<uint64_t>(1, stats.distanceEvaluations + stats.skippedDistanceEvaluations);
+
+    /* dkm runs until convergence, only its total time is comparable */
+    double dkmSeconds = timeMedian([&]() { dkm::kmeans_lloyd<float, N>(points, k); });
+
+    ostringstream record;
+    record << "{\"n\": " << pointCount << ", \"k\": " << k << ", \"dimensions\": " << N << ", \"iterations\": " << stats.iterations
+        << ", \"serial_seconds_per_iteration\": " << serialIterationSeconds
+        << ", \"threads\": " << resolveThreadCount(threadCount) << ", \"parallel_seconds_per_iteration\": " << parallelIterationSeconds
+        << ", \"hamerly_seconds_per_iteration\": " << hamerlyIterationSeconds << ", \"hamerly_skipped_distance_ratio\": " << skippedRatio
+        << ", \"dkm_seconds\": " << dkmSeconds << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Seeding time of the k-means++ and k-means|| initializations on all threads, inertia of the seeds, and inertia and
+ * number of iterations of the Lloyd runs started from them.
+ */
+template <size_t N>
+static void benchSeeding(size_t pointCount, uint32_t k, int threadCount, vector<string> *pRecords)
+{
+    vector<array<float, N>> syntheticData = syntheticPoints<N>(pointCount, BENCH_SEED);
+    FeatureMatrix<N> points(syntheticData.begin(), syntheticData.end());
+    auto fetchPoint = [&points](size_t index, array<float, N> *pPoint) { *pPoint = points[index]; };
+
+    KmeansParams params;
+    params.k = k;
+    params.seed = BENCH_SEED;
+    params.threadCount = threadCount;
+    params.maxIterations = 0;
+    params.batchSize = 0;
+    params.abandonAfter = 0;
+    params.abandonInertia = 0;
+    params.oversampling = 2.0f;
+
+    const int inits[] = { KMEANS_INIT_PLUS_PLUS, KMEANS_INIT_PARALLEL };
+    const char *initNames[] = { "kmeans++", "kmeans||" };
+
+    for(size_t i = 0; i < sizeof(inits) / sizeof(inits[0]); i++)
+    {
+        params.init = inits[i];
+
+        vector<array<float, N>> seeds;
+        double seedingSeconds = timeMedian([&]() { seeds = seedKmeans<N>(points, &params); });
+        double seedingInertia = kmeansInertia<N>(points.size(), fetchPoint, seeds, points.size(), threadCount);
+
+        /* Lloyd iterations until convergence from the same seeds */
+        KmeansStats stats;
+        kmeansLloydParallel<N>(points, &params, &stats);
+
+        ostringstream record;
+        record << "{\"n\": " << pointCount << ", \"k\": " << k << ", \"dimensions\": " << N << ", \"init\": \"" << initNames[i] << "\""
+            << ", \"threads\": " << resolveThreadCount(threadCount) << ", \"seeding_seconds\": " << seedingSeconds
+            << ", \"seeding_inertia\": " << seedingInertia << ", \"iterations\": " << stats.iterations
+            << ", \"final_inertia\": " << stats.inertia << "}";
+        pRecords->push_back(record.str());
+    }
+}
+
+/**
+ * Cost of filling a training data matrix one row at a time: growing a standard vector with push_back, as the training
+ * data used to be loaded, or a training data matrix reserved up front, as it is now.
+ * Reports the time, the number of allocations, and the peak heap bytes, reached while a reallocation copies the rows
+ * from the old buffer to the new one.
+ */
+template <size_t N>
+static void benchFeatureMatrix(size_t rowCount, vector<string> *pRecords)
+{
+    array<float, N> row;
+    row.fill(0.5f);
+
+    size_t growthAllocations = 0;
+    size_t growthPeakBytes = 0;
+    double growthSeconds = timeMedian([&]()
+    {
+        vector<array<float, N>> rows;
+        growthAllocations = 0;
+        growthPeakBytes = 0;
+
+        for(size_t i = 0; i < rowCount; i++)
+        {
+            size_t capacity = rows.capacity();
+            rows.push_back(row);
+
+            if(rows.capacity() != capacity)
+            {
+                growthAllocations++;
+                growthPeakBytes = max(growthPeakBytes, (capacity + rows.capacity()) * sizeof(row));
+            }
+        }
+    });
+
+    size_t reservedAllocations = 0;
+    size_t reservedPeakBytes = 0;
+    double reservedSeconds = timeMedian([&]()
+    {
+        FeatureMatrix<N> rows;
+        rows.reserve(rowCount);
+        reservedAllocations = 1;
+
+        for(size_t i = 0; i < rowCount; i++)
+        {
+            size_t capacity = rows.capacity();
+            rows.push_back(row);
+            reservedAllocations += (rows.capacity() != capacity);
+        }
+
+        reservedPeakBytes = rows.capacity() * sizeof(row);
+    });
+
+    ostringstream record;
+    record << "{\"rows\": " << rowCount << ", \"dimensions\": " << N
+        << ", \"growth_seconds\": " << growthSeconds << ", \"growth_allocations\": " << growthAllocations << ", \"growth_peak_bytes\": " << growthPeakBytes
+        << ", \"reserved_seconds\": " << reservedSeconds << ", \"reserved_allocations\": " << reservedAllocations
+        << ", \"reserved_peak_bytes\": " << reservedPeakBytes << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Closest centroid latency per point, with the SIMD and scalar distance kernels.
+ */
+template <size_t N>
+static void benchPredict(uint32_t k, vector<string> *pRecords)
+{
+    const size_t pointCount = 10000;
+
+    vector<array<float, N>> points = syntheticPoints<N>(pointCount, BENCH_SEED);
+    vector<array<float, N>> centroids = syntheticPoints<N>(k, BENCH_SEED + 1);
+
+    /* Accumulated so that the calls cannot be optimized away */
+    volatile uint64_t sink = 0;
+
+    double simdSeconds = timeMedian([&]()
+    {
+        uint64_t sum = 0;
+        for(const array<float, N> &point : points)
+        {
+            sum += closestCentroid<N>(point, centroids);
+        }
+        sink += sum;
+    });
+
+    double scalarSeconds = timeMedian([&]()
+    {
+        uint64_t sum = 0;
+        for(const array<float, N> &point : points)
+        {
+            float bestDistance = numeric_limits<float>::max();
+            uint32_t best = 0;
+            for(uint32_t c = 0; c < k; c++)
+            {
+                float d = distanceSquaredScalar(point.data(), centroids[c].data(), N);
+                if(d < bestDistance)
+                {
+                    bestDistance = d;
+                    best = c;
+                }
+            }
+            sum += best;
+        }
+        sink += sum;
+    });
+
+    ostringstream record;
+    record << "{\"k\": " << k << ", \"dimensions\": " << N << ", \"kernel\": \"" << distanceKernelName() << "\""
+        << ", \"nanoseconds_per_prediction\": " << simdSeconds / pointCount * 1e9
+        << ", \"scalar_nanoseconds_per_prediction\": " << scalarSeconds / pointCount * 1e9 << "}";
+    pRecords->push_back(record.str());
+}
+
+/**
+ * Writes a named JSON array of records.
+ */
+static void printRecords(const char *name, const vector<string> &records, bool last)
+{
+    std::cout << "  \"" << name << "\": [";
+    for(size_t i = 0; i < records.size(); i++)
+    {
+        std::cout << (i == 0 ? "\n    " : ",\n    ") << records[i];
+    }
+    std::cout << (records.empty() ? "]" : "\n  ]") << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char **argv)
+{
+    string examplesDirPath = "examples";
+    int threadCount = 0;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            threadCount = atoi(argv[++i]);
+        }
+        else
+        {
+            examplesDirPath = argv[i];
+        }
+    }
+
+    /* Image decode and downsample, one record per image set */
+    vector<string> decodeRecords;
+    vector<string> resizeRecords;
+    vector<string> extractRecords;
+    vector<string> readAheadRecords;
+
+    DIR *pDir = opendir(examplesDirPath.c_str());
+    if(pDir != NULL)
+    {
+        struct dirent *pEntry;
+        while((pEntry = readdir(pDir)) != NULL)
+        {
+            if(pEntry->d_type == DT_DIR && pEntry->d_name[0] != '.')
+            {
+                std::cerr << "Benchmarking decode: " << pEntry->d_name << endl;
+                benchDecode(examplesDirPath + "/" + pEntry->d_name, pEntry->d_name, threadCount, &decodeRecords);
+                benchReadAhead(examplesDirPath + "/" + pEntry->d_name, pEntry->d_name, threadCount, &readAheadRecords);
+                benchResize(examplesDirPath + "/" + pEntry->d_name, pEntry->d_name, &resizeRecords);
+                benchExtract(examplesDirPath + "/" + pEntry->d_name, pEntry->d_name, &extractRecords);
+            }
+        }
+        closedir(pDir);
+    }
+
+    /* Centroids CSV write and parse */
+    std::cerr << "Benchmarking CSV" << endl;
+    vector<string> csvRecords;
+    benchCsv(16, &csvRecords);
+    benchCsv(10000, &csvRecords);
+
+    /* Training data matrix fill, grown or reserved */
+    std::cerr << "Benchmarking training data matrix" << endl;
+    vector<string> matrixRecords;
+    benchFeatureMatrix<Geometry20x20Grey::size>(10000, &matrixRecords);
+    benchFeatureMatrix<Geometry20x20Grey::size>(100000, &matrixRecords);
+    benchFeatureMatrix<Geometry20x20Rgb::size>(100000, &matrixRecords);
+
+    /* Lloyd iterations as N, K and D vary */
+    std::cerr << "Benchmarking Lloyd" << endl;
+    vector<string> lloydRecords;
+    benchLloyd<Geometry20x20Grey::size>(1000, 4, threadCount, &lloydRecords);
+    benchLloyd<Geometry20x20Grey::size>(10000, 4, threadCount, &lloydRecords);
+    benchLloyd<Geometry20x20Grey::size>(10000, 16, threadCount, &lloydRecords);
+    benchLloyd<Geometry16x16Grey::size>(10000, 4, threadCount, &lloydRecords);
+    benchLloyd<Geometry32x32Grey::size>(10000, 4, threadCount, &lloydRecords);
+    benchLloyd<Geometry20x20Rgb::size>(10000, 4, threadCount, &lloydRecords);
+
+    /* k-means++ and k-means|| seeding as N and K vary */
+    std::cerr << "Benchmarking seeding" << endl;
+    vector<string> seedingRecords;
+    benchSeeding<Geometry20x20Grey::size>(10000, 16, threadCount, &seedingRecords);
+    benchSeeding<Geometry20x20Grey::size>(100000, 16, threadCount, &seedingRecords);
+    benchSeeding<Geometry20x20Grey::size>(100000, 64, threadCount, &seedingRecords);
+
+    /* Prediction latency */
+    std::cerr << "Benchmarking predict" << endl;
+    vector<string> predictRecords;
+    benchPredict<Geometry20x20Grey::size>(4, &predictRecords);
+    benchPredict<Geometry20x20Grey::size>(16, &predictRecords);
+    benchPredict<Geometry32x32Grey::size>(4, &predictRecords);
+    benchPredict<Geometry20x20Rgb::size>(4, &predictRecords);
+
+#if defined(__aarch64__) || defined(__arm__)
+    const char *arch = "arm";
+#elif defined(__x86_64__) || defined(__i386__)
+    const char *arch = "x86";
+#else
+    const char *arch = "unknown";
+#endif
+
+    std::cout << "{\n";
+    std::cout << "  \"arch\": \"" << arch << "\",\n";
+    std::cout << "  \"distance_kernel\": \"" << distanceKernelName() << "\",\n";
+    std::cout << "  \"hardware_threads\": " << resolveThreadCount(0) << ",\n";
+    std::cout << "  \"repetitions\": " << BENCH_REPETITIONS << ",\n";
+    printRecords("decode", decodeRecords, false);
+    printRecords("read_ahead", readAheadRecords, false);
+    printRecords("resize", resizeRecords, false);
+    printRecords("extract", extractRecords, false);
+    printRecords("csv", csvRecords, false);
+    printRecords("feature_matrix", matrixRecords, false);
+    printRecords("lloyd", lloydRecords, false);
+    printRecords("seeding", seedingRecords, false);
+    printRecords("predict", predictRecords, true);
+    std::cout << "}" << endl;
+
+    return NO_ERROR;
+}
@@ -0,0 +1,204 @@
+#include "centroid_file.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits>
+
+/* Check that the header layout is the documented 64 bytes, which keeps the first row aligned */
+static_assert(sizeof(CentroidFileHeader) == CENTROID_FILE_ROW_ALIGNMENT, "Unexpected centroid file header size");
+
+/* FNV-1a 64-bit parameters */
+#define CENTROID_FILE_FNV_OFFSET_BASIS                                                0xcbf29ce484222325ULL
+#define CENTROID_FILE_FNV_PRIME                                                       0x00000100000001b3ULL
+
+/**
+ * 64-bit FNV-1a hash of a byte range.
+ */
+static uint64_t centroidFileChecksum(const uint8_t *pBytes, size_t length)
+{
+    uint64_t hash = CENTROID_FILE_FNV_OFFSET_BASIS;
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= pBytes[i];
+        hash *= CENTROID_FILE_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Size in bytes of the rows described by the given header.
+ */
+static size_t centroidFileRowsSize(const CentroidFileHeader *pHeader)
+{
+    return (size_t)pHeader->k * pHeader->rowStride * sizeof(float);
+}
+
+/**
+ * Writes exactly length bytes, false on a short write.
+ */
+static bool writeFully(int fd, const void *pBuffer, size_t length)
+{
+    const uint8_t *p = (const uint8_t*)pBuffer;
+    while(length > 0)
+    {
+        ssize_t n = write(fd, p, length);
+        if(n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+bool isCentroidFile(std::string centroidFilePath)
+{
+    int fd = open(centroidFilePath.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    char magic[4];
+    bool isMagic = read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(magic, CENTROID_FILE_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+
+    return isMagic;
+}
+
+int writeCentroidFile(std::string centroidFilePath, int width, int height, int channels, int extractor, int normalize,
+    const float *pCentroids, uint32_t k, uint32_t dim)
+{
+    const size_t floatsPerAlignment = CENTROID_FILE_ROW_ALIGNMENT / sizeof(float);
+
+    CentroidFileHeader header;
+    memset(&header, 0, sizeof(CentroidFileHeader));
+    memcpy(header.magic, CENTROID_FILE_MAGIC, sizeof(header.magic));
+    header.version = CENTROID_FILE_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.channels = (uint32_t)channels;
+    header.extractor = (uint32_t)extractor;
+    header.bins = (uint32_t)featureExtractorBins(extractor);
+    header.workingSize = (uint32_t)featureExtractorWorkingSize(extractor);
+    header.normalize = (uint32_t)normalize;
+    header.k = k;
+    header.dim = dim;
+    header.rowStride = (uint32_t)((dim + floatsPerAlignment - 1) / floatsPerAlignment * floatsPerAlignment);
+
+    /* Lay the rows out with their zero padding and hash them */
+    std::vector<float> rows((size_t)k * header.rowStride, 0.0f);
+    for(uint32_t c = 0; c < k; c++)
+    {
+        memcpy(&rows[(size_t)c * header.rowStride], pCentroids + (size_t)c * dim, dim * sizeof(float));
+    }
+    header.checksum = centroidFileChecksum((const uint8_t*)rows.data(), centroidFileRowsSize(&header));
+
+    std::string tmpFilePath = centroidFilePath + ".tmp." + std::to_string(getpid());
+    int fd = open(tmpFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        return ERROR_WRITING_CENTROID;
+    }
+
+    bool written = writeFully(fd, &header, sizeof(CentroidFileHeader))
+        && writeFully(fd, rows.data(), centroidFileRowsSize(&header))
+        && fsync(fd) == 0;
+
+    if(close(fd) != 0 || !written || rename(tmpFilePath.c_str(), centroidFilePath.c_str()) != 0)
+    {
+        unlink(tmpFilePath.c_str());
+        return ERROR_WRITING_CENTROID;
+    }
+
+    return NO_ERROR;
+}
+
+int mapCentroidFile(std::string centroidFilePath, CentroidFileMap *pMap)
+{
+    memset(pMap, 0, sizeof(CentroidFileMap));
+
+    int fd = open(centroidFilePath.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    struct stat sb;
+    if(fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(CentroidFileHeader))
+    {
+        close(fd);
+        return ERROR_READING_CENTROID;
+    }
+
+    void *pAddr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping stays valid after the file descriptor is closed */
+    close(fd);
+
+    if(pAddr == MAP_FAILED)
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    memcpy(&pMap->header, pAddr, sizeof(CentroidFileHeader));
+    pMap->pAddr = pAddr;
+    pMap->length = sb.st_size;
+    pMap->pRows = (const float*)((const uint8_t*)pAddr + sizeof(CentroidFileHeader));
+
+    /* Check the header, that the file holds all the rows it claims to hold, and that they are intact */
+    const CentroidFileHeader *pHeader = &pMap->header;
+    int validateRes = NO_ERROR;
+    if(memcmp(pHeader->magic, CENTROID_FILE_MAGIC, sizeof(pHeader->magic)) != 0 || pHeader->version != CENTROID_FILE_VERSION
+        || pHeader->k == 0 || pHeader->extractor >= FEATURE_EXTRACTOR_COUNT || pHeader->dim != pHeader->width * pHeader->height * pHeader->channels || pHeader->rowStride < pHeader->dim
+        || (pHeader->rowStride * sizeof(float)) % CENTROID_FILE_ROW_ALIGNMENT != 0)
+    {
+        validateRes = ERROR_MODEL_MISMATCH;
+    }
+    else if(sizeof(CentroidFileHeader) + centroidFileRowsSize(pHeader) > pMap->length
+        || centroidFileChecksum((const uint8_t*)pMap->pRows, centroidFileRowsSize(pHeader)) != pHeader->checksum)
+    {
+        validateRes = ERROR_READING_CENTROID;
+    }
+
+    if(validateRes != NO_ERROR)
+    {
+        unmapCentroidFile(pMap);
+        return validateRes;
+    }
+
+    return NO_ERROR;
+}
+
+void unmapCentroidFile(CentroidFileMap *pMap)
+{
+    if(pMap->pAddr != NULL)
+    {
+        munmap(pMap->pAddr, pMap->length);
+    }
+
+    memset(pMap, 0, sizeof(CentroidFileMap));
+}
+
+uint32_t closestMappedCentroid(const float *pPoint, const CentroidFileMap *pMap)
+{
+    float bestDistance = std::numeric_limits<float>::max();
+    uint32_t bestIndex = 0;
+
+    for(uint32_t c = 0; c < pMap->header.k; c++)
+    {
+        float d = distanceSquaredSimd(pPoint, centroidFileRow(pMap, c), pMap->header.dim);
+        if(d < bestDistance)
+        {
+            bestDistance = d;
+            bestIndex = c;
+        }
+    }
+
+    return bestIndex;
+}
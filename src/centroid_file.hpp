@@ -0,0 +1,188 @@
+/**
+ * Binary centroids file.
+ *
+ * A fixed layout alternative to the centroids CSV file that is memory mapped and used in place, without any
+ * parsing: loading a model costs an mmap and a checksum pass over the rows instead of a text to float conversion
+ * of every value.
+ *
+ * Layout (little endian, as written by the host):
+ *  - 64 bytes header, see CentroidFileHeader.
+ *  - k rows of rowStride floats. The first dim floats of a row are the centroid values, the rest is zero padding.
+ *    rowStride is a multiple of CENTROID_FILE_ROW_ALIGNMENT bytes so that every row starts on a cache line of the
+ *    page aligned mapping.
+ *
+ * The checksum is the 64-bit FNV-1a hash of the rows, padding included. The header also records the feature
+ * extractor, see feature_extractor.hpp.
+ */
+
+#ifndef CENTROID_FILE_H
+#define CENTROID_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <array>
+
+#include "error_codes.hpp"
+#include "geometry.hpp"
+#include "distance.hpp"
+#include "model.hpp"
+
+/* Magic bytes at the start of every binary centroids file */
+#define CENTROID_FILE_MAGIC                                                                       "KMCB"
+
+/* Version of the binary centroids file format */
+#define CENTROID_FILE_VERSION                                                                          1
+
+/* Alignment in bytes of the header and of every row */
+#define CENTROID_FILE_ROW_ALIGNMENT                                                                   64
+
+typedef struct _centroid_file_header {
+    char magic[4];          /* CENTROID_FILE_MAGIC */
+    uint16_t version;       /* CENTROID_FILE_VERSION */
+    uint16_t reserved0;     /* Zero */
+    uint32_t width;         /* Downsampled image width */
+    uint32_t height;        /* Downsampled image height */
+    uint32_t channels;      /* Downsampled image channels */
+    uint32_t normalize;     /* Whether or not the centroids are normalized */
+    uint32_t k;             /* Number of centroids */
+    uint32_t dim;           /* Number of values per centroid, width * height * channels */
+    uint32_t rowStride;     /* Number of floats per row, dim rounded up to the row alignment */
+    uint32_t reserved1;     /* Zero */
+    uint64_t checksum;      /* FNV-1a hash of the rows */
+    uint32_t extractor;     /* One of featureExtractors, zero for the pixels */
+    uint32_t bins;          /* Number of bins of each histogram of the extractor, zero for the pixels */
+    uint32_t workingSize;   /* Largest side of the image the extractor reads, zero for the pixels */
+    uint8_t reserved[4];    /* Pads the header to 64 bytes */
+} CentroidFileHeader;
+
+/* A read-only memory mapped binary centroids file */
+typedef struct _centroid_file_map {
+    CentroidFileHeader header; /* Copy of the file header */
+    const float *pRows;        /* First row, inside the mapping */
+    void *pAddr;               /* Start of the mapping */
+    size_t length;             /* Length of the mapping */
+} CentroidFileMap;
+
+/**
+ * Whether or not the file at the given path starts with the binary centroids file magic bytes.
+ */
+bool isCentroidFile(std::string centroidFilePath);
+
+/**
+ * Writes k rows of dim floats, of the given geometry and features, to a binary centroids file.
+ * The file is written to a temporary file that is flushed and renamed over the given path, so that readers
+ * either see the old or the new centroids.
+ */
+int writeCentroidFile(std::string centroidFilePath, int width, int height, int channels, int extractor, int normalize,
+    const float *pCentroids, uint32_t k, uint32_t dim);
+
+/**
+ * Memory maps the binary centroids file at the given path and validates its header, size, and checksum.
+ */
+int mapCentroidFile(std::string centroidFilePath, CentroidFileMap *pMap);
+
+/**
+ * Releases a mapping created with mapCentroidFile.
+ */
+void unmapCentroidFile(CentroidFileMap *pMap);
+
+/**
+ * Row of a centroid inside the mapping, CENTROID_FILE_ROW_ALIGNMENT bytes aligned.
+ */
+inline const float* centroidFileRow(const CentroidFileMap *pMap, uint32_t c)
+{
+    return pMap->pRows + (size_t)c * pMap->header.rowStride;
+}
+
+/**
+ * Index of the mapped centroid closest to the given point, compared in place.
+ * Ties go to the lowest index, like closestCentroid.
+ */
+uint32_t closestMappedCentroid(const float *pPoint, const CentroidFileMap *pMap);
+
+/**
+ * Memory maps a binary centroids file, rejecting centroids trained with another geometry, features, or normalization.
+ */
+template <typename G>
+int mapCentroidFileChecked(std::string centroidFilePath, int normalize, CentroidFileMap *pMap)
+{
+    int mapRes = mapCentroidFile(centroidFilePath, pMap);
+    if(mapRes != NO_ERROR)
+    {
+        return mapRes;
+    }
+
+    const CentroidFileHeader *pHeader = &pMap->header;
+    if(pHeader->width != (uint32_t)G::width || pHeader->height != (uint32_t)G::height || pHeader->channels != (uint32_t)G::channels
+        || pHeader->normalize != (uint32_t)normalize || pHeader->dim != (uint32_t)G::size
+        || pHeader->extractor != (uint32_t)G::extractor || pHeader->bins != (uint32_t)featureExtractorBins(G::extractor)
+        || pHeader->workingSize != (uint32_t)featureExtractorWorkingSize(G::extractor))
+    {
+        unmapCentroidFile(pMap);
+        return ERROR_MODEL_MISMATCH;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Writes centroids trained with the given geometry, features, and normalization to a binary centroids file.
+ */
+template <typename G>
+int writeCentroidFileFromVector(const std::vector<std::array<float, G::size>> *pClusterCentroidsVector, int normalize, std::string centroidFilePath)
+{
+    /* std::array<float, N> has no padding, the centroids are contiguous */
+    return writeCentroidFile(centroidFilePath, G::width, G::height, G::channels, G::extractor, normalize,
+        pClusterCentroidsVector->empty() ? NULL : pClusterCentroidsVector->front().data(),
+        (uint32_t)pClusterCentroidsVector->size(), (uint32_t)G::size);
+}
+
+/**
+ * Reads a binary centroids file into a centroids vector, e.g. for the code paths that update the centroids.
+ */
+template <typename G>
+int loadCentroidsFromCentroidFile(std::string centroidFilePath, int normalize, std::vector<std::array<float, G::size>> *pClusterCentroidsVector)
+{
+    CentroidFileMap map;
+    int mapRes = mapCentroidFileChecked<G>(centroidFilePath, normalize, &map);
+    if(mapRes != NO_ERROR)
+    {
+        return mapRes;
+    }
+
+    pClusterCentroidsVector->resize(map.header.k);
+    for(uint32_t c = 0; c < map.header.k; c++)
+    {
+        memcpy((*pClusterCentroidsVector)[c].data(), centroidFileRow(&map, c), G::size * sizeof(float));
+    }
+
+    unmapCentroidFile(&map);
+    return NO_ERROR;
+}
+
+/**
+ * Reads a binary or CSV centroids file, told apart by the binary file magic bytes.
+ */
+template <typename G>
+int loadCentroidsFromFile(std::string clusterCentroidsFilePath, int normalize, std::vector<std::array<float, G::size>> *pClusterCentroidsVector)
+{
+    return isCentroidFile(clusterCentroidsFilePath)
+        ? loadCentroidsFromCentroidFile<G>(clusterCentroidsFilePath, normalize, pClusterCentroidsVector)
+        : loadCentroidsFromCsvFile<G>(clusterCentroidsFilePath, normalize, pClusterCentroidsVector);
+}
+
+/**
+ * Atomically replaces a binary or CSV centroids file, keeping its format.
+ */
+template <typename G>
+int replaceCentroidsFile(const std::vector<std::array<float, G::size>> *pClusterCentroidsVector, int normalize, std::string clusterCentroidsFilePath)
+{
+    return isCentroidFile(clusterCentroidsFilePath)
+        ? writeCentroidFileFromVector<G>(pClusterCentroidsVector, normalize, clusterCentroidsFilePath)
+        : replaceCentroidsCsvFile<G>(pClusterCentroidsVector, normalize, clusterCentroidsFilePath);
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include "distance.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DISTANCE_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DISTANCE_NEON 1
+#endif
+
+float distanceSquaredScalar(const float *a, const float *b, size_t n)
+{
+    float d = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        float diff = a[i] - b[i];
+        d += diff * diff;
+    }
+
+    return d;
+}
+
+#ifdef DISTANCE_X86
+
+#ifdef __SSE__
+/**
+ * SSE kernel: 4 floats per step, two accumulators to hide the add latency.
+ */
+static float distanceSquaredSse(const float *a, const float *b, size_t n)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+    }
+
+    /* Horizontal sum of the accumulators */
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    float d = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    /* Remaining values */
+    for(; i < n; i++)
+    {
+        float diff = a[i] - b[i];
+        d += diff * diff;
+    }
+
+    return d;
+}
+#endif
+
+/**
+ * AVX2 kernel: 8 floats per step with fused multiply-add, two accumulators to hide the FMA latency.
+ * Compiled for AVX2 regardless of the build flags and only called when the CPU supports it.
+ */
+__attribute__((target("avx2,fma")))
+static float distanceSquaredAvx2(const float *a, const float *b, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16)
+    {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    }
+
+    /* Horizontal sum of the accumulators */
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    float d = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    /* Remaining values */
+    for(; i < n; i++)
+    {
+        float diff = a[i] - b[i];
+        d += diff * diff;
+    }
+
+    return d;
+}
+
+#endif
+
+#ifdef DISTANCE_NEON
+/**
+ * NEON kernel: 4 floats per step, two accumulators to hide the multiply-accumulate latency.
+ */
+static float distanceSquaredNeon(const float *a, const float *b, size_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8)
+    {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc0 = vmlaq_f32(acc0, d0, d0);
+        acc1 = vmlaq_f32(acc1, d1, d1);
+    }
+
+    /* Horizontal sum of the accumulators */
+    float lanes[4];
+    vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+    float d = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    /* Remaining values */
+    for(; i < n; i++)
+    {
+        float diff = a[i] - b[i];
+        d += diff * diff;
+    }
+
+    return d;
+}
+#endif
+
+uint32_t distanceSquaredU8(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    uint32_t d = 0;
+    size_t i = 0;
+
+#if defined(DISTANCE_X86) && defined(__SSE2__)
+    /* 16 bytes per step: widen to 16 bits, subtract, then multiply-add pairs of squares into 32-bit lanes */
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i dLo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+        __m128i dHi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(dLo, dLo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(dHi, dHi));
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    d = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(DISTANCE_NEON)
+    /* 16 bytes per step: absolute differences, widening squares, then pairwise accumulation into 32-bit lanes */
+    uint32x4_t acc = vdupq_n_u32(0);
+
+    for(; i + 16 <= n; i += 16)
+    {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+        acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+    }
+
+    uint32_t lanes[4];
+    vst1q_u32(lanes, acc);
+    d = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+    /* Remaining values */
+    for(; i < n; i++)
+    {
+        int diff = (int)a[i] - (int)b[i];
+        d += (uint32_t)(diff * diff);
+    }
+
+    return d;
+}
+
+uint64_t distanceSquaredU8U16(const uint8_t *a, const uint16_t *b, size_t n)
+{
+    uint64_t d = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        int64_t diff = ((int64_t)a[i] << 8) - (int64_t)b[i];
+        d += (uint64_t)(diff * diff);
+    }
+
+    return d;
+}
+
+int supportedDistanceKernels(DistanceKernelInfo *pKernels)
+{
+    int count = 0;
+    pKernels[count++] = {"scalar", distanceSquaredScalar};
+
+#ifdef DISTANCE_X86
+#ifdef __SSE__
+    pKernels[count++] = {"sse", distanceSquaredSse};
+#endif
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        pKernels[count++] = {"avx2", distanceSquaredAvx2};
+    }
+#endif
+
+#ifdef DISTANCE_NEON
+    pKernels[count++] = {"neon", distanceSquaredNeon};
+#endif
+
+    return count;
+}
+
+/**
+ * Picks the best kernel for the running CPU, i.e. the last supported one.
+ */
+static distanceKernel selectDistanceKernel(const char **pName)
+{
+    DistanceKernelInfo kernels[DISTANCE_KERNEL_MAX_COUNT];
+    int count = supportedDistanceKernels(kernels);
+
+    *pName = kernels[count - 1].name;
+    return kernels[count - 1].kernel;
+}
+
+/* The kernel is selected once, before main runs */
+static const char *selectedDistanceKernelName = "scalar";
+static const distanceKernel selectedDistanceKernel = selectDistanceKernel(&selectedDistanceKernelName);
+
+float distanceSquaredSimd(const float *a, const float *b, size_t n)
+{
+    return selectedDistanceKernel(a, b, n);
+}
+
+const char* distanceKernelName()
+{
+    return selectedDistanceKernelName;
+}
@@ -0,0 +1,60 @@
+/**
+ * Squared Euclidean distance kernels.
+ *
+ * The vectorized kernel is picked once at startup: AVX2 when the x86 CPU supports it, SSE otherwise,
+ * NEON when the ARM build is compiled with NEON support, and the scalar reference everywhere else.
+ */
+
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Signature shared by all the float kernels */
+typedef float (*distanceKernel)(const float *a, const float *b, size_t n);
+
+/* A float kernel and its name */
+typedef struct _distance_kernel_info {
+    const char *name;      /* "scalar", "sse", "avx2", or "neon" */
+    distanceKernel kernel;
+} DistanceKernelInfo;
+
+/* Largest number of float kernels compiled in a build */
+#define DISTANCE_KERNEL_MAX_COUNT                                                                     4
+
+/**
+ * Scalar reference kernel.
+ */
+float distanceSquaredScalar(const float *a, const float *b, size_t n);
+
+/**
+ * Vectorized kernel selected for the running CPU.
+ * The result can differ from the scalar reference in the last bits because of the summation order.
+ */
+float distanceSquaredSimd(const float *a, const float *b, size_t n);
+
+/**
+ * Squared Euclidean distance between two 8-bit vectors, e.g. downsampled pixels and uint8 quantized centroids.
+ * Exact integer result, vectorized with SSE2 on x86 and NEON on ARM. n must not exceed 66051 so that the sum fits.
+ */
+uint32_t distanceSquaredU8(const uint8_t *a, const uint8_t *b, size_t n);
+
+/**
+ * Squared Euclidean distance between 8-bit pixels and a uint16 quantized centroid with 8 fractional bits,
+ * i.e. sum((a[i] * 256 - b[i])^2). Exact integer result.
+ */
+uint64_t distanceSquaredU8U16(const uint8_t *a, const uint16_t *b, size_t n);
+
+/**
+ * Name of the kernel selected for the running CPU: "avx2", "sse", "neon", or "scalar".
+ */
+const char* distanceKernelName();
+
+/**
+ * Lists the float kernels compiled in this build that the running CPU supports, e.g. to test each of them: the scalar
+ * reference first, the selected kernel last. Returns their number, at most DISTANCE_KERNEL_MAX_COUNT.
+ */
+int supportedDistanceKernels(DistanceKernelInfo *pKernels);
+
+#endif
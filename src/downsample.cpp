@@ -0,0 +1,78 @@
+#include "downsample.hpp"
+
+#include <algorithm>
+#include <vector>
+
+int boxDownsampleUint8(const uint8_t *pSrc, int srcWidth, int srcHeight, int channels, uint8_t *pDst, int dstWidth, int dstHeight)
+{
+    if(dstWidth <= 0 || dstHeight <= 0 || srcWidth < dstWidth || srcHeight < dstHeight)
+    {
+        return 0;
+    }
+
+    const size_t srcStride = (size_t)srcWidth * channels;
+    std::vector<uint32_t> sums((size_t)dstWidth * channels);
+
+    /* First source column of each destination column, the last entry is the source width */
+    std::vector<int> srcXBounds(dstWidth + 1);
+    for(int x = 0; x <= dstWidth; x++)
+    {
+        srcXBounds[x] = (int)((int64_t)x * srcWidth / dstWidth);
+    }
+
+    for(int y = 0; y < dstHeight; y++)
+    {
+        /* Source rows of this destination row */
+        const int srcY0 = (int)((int64_t)y * srcHeight / dstHeight);
+        const int srcY1 = (int)((int64_t)(y + 1) * srcHeight / dstHeight);
+
+        std::fill(sums.begin(), sums.end(), 0);
+
+        for(int srcY = srcY0; srcY < srcY1; srcY++)
+        {
+            const uint8_t *pRow = pSrc + srcY * srcStride;
+
+            for(int x = 0; x < dstWidth; x++)
+            {
+                const int srcX0 = srcXBounds[x];
+                const int srcX1 = srcXBounds[x + 1];
+                uint32_t *pSums = &sums[x * channels];
+
+                if(channels == 1)
+                {
+                    /* Contiguous run of greyscale pixels, vectorized by the compiler */
+                    uint32_t sum = 0;
+                    for(int srcX = srcX0; srcX < srcX1; srcX++)
+                    {
+                        sum += pRow[srcX];
+                    }
+                    pSums[0] += sum;
+                }
+                else
+                {
+                    for(int srcX = srcX0; srcX < srcX1; srcX++)
+                    {
+                        for(int c = 0; c < channels; c++)
+                        {
+                            pSums[c] += pRow[srcX * channels + c];
+                        }
+                    }
+                }
+            }
+        }
+
+        /* Rounded mean of each rectangle */
+        uint8_t *pDstRow = pDst + (size_t)y * dstWidth * channels;
+        for(int x = 0; x < dstWidth; x++)
+        {
+            const uint32_t area = (uint32_t)(srcXBounds[x + 1] - srcXBounds[x]) * (uint32_t)(srcY1 - srcY0);
+
+            for(int c = 0; c < channels; c++)
+            {
+                pDstRow[x * channels + c] = (uint8_t)((sums[x * channels + c] + area / 2) / area);
+            }
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,31 @@
+/**
+ * Box filter image downsampler.
+ *
+ * A single pass integer alternative to stbir_resize_uint8 for the large reduction factors of the training and
+ * prediction geometries, e.g. 614x583 down to 20x20. The source image is split into dstWidth x dstHeight
+ * rectangles of whole pixels and each destination pixel is the rounded mean of its rectangle. Source rows are
+ * read once, in order, and the only working memory is one row of destination sums.
+ *
+ * The output differs slightly from the default stbir_resize_uint8 filter, which weighs pixels with a Mitchell kernel
+ * that overlaps neighboring rectangles: use the same downsampler for training and prediction. The difference
+ * is measured by the bench target.
+ */
+
+#ifndef DOWNSAMPLE_H
+#define DOWNSAMPLE_H
+
+#include <stdint.h>
+
+/* Image downsamplers */
+typedef enum _img_resize_filters {
+    IMG_RESIZE_FILTER_STB = 0, /* stbir_resize_uint8, default */
+    IMG_RESIZE_FILTER_BOX = 1  /* boxDownsampleUint8 */
+} imgResizeFilters;
+
+/**
+ * Downsamples an interleaved 8-bit image with a box filter.
+ * Returns 1 on success and 0 if the destination is larger than the source in any dimension, like stbir_resize_uint8.
+ */
+int boxDownsampleUint8(const uint8_t *pSrc, int srcWidth, int srcHeight, int channels, uint8_t *pDst, int dstWidth, int dstHeight);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ERROR_CODES_H
+#define ERROR_CODES_H
+
+typedef enum _error_codes {
+    NO_ERROR                     = 0,  /* No error */
+    ERROR_ARGS                   = 1,  /* Error: invalid program arguments */
+    ERROR_MODE                   = 2,  /* Error: invalid program mode selected */
+    ERROR_OPENING_DIR            = 3,  /* Error: opening directory */
+    ERROR_NO_IMAGES              = 4,  /* Error: no images in given directory */
+    ERROR_LOADING_IMAGE          = 5,  /* Error: loading image */
+    ERROR_RESIZING_IMAGE         = 6,  /* Error: resizing the images */
+    ERROR_WRITING_CENTROID       = 7,  /* Error: writing CSV output file for centroids */
+    ERROR_UNKNOWN                = 8,  /* Error: unknown */
+    ERROR_READING_TRAINING_DATA  = 9,  /* Error: reading the training data file */
+    ERROR_WRITING_TRAINING_DATA  = 10, /* Error: writing the training data file */
+    ERROR_TRAINING_DATA_MISMATCH = 11, /* Error: training data file format does not match the expected one */
+    ERROR_READING_CENTROID       = 12, /* Error: reading the centroids file */
+    ERROR_MODEL_MISMATCH         = 13, /* Error: centroids file geometry does not match the expected one */
+    ERROR_WRITING_STATS          = 14, /* Error: writing the stats file */
+    ERROR_WRITING_REPORT         = 15, /* Error: writing the K sweep report file */
+    ERROR_READING_CACHE          = 16, /* Error: reading the feature cache file */
+    ERROR_WRITING_CACHE          = 17, /* Error: writing the feature cache file */
+    ERROR_READING_ARCHIVE        = 18, /* Error: reading the tar archive of images */
+    ERROR_WRITING_MANIFEST       = 19, /* Error: writing the manifest file of the image labels */
+    ERROR_WRITING_PROJECTION     = 20  /* Error: writing the PCA projection file */
+} errorCodes;
+
+#endif
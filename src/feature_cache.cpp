@@ -0,0 +1,295 @@
+#include "feature_cache.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "error_codes.hpp"
+#include "feature_extractor.hpp"
+
+using namespace std;
+
+/* Check that the header layout is the documented 64 bytes, and that the entry header has no padding to zero */
+static_assert(sizeof(FeatureCacheHeader) == 64, "Unexpected feature cache header size");
+static_assert(sizeof(FeatureCacheEntryHeader) == 72, "Unexpected feature cache entry header size");
+
+/* An entry loaded in memory */
+typedef struct _feature_cache_entry {
+    FeatureCacheEntryHeader header;
+    string path;
+    vector<uint8_t> data;
+} FeatureCacheEntry;
+
+/* The loaded cache, keyed by path, geometry, features, and downsampler */
+static bool cacheEnabled = false;
+static bool cacheUsed = false;
+static string cacheFilePath;
+static uint64_t cacheMaxBytes = 0;
+static uint64_t cacheGeneration = 0;
+static unordered_map<string, FeatureCacheEntry> cacheEntries;
+static mutex cacheMutex;
+
+/**
+ * Key of the entry of an image file: its canonical path followed by the geometry, the feature extractor with its number
+ * of bins and working size, and the downsampler.
+ */
+static string featureCacheKey(const string &canonicalPath, int width, int height, int channels, int extractor, int bins, int workingSize,
+    int resizeFilter)
+{
+    return canonicalPath + '\n' + to_string(width) + 'x' + to_string(height) + 'x' + to_string(channels)
+        + '/' + to_string(extractor) + ':' + to_string(bins) + ':' + to_string(workingSize) + '/' + to_string(resizeFilter);
+}
+
+/**
+ * Canonical path of an image file, so that the same file reached through different paths shares its entry.
+ */
+static string canonicalImgFilePath(const char *imgFilePath)
+{
+    char resolvedPath[PATH_MAX];
+    return (realpath(imgFilePath, resolvedPath) != NULL) ? string(resolvedPath) : string(imgFilePath);
+}
+
+/**
+ * Size in bytes of an entry in the cache file.
+ */
+static uint64_t featureCacheEntrySize(const FeatureCacheEntry *pEntry)
+{
+    return sizeof(FeatureCacheEntryHeader) + pEntry->path.size() + pEntry->data.size();
+}
+
+/**
+ * Reads exactly length bytes, false on a short read.
+ */
+static bool readFully(int fd, void *pBuffer, size_t length)
+{
+    uint8_t *p = (uint8_t*)pBuffer;
+    while(length > 0)
+    {
+        ssize_t n = read(fd, p, length);
+        if(n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+/**
+ * Writes exactly length bytes, false on a short write.
+ */
+static bool writeFully(int fd, const void *pBuffer, size_t length)
+{
+    const uint8_t *p = (const uint8_t*)pBuffer;
+    while(length > 0)
+    {
+        ssize_t n = write(fd, p, length);
+        if(n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+int openFeatureCache(string filePath, uint64_t maxBytes)
+{
+    cacheFilePath = filePath;
+    cacheMaxBytes = maxBytes;
+    cacheGeneration = 0;
+    cacheEntries.clear();
+
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        /* No cache yet, it is created when saved */
+        cacheEnabled = (errno == ENOENT);
+        return cacheEnabled ? NO_ERROR : ERROR_READING_CACHE;
+    }
+
+    /* Refuse to use, and later overwrite, a file that is not a feature cache, or of a newer version */
+    FeatureCacheHeader header;
+    if(!readFully(fd, &header, sizeof(FeatureCacheHeader)) || memcmp(header.magic, FEATURE_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version > FEATURE_CACHE_VERSION)
+    {
+        close(fd);
+        return ERROR_READING_CACHE;
+    }
+
+    /* The entries of an older version have another layout: start empty, the file is replaced when saved */
+    if(header.version < FEATURE_CACHE_VERSION)
+    {
+        header.entryCount = 0;
+    }
+
+    /* A truncated entry ends the cache, the entries before it are still valid */
+    for(uint64_t e = 0; e < header.entryCount; e++)
+    {
+        FeatureCacheEntry entry;
+        if(!readFully(fd, &entry.header, sizeof(FeatureCacheEntryHeader)) || entry.header.pathLength > PATH_MAX)
+        {
+            break;
+        }
+
+        entry.path.resize(entry.header.pathLength);
+        entry.data.resize(entry.header.dataSize);
+        if(!readFully(fd, &entry.path[0], entry.path.size()) || !readFully(fd, entry.data.data(), entry.data.size()))
+        {
+            break;
+        }
+
+        string key = featureCacheKey(entry.path, entry.header.width, entry.header.height, entry.header.channels, entry.header.extractor,
+            entry.header.bins, entry.header.workingSize, entry.header.resizeFilter);
+        cacheEntries[key] = std::move(entry);
+    }
+
+    close(fd);
+
+    cacheGeneration = header.generation;
+    cacheEnabled = true;
+
+    return NO_ERROR;
+}
+
+bool featureCacheEnabled()
+{
+    return cacheEnabled;
+}
+
+bool lookupFeatureCache(const char *imgFilePath, const struct stat *pImgFileStat, int width, int height, int channels,
+    int extractor, int resizeFilter, uint8_t *pImgDataBuffer)
+{
+    string key = featureCacheKey(canonicalImgFilePath(imgFilePath), width, height, channels, extractor, featureExtractorBins(extractor),
+        featureExtractorWorkingSize(extractor), resizeFilter);
+
+    lock_guard<mutex> lock(cacheMutex);
+
+    auto it = cacheEntries.find(key);
+    if(it == cacheEntries.end())
+    {
+        return false;
+    }
+
+    /* The image file changed since it was cached */
+    FeatureCacheEntry *pEntry = &it->second;
+    if(pEntry->header.fileSize != (uint64_t)pImgFileStat->st_size || pEntry->header.mtimeSec != (int64_t)pImgFileStat->st_mtim.tv_sec
+        || pEntry->header.mtimeNsec != (int64_t)pImgFileStat->st_mtim.tv_nsec || pEntry->data.size() != (size_t)width * height * channels)
+    {
+        return false;
+    }
+
+    memcpy(pImgDataBuffer, pEntry->data.data(), pEntry->data.size());
+
+    pEntry->header.lastUsed = cacheGeneration + 1;
+    cacheUsed = true;
+
+    return true;
+}
+
+void insertFeatureCache(const char *imgFilePath, const struct stat *pImgFileStat, int width, int height, int channels,
+    int extractor, int resizeFilter, const uint8_t *pImgDataBuffer)
+{
+    FeatureCacheEntry entry;
+    memset(&entry.header, 0, sizeof(FeatureCacheEntryHeader));
+    entry.path = canonicalImgFilePath(imgFilePath);
+    entry.data.assign(pImgDataBuffer, pImgDataBuffer + (size_t)width * height * channels);
+
+    entry.header.fileSize = pImgFileStat->st_size;
+    entry.header.mtimeSec = pImgFileStat->st_mtim.tv_sec;
+    entry.header.mtimeNsec = pImgFileStat->st_mtim.tv_nsec;
+    entry.header.lastUsed = cacheGeneration + 1;
+    entry.header.width = width;
+    entry.header.height = height;
+    entry.header.channels = channels;
+    entry.header.extractor = extractor;
+    entry.header.bins = featureExtractorBins(extractor);
+    entry.header.workingSize = featureExtractorWorkingSize(extractor);
+    entry.header.resizeFilter = resizeFilter;
+    entry.header.pathLength = entry.path.size();
+    entry.header.dataSize = entry.data.size();
+
+    string key = featureCacheKey(entry.path, width, height, channels, extractor, entry.header.bins, entry.header.workingSize, resizeFilter);
+
+    lock_guard<mutex> lock(cacheMutex);
+
+    /* Replaces the entry of a file that changed */
+    cacheEntries[key] = std::move(entry);
+    cacheUsed = true;
+}
+
+int saveFeatureCache()
+{
+    if(!cacheEnabled || !cacheUsed)
+    {
+        return NO_ERROR;
+    }
+
+    /* Most recently used entries first, the path breaks ties so that the kept entries do not depend on the map order */
+    vector<const FeatureCacheEntry*> entries;
+    entries.reserve(cacheEntries.size());
+    for(const auto &keyEntry : cacheEntries)
+    {
+        entries.push_back(&keyEntry.second);
+    }
+
+    sort(entries.begin(), entries.end(), [](const FeatureCacheEntry *a, const FeatureCacheEntry *b)
+    {
+        return (a->header.lastUsed != b->header.lastUsed) ? a->header.lastUsed > b->header.lastUsed : a->path < b->path;
+    });
+
+    /* Evict the least recently used entries beyond the size cap */
+    uint64_t size = sizeof(FeatureCacheHeader);
+    size_t keptCount = 0;
+    while(keptCount < entries.size() && size + featureCacheEntrySize(entries[keptCount]) <= cacheMaxBytes)
+    {
+        size += featureCacheEntrySize(entries[keptCount]);
+        keptCount++;
+    }
+
+    FeatureCacheHeader header;
+    memset(&header, 0, sizeof(FeatureCacheHeader));
+    memcpy(header.magic, FEATURE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = FEATURE_CACHE_VERSION;
+    header.generation = cacheGeneration + 1;
+    header.entryCount = keptCount;
+
+    /* Write to a temporary file that is renamed over the cache file, so that readers never see a partial cache */
+    string tmpFilePath = cacheFilePath + ".tmp." + to_string(getpid());
+    int fd = open(tmpFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        return ERROR_WRITING_CACHE;
+    }
+
+    bool written = writeFully(fd, &header, sizeof(FeatureCacheHeader));
+    for(size_t e = 0; written && e < keptCount; e++)
+    {
+        written = writeFully(fd, &entries[e]->header, sizeof(FeatureCacheEntryHeader))
+            && writeFully(fd, entries[e]->path.data(), entries[e]->path.size())
+            && writeFully(fd, entries[e]->data.data(), entries[e]->data.size());
+    }
+    written = written && fsync(fd) == 0;
+
+    if(close(fd) != 0 || !written || rename(tmpFilePath.c_str(), cacheFilePath.c_str()) != 0)
+    {
+        unlink(tmpFilePath.c_str());
+        return ERROR_WRITING_CACHE;
+    }
+
+    cacheGeneration++;
+    cacheUsed = false;
+
+    return NO_ERROR;
+}
@@ -0,0 +1,91 @@
+/**
+ * Decoded feature cache.
+ *
+ * Keeps the downsampled image data buffer of every decoded image file in a file, so that later runs over the same
+ * images skip decoding them. An entry is keyed by the canonical path of the image file, the geometry, the feature
+ * extractor and its parameters (see feature_extractor.hpp), and the downsampler, and is only used while the size and
+ * modification time of the image file are the ones it was decoded with: a modified file is decoded again and its entry
+ * replaced.
+ *
+ * The cache is loaded in memory by openFeatureCache() and written back by saveFeatureCache(), keeping the most
+ * recently used entries that fit in the size cap. The file is replaced atomically, concurrent runs sharing a cache
+ * file do not corrupt it but only the entries of the last run to save it are kept. A cache file of an older version
+ * is loaded empty and replaced when saved.
+ *
+ * Layout (little endian, as written by the host):
+ *  - 64 bytes header, see FeatureCacheHeader.
+ *  - entryCount entries, each made out of a FeatureCacheEntryHeader, the path, and the downsampled image data buffer.
+ */
+
+#ifndef FEATURE_CACHE_H
+#define FEATURE_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+
+/* Magic bytes at the start of every feature cache file */
+#define FEATURE_CACHE_MAGIC                                                                       "KMFC"
+
+/* Version of the feature cache file format */
+#define FEATURE_CACHE_VERSION                                                                          2
+
+typedef struct _feature_cache_header {
+    char magic[4];          /* FEATURE_CACHE_MAGIC */
+    uint16_t version;       /* FEATURE_CACHE_VERSION */
+    uint16_t reserved0;     /* Zero */
+    uint64_t generation;    /* Number of times the cache was saved, entries used by a run are stamped with it */
+    uint64_t entryCount;    /* Number of entries following the header */
+    uint8_t reserved[40];   /* Pads the header to 64 bytes */
+} FeatureCacheHeader;
+
+typedef struct _feature_cache_entry_header {
+    uint64_t fileSize;      /* Size of the image file when it was decoded */
+    int64_t mtimeSec;       /* Modification time of the image file when it was decoded, seconds */
+    int64_t mtimeNsec;      /* Modification time of the image file when it was decoded, nanoseconds */
+    uint64_t lastUsed;      /* Generation of the last run that used the entry */
+    uint32_t width;         /* Downsampled image width */
+    uint32_t height;        /* Downsampled image height */
+    uint32_t channels;      /* Downsampled image channels */
+    uint32_t extractor;     /* One of featureExtractors, zero for the pixels */
+    uint32_t bins;          /* Number of bins of each histogram of the extractor, zero for the pixels */
+    uint32_t workingSize;   /* Largest side of the image the extractor reads, zero for the pixels */
+    uint32_t resizeFilter;  /* Downsampler, one of imgResizeFilters */
+    uint32_t pathLength;    /* Length of the path following the entry header */
+    uint32_t dataSize;      /* Size of the downsampled image data buffer following the path */
+    uint32_t reserved;      /* Zero */
+} FeatureCacheEntryHeader;
+
+/**
+ * Loads the feature cache file at the given path and enables the cache. A missing file is an empty cache.
+ * Fails without enabling the cache if the file exists but is not a feature cache file.
+ * maxBytes caps the size of the file written by saveFeatureCache().
+ */
+int openFeatureCache(std::string cacheFilePath, uint64_t maxBytes);
+
+/**
+ * Whether or not openFeatureCache() succeeded.
+ */
+bool featureCacheEnabled();
+
+/**
+ * Copies the cached downsampled image data buffer of the given image file into pImgDataBuffer.
+ * Returns false if there is no entry for the file, geometry, features, and downsampler, or if the file changed since.
+ * Safe to call from multiple threads.
+ */
+bool lookupFeatureCache(const char *imgFilePath, const struct stat *pImgFileStat, int width, int height, int channels,
+    int extractor, int resizeFilter, uint8_t *pImgDataBuffer);
+
+/**
+ * Adds or replaces the entry of the given image file.
+ * Safe to call from multiple threads.
+ */
+void insertFeatureCache(const char *imgFilePath, const struct stat *pImgFileStat, int width, int height, int channels,
+    int extractor, int resizeFilter, const uint8_t *pImgDataBuffer);
+
+/**
+ * Writes the cache back to its file if it was used, evicting the least recently used entries beyond the size cap.
+ */
+int saveFeatureCache();
+
+#endif
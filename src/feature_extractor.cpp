@@ -0,0 +1,295 @@
+#include "feature_extractor.hpp"
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "stb_image.h"
+
+#include "error_codes.hpp"
+
+/* Gradient magnitudes below this are noise, the orientation of their pixel is not counted */
+#define EDGE_MIN_MAGNITUDE                                                                            16
+
+/* The gradient magnitude histogram bins are 2^EDGE_MAGNITUDE_SHIFT wide, the last bin counts all the larger magnitudes */
+#define EDGE_MAGNITUDE_SHIFT                                                                          5
+
+/* Number of bins of the rotation invariant uniform local binary patterns: 0 to 8 set neighbors, and non-uniform */
+#define TEXTURE_LBP_BINS                                                                              10
+
+/**
+ * Stores a histogram as 255 * sqrt(bin fraction). An empty histogram is stored as zeros.
+ */
+static void storeHistogram(const uint32_t *pCounts, uint64_t total, uint8_t *pFeatures)
+{
+    for(int b = 0; b < FEATURE_EXTRACTOR_BINS; b++)
+    {
+        pFeatures[b] = (total == 0) ? 0 : (uint8_t)lrintf(255.0f * sqrtf((float)pCounts[b] / total));
+    }
+}
+
+/**
+ * Stores a statistic of the range [0, 1] as an 8-bit value.
+ */
+static uint8_t storeStatistic(float value)
+{
+    return (uint8_t)lrintf(255.0f * fminf(fmaxf(value, 0.0f), 1.0f));
+}
+
+/**
+ * Red, green, blue and luminance histograms of an RGB image.
+ */
+static void extractColourHistogram(const uint8_t *pImg, int width, int height, uint8_t *pFeatures)
+{
+    uint32_t counts[FEATURE_EXTRACTOR_COLOUR_HISTOGRAM_ROWS][FEATURE_EXTRACTOR_BINS] = {};
+    const int pixelCount = width * height;
+
+    for(int i = 0; i < pixelCount; i++)
+    {
+        const uint8_t *p = pImg + 3 * i;
+        counts[0][p[0] >> 4]++;
+        counts[1][p[1] >> 4]++;
+        counts[2][p[2] >> 4]++;
+
+        /* ITU-R BT.601 luma with 8-bit fixed point weights that sum to 256 */
+        counts[3][(77 * p[0] + 150 * p[1] + 29 * p[2]) >> 12]++;
+    }
+
+    for(int r = 0; r < FEATURE_EXTRACTOR_COLOUR_HISTOGRAM_ROWS; r++)
+    {
+        storeHistogram(counts[r], pixelCount, pFeatures + r * FEATURE_EXTRACTOR_BINS);
+    }
+}
+
+/**
+ * Sobel gradients of the interior pixels of one row of a greyscale image, into gx[1..width-2] and gy[1..width-2].
+ * The row must have a row above and below it.
+ */
+static void sobelRow(const uint8_t *pRow, int width, int16_t *gx, int16_t *gy)
+{
+    const uint8_t *a = pRow - width;
+    const uint8_t *b = pRow;
+    const uint8_t *c = pRow + width;
+
+    /* Independent iterations over 8-bit inputs that the compiler vectorizes */
+    for(int x = 1; x < width - 1; x++)
+    {
+        gx[x] = (int16_t)((a[x + 1] + 2 * b[x + 1] + c[x + 1]) - (a[x - 1] + 2 * b[x - 1] + c[x - 1]));
+        gy[x] = (int16_t)((c[x - 1] + 2 * c[x] + c[x + 1]) - (a[x - 1] + 2 * a[x] + a[x + 1]));
+    }
+}
+
+/**
+ * Unsigned orientation in [0, pi) of a non-zero gradient, within 2e-4 radians.
+ * A polynomial arctangent on the first octant, a fraction of the cost of atan2f.
+ */
+static float gradientOrientation(int gx, int gy)
+{
+    /* Fold the opposite directions together, an edge has the same orientation whichever side is brighter */
+    if(gy < 0 || (gy == 0 && gx < 0))
+    {
+        gx = -gx;
+        gy = -gy;
+    }
+
+    const float ax = (float)abs(gx);
+    const float ay = (float)gy;
+    const float a = fminf(ax, ay) / fmaxf(ax, ay);
+    const float s = a * a;
+
+    float angle = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+    angle = (ay > ax) ? (float)M_PI_2 - angle : angle;
+    return (gx < 0) ? (float)M_PI - angle : angle;
+}
+
+/**
+ * Gradient orientation histogram weighted by the gradient magnitude, and gradient magnitude histogram of a greyscale image.
+ * The orientations are unsigned, i.e. in [0, pi), and the magnitudes are the L1 norms of the Sobel gradients.
+ */
+static void extractEdgeHistogram(const uint8_t *pImg, int width, int height, uint8_t *pFeatures)
+{
+    uint32_t orientationWeights[FEATURE_EXTRACTOR_BINS] = {};
+    uint32_t magnitudeCounts[FEATURE_EXTRACTOR_BINS] = {};
+    uint64_t orientationTotal = 0;
+    uint64_t magnitudeTotal = 0;
+
+    int16_t gx[FEATURE_EXTRACTOR_WORKING_SIZE];
+    int16_t gy[FEATURE_EXTRACTOR_WORKING_SIZE];
+
+    for(int y = 1; y < height - 1; y++)
+    {
+        sobelRow(pImg + y * width, width, gx, gy);
+
+        for(int x = 1; x < width - 1; x++)
+        {
+            const int magnitude = abs(gx[x]) + abs(gy[x]);
+            magnitudeCounts[(magnitude >> EDGE_MAGNITUDE_SHIFT < FEATURE_EXTRACTOR_BINS) ? magnitude >> EDGE_MAGNITUDE_SHIFT : FEATURE_EXTRACTOR_BINS - 1]++;
+            magnitudeTotal++;
+
+            if(magnitude >= EDGE_MIN_MAGNITUDE)
+            {
+                int bin = (int)(gradientOrientation(gx[x], gy[x]) * (FEATURE_EXTRACTOR_BINS / (float)M_PI));
+                orientationWeights[(bin < FEATURE_EXTRACTOR_BINS) ? bin : FEATURE_EXTRACTOR_BINS - 1] += magnitude;
+                orientationTotal += magnitude;
+            }
+        }
+    }
+
+    storeHistogram(orientationWeights, orientationTotal, pFeatures);
+    storeHistogram(magnitudeCounts, magnitudeTotal, pFeatures + FEATURE_EXTRACTOR_BINS);
+}
+
+/**
+ * Rotation invariant uniform local binary pattern histogram of the interior pixels of a greyscale image, followed by
+ * its grey level mean, standard deviation, horizontal and vertical mean absolute differences between neighbors,
+ * homogeneity, and the entropy of its 16-bin grey level histogram.
+ */
+static void extractTexture(const uint8_t *pImg, int width, int height, uint8_t *pFeatures)
+{
+    uint32_t patternCounts[FEATURE_EXTRACTOR_BINS] = {};
+    uint32_t greyCounts[FEATURE_EXTRACTOR_BINS] = {};
+    uint64_t patternTotal = 0;
+    uint64_t sum = 0;
+    uint64_t sumSquares = 0;
+    uint64_t horizontalDiffs = 0;
+    uint64_t verticalDiffs = 0;
+    float homogeneity = 0;
+
+    const int pixelCount = width * height;
+
+    for(int y = 0; y < height; y++)
+    {
+        const uint8_t *p = pImg + y * width;
+
+        /* Grey level moments and differences between neighbors, independent iterations that the compiler vectorizes */
+        for(int x = 0; x < width; x++)
+        {
+            sum += p[x];
+            sumSquares += p[x] * p[x];
+            greyCounts[p[x] >> 4]++;
+        }
+
+        for(int x = 0; x < width - 1; x++)
+        {
+            const int diff = abs(p[x + 1] - p[x]);
+            horizontalDiffs += diff;
+            homogeneity += 1.0f / (1 + diff);
+        }
+
+        if(y + 1 < height)
+        {
+            for(int x = 0; x < width; x++)
+            {
+                const int diff = abs(p[x + width] - p[x]);
+                verticalDiffs += diff;
+                homogeneity += 1.0f / (1 + diff);
+            }
+        }
+
+        if(y == 0 || y == height - 1)
+        {
+            continue;
+        }
+
+        /* Local binary patterns, the 8 neighbors in circular order */
+        for(int x = 1; x < width - 1; x++)
+        {
+            const uint8_t center = p[x];
+            const unsigned pattern = (p[x - width - 1] >= center) | (p[x - width] >= center) << 1 | (p[x - width + 1] >= center) << 2
+                | (p[x + 1] >= center) << 3 | (p[x + width + 1] >= center) << 4 | (p[x + width] >= center) << 5
+                | (p[x + width - 1] >= center) << 6 | (p[x - 1] >= center) << 7;
+
+            /* A uniform pattern has at most 2 circular 0/1 transitions and is binned by its number of set bits */
+            const unsigned rotated = ((pattern << 1) | (pattern >> 7)) & 0xFF;
+            const int transitions = __builtin_popcount(pattern ^ rotated);
+            patternCounts[(transitions <= 2) ? __builtin_popcount(pattern) : TEXTURE_LBP_BINS - 1]++;
+            patternTotal++;
+        }
+    }
+
+    storeHistogram(patternCounts, patternTotal, pFeatures);
+
+    /* The statistics take the bins left after the pattern histogram, all scaled to [0, 1] */
+    uint8_t *pStatistics = pFeatures + TEXTURE_LBP_BINS;
+    if(pixelCount == 0)
+    {
+        memset(pStatistics, 0, FEATURE_EXTRACTOR_BINS - TEXTURE_LBP_BINS);
+        return;
+    }
+
+    const float mean = (float)sum / pixelCount;
+    const float variance = fmaxf((float)sumSquares / pixelCount - mean * mean, 0.0f);
+    const int horizontalPairs = (width - 1) * height;
+    const int verticalPairs = width * (height - 1);
+
+    float entropy = 0;
+    for(int b = 0; b < FEATURE_EXTRACTOR_BINS; b++)
+    {
+        if(greyCounts[b] > 0)
+        {
+            const float fraction = (float)greyCounts[b] / pixelCount;
+            entropy -= fraction * log2f(fraction);
+        }
+    }
+
+    /* The standard deviation is at most 127.5 and differences between neighbors are mostly below 64 */
+    pStatistics[0] = storeStatistic(mean / 255.0f);
+    pStatistics[1] = storeStatistic(sqrtf(variance) / 127.5f);
+    pStatistics[2] = storeStatistic((horizontalPairs > 0) ? (float)horizontalDiffs / horizontalPairs / 64.0f : 0.0f);
+    pStatistics[3] = storeStatistic((verticalPairs > 0) ? (float)verticalDiffs / verticalPairs / 64.0f : 0.0f);
+    pStatistics[4] = storeStatistic((horizontalPairs + verticalPairs > 0) ? homogeneity / (horizontalPairs + verticalPairs) : 0.0f);
+    pStatistics[5] = storeStatistic(entropy / 4.0f);
+}
+
+/* The extractors, indexed by featureExtractors, the pixels have none */
+static const FeatureExtractor extractorTable[FEATURE_EXTRACTOR_COUNT] = {
+    {"pixels", 0, 0, 0, NULL},
+    {"colour-histogram", FEATURE_EXTRACTOR_BINS, FEATURE_EXTRACTOR_COLOUR_HISTOGRAM_ROWS, STBI_rgb, extractColourHistogram},
+    {"edge-histogram", FEATURE_EXTRACTOR_BINS, FEATURE_EXTRACTOR_EDGE_HISTOGRAM_ROWS, STBI_grey, extractEdgeHistogram},
+    {"texture", FEATURE_EXTRACTOR_BINS, FEATURE_EXTRACTOR_TEXTURE_ROWS, STBI_grey, extractTexture}
+};
+
+int parseFeatureExtractorName(const char *name, int *pExtractor)
+{
+    for(int e = 0; e < FEATURE_EXTRACTOR_COUNT; e++)
+    {
+        if(strcmp(name, extractorTable[e].name) == 0)
+        {
+            *pExtractor = e;
+            return NO_ERROR;
+        }
+    }
+
+    return ERROR_ARGS;
+}
+
+const char* featureExtractorName(int extractor)
+{
+    if(extractor < 0 || extractor >= FEATURE_EXTRACTOR_COUNT)
+    {
+        return "unknown";
+    }
+
+    return extractorTable[extractor].name;
+}
+
+const FeatureExtractor* featureExtractorOf(int extractor)
+{
+    if(extractor <= FEATURE_EXTRACTOR_PIXELS || extractor >= FEATURE_EXTRACTOR_COUNT)
+    {
+        return NULL;
+    }
+
+    return &extractorTable[extractor];
+}
+
+int featureExtractorBins(int extractor)
+{
+    const FeatureExtractor *pExtractor = featureExtractorOf(extractor);
+    return (pExtractor != NULL) ? pExtractor->bins : 0;
+}
+
+int featureExtractorWorkingSize(int extractor)
+{
+    return (featureExtractorOf(extractor) != NULL) ? FEATURE_EXTRACTOR_WORKING_SIZE : 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * Feature extractors.
+ *
+ * Instead of its downsampled pixels, an image can be described by a few histograms that are computed in the same pass
+ * as the decode: the decoded image is downsampled to at most FEATURE_EXTRACTOR_WORKING_SIZE pixels per side and the
+ * extractor reads the downsampled image once. None of the histograms depend on where the content is in the image, so
+ * they are far less sensitive than the pixels to shifts, and all but the gradient orientation histogram do not depend
+ * on its rotation either.
+ *
+ * An extractor writes rows x bins 8-bit values, one row per histogram, that take the place of the downsampled pixels
+ * in the rest of the pipeline: a geometry of bins x rows x 1 channel. Histogram bins are stored as
+ * 255 * sqrt(bin fraction), which makes the Euclidean distance between two feature vectors proportional to the
+ * Hellinger distance between their histograms.
+ *
+ * The feature cache, the feature store, and the binary and quantized centroid files record the extractor, its number
+ * of bins, and its working size next to the geometry, so that features of another extractor or of other parameters
+ * are rejected even if they have the same shape. All three are zero for the pixels, which is also what the reserved
+ * header bytes of the files written before they were recorded hold: those files keep loading as pixels.
+ */
+
+#ifndef FEATURE_EXTRACTOR_H
+#define FEATURE_EXTRACTOR_H
+
+#include <stdint.h>
+
+/* Features of the images */
+typedef enum _feature_extractors {
+    FEATURE_EXTRACTOR_PIXELS           = 0, /* The downsampled pixels, no extractor */
+    FEATURE_EXTRACTOR_COLOUR_HISTOGRAM = 1, /* Red, green, blue and luminance histograms */
+    FEATURE_EXTRACTOR_EDGE_HISTOGRAM   = 2, /* Gradient orientation histogram weighted by magnitude, and gradient magnitude histogram */
+    FEATURE_EXTRACTOR_TEXTURE          = 3, /* Rotation invariant local binary pattern histogram, and grey level statistics */
+    FEATURE_EXTRACTOR_COUNT            = 4
+} featureExtractors;
+
+/* Largest width and height of the downsampled image the extractors read */
+#define FEATURE_EXTRACTOR_WORKING_SIZE                                                                64
+
+/* Number of bins of every histogram, i.e. the width of the extractor geometries */
+#define FEATURE_EXTRACTOR_BINS                                                                        16
+
+/* Number of histograms written by each extractor, i.e. the height of the extractor geometries */
+#define FEATURE_EXTRACTOR_COLOUR_HISTOGRAM_ROWS                                                       4
+#define FEATURE_EXTRACTOR_EDGE_HISTOGRAM_ROWS                                                         2
+#define FEATURE_EXTRACTOR_TEXTURE_ROWS                                                                1
+
+/**
+ * Extracts the features of an interleaved 8-bit image of the extractor's decode channels into rows x bins values.
+ */
+typedef void (*featureExtractFn)(const uint8_t *pImg, int width, int height, uint8_t *pFeatures);
+
+/* A feature extractor */
+typedef struct _feature_extractor {
+    const char *name;         /* Name given to --features and recorded in the centroids file */
+    int bins;                 /* Number of bins of each histogram */
+    int rows;                 /* Number of histograms */
+    int decodeChannels;       /* Number of channels the images are decoded to, STBI_grey or STBI_rgb */
+    featureExtractFn extract; /* Extraction function */
+} FeatureExtractor;
+
+/**
+ * Parses a feature extractor name such as "colour-histogram" into one of featureExtractors.
+ */
+int parseFeatureExtractorName(const char *name, int *pExtractor);
+
+/**
+ * Name of one of featureExtractors, e.g. "colour-histogram".
+ */
+const char* featureExtractorName(int extractor);
+
+/**
+ * The extractor of one of featureExtractors, NULL for the pixels.
+ */
+const FeatureExtractor* featureExtractorOf(int extractor);
+
+/**
+ * Number of bins of each histogram of one of featureExtractors, 0 for the pixels.
+ */
+int featureExtractorBins(int extractor);
+
+/**
+ * Largest width and height of the downsampled image read by one of featureExtractors, 0 for the pixels.
+ */
+int featureExtractorWorkingSize(int extractor);
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * Training data matrix.
+ *
+ * The training data points are stored as rows of a single contiguous arena allocated on a 64-byte boundary, i.e. on a
+ * cache line and on the widest SIMD register the distance kernels load. Every geometry has a row size that is a
+ * multiple of 64 bytes, so every row starts on a 64-byte boundary as well.
+ *
+ * The matrix keeps the std::vector interface so that the engines index it the same way as any other point vector, but
+ * its allocations are counted in the stats (feature_allocations): the loaders reserve the whole capacity up front from
+ * the number of listed images or from the file header, so training data that is loaded without any reallocation
+ * counts a single allocation.
+ */
+
+#ifndef FEATURE_MATRIX_H
+#define FEATURE_MATRIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <new>
+
+#include "error_codes.hpp"
+#include "stats.hpp"
+
+/* Alignment of the training data arena */
+#define FEATURE_MATRIX_ALIGNMENT                                                                      64
+
+/**
+ * Allocator of the training data arena: aligned on FEATURE_MATRIX_ALIGNMENT and counted in the stats.
+ */
+template <typename T>
+struct FeatureArenaAllocator
+{
+    typedef T value_type;
+
+    FeatureArenaAllocator() noexcept {}
+
+    template <typename U>
+    FeatureArenaAllocator(const FeatureArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t count)
+    {
+        void *p = NULL;
+        if(count > SIZE_MAX / sizeof(T) || posix_memalign(&p, FEATURE_MATRIX_ALIGNMENT, count * sizeof(T)) != 0)
+        {
+            throw std::bad_alloc();
+        }
+
+        statsCount(STATS_COUNTER_FEATURE_ALLOCATIONS, 1);
+        return (T*)p;
+    }
+
+    void deallocate(T *p, size_t) noexcept
+    {
+        free(p);
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const FeatureArenaAllocator<T>&, const FeatureArenaAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+inline bool operator!=(const FeatureArenaAllocator<T>&, const FeatureArenaAllocator<U>&) { return false; }
+
+/* Training data points of N values each, one row per point */
+template <size_t N>
+using FeatureMatrix = std::vector<std::array<float, N>, FeatureArenaAllocator<std::array<float, N>>>;
+
+/**
+ * Reads a training data CSV file of N comma separated values per line.
+ * The lines are counted first so that the matrix is allocated once.
+ */
+template <size_t N>
+int loadFeatureMatrixFromCsvFile(std::string trainingDataCsvFilePath, FeatureMatrix<N> *pTrainingImgMatrix)
+{
+    std::ifstream trainingDataCsvFile(trainingDataCsvFilePath.c_str());
+    if(!trainingDataCsvFile.is_open())
+    {
+        return ERROR_READING_TRAINING_DATA;
+    }
+
+    std::stringstream content;
+    content << trainingDataCsvFile.rdbuf();
+    const std::string csv = content.str();
+
+    size_t lineCount = 0;
+    for(char c : csv)
+    {
+        lineCount += (c == '\n');
+    }
+
+    pTrainingImgMatrix->clear();
+    pTrainingImgMatrix->reserve(lineCount + 1);
+
+    const char *p = csv.c_str();
+    while(*p != '\0')
+    {
+        /* Skip blank lines */
+        const char *lineEnd = p;
+        while(*lineEnd != '\0' && *lineEnd != '\n')
+        {
+            lineEnd++;
+        }
+
+        if(std::string(p, lineEnd).find_first_not_of(" \t\r") == std::string::npos)
+        {
+            p = (*lineEnd == '\n') ? lineEnd + 1 : lineEnd;
+            continue;
+        }
+
+        /* Parse the comma separated values in place, in the next row */
+        pTrainingImgMatrix->emplace_back();
+        std::array<float, N> &row = pTrainingImgMatrix->back();
+        size_t i = 0;
+
+        while(p < lineEnd && *p != '\r')
+        {
+            char *end;
+            float value = strtof(p, &end);
+            if(end == p || end > lineEnd)
+            {
+                return ERROR_READING_TRAINING_DATA;
+            }
+
+            /* A row with more values than expected was collected with another geometry */
+            if(i == N)
+            {
+                return ERROR_TRAINING_DATA_MISMATCH;
+            }
+
+            row[i++] = value;
+            p = (*end == ',') ? end + 1 : end;
+        }
+
+        /* A row with fewer values than expected was collected with another geometry */
+        if(i != N)
+        {
+            return ERROR_TRAINING_DATA_MISMATCH;
+        }
+
+        p = (*lineEnd == '\n') ? lineEnd + 1 : lineEnd;
+    }
+
+    return NO_ERROR;
+}
+
+#endif
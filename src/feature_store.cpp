@@ -0,0 +1,193 @@
+#include "feature_store.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Check that the header layout is the documented 64 bytes */
+static_assert(sizeof(FeatureStoreHeader) == 64, "Unexpected feature store header size");
+
+void initFeatureStoreHeader(FeatureStoreHeader *pHeader, int width, int height, int channels, int extractor, int normalize, int dtype)
+{
+    memset(pHeader, 0, sizeof(FeatureStoreHeader));
+    memcpy(pHeader->magic, FEATURE_STORE_MAGIC, sizeof(pHeader->magic));
+    pHeader->version = FEATURE_STORE_VERSION;
+    pHeader->dtype = (uint16_t)dtype;
+    pHeader->width = (uint32_t)width;
+    pHeader->height = (uint32_t)height;
+    pHeader->channels = (uint32_t)channels;
+    pHeader->extractor = (uint32_t)extractor;
+    pHeader->bins = (uint32_t)featureExtractorBins(extractor);
+    pHeader->workingSize = (uint32_t)featureExtractorWorkingSize(extractor);
+    pHeader->normalize = (uint32_t)normalize;
+    pHeader->sampleCount = 0;
+}
+
+size_t featureStoreRowSize(const FeatureStoreHeader *pHeader)
+{
+    size_t valueSize = (pHeader->dtype == FEATURE_STORE_DTYPE_FLOAT) ? sizeof(float) : sizeof(uint8_t);
+    return (size_t)pHeader->width * pHeader->height * pHeader->channels * valueSize;
+}
+
+/**
+ * Checks that a header read from a file is a supported feature store header.
+ */
+static int validateFeatureStoreHeader(const FeatureStoreHeader *pHeader)
+{
+    if(memcmp(pHeader->magic, FEATURE_STORE_MAGIC, sizeof(pHeader->magic)) != 0 || pHeader->version != FEATURE_STORE_VERSION)
+    {
+        return ERROR_TRAINING_DATA_MISMATCH;
+    }
+
+    if((pHeader->dtype != FEATURE_STORE_DTYPE_UINT8 && pHeader->dtype != FEATURE_STORE_DTYPE_FLOAT) || pHeader->extractor >= FEATURE_EXTRACTOR_COUNT)
+    {
+        return ERROR_TRAINING_DATA_MISMATCH;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Writes the whole buffer at the given offset, retrying on partial writes.
+ */
+static int pwriteAll(int fd, const void *pBuffer, size_t length, off_t offset)
+{
+    const uint8_t *p = (const uint8_t*)pBuffer;
+
+    while(length > 0)
+    {
+        ssize_t written = pwrite(fd, p, length, offset);
+        if(written <= 0)
+        {
+            return ERROR_WRITING_TRAINING_DATA;
+        }
+
+        p += written;
+        length -= written;
+        offset += written;
+    }
+
+    return NO_ERROR;
+}
+
+int appendToFeatureStore(std::string featureStoreFilePath, const FeatureStoreHeader *pHeader, const uint8_t *pRows, uint64_t rowCount)
+{
+    /* Create a new file if it doesn't exist or append to it if it already exists */
+    int fd = open(featureStoreFilePath.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd < 0)
+    {
+        return ERROR_WRITING_TRAINING_DATA;
+    }
+
+    FeatureStoreHeader fileHeader;
+    ssize_t readRes = pread(fd, &fileHeader, sizeof(FeatureStoreHeader), 0);
+
+    if(readRes == 0)
+    {
+        /* New file: start from the given header */
+        fileHeader = *pHeader;
+        fileHeader.sampleCount = 0;
+    }
+    else if(readRes != sizeof(FeatureStoreHeader) || validateFeatureStoreHeader(&fileHeader) != NO_ERROR)
+    {
+        close(fd);
+        return ERROR_TRAINING_DATA_MISMATCH;
+    }
+    else if(fileHeader.width != pHeader->width || fileHeader.height != pHeader->height || fileHeader.channels != pHeader->channels
+        || fileHeader.normalize != pHeader->normalize || fileHeader.dtype != pHeader->dtype || fileHeader.extractor != pHeader->extractor
+        || fileHeader.bins != pHeader->bins || fileHeader.workingSize != pHeader->workingSize)
+    {
+        /* Rows of different shapes cannot be mixed in the same file */
+        close(fd);
+        return ERROR_TRAINING_DATA_MISMATCH;
+    }
+
+    /* Write the rows right after the last committed row, overwriting whatever an interrupted append may have left behind */
+    const size_t rowSize = featureStoreRowSize(&fileHeader);
+    off_t rowsOffset = sizeof(FeatureStoreHeader) + fileHeader.sampleCount * rowSize;
+
+    int writeRes = pwriteAll(fd, pRows, rowCount * rowSize, rowsOffset);
+
+    /* Commit the new rows by updating the sample count in the header */
+    if(writeRes == NO_ERROR)
+    {
+        fileHeader.sampleCount += rowCount;
+        writeRes = pwriteAll(fd, &fileHeader, sizeof(FeatureStoreHeader), 0);
+    }
+
+    /* Drop any leftover bytes past the last committed row */
+    if(writeRes == NO_ERROR && ftruncate(fd, sizeof(FeatureStoreHeader) + fileHeader.sampleCount * rowSize) != 0)
+    {
+        writeRes = ERROR_WRITING_TRAINING_DATA;
+    }
+
+    if(close(fd) != 0 && writeRes == NO_ERROR)
+    {
+        writeRes = ERROR_WRITING_TRAINING_DATA;
+    }
+
+    return writeRes;
+}
+
+int mapFeatureStore(std::string featureStoreFilePath, FeatureStoreMap *pMap)
+{
+    memset(pMap, 0, sizeof(FeatureStoreMap));
+
+    int fd = open(featureStoreFilePath.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return ERROR_READING_TRAINING_DATA;
+    }
+
+    struct stat sb;
+    if(fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(FeatureStoreHeader))
+    {
+        close(fd);
+        return ERROR_READING_TRAINING_DATA;
+    }
+
+    void *pAddr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping stays valid after the file descriptor is closed */
+    close(fd);
+
+    if(pAddr == MAP_FAILED)
+    {
+        return ERROR_READING_TRAINING_DATA;
+    }
+
+    memcpy(&pMap->header, pAddr, sizeof(FeatureStoreHeader));
+    pMap->pAddr = pAddr;
+    pMap->length = sb.st_size;
+    pMap->pRows = (const uint8_t*)pAddr + sizeof(FeatureStoreHeader);
+
+    /* Check the header and that the file holds all the rows it claims to hold */
+    int validateRes = validateFeatureStoreHeader(&pMap->header);
+    if(validateRes == NO_ERROR
+        && sizeof(FeatureStoreHeader) + pMap->header.sampleCount * featureStoreRowSize(&pMap->header) > pMap->length)
+    {
+        validateRes = ERROR_TRAINING_DATA_MISMATCH;
+    }
+
+    if(validateRes != NO_ERROR)
+    {
+        unmapFeatureStore(pMap);
+        return validateRes;
+    }
+
+    /* Rows are read front to back */
+    madvise(pAddr, pMap->length, MADV_SEQUENTIAL);
+
+    return NO_ERROR;
+}
+
+void unmapFeatureStore(FeatureStoreMap *pMap)
+{
+    if(pMap->pAddr != NULL)
+    {
+        munmap(pMap->pAddr, pMap->length);
+    }
+
+    memset(pMap, 0, sizeof(FeatureStoreMap));
+}
@@ -0,0 +1,158 @@
+/**
+ * Binary training data file (feature store).
+ *
+ * An append-only file made out of a fixed size header followed by packed training data rows.
+ * Each row holds the pixel values of one downsampled image, stored either as raw uint8 pixel
+ * values or as float values. The file can be memory mapped and used as is, without any parsing.
+ *
+ * Layout (little endian, as written by the host):
+ *  - 64 bytes header, see FeatureStoreHeader.
+ *  - sampleCount rows of width * height * channels values of the header's data type.
+ *
+ * The header also records the feature extractor, see feature_extractor.hpp.
+ */
+
+#ifndef FEATURE_STORE_H
+#define FEATURE_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <array>
+
+#include "error_codes.hpp"
+#include "geometry.hpp"
+#include "feature_matrix.hpp"
+
+/* Magic bytes at the start of every feature store file */
+#define FEATURE_STORE_MAGIC                                                                       "KMFS"
+
+/* Version of the feature store file format */
+#define FEATURE_STORE_VERSION                                                                          1
+
+/* Data type of the values stored in the rows */
+typedef enum _feature_store_dtype {
+    FEATURE_STORE_DTYPE_UINT8 = 0, /* Raw pixel values, normalized when loaded if the normalize flag is set */
+    FEATURE_STORE_DTYPE_FLOAT = 1  /* Float values, stored as they will be used (i.e. already normalized if the normalize flag is set) */
+} featureStoreDtype;
+
+typedef struct _feature_store_header {
+    char magic[4];          /* FEATURE_STORE_MAGIC */
+    uint16_t version;       /* FEATURE_STORE_VERSION */
+    uint16_t dtype;         /* One of featureStoreDtype */
+    uint32_t width;         /* Downsampled image width */
+    uint32_t height;        /* Downsampled image height */
+    uint32_t channels;      /* Downsampled image channels */
+    uint32_t normalize;     /* Whether or not the pixel values are normalized */
+    uint64_t sampleCount;   /* Number of rows following the header */
+    uint32_t extractor;     /* One of featureExtractors, zero for the pixels */
+    uint32_t bins;          /* Number of bins of each histogram of the extractor, zero for the pixels */
+    uint32_t workingSize;   /* Largest side of the image the extractor reads, zero for the pixels */
+    uint8_t reserved[20];   /* Pads the header to 64 bytes */
+} FeatureStoreHeader;
+
+/* A read-only memory mapped feature store file */
+typedef struct _feature_store_map {
+    FeatureStoreHeader header; /* Copy of the file header */
+    const uint8_t *pRows;      /* First row, inside the mapping */
+    void *pAddr;               /* Start of the mapping */
+    size_t length;             /* Length of the mapping */
+} FeatureStoreMap;
+
+/**
+ * Initializes a header for the given geometry, features, and data type with a sample count of zero.
+ */
+void initFeatureStoreHeader(FeatureStoreHeader *pHeader, int width, int height, int channels, int extractor, int normalize, int dtype);
+
+/**
+ * Size in bytes of a single row described by the given header.
+ */
+size_t featureStoreRowSize(const FeatureStoreHeader *pHeader);
+
+/**
+ * Appends rows to the feature store file at the given path.
+ * The file is created if it doesn't exist. If it exists then its header must match the given header's
+ * geometry, features, normalization and data type. The sample count is only updated once all rows have been written
+ * so an interrupted append leaves the previously stored samples intact.
+ */
+int appendToFeatureStore(std::string featureStoreFilePath, const FeatureStoreHeader *pHeader, const uint8_t *pRows, uint64_t rowCount);
+
+/**
+ * Memory maps the feature store file at the given path and validates its header.
+ */
+int mapFeatureStore(std::string featureStoreFilePath, FeatureStoreMap *pMap);
+
+/**
+ * Releases a mapping created with mapFeatureStore.
+ */
+void unmapFeatureStore(FeatureStoreMap *pMap);
+
+/**
+ * Checks that the geometry, features, and normalization recorded in the header match the expected ones.
+ */
+template <typename G>
+int checkFeatureStoreGeometry(const FeatureStoreMap *pMap, int normalize)
+{
+    const FeatureStoreHeader *pHeader = &pMap->header;
+
+    if(pHeader->width != (uint32_t)G::width || pHeader->height != (uint32_t)G::height || pHeader->channels != (uint32_t)G::channels
+        || pHeader->normalize != (uint32_t)normalize || pHeader->extractor != (uint32_t)G::extractor
+        || pHeader->bins != (uint32_t)featureExtractorBins(G::extractor) || pHeader->workingSize != (uint32_t)featureExtractorWorkingSize(G::extractor))
+    {
+        return ERROR_TRAINING_DATA_MISMATCH;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Copies a single row of a mapped feature store into a training data point, normalizing uint8 values if required.
+ * The geometry must have been checked with checkFeatureStoreGeometry.
+ */
+template <typename G>
+inline void featureStoreRowToArray(const FeatureStoreMap *pMap, uint64_t row, std::array<float, G::size> *pTrainingImgDataArray)
+{
+    const FeatureStoreHeader *pHeader = &pMap->header;
+    const size_t rowSize = featureStoreRowSize(pHeader);
+    const uint8_t *pRow = pMap->pRows + row * rowSize;
+
+    if(pHeader->dtype == FEATURE_STORE_DTYPE_FLOAT)
+    {
+        /* Float rows are used as they are */
+        memcpy(pTrainingImgDataArray->data(), pRow, rowSize);
+    }
+    else
+    {
+        /* Raw pixel rows are converted the same way as freshly decoded images */
+        imgDataBufferToArray<G>(pRow, pHeader->normalize, pTrainingImgDataArray);
+    }
+}
+
+/**
+ * Copies all the rows of a mapped feature store into a training data matrix, or a standard vector of rows, sized from
+ * the header, normalizing uint8 values if required.
+ * The geometry and normalization recorded in the header must match the expected ones.
+ */
+template <typename G, typename M>
+int featureStoreToVector(const FeatureStoreMap *pMap, int normalize, M *pTrainingImgVector)
+{
+    /* The rows must have been collected with the expected geometry and normalization */
+    int checkRes = checkFeatureStoreGeometry<G>(pMap, normalize);
+    if(checkRes != NO_ERROR)
+    {
+        return checkRes;
+    }
+
+    pTrainingImgVector->resize(pMap->header.sampleCount);
+
+    for(uint64_t r = 0; r < pMap->header.sampleCount; r++)
+    {
+        featureStoreRowToArray<G>(pMap, r, &pTrainingImgVector->at(r));
+    }
+
+    return NO_ERROR;
+}
+
+#endif
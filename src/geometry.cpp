@@ -0,0 +1,62 @@
+#include "geometry.hpp"
+
+#include <string.h>
+
+#include "error_codes.hpp"
+
+/* Names of the pre-instantiated geometries, indexed by geometry identifier */
+static const char *geometryNames[] = {
+    "16x16-grey",
+    "20x20-grey",
+    "32x32-grey",
+    "20x20-rgb"
+};
+
+int parseGeometryName(const char *name, int *pGeometryId)
+{
+    for(int g = 0; g < (int)(sizeof(geometryNames) / sizeof(geometryNames[0])); g++)
+    {
+        if(strcmp(name, geometryNames[g]) == 0)
+        {
+            *pGeometryId = g;
+            return NO_ERROR;
+        }
+    }
+
+    return ERROR_ARGS;
+}
+
+const char* geometryName(int geometryId)
+{
+    switch(geometryId)
+    {
+        case GEOMETRY_COLOUR_HISTOGRAM:
+            return featureExtractorName(FEATURE_EXTRACTOR_COLOUR_HISTOGRAM);
+        case GEOMETRY_EDGE_HISTOGRAM:
+            return featureExtractorName(FEATURE_EXTRACTOR_EDGE_HISTOGRAM);
+        case GEOMETRY_TEXTURE:
+            return featureExtractorName(FEATURE_EXTRACTOR_TEXTURE);
+    }
+
+    if(geometryId < 0 || geometryId >= (int)(sizeof(geometryNames) / sizeof(geometryNames[0])))
+    {
+        return "unknown";
+    }
+
+    return geometryNames[geometryId];
+}
+
+int featureGeometryId(int extractor, int imgGeometryId)
+{
+    switch(extractor)
+    {
+        case FEATURE_EXTRACTOR_COLOUR_HISTOGRAM:
+            return GEOMETRY_COLOUR_HISTOGRAM;
+        case FEATURE_EXTRACTOR_EDGE_HISTOGRAM:
+            return GEOMETRY_EDGE_HISTOGRAM;
+        case FEATURE_EXTRACTOR_TEXTURE:
+            return GEOMETRY_TEXTURE;
+        default:
+            return imgGeometryId;
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * Training and prediction image geometries.
+ *
+ * The images that are used as training and prediction inputs are resized to a fixed width, height and number of channels.
+ * Each supported geometry is a distinct type so that the whole pipeline is instantiated with fixed-size arrays
+ * that the compiler can unroll and vectorize. The geometry to use is picked at runtime among the pre-instantiated ones.
+ *
+ * Images can also be described by the histograms of a feature extractor instead of their pixels: the extractor
+ * geometries are the shapes of the extractor outputs, see feature_extractor.hpp.
+ */
+
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+#include "stb_image.h"
+#include "stats.hpp"
+#include "feature_extractor.hpp"
+
+/**
+ * Image geometry.
+ * Channels are defined in stb_image.h: STBI_grey, STBI_grey_alpha, STBI_rgb, and STBI_rgb_alpha.
+ */
+template <int W, int H, int C>
+struct ImgGeometry
+{
+    static const int width = W;
+    static const int height = H;
+    static const int channels = C;
+    static const size_t size = (size_t)W * H * C;
+    static const int extractor = FEATURE_EXTRACTOR_PIXELS;
+};
+
+/**
+ * Feature extractor geometry: H histograms of W bins, one 8-bit value per bin.
+ */
+template <int E, int W, int H>
+struct FeatureGeometry
+{
+    static const int width = W;
+    static const int height = H;
+    static const int channels = STBI_grey;
+    static const size_t size = (size_t)W * H;
+    static const int extractor = E;
+};
+
+/* The pre-instantiated geometries */
+typedef ImgGeometry<16, 16, STBI_grey> Geometry16x16Grey;
+typedef ImgGeometry<20, 20, STBI_grey> Geometry20x20Grey;
+typedef ImgGeometry<32, 32, STBI_grey> Geometry32x32Grey;
+typedef ImgGeometry<20, 20, STBI_rgb>  Geometry20x20Rgb;
+typedef FeatureGeometry<FEATURE_EXTRACTOR_COLOUR_HISTOGRAM, FEATURE_EXTRACTOR_BINS, FEATURE_EXTRACTOR_COLOUR_HISTOGRAM_ROWS> GeometryColourHistogram;
+typedef FeatureGeometry<FEATURE_EXTRACTOR_EDGE_HISTOGRAM, FEATURE_EXTRACTOR_BINS, FEATURE_EXTRACTOR_EDGE_HISTOGRAM_ROWS> GeometryEdgeHistogram;
+typedef FeatureGeometry<FEATURE_EXTRACTOR_TEXTURE, FEATURE_EXTRACTOR_BINS, FEATURE_EXTRACTOR_TEXTURE_ROWS> GeometryTexture;
+
+/* Runtime identifiers of the pre-instantiated geometries */
+typedef enum _geometry_ids {
+    GEOMETRY_16X16_GREY       = 0,
+    GEOMETRY_20X20_GREY       = 1,
+    GEOMETRY_32X32_GREY       = 2,
+    GEOMETRY_20X20_RGB        = 3,
+    GEOMETRY_COLOUR_HISTOGRAM = 4, /* The extractor geometries are selected with --features, not --geometry */
+    GEOMETRY_EDGE_HISTOGRAM   = 5,
+    GEOMETRY_TEXTURE          = 6
+} geometryIds;
+
+/* The geometry used when none is given, i.e. the 20x20 greyscale thumbnails the project was built around */
+#define DEFAULT_GEOMETRY                                                             GEOMETRY_20X20_GREY
+
+/**
+ * Parses a geometry name such as "20x20-grey" into its identifier.
+ */
+int parseGeometryName(const char *name, int *pGeometryId);
+
+/**
+ * Name of a geometry identifier, e.g. "20x20-grey". The extractor geometries are named after their extractor.
+ */
+const char* geometryName(int geometryId);
+
+/**
+ * Geometry identifier of the features of one of featureExtractors: the given image geometry for the pixels.
+ */
+int featureGeometryId(int extractor, int imgGeometryId);
+
+/**
+ * Converts a downsampled pixel value, or an extracted 8-bit feature, into a feature value.
+ * In terms of clustering there seems to be no obvious advantages or disadvantages to normalizing or not.
+ */
+inline float pixelToFeature(uint8_t pixel, int normalize)
+{
+    return (normalize == 1) ? ((int)pixel) / 255.0 : (float)pixel;
+}
+
+/**
+ * Converts a downsampled image data buffer into a feature array.
+ */
+template <typename G>
+inline void imgDataBufferToArray(const uint8_t *pImgDataBuffer, int normalize, std::array<float, G::size> *pImgDataArray)
+{
+    uint64_t convertBegin = statsStageBegin();
+
+    for(size_t i = 0; i < G::size; i++)
+    {
+        (*pImgDataArray)[i] = pixelToFeature(pImgDataBuffer[i], normalize);
+    }
+
+    statsStageEnd(STATS_STAGE_CONVERT, convertBegin);
+}
+
+#endif
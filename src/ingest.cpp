@@ -0,0 +1,478 @@
+#include "ingest.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+
+#include "downsample.hpp"
+#include "feature_extractor.hpp"
+#include "error_codes.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "feature_cache.hpp"
+#include "tar_archive.hpp"
+#include "read_ahead.hpp"
+
+using namespace std;
+
+/* Downsampler of the decoded images, one of imgResizeFilters */
+static int imgResizeFilter = IMG_RESIZE_FILTER_STB;
+
+void setImgResizeFilter(int resizeFilter)
+{
+    imgResizeFilter = resizeFilter;
+}
+
+/* Number of reads kept in flight ahead of the decoders, 0 if the decoders read their own files */
+static int imgReadAhead = 0;
+
+/* Engine of the read-ahead stage, one of readEngines */
+static int imgReadEngine = READ_ENGINE_IO_URING;
+
+void setImgReadAhead(int readAhead, int readEngine)
+{
+    imgReadAhead = readAhead;
+    imgReadEngine = readEngine;
+}
+
+/**
+ * Number of channels to decode the images to: the channels of the geometry, or those of its extractor if it has one.
+ */
+static int imgDecodeChannels(int imgChannels, int extractor)
+{
+    const FeatureExtractor *pExtractor = featureExtractorOf(extractor);
+    return (pExtractor != NULL) ? pExtractor->decodeChannels : imgChannels;
+}
+
+/**
+ * Downsamples a decoded image into the given buffer and frees it, ending the load stage started at loadBegin.
+ * For an extractor geometry, the image is downsampled to the working size of the extractors and the buffer receives its features.
+ * A NULL image is one that could not be decoded.
+ */
+static int downsampleDecodedImg(uint8_t *inputImgData, int inputImgWidth, int inputImgHeight, int imgWidth, int imgHeight, int imgChannels,
+    int extractor, uint8_t* pImgDataBuffer, uint64_t loadBegin)
+{
+    /* NULL on an allocation failure or if the image is corrupt or invalid */
+    if(inputImgData == NULL)
+    {
+        statsStageEnd(STATS_STAGE_LOAD, loadBegin);
+        statsCount(STATS_COUNTER_IMAGES_CORRUPT, 1);
+        return ERROR_LOADING_IMAGE;
+    }
+
+    uint64_t loadTime = statsStageEnd(STATS_STAGE_LOAD, loadBegin);
+    uint64_t resizeBegin = statsStageBegin();
+
+    /* Extractors read the image at their working size, never upsampled, in the channels it was decoded to */
+    const FeatureExtractor *pExtractor = featureExtractorOf(extractor);
+    uint8_t workingImgData[FEATURE_EXTRACTOR_WORKING_SIZE * FEATURE_EXTRACTOR_WORKING_SIZE * STBI_rgb];
+
+    uint8_t *pResizedImgData = pImgDataBuffer;
+    int resizedWidth = imgWidth;
+    int resizedHeight = imgHeight;
+    int resizedChannels = imgChannels;
+
+    if(pExtractor != NULL)
+    {
+        pResizedImgData = workingImgData;
+        resizedWidth = min(inputImgWidth, FEATURE_EXTRACTOR_WORKING_SIZE);
+        resizedHeight = min(inputImgHeight, FEATURE_EXTRACTOR_WORKING_SIZE);
+        resizedChannels = pExtractor->decodeChannels;
+    }
+
+    /* Downsample the image i.e., resize the image to a smaller dimension */
+    /* The box filter only downsamples, images smaller than the target geometry always go through stbir */
+    int resizeRes = 0;
+    if(imgResizeFilter == IMG_RESIZE_FILTER_BOX)
+    {
+        resizeRes = boxDownsampleUint8(inputImgData, inputImgWidth, inputImgHeight, resizedChannels, pResizedImgData, resizedWidth, resizedHeight);
+    }
+
+    if(resizeRes == 0)
+    {
+        resizeRes = stbir_resize_uint8(inputImgData, inputImgWidth, inputImgHeight, 0, pResizedImgData, resizedWidth, resizedHeight, 0, resizedChannels);
+    }
+
+    /* Free the input image data buffer */
+    stbi_image_free(inputImgData);
+
+    uint64_t resizeTime = statsStageEnd(STATS_STAGE_RESIZE, resizeBegin);
+
+    /* Return error code in case of resize error */
+    if(resizeRes == 0)
+    {
+        statsCount(STATS_COUNTER_IMAGES_CORRUPT, 1);
+        return ERROR_RESIZING_IMAGE;
+    }
+
+    uint64_t extractTime = 0;
+    if(pExtractor != NULL)
+    {
+        uint64_t extractBegin = statsStageBegin();
+        pExtractor->extract(workingImgData, resizedWidth, resizedHeight, pImgDataBuffer);
+        extractTime = statsStageEnd(STATS_STAGE_EXTRACT, extractBegin);
+    }
+
+    statsCount(STATS_COUNTER_IMAGES_DECODED, 1);
+    addImgLatency(loadTime + resizeTime + extractTime);
+
+    return NO_ERROR;
+}
+
+int decodeImgDataBuffer(const char *inputImgFilePath, int imgWidth, int imgHeight, int imgChannels, int extractor, uint8_t* pImgDataBuffer)
+{
+    int inputImgWidth = 0;
+    int inputImgHeight = 0;
+    int intputImgChannels;
+
+    uint64_t loadBegin = statsStageBegin();
+
+    /* The file size and modification time key the feature cache, and the size counts the bytes read */
+    struct stat st;
+    const bool cached = featureCacheEnabled();
+    const bool statRes = (cached || statsEnabled()) && stat(inputImgFilePath, &st) == 0;
+
+    /* Skip decoding an unchanged file that was already decoded with the same geometry, features, and downsampler */
+    if(cached && statRes)
+    {
+        if(lookupFeatureCache(inputImgFilePath, &st, imgWidth, imgHeight, imgChannels, extractor, imgResizeFilter, pImgDataBuffer))
+        {
+            statsStageEnd(STATS_STAGE_LOAD, loadBegin);
+            statsCount(STATS_COUNTER_CACHE_HITS, 1);
+            return NO_ERROR;
+        }
+
+        statsCount(STATS_COUNTER_CACHE_MISSES, 1);
+    }
+
+    if(statRes)
+    {
+        statsCount(STATS_COUNTER_BYTES_READ, st.st_size);
+    }
+
+    /* Decode the image file */
+    /* Note that the desired number of channels is the value fixed for the training and prediction image data input */
+    uint8_t *inputImgData = (uint8_t*)stbi_load(inputImgFilePath, &inputImgWidth, &inputImgHeight, &intputImgChannels,
+        imgDecodeChannels(imgChannels, extractor));
+
+    int downsampleRes = downsampleDecodedImg(inputImgData, inputImgWidth, inputImgHeight, imgWidth, imgHeight, imgChannels, extractor,
+        pImgDataBuffer, loadBegin);
+
+    if(downsampleRes == NO_ERROR && cached && statRes)
+    {
+        insertFeatureCache(inputImgFilePath, &st, imgWidth, imgHeight, imgChannels, extractor, imgResizeFilter, pImgDataBuffer);
+    }
+
+    return downsampleRes;
+}
+
+int decodeImgDataBufferFromMemory(const uint8_t *pEncodedImgData, size_t encodedImgSize, int imgWidth, int imgHeight, int imgChannels,
+    int extractor, uint8_t* pImgDataBuffer)
+{
+    int inputImgWidth = 0;
+    int inputImgHeight = 0;
+    int intputImgChannels;
+
+    uint64_t loadBegin = statsStageBegin();
+    statsCount(STATS_COUNTER_BYTES_READ, encodedImgSize);
+
+    /* stb_image takes the encoded size as an int */
+    uint8_t *inputImgData = NULL;
+    if(encodedImgSize <= INT_MAX)
+    {
+        inputImgData = (uint8_t*)stbi_load_from_memory(pEncodedImgData, (int)encodedImgSize, &inputImgWidth, &inputImgHeight,
+            &intputImgChannels, imgDecodeChannels(imgChannels, extractor));
+    }
+
+    return downsampleDecodedImg(inputImgData, inputImgWidth, inputImgHeight, imgWidth, imgHeight, imgChannels, extractor, pImgDataBuffer,
+        loadBegin);
+}
+
+void printImgDecodeError(const char *inputImgFilePath, int imgDecodeRes)
+{
+    if(imgDecodeRes == ERROR_LOADING_IMAGE)
+    {
+        std::cout << "Error: allocation failure of image file is corrupt or invalid: " << inputImgFilePath << endl;
+    }
+}
+
+int createImgDataBuffer(const char *inputImgFilePath, int imgWidth, int imgHeight, int imgChannels, int extractor, uint8_t* pImgDataBuffer)
+{
+    int imgDecodeRes = decodeImgDataBuffer(inputImgFilePath, imgWidth, imgHeight, imgChannels, extractor, pImgDataBuffer);
+    printImgDecodeError(inputImgFilePath, imgDecodeRes);
+
+    return imgDecodeRes;
+}
+
+int listImgFiles(string inputImgDirPath, vector<string> *pImgFileNameVector)
+{
+    DIR *dir;
+    struct dirent *ent;
+
+    uint64_t listBegin = statsStageBegin();
+
+    if((dir = opendir(inputImgDirPath.c_str())) == NULL)
+    {
+        /* Could not open directory */
+        return ERROR_OPENING_DIR;
+    }
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        /* Only process regular image files */
+        /* Some filesystems do not report the file type in the directory entries, stat those */
+        struct stat st;
+        if(ent->d_type == DT_REG
+            || (ent->d_type == DT_UNKNOWN && fstatat(dirfd(dir), ent->d_name, &st, 0) == 0 && S_ISREG(st.st_mode)))
+        {
+            pImgFileNameVector->push_back(ent->d_name);
+        }
+    }
+
+    /* Close opened directory */
+    closedir(dir);
+
+    statsStageEnd(STATS_STAGE_LIST, listBegin);
+
+    return NO_ERROR;
+}
+
+/**
+ * Decodes the image files of the given paths into the batch, either each one read by its decoder or all of them read
+ * ahead of the decoders by the read-ahead stage.
+ */
+static void decodeImgFiles(const vector<string> &imgFilePathVector, int imgWidth, int imgHeight, int imgChannels, int extractor,
+    int workerCount, ImgBatch *pImgBatch)
+{
+    if(imgReadAhead <= 0)
+    {
+        /* Each worker claims the next file to decode and writes into that file's own slot */
+        parallelFor(imgFilePathVector.size(), workerCount, [&](size_t i)
+        {
+            pImgBatch->imgDecodeResVector[i] = decodeImgDataBuffer(imgFilePathVector[i].c_str(), imgWidth, imgHeight, imgChannels, extractor,
+                pImgBatch->imgDataBuffers.data() + i * pImgBatch->imgSize);
+        });
+
+        return;
+    }
+
+    const bool cached = featureCacheEnabled();
+
+    /* Unchanged files that were already decoded with the same geometry, features, and downsampler are not even read */
+    auto skip = [&](size_t i, const struct stat *pSt)
+    {
+        if(!cached)
+        {
+            return false;
+        }
+
+        uint64_t loadBegin = statsStageBegin();
+        if(lookupFeatureCache(imgFilePathVector[i].c_str(), pSt, imgWidth, imgHeight, imgChannels, extractor, imgResizeFilter,
+            pImgBatch->imgDataBuffers.data() + i * pImgBatch->imgSize))
+        {
+            statsStageEnd(STATS_STAGE_LOAD, loadBegin);
+            statsCount(STATS_COUNTER_CACHE_HITS, 1);
+            return true;
+        }
+
+        statsCount(STATS_COUNTER_CACHE_MISSES, 1);
+        return false;
+    };
+
+    /* Each decoder takes the next file that was read and writes into that file's own slot */
+    auto decode = [&](ReadFile *pFile)
+    {
+        const size_t i = pFile->index;
+        uint8_t *pImgDataBuffer = pImgBatch->imgDataBuffers.data() + i * pImgBatch->imgSize;
+
+        if(pFile->readRes != NO_ERROR)
+        {
+            statsCount(STATS_COUNTER_IMAGES_CORRUPT, 1);
+            pImgBatch->imgDecodeResVector[i] = ERROR_LOADING_IMAGE;
+            return;
+        }
+
+        pImgBatch->imgDecodeResVector[i] = decodeImgDataBufferFromMemory(pFile->data.data(), pFile->data.size(), imgWidth, imgHeight,
+            imgChannels, extractor, pImgDataBuffer);
+
+        if(pImgBatch->imgDecodeResVector[i] == NO_ERROR && cached)
+        {
+            insertFeatureCache(imgFilePathVector[i].c_str(), &pFile->st, imgWidth, imgHeight, imgChannels, extractor, imgResizeFilter,
+                pImgDataBuffer);
+        }
+    };
+
+    readFilesAhead(imgFilePathVector, imgReadEngine, imgReadAhead, workerCount, skip, decode);
+}
+
+int ingestImgDir(string inputImgDirPath, int imgWidth, int imgHeight, int imgChannels, int extractor, int workerCount, ImgBatch *pImgBatch)
+{
+    pImgBatch->imgSize = imgWidth * imgHeight * imgChannels;
+    pImgBatch->imgSourceKind = IMG_SOURCE_DIR;
+    pImgBatch->imgSourcePath = inputImgDirPath;
+    pImgBatch->imgFileNameVector.clear();
+
+    /* List the files first so that the decoded images keep the directory listing order */
+    int listRes = listImgFiles(inputImgDirPath, &pImgBatch->imgFileNameVector);
+    if(listRes != NO_ERROR)
+    {
+        return listRes;
+    }
+
+    const size_t imgCount = pImgBatch->imgFileNameVector.size();
+    pImgBatch->imgDecodeResVector.assign(imgCount, NO_ERROR);
+    pImgBatch->imgDataBuffers.assign(imgCount * pImgBatch->imgSize, 0);
+
+    vector<string> imgFilePathVector(imgCount);
+    for(size_t i = 0; i < imgCount; i++)
+    {
+        imgFilePathVector[i] = inputImgDirPath + "/" + pImgBatch->imgFileNameVector[i];
+    }
+
+    decodeImgFiles(imgFilePathVector, imgWidth, imgHeight, imgChannels, extractor, workerCount, pImgBatch);
+
+    return NO_ERROR;
+}
+
+int listImgFilesFromStream(istream &stream, vector<string> *pImgFilePathVector)
+{
+    uint64_t listBegin = statsStageBegin();
+
+    string line;
+    while(getline(stream, line))
+    {
+        /* Tolerate lists written with CRLF line endings */
+        if(!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if(!line.empty())
+        {
+            pImgFilePathVector->push_back(line);
+        }
+    }
+
+    statsStageEnd(STATS_STAGE_LIST, listBegin);
+
+    return stream.bad() ? ERROR_OPENING_DIR : NO_ERROR;
+}
+
+int ingestImgTar(string tarFilePath, int imgWidth, int imgHeight, int imgChannels, int extractor, int workerCount, ImgBatch *pImgBatch)
+{
+    pImgBatch->imgSize = imgWidth * imgHeight * imgChannels;
+    pImgBatch->imgSourceKind = IMG_SOURCE_TAR;
+    pImgBatch->imgSourcePath = tarFilePath;
+    pImgBatch->imgFileNameVector.clear();
+
+    /* Index the whole archive first so that the decoded images keep the archive order */
+    uint64_t listBegin = statsStageBegin();
+
+    TarArchiveMap tarArchiveMap;
+    vector<TarEntry> tarEntries;
+    int mapRes = mapTarArchive(tarFilePath, &tarArchiveMap, &tarEntries);
+
+    statsStageEnd(STATS_STAGE_LIST, listBegin);
+
+    if(mapRes != NO_ERROR)
+    {
+        return mapRes;
+    }
+
+    const size_t imgCount = tarEntries.size();
+    pImgBatch->imgDecodeResVector.assign(imgCount, NO_ERROR);
+    pImgBatch->imgDataBuffers.assign(imgCount * pImgBatch->imgSize, 0);
+
+    for(const TarEntry &tarEntry : tarEntries)
+    {
+        pImgBatch->imgFileNameVector.push_back(tarEntry.name);
+    }
+
+    /* Each worker claims the next entry and decodes it in place, inside the mapped archive */
+    parallelFor(imgCount, workerCount, [&](size_t i)
+    {
+        pImgBatch->imgDecodeResVector[i] = decodeImgDataBufferFromMemory(tarEntryData(&tarArchiveMap, &tarEntries[i]), tarEntries[i].size,
+            imgWidth, imgHeight, imgChannels, extractor, pImgBatch->imgDataBuffers.data() + i * pImgBatch->imgSize);
+    });
+
+    unmapTarArchive(&tarArchiveMap);
+
+    return NO_ERROR;
+}
+
+int ingestImgList(const vector<string> &imgFilePathVector, int imgWidth, int imgHeight, int imgChannels, int extractor,
+    int workerCount, ImgBatch *pImgBatch)
+{
+    pImgBatch->imgSize = imgWidth * imgHeight * imgChannels;
+    pImgBatch->imgSourceKind = IMG_SOURCE_LIST;
+    pImgBatch->imgSourcePath = "";
+    pImgBatch->imgFileNameVector = imgFilePathVector;
+
+    const size_t imgCount = pImgBatch->imgFileNameVector.size();
+    pImgBatch->imgDecodeResVector.assign(imgCount, NO_ERROR);
+    pImgBatch->imgDataBuffers.assign(imgCount * pImgBatch->imgSize, 0);
+
+    /* The listed paths are decoded as given, a path that is not a readable image is reported as a decode error */
+    decodeImgFiles(pImgBatch->imgFileNameVector, imgWidth, imgHeight, imgChannels, extractor, workerCount, pImgBatch);
+
+    return NO_ERROR;
+}
+
+int imgSourceKindOf(string imgSourcePath)
+{
+    if(imgSourcePath == IMG_SOURCE_STDIN)
+    {
+        return IMG_SOURCE_LIST;
+    }
+
+    struct stat st;
+    if(stat(imgSourcePath.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        return IMG_SOURCE_TAR;
+    }
+
+    return IMG_SOURCE_DIR;
+}
+
+int ingestImgSource(string imgSourcePath, int imgWidth, int imgHeight, int imgChannels, int extractor, int workerCount, ImgBatch *pImgBatch)
+{
+    switch(imgSourceKindOf(imgSourcePath))
+    {
+        case IMG_SOURCE_LIST:
+        {
+            vector<string> imgFilePathVector;
+            int listRes = listImgFilesFromStream(cin, &imgFilePathVector);
+            if(listRes != NO_ERROR)
+            {
+                return listRes;
+            }
+
+            return ingestImgList(imgFilePathVector, imgWidth, imgHeight, imgChannels, extractor, workerCount, pImgBatch);
+        }
+        case IMG_SOURCE_TAR:
+            return ingestImgTar(imgSourcePath, imgWidth, imgHeight, imgChannels, extractor, workerCount, pImgBatch);
+        default:
+            return ingestImgDir(imgSourcePath, imgWidth, imgHeight, imgChannels, extractor, workerCount, pImgBatch);
+    }
+}
+
+string imgBatchFilePath(const ImgBatch *pImgBatch, size_t i)
+{
+    switch(pImgBatch->imgSourceKind)
+    {
+        case IMG_SOURCE_LIST:
+            return pImgBatch->imgFileNameVector[i];
+        case IMG_SOURCE_TAR:
+            return pImgBatch->imgSourcePath + ":" + pImgBatch->imgFileNameVector[i];
+        default:
+            return pImgBatch->imgSourcePath + "/" + pImgBatch->imgFileNameVector[i];
+    }
+}
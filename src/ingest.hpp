@@ -0,0 +1,143 @@
+/**
+ * Image ingestion stage.
+ *
+ * Lists the regular files of an image directory and decodes and downsamples them into training or prediction
+ * image data buffers. Decoding can be spread over a pool of worker threads, the results are always returned
+ * in directory listing order so that the output is identical to a serial run.
+ *
+ * The images can also come from a tar archive, whose entries are decoded in memory straight out of the mapped
+ * archive, or from a newline-delimited list of image file paths read from stdin. Neither walks a directory.
+ *
+ * The files of a directory or of a list can also be read ahead of the decoders by the read-ahead stage, with many
+ * reads in flight on io_uring or on a pool of reader threads, and decoded from memory. See read_ahead.hpp.
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <istream>
+
+/* Sources of the images to ingest */
+typedef enum _img_source_kind {
+    IMG_SOURCE_DIR  = 0, /* The regular files of a directory */
+    IMG_SOURCE_LIST = 1, /* The image file paths listed on stdin, one per line */
+    IMG_SOURCE_TAR  = 2  /* The regular file entries of a tar archive */
+} imgSourceKind;
+
+/* Source argument selecting the list of image file paths read from stdin */
+#define IMG_SOURCE_STDIN                                                                            "-"
+
+/* The downsampled images of a source, in listing order */
+typedef struct _img_batch {
+    int imgSize;                                /* Size of a single downsampled image data buffer */
+    int imgSourceKind;                          /* Kind of source the images were read from, one of imgSourceKind */
+    std::string imgSourcePath;                  /* Directory or archive path, empty for a list */
+    std::vector<std::string> imgFileNameVector; /* File names in the directory, paths as listed, or entry names in the archive */
+    std::vector<int> imgDecodeResVector;        /* Error code returned when decoding each file */
+    std::vector<uint8_t> imgDataBuffers;        /* Downsampled image data buffers, imgSize bytes per file */
+} ImgBatch;
+
+/**
+ * Selects the downsampler of the decoded images, one of imgResizeFilters. Defaults to IMG_RESIZE_FILTER_STB.
+ * Must be called before any image is decoded.
+ */
+void setImgResizeFilter(int resizeFilter);
+
+/**
+ * Reads the image files of directories and lists with the read-ahead stage, keeping up to readAhead reads in flight
+ * on the given engine, one of readEngines. Defaults to 0 i.e., each decoder reads its own files.
+ * Must be called before any image is decoded.
+ */
+void setImgReadAhead(int readAhead, int readEngine);
+
+/**
+ * Decodes the image file and downsamples it into the given buffer, without printing anything.
+ * With an extractor, one of featureExtractors other than the pixels, the buffer receives the features of the image instead.
+ * Unchanged files are read from the feature cache instead, if it is enabled.
+ */
+int decodeImgDataBuffer(const char *inputImgFilePath, int imgWidth, int imgHeight, int imgChannels, int extractor, uint8_t* pImgDataBuffer);
+
+/**
+ * Decodes an encoded image held in memory and downsamples it into the given buffer, without printing anything.
+ * The feature cache is not used.
+ */
+int decodeImgDataBufferFromMemory(const uint8_t *pEncodedImgData, size_t encodedImgSize, int imgWidth, int imgHeight, int imgChannels,
+    int extractor, uint8_t* pImgDataBuffer);
+
+/**
+ * Prints the error message of a failed image decode, if any.
+ */
+void printImgDecodeError(const char *inputImgFilePath, int imgDecodeRes);
+
+/**
+ * Decodes the image file and downsamples it into the given buffer.
+ * Prints an error message if the image file could not be decoded.
+ */
+int createImgDataBuffer(const char *inputImgFilePath, int imgWidth, int imgHeight, int imgChannels, int extractor, uint8_t* pImgDataBuffer);
+
+/**
+ * Lists the regular files of the given directory in directory listing order.
+ */
+int listImgFiles(std::string inputImgDirPath, std::vector<std::string> *pImgFileNameVector);
+
+/**
+ * Decodes and downsamples all the regular files of the given directory.
+ * A worker count of 1 decodes serially, a worker count of 0 uses one worker per available core.
+ * Decode errors are reported per file in the batch and are left to the caller to print, in directory listing order.
+ */
+int ingestImgDir(std::string inputImgDirPath, int imgWidth, int imgHeight, int imgChannels, int extractor, int workerCount, ImgBatch *pImgBatch);
+
+/**
+ * Reads the image file paths listed one per line on the given stream, skipping empty lines.
+ */
+int listImgFilesFromStream(std::istream &stream, std::vector<std::string> *pImgFilePathVector);
+
+/**
+ * Decodes and downsamples all the regular file entries of the given tar archive, in archive order.
+ * The archive is opened once and mapped, the entries are decoded from memory.
+ */
+int ingestImgTar(std::string tarFilePath, int imgWidth, int imgHeight, int imgChannels, int extractor, int workerCount, ImgBatch *pImgBatch);
+
+/**
+ * Decodes and downsamples all the image files of the given paths, in the given order.
+ */
+int ingestImgList(const std::vector<std::string> &imgFilePathVector, int imgWidth, int imgHeight, int imgChannels, int extractor,
+    int workerCount, ImgBatch *pImgBatch);
+
+/**
+ * Kind of the given image source: IMG_SOURCE_STDIN for a list read from stdin, a regular file for a tar archive,
+ * and a directory otherwise.
+ */
+int imgSourceKindOf(std::string imgSourcePath);
+
+/**
+ * Decodes and downsamples all the images of the given source, whatever its kind.
+ */
+int ingestImgSource(std::string imgSourcePath, int imgWidth, int imgHeight, int imgChannels, int extractor, int workerCount, ImgBatch *pImgBatch);
+
+/**
+ * Path of the i-th file of the batch, as printed in messages. Entries of an archive are given as <archive>:<entry>.
+ */
+std::string imgBatchFilePath(const ImgBatch *pImgBatch, size_t i);
+
+/**
+ * File name of an image file path, i.e. without its directories.
+ */
+inline std::string imgFileBaseName(const std::string &imgFilePath)
+{
+    size_t slash = imgFilePath.find_last_of('/');
+    return (slash == std::string::npos) ? imgFilePath : imgFilePath.substr(slash + 1);
+}
+
+/**
+ * Pointer to the downsampled image data buffer of the i-th file of the batch.
+ */
+inline const uint8_t* imgBatchDataBuffer(const ImgBatch *pImgBatch, size_t i)
+{
+    return pImgBatch->imgDataBuffers.data() + i * pImgBatch->imgSize;
+}
+
+#endif
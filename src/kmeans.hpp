@@ -0,0 +1,1030 @@
+/**
+ * Parallel K-Means training engine.
+ *
+ * A multithreaded implementation of the Lloyd algorithm with k-means++ or k-means|| seeding.
+ * The training points are split into a fixed number of partitions that does not depend on the thread count.
+ * Each partition accumulates its own centroid sums and the partition sums are reduced in partition order, so
+ * that a given seed always produces bit-identical centroids whatever the number of threads.
+ */
+
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <vector>
+#include <tuple>
+#include <limits>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.hpp"
+#include "distance.hpp"
+#include "feature_matrix.hpp"
+
+/**
+ * Number of point partitions used to spread the work over threads.
+ * Fixed so that the summation order, and thus the result, does not depend on the thread count.
+ */
+#define KMEANS_PARTITION_COUNT                                                                        64
+
+/**
+ * Relative safety margin of the triangle inequality bound checks.
+ * Large enough to absorb the rounding of single precision distances so that pruning never changes an assignment.
+ */
+#define KMEANS_BOUND_TOLERANCE                                                                        1e-4f
+
+/**
+ * Number of restarts run concurrently when restarts can be abandoned.
+ * Fixed so that which restarts a restart is compared to, and thus the result, does not depend on the thread count.
+ */
+#define KMEANS_RESTART_ROUND_SIZE                                                                      4
+
+/**
+ * Number of sampling rounds of the k-means|| initialization.
+ * A handful of rounds is enough in practice, each one samples about oversampling * k candidates.
+ */
+#define KMEANS_PARALLEL_INIT_ROUNDS                                                                    5
+
+/* Initializations of the Lloyd engines */
+typedef enum _kmeans_init {
+    KMEANS_INIT_PLUS_PLUS = 0, /* k-means++: k passes over the points, one per seed */
+    KMEANS_INIT_PARALLEL  = 1  /* k-means||: a few oversampling passes, then k-means++ over the weighted candidates */
+} kmeansInit;
+
+typedef struct _kmeans_params {
+    uint32_t k;              /* Number of clusters */
+    uint64_t seed;           /* Seed of the k-means++ initialization */
+    int threadCount;         /* Number of threads, 0 for one per available core */
+    uint64_t maxIterations;  /* Maximum number of Lloyd iterations, 0 to iterate until convergence (number of mini-batches for the mini-batch engine) */
+    uint64_t batchSize;      /* Number of points per mini-batch, mini-batch engine only */
+    uint64_t abandonAfter;   /* Lloyd iteration after which a run whose inertia is above abandonInertia stops, 0 to never abandon */
+    double abandonInertia;   /* Inertia a run must be below after abandonAfter iterations to carry on */
+    int init;                /* Initialization of the Lloyd engines, one of kmeansInit */
+    float oversampling;      /* Candidates sampled per round of the k-means|| initialization, as a multiple of k */
+} KmeansParams;
+
+typedef struct _kmeans_stats {
+    uint64_t iterations;     /* Number of Lloyd iterations run */
+    double inertia;          /* Sum of the squared distances from each point to its centroid */
+    uint64_t distanceEvaluations;        /* Number of point to centroid and centroid to centroid distances computed */
+    uint64_t skippedDistanceEvaluations; /* Number of point to centroid distances a plain Lloyd engine would have computed on top */
+    bool abandoned;          /* Whether or not the run was abandoned, the inertia is then the one it was abandoned with */
+} KmeansStats;
+
+/**
+ * Squared Euclidean distance between two points, using the vectorized kernel.
+ */
+template <size_t N>
+inline float distanceSquared(const std::array<float, N>& a, const std::array<float, N>& b)
+{
+    return distanceSquaredSimd(a.data(), b.data(), N);
+}
+
+/**
+ * Index of the centroid closest to the given point.
+ * Optionally returns the squared distance to that centroid.
+ */
+template <size_t N>
+inline uint32_t closestCentroid(const std::array<float, N>& point, const std::vector<std::array<float, N>>& centroids, float *pDistance = NULL)
+{
+    float bestDistance = std::numeric_limits<float>::max();
+    uint32_t bestIndex = 0;
+
+    for(size_t c = 0; c < centroids.size(); c++)
+    {
+        float d = distanceSquared<N>(point, centroids[c]);
+        if(d < bestDistance)
+        {
+            bestDistance = d;
+            bestIndex = (uint32_t)c;
+        }
+    }
+
+    if(pDistance != NULL)
+    {
+        *pDistance = bestDistance;
+    }
+
+    return bestIndex;
+}
+
+/**
+ * First and one past last point index of a partition.
+ */
+inline void kmeansPartitionRange(size_t pointCount, size_t partitionCount, size_t partition, size_t *pBegin, size_t *pEnd)
+{
+    *pBegin = partition * pointCount / partitionCount;
+    *pEnd = (partition + 1) * pointCount / partitionCount;
+}
+
+/**
+ * Number of partitions to use for the given number of points.
+ */
+inline size_t kmeansPartitionCount(size_t pointCount)
+{
+    return std::max<size_t>(1, std::min<size_t>(KMEANS_PARTITION_COUNT, pointCount));
+}
+
+/**
+ * SplitMix64 finalizer, turns consecutive integers into well mixed 64-bit values.
+ */
+inline uint64_t kmeansMix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Uniform draw in [0, 1) of a point in a round, a pure function of its arguments so that the points can be drawn
+ * in any order, on any thread.
+ */
+inline double kmeansPointUniform(uint64_t seed, uint64_t round, uint64_t point)
+{
+    uint64_t z = kmeansMix64(kmeansMix64(seed + (round + 1) * 0x9e3779b97f4a7c15ULL) + point * 0x9e3779b97f4a7c15ULL);
+    return (double)(z >> 11) / 9007199254740992.0;
+}
+
+/**
+ * K-means++ initialization.
+ * The distances to the nearest chosen centroid are updated in parallel, the random draws are serial.
+ */
+template <size_t N>
+std::vector<std::array<float, N>> seedKmeansPlusPlus(const FeatureMatrix<N>& data, uint32_t k, uint64_t seed, int threadCount)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<std::array<float, N>> centroids;
+    centroids.reserve(k);
+
+    /* The first centroid is picked uniformly at random */
+    std::uniform_int_distribution<size_t> uniform(0, data.size() - 1);
+    centroids.push_back(data[uniform(rng)]);
+
+    /* Squared distance from each point to its nearest chosen centroid */
+    std::vector<float> distances(data.size(), std::numeric_limits<float>::max());
+    const size_t partitionCount = kmeansPartitionCount(data.size());
+
+    while(centroids.size() < k)
+    {
+        const std::array<float, N>& lastCentroid = centroids.back();
+
+        parallelFor(partitionCount, threadCount, [&](size_t p)
+        {
+            size_t begin, end;
+            kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+            for(size_t i = begin; i < end; i++)
+            {
+                distances[i] = std::min(distances[i], distanceSquared<N>(data[i], lastCentroid));
+            }
+        });
+
+        /* The next centroid is picked with a probability proportional to its squared distance */
+        /* Fall back to a uniform pick when all the points coincide with the chosen centroids */
+        double totalDistance = 0;
+        for(float d : distances)
+        {
+            totalDistance += d;
+        }
+
+        if(totalDistance > 0)
+        {
+            std::discrete_distribution<size_t> weighted(distances.begin(), distances.end());
+            centroids.push_back(data[weighted(rng)]);
+        }
+        else
+        {
+            centroids.push_back(data[uniform(rng)]);
+        }
+    }
+
+    return centroids;
+}
+
+/**
+ * K-means|| initialization (Bahmani et al., Scalable K-Means++).
+ *
+ * Instead of one pass over the points per seed, each of KMEANS_PARALLEL_INIT_ROUNDS passes keeps every point as a
+ * candidate with a probability proportional to its squared distance to the nearest candidate, about
+ * oversampling * k candidates per round. Each candidate is then weighted by the number of points it is the nearest
+ * candidate of, and k-means++ picks the k seeds among the weighted candidates.
+ *
+ * The draws of every point only depend on the seed, the round, and the point index, and the candidates are appended in
+ * point order, so the seeds do not depend on the number of threads.
+ */
+template <size_t N>
+std::vector<std::array<float, N>> seedKmeansParallel(const FeatureMatrix<N>& data, uint32_t k, uint64_t seed, int threadCount,
+    float oversampling)
+{
+    const size_t partitionCount = kmeansPartitionCount(data.size());
+    const double candidatesPerRound = (double)oversampling * k;
+
+    std::mt19937_64 rng(seed);
+    std::vector<std::array<float, N>> candidates;
+
+    /* The first candidate is picked uniformly at random */
+    std::uniform_int_distribution<size_t> uniform(0, data.size() - 1);
+    candidates.push_back(data[uniform(rng)]);
+
+    /* Squared distance from each point to its nearest candidate, and that candidate */
+    std::vector<float> distances(data.size(), std::numeric_limits<float>::max());
+    std::vector<uint32_t> nearest(data.size(), 0);
+    std::vector<double> partitionCosts(partitionCount);
+    std::vector<std::vector<size_t>> partitionPicks(partitionCount);
+
+    /* Updates the distances with the candidates added since firstCandidate and returns their sum */
+    auto updateDistances = [&](size_t firstCandidate)
+    {
+        parallelFor(partitionCount, threadCount, [&](size_t p)
+        {
+            size_t begin, end;
+            kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+            double cost = 0;
+            for(size_t i = begin; i < end; i++)
+            {
+                for(size_t c = firstCandidate; c < candidates.size(); c++)
+                {
+                    float d = distanceSquared<N>(data[i], candidates[c]);
+                    if(d < distances[i])
+                    {
+                        distances[i] = d;
+                        nearest[i] = (uint32_t)c;
+                    }
+                }
+                cost += distances[i];
+            }
+            partitionCosts[p] = cost;
+        });
+
+        double cost = 0;
+        for(double partitionCost : partitionCosts)
+        {
+            cost += partitionCost;
+        }
+        return cost;
+    };
+
+    double cost = updateDistances(0);
+
+    for(uint32_t round = 0; round < KMEANS_PARALLEL_INIT_ROUNDS && cost > 0; round++)
+    {
+        /* Every point is drawn independently, the picks are collected per partition */
+        parallelFor(partitionCount, threadCount, [&](size_t p)
+        {
+            size_t begin, end;
+            kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+            partitionPicks[p].clear();
+            for(size_t i = begin; i < end; i++)
+            {
+                if(kmeansPointUniform(seed, round, i) < candidatesPerRound * distances[i] / cost)
+                {
+                    partitionPicks[p].push_back(i);
+                }
+            }
+        });
+
+        /* Appended in partition order, i.e. in point order */
+        const size_t firstCandidate = candidates.size();
+        for(const std::vector<size_t>& picks : partitionPicks)
+        {
+            for(size_t i : picks)
+            {
+                candidates.push_back(data[i]);
+            }
+        }
+
+        if(candidates.size() > firstCandidate)
+        {
+            cost = updateDistances(firstCandidate);
+        }
+    }
+
+    /* Too few distinct points were sampled to pick k seeds among them */
+    if(candidates.size() < k)
+    {
+        return seedKmeansPlusPlus<N>(data, k, seed, threadCount);
+    }
+
+    /* Weight of each candidate: the number of points it is the nearest candidate of, reduced in partition order */
+    const size_t candidateCount = candidates.size();
+    std::vector<uint64_t> partitionWeights(partitionCount * candidateCount, 0);
+
+    parallelFor(partitionCount, threadCount, [&](size_t p)
+    {
+        size_t begin, end;
+        kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+        for(size_t i = begin; i < end; i++)
+        {
+            partitionWeights[p * candidateCount + nearest[i]]++;
+        }
+    });
+
+    std::vector<double> weights(candidateCount, 0.0);
+    for(size_t p = 0; p < partitionCount; p++)
+    {
+        for(size_t c = 0; c < candidateCount; c++)
+        {
+            weights[c] += (double)partitionWeights[p * candidateCount + c];
+        }
+    }
+
+    /* Weighted k-means++ over the candidates, the first seed is picked proportionally to the weights */
+    std::vector<std::array<float, N>> centroids;
+    centroids.reserve(k);
+
+    std::discrete_distribution<size_t> weightedFirst(weights.begin(), weights.end());
+    centroids.push_back(candidates[weightedFirst(rng)]);
+
+    std::vector<double> candidateDistances(candidateCount, std::numeric_limits<double>::max());
+    std::vector<double> probabilities(candidateCount);
+    const size_t candidatePartitionCount = kmeansPartitionCount(candidateCount);
+    std::uniform_int_distribution<size_t> uniformCandidate(0, candidateCount - 1);
+
+    while(centroids.size() < k)
+    {
+        const std::array<float, N>& lastCentroid = centroids.back();
+
+        parallelFor(candidatePartitionCount, threadCount, [&](size_t p)
+        {
+            size_t begin, end;
+            kmeansPartitionRange(candidateCount, candidatePartitionCount, p, &begin, &end);
+
+            for(size_t c = begin; c < end; c++)
+            {
+                candidateDistances[c] = std::min(candidateDistances[c], (double)distanceSquared<N>(candidates[c], lastCentroid));
+                probabilities[c] = weights[c] * candidateDistances[c];
+            }
+        });
+
+        /* Fall back to a uniform pick when all the candidates coincide with the chosen centroids */
+        double totalProbability = 0;
+        for(double probability : probabilities)
+        {
+            totalProbability += probability;
+        }
+
+        if(totalProbability > 0)
+        {
+            std::discrete_distribution<size_t> weighted(probabilities.begin(), probabilities.end());
+            centroids.push_back(candidates[weighted(rng)]);
+        }
+        else
+        {
+            centroids.push_back(candidates[uniformCandidate(rng)]);
+        }
+    }
+
+    return centroids;
+}
+
+/**
+ * Seeds of a Lloyd run with the initialization selected in the parameters.
+ */
+template <size_t N>
+std::vector<std::array<float, N>> seedKmeans(const FeatureMatrix<N>& data, const KmeansParams *pParams)
+{
+    if(pParams->init == KMEANS_INIT_PARALLEL)
+    {
+        return seedKmeansParallel<N>(data, pParams->k, pParams->seed, pParams->threadCount, pParams->oversampling);
+    }
+
+    return seedKmeansPlusPlus<N>(data, pParams->k, pParams->seed, pParams->threadCount);
+}
+
+/**
+ * Half distances between every pair of centroids, used to skip the distance evaluations that cannot
+ * change the closest centroid of a point (triangle inequality).
+ */
+typedef struct _centroid_distance_table {
+    uint32_t k;                      /* Number of centroids */
+    std::vector<float> halfDistances; /* k * k half distances, halfDistances[a * k + b] = d(a, b) / 2 */
+} CentroidDistanceTable;
+
+/**
+ * Updates the row and column of a centroid in the distance table after it moved.
+ */
+template <size_t N>
+void updateCentroidDistanceTable(const std::vector<std::array<float, N>>& centroids, uint32_t c, CentroidDistanceTable *pTable)
+{
+    const uint32_t k = pTable->k;
+    for(uint32_t other = 0; other < k; other++)
+    {
+        float half = (other == c) ? 0.0f : 0.5f * std::sqrt(distanceSquared<N>(centroids[c], centroids[other]));
+        pTable->halfDistances[c * k + other] = half;
+        pTable->halfDistances[other * k + c] = half;
+    }
+}
+
+/**
+ * Builds the distance table of the given centroids.
+ */
+template <size_t N>
+void buildCentroidDistanceTable(const std::vector<std::array<float, N>>& centroids, CentroidDistanceTable *pTable)
+{
+    pTable->k = (uint32_t)centroids.size();
+    pTable->halfDistances.assign((size_t)pTable->k * pTable->k, 0.0f);
+
+    for(uint32_t c = 0; c < pTable->k; c++)
+    {
+        updateCentroidDistanceTable<N>(centroids, c, pTable);
+    }
+}
+
+/**
+ * Same as closestCentroid, but skips the centroids that are at least twice as far from the current best
+ * centroid as the point is: they cannot be closer than the current best. The result is identical to closestCentroid,
+ * a safety margin of KMEANS_BOUND_TOLERANCE absorbs the rounding of the single precision distances.
+ * Optionally adds the number of distance evaluations run and skipped to the given counters.
+ */
+template <size_t N>
+inline uint32_t closestCentroidPruned(const std::array<float, N>& point, const std::vector<std::array<float, N>>& centroids,
+    const CentroidDistanceTable *pTable, float *pDistance = NULL, uint64_t *pEvaluated = NULL, uint64_t *pSkipped = NULL)
+{
+    const uint32_t k = pTable->k;
+
+    float bestDistance = distanceSquared<N>(point, centroids[0]);
+    float bestRoot = std::sqrt(bestDistance);
+    uint32_t bestIndex = 0;
+    uint64_t evaluated = 1;
+
+    for(uint32_t c = 1; c < k; c++)
+    {
+        /* d(x, c) >= d(best, c) - d(x, best) >= d(x, best) */
+        if(pTable->halfDistances[bestIndex * k + c] * (1.0f - KMEANS_BOUND_TOLERANCE) > bestRoot)
+        {
+            continue;
+        }
+
+        float d = distanceSquared<N>(point, centroids[c]);
+        evaluated++;
+        if(d < bestDistance)
+        {
+            bestDistance = d;
+            bestRoot = std::sqrt(d);
+            bestIndex = c;
+        }
+    }
+
+    if(pDistance != NULL)
+    {
+        *pDistance = bestDistance;
+    }
+
+    if(pEvaluated != NULL)
+    {
+        *pEvaluated += evaluated;
+        *pSkipped += k - evaluated;
+    }
+
+    return bestIndex;
+}
+
+/**
+ * Lloyd iterations shared by the Lloyd and Hamerly engines.
+ *
+ * With useBounds, each point keeps an upper bound on the distance to its centroid and a lower bound on the distance
+ * to its second closest centroid (Hamerly, 2010). The bounds are moved by how far the centroids drifted after each
+ * update, and a point whose upper bound is below both its lower bound and half the distance from its centroid to the
+ * nearest other centroid keeps its centroid without any distance evaluation. Bound checks keep a margin of
+ * KMEANS_BOUND_TOLERANCE and points that are not skipped are assigned with the same scan as the plain engine,
+ * so both produce the same assignments and centroids.
+ *
+ * The iterations start from the first k of the given seeds, or from the initialization selected in the parameters when pSeeds is NULL.
+ *
+ * With abandonAfter, the inertia is computed once after that many iterations and the run stops there if it is above
+ * abandonInertia.
+ */
+template <size_t N>
+std::tuple<std::vector<std::array<float, N>>, std::vector<uint32_t>> kmeansLloydRun(const FeatureMatrix<N>& data,
+    const KmeansParams *pParams, bool useBounds, KmeansStats *pStats, const std::vector<std::array<float, N>> *pSeeds = NULL)
+{
+    const uint32_t k = pParams->k;
+    const size_t partitionCount = kmeansPartitionCount(data.size());
+
+    std::vector<std::array<float, N>> centroids = (pSeeds != NULL)
+        ? std::vector<std::array<float, N>>(pSeeds->begin(), pSeeds->begin() + k)
+        : seedKmeans<N>(data, pParams);
+    std::vector<uint32_t> clusters(data.size(), std::numeric_limits<uint32_t>::max());
+
+    /* Per partition centroid sums, point counts, and number of points that changed cluster */
+    std::vector<double> partitionSums(partitionCount * k * N);
+    std::vector<uint64_t> partitionCounts(partitionCount * k);
+    std::vector<uint64_t> partitionChanges(partitionCount);
+
+    /* Per partition number of distance evaluations */
+    std::vector<uint64_t> partitionEvaluations(partitionCount);
+    uint64_t evaluations = 0;
+
+    std::vector<double> sums(k * N);
+    std::vector<uint64_t> counts(k);
+
+    /* Hamerly bounds: upper bound to the assigned centroid, lower bound to the second closest one */
+    std::vector<float> upperBounds(useBounds ? data.size() : 0);
+    std::vector<float> lowerBounds(useBounds ? data.size() : 0);
+
+    /* Half the distance from each centroid to its nearest other centroid, and how far each centroid moved */
+    std::vector<float> halfNearest(k, 0.0f);
+    std::vector<float> drifts(k, 0.0f);
+    std::vector<std::array<float, N>> previousCentroids;
+
+    /* Inertia of the current centroids and assignments, reduced in partition order */
+    auto assignedInertia = [&]()
+    {
+        std::vector<double> partitionInertia(partitionCount);
+        parallelFor(partitionCount, pParams->threadCount, [&](size_t p)
+        {
+            size_t begin, end;
+            kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+            double inertia = 0;
+            for(size_t i = begin; i < end; i++)
+            {
+                inertia += distanceSquared<N>(data[i], centroids[clusters[i]]);
+            }
+            partitionInertia[p] = inertia;
+        });
+
+        double inertia = 0;
+        for(double partialInertia : partitionInertia)
+        {
+            inertia += partialInertia;
+        }
+        return inertia;
+    };
+
+    uint64_t iterations = 0;
+    bool changed = true;
+    bool abandoned = false;
+    double abandonedInertia = 0;
+
+    while(changed && (pParams->maxIterations == 0 || iterations < pParams->maxIterations))
+    {
+        if(useBounds)
+        {
+            /* Half distance to the nearest other centroid */
+            std::fill(halfNearest.begin(), halfNearest.end(), std::numeric_limits<float>::max());
+            for(uint32_t a = 0; a < k; a++)
+            {
+                for(uint32_t b = a + 1; b < k; b++)
+                {
+                    float half = 0.5f * std::sqrt(distanceSquared<N>(centroids[a], centroids[b]));
+                    halfNearest[a] = std::min(halfNearest[a], half);
+                    halfNearest[b] = std::min(halfNearest[b], half);
+                }
+            }
+            evaluations += (uint64_t)k * (k - 1) / 2;
+        }
+
+        /* Assignment step: each partition assigns its points and accumulates its own sums */
+        parallelFor(partitionCount, pParams->threadCount, [&](size_t p)
+        {
+            double *pSums = &partitionSums[p * k * N];
+            uint64_t *pCounts = &partitionCounts[p * k];
+            uint64_t changes = 0;
+            uint64_t partialEvaluations = 0;
+
+            std::fill(pSums, pSums + k * N, 0.0);
+            std::fill(pCounts, pCounts + k, 0);
+
+            size_t begin, end;
+            kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+            for(size_t i = begin; i < end; i++)
+            {
+                uint32_t c = clusters[i];
+                bool keep = false;
+
+                if(useBounds && c < k)
+                {
+                    /* The point keeps its centroid if no other centroid can be closer */
+                    float bound = std::max(halfNearest[c], lowerBounds[i]) * (1.0f - KMEANS_BOUND_TOLERANCE);
+                    if(upperBounds[i] < bound)
+                    {
+                        keep = true;
+                    }
+                    else
+                    {
+                        /* Tighten the upper bound and check again */
+                        upperBounds[i] = std::sqrt(distanceSquared<N>(data[i], centroids[c])) * (1.0f + KMEANS_BOUND_TOLERANCE);
+                        partialEvaluations++;
+                        keep = upperBounds[i] < bound;
+                    }
+                }
+
+                if(!keep)
+                {
+                    if(useBounds)
+                    {
+                        /* Full scan, in the same order as closestCentroid, that also finds the second closest centroid */
+                        float bestDistance = std::numeric_limits<float>::max();
+                        float secondDistance = std::numeric_limits<float>::max();
+                        uint32_t best = 0;
+
+                        for(uint32_t j = 0; j < k; j++)
+                        {
+                            float d = distanceSquared<N>(data[i], centroids[j]);
+                            if(d < bestDistance)
+                            {
+                                secondDistance = bestDistance;
+                                bestDistance = d;
+                                best = j;
+                            }
+                            else if(d < secondDistance)
+                            {
+                                secondDistance = d;
+                            }
+                        }
+
+                        upperBounds[i] = std::sqrt(bestDistance) * (1.0f + KMEANS_BOUND_TOLERANCE);
+                        lowerBounds[i] = (k > 1) ? std::sqrt(secondDistance) * (1.0f - KMEANS_BOUND_TOLERANCE) : std::numeric_limits<float>::max();
+                        c = best;
+                    }
+                    else
+                    {
+                        c = closestCentroid<N>(data[i], centroids);
+                    }
+
+                    partialEvaluations += k;
+                }
+
+                if(c != clusters[i])
+                {
+                    clusters[i] = c;
+                    changes++;
+                }
+
+                double *pCentroidSums = pSums + c * N;
+                for(size_t d = 0; d < N; d++)
+                {
+                    pCentroidSums[d] += data[i][d];
+                }
+                pCounts[c]++;
+            }
+
+            partitionChanges[p] = changes;
+            partitionEvaluations[p] = partialEvaluations;
+        });
+
+        /* Reduction in partition order so that the sums do not depend on which thread ran which partition */
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        uint64_t changes = 0;
+
+        for(size_t p = 0; p < partitionCount; p++)
+        {
+            for(size_t j = 0; j < k * N; j++)
+            {
+                sums[j] += partitionSums[p * k * N + j];
+            }
+
+            for(uint32_t c = 0; c < k; c++)
+            {
+                counts[c] += partitionCounts[p * k + c];
+            }
+
+            changes += partitionChanges[p];
+            evaluations += partitionEvaluations[p];
+        }
+
+        if(useBounds)
+        {
+            previousCentroids = centroids;
+        }
+
+        /* Update step: empty clusters keep their previous centroid */
+        for(uint32_t c = 0; c < k; c++)
+        {
+            if(counts[c] > 0)
+            {
+                for(size_t d = 0; d < N; d++)
+                {
+                    centroids[c][d] = (float)(sums[c * N + d] / counts[c]);
+                }
+            }
+        }
+
+        changed = changes > 0;
+        iterations++;
+
+        /* Stop a run that is not doing better than the given inertia */
+        if(pParams->abandonAfter > 0 && iterations == pParams->abandonAfter && changed)
+        {
+            abandonedInertia = assignedInertia();
+            if(abandonedInertia > pParams->abandonInertia)
+            {
+                abandoned = true;
+                break;
+            }
+        }
+
+        if(useBounds && changed)
+        {
+            /* Move the bounds by how far the centroids drifted */
+            uint32_t largest = 0;
+            float secondLargestDrift = 0.0f;
+            for(uint32_t c = 0; c < k; c++)
+            {
+                drifts[c] = std::sqrt(distanceSquared<N>(centroids[c], previousCentroids[c])) * (1.0f + KMEANS_BOUND_TOLERANCE);
+                if(drifts[c] > drifts[largest])
+                {
+                    largest = c;
+                }
+            }
+            for(uint32_t c = 0; c < k; c++)
+            {
+                if(c != largest)
+                {
+                    secondLargestDrift = std::max(secondLargestDrift, drifts[c]);
+                }
+            }
+            evaluations += k;
+
+            parallelFor(partitionCount, pParams->threadCount, [&](size_t p)
+            {
+                size_t begin, end;
+                kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+                for(size_t i = begin; i < end; i++)
+                {
+                    upperBounds[i] += drifts[clusters[i]];
+                    lowerBounds[i] -= (clusters[i] == largest) ? secondLargestDrift : drifts[largest];
+                }
+            });
+        }
+    }
+
+    if(pStats != NULL)
+    {
+        /* Inertia of the final centroids */
+        pStats->iterations = iterations;
+        pStats->inertia = abandoned ? abandonedInertia : assignedInertia();
+        pStats->abandoned = abandoned;
+
+        /* Skipped evaluations are counted against a plain Lloyd assignment step of every point to every centroid */
+        const uint64_t plainEvaluations = iterations * data.size() * k;
+        pStats->distanceEvaluations = evaluations;
+        pStats->skippedDistanceEvaluations = plainEvaluations > evaluations ? plainEvaluations - evaluations : 0;
+    }
+
+    return std::make_tuple(centroids, clusters);
+}
+
+/**
+ * Multithreaded K-Means Lloyd algorithm.
+ * Returns the same centroids and cluster assignments tuple as dkm::kmeans_lloyd.
+ */
+template <size_t N>
+std::tuple<std::vector<std::array<float, N>>, std::vector<uint32_t>> kmeansLloydParallel(const FeatureMatrix<N>& data,
+    const KmeansParams *pParams, KmeansStats *pStats = NULL)
+{
+    return kmeansLloydRun<N>(data, pParams, false, pStats);
+}
+
+/**
+ * Multithreaded K-Means with Hamerly's triangle inequality bounds.
+ * Produces the same centroids and cluster assignments as kmeansLloydParallel for the same parameters, with far fewer
+ * distance evaluations once the centroids settle.
+ */
+template <size_t N>
+std::tuple<std::vector<std::array<float, N>>, std::vector<uint32_t>> kmeansHamerlyParallel(const FeatureMatrix<N>& data,
+    const KmeansParams *pParams, KmeansStats *pStats = NULL)
+{
+    return kmeansLloydRun<N>(data, pParams, true, pStats);
+}
+
+/**
+ * Seed of a restart: the given seed for the first restart, so that a single restart is the same as a plain run,
+ * and a SplitMix64 mix of the seed and the restart index for the others.
+ */
+inline uint64_t kmeansRestartSeed(uint64_t seed, uint32_t restart)
+{
+    if(restart == 0)
+    {
+        return seed;
+    }
+
+    return kmeansMix64(seed + (uint64_t)restart * 0x9e3779b97f4a7c15ULL);
+}
+
+/**
+ * Runs independent Lloyd (or Hamerly with useBounds) trainings from restartCount seeds derived from the given seed,
+ * and returns the one with the lowest inertia, the lowest restart index winning ties.
+ *
+ * The restarts run concurrently, each one on an equal share of the threads. With abandonAfter, they run in rounds of
+ * KMEANS_RESTART_ROUND_SIZE and a restart whose inertia after abandonAfter iterations is above the best inertia of
+ * the previous rounds is abandoned. Lloyd iterations only lower the inertia, so this is a heuristic: an abandoned
+ * restart could still have ended below the best. The rounds do not depend on the thread count, so a given seed
+ * always produces the same centroids.
+ *
+ * Optionally returns the stats of every restart and the index of the selected one. The distance evaluation counts
+ * of the returned stats are summed over all the restarts.
+ */
+template <size_t N>
+std::tuple<std::vector<std::array<float, N>>, std::vector<uint32_t>> kmeansLloydRestarts(const FeatureMatrix<N>& data,
+    const KmeansParams *pParams, uint32_t restartCount, bool useBounds, KmeansStats *pStats = NULL,
+    std::vector<KmeansStats> *pRestartStats = NULL, uint32_t *pBestRestart = NULL)
+{
+    const int threadCount = resolveThreadCount(pParams->threadCount);
+    const size_t roundSize = (pParams->abandonAfter > 0) ? KMEANS_RESTART_ROUND_SIZE : (size_t)threadCount;
+
+    std::tuple<std::vector<std::array<float, N>>, std::vector<uint32_t>> best;
+    std::vector<KmeansStats> restartStats(restartCount);
+    uint32_t bestRestart = 0;
+    double bestInertia = std::numeric_limits<double>::max();
+    uint64_t evaluations = 0;
+    uint64_t skippedEvaluations = 0;
+
+    for(uint32_t roundBegin = 0; roundBegin < restartCount; roundBegin += roundSize)
+    {
+        const size_t runCount = std::min<size_t>(roundSize, restartCount - roundBegin);
+        const int runThreadCount = std::max(1, threadCount / (int)std::min<size_t>(runCount, threadCount));
+        std::vector<std::tuple<std::vector<std::array<float, N>>, std::vector<uint32_t>>> roundResults(runCount);
+
+        /* The restarts of a round are only compared to the previous rounds */
+        const double abandonInertia = bestInertia;
+
+        parallelFor(runCount, threadCount / runThreadCount, [&](size_t r)
+        {
+            KmeansParams params = *pParams;
+            params.seed = kmeansRestartSeed(pParams->seed, roundBegin + (uint32_t)r);
+            params.threadCount = runThreadCount;
+            params.abandonInertia = abandonInertia;
+
+            roundResults[r] = kmeansLloydRun<N>(data, &params, useBounds, &restartStats[roundBegin + r]);
+        });
+
+        /* Keep the best restart, in restart order */
+        for(size_t r = 0; r < runCount; r++)
+        {
+            const KmeansStats& stats = restartStats[roundBegin + r];
+            evaluations += stats.distanceEvaluations;
+            skippedEvaluations += stats.skippedDistanceEvaluations;
+
+            if(!stats.abandoned && stats.inertia < bestInertia)
+            {
+                bestInertia = stats.inertia;
+                bestRestart = roundBegin + (uint32_t)r;
+                best = std::move(roundResults[r]);
+            }
+        }
+    }
+
+    if(pStats != NULL)
+    {
+        *pStats = restartStats[bestRestart];
+        pStats->distanceEvaluations = evaluations;
+        pStats->skippedDistanceEvaluations = skippedEvaluations;
+    }
+
+    if(pRestartStats != NULL)
+    {
+        *pRestartStats = restartStats;
+    }
+
+    if(pBestRestart != NULL)
+    {
+        *pBestRestart = bestRestart;
+    }
+
+    return best;
+}
+
+/**
+ * Moves a centroid towards a point: centroid = (1 - eta) * centroid + eta * point.
+ */
+template <size_t N>
+inline void moveCentroid(std::array<float, N>* pCentroid, const std::array<float, N>& point, float eta)
+{
+    for(size_t d = 0; d < N; d++)
+    {
+        (*pCentroid)[d] = (1.0f - eta) * (*pCentroid)[d] + eta * point[d];
+    }
+}
+
+/**
+ * Inertia of the given centroids over all the points provided by fetchPoint(index, pPoint).
+ * Points are fetched chunk by chunk so that only one chunk is held in memory at a time.
+ */
+template <size_t N, typename FetchPoint>
+double kmeansInertia(size_t pointCount, FetchPoint fetchPoint, const std::vector<std::array<float, N>>& centroids, size_t chunkSize, int threadCount)
+{
+    std::vector<std::array<float, N>> chunk(std::min(chunkSize, pointCount));
+    double inertia = 0;
+
+    for(size_t chunkBegin = 0; chunkBegin < pointCount; chunkBegin += chunkSize)
+    {
+        const size_t chunkCount = std::min(chunkSize, pointCount - chunkBegin);
+        for(size_t i = 0; i < chunkCount; i++)
+        {
+            fetchPoint(chunkBegin + i, &chunk[i]);
+        }
+
+        /* Per partition sums, reduced in partition order for reproducibility */
+        const size_t partitionCount = kmeansPartitionCount(chunkCount);
+        std::vector<double> partitionInertia(partitionCount);
+
+        parallelFor(partitionCount, threadCount, [&](size_t p)
+        {
+            size_t begin, end;
+            kmeansPartitionRange(chunkCount, partitionCount, p, &begin, &end);
+
+            double partialInertia = 0;
+            for(size_t i = begin; i < end; i++)
+            {
+                float d;
+                closestCentroid<N>(chunk[i], centroids, &d);
+                partialInertia += d;
+            }
+            partitionInertia[p] = partialInertia;
+        });
+
+        for(double partialInertia : partitionInertia)
+        {
+            inertia += partialInertia;
+        }
+    }
+
+    return inertia;
+}
+
+/**
+ * Mini-batch K-Means (Sculley, 2010) for training sets that don't fit in memory.
+ *
+ * Points are provided by fetchPoint(index, pPoint) so that they can be read straight from the training data file.
+ * Only the current mini-batch and the centroids are held in memory. Each iteration draws batchSize random points,
+ * assigns them in parallel, then moves each assigned centroid towards its points with a per-centroid learning rate
+ * of 1 / (number of points assigned to it so far). The updates are applied in draw order so a given seed always
+ * produces the same centroids.
+ */
+template <size_t N, typename FetchPoint>
+std::vector<std::array<float, N>> kmeansMiniBatch(size_t pointCount, FetchPoint fetchPoint, const KmeansParams *pParams, KmeansStats *pStats = NULL)
+{
+    const uint32_t k = pParams->k;
+    const size_t batchSize = std::max<size_t>(1, std::min<size_t>(pParams->batchSize, pointCount));
+
+    std::mt19937_64 rng(pParams->seed);
+    std::uniform_int_distribution<size_t> uniform(0, pointCount - 1);
+
+    /* Seed with k-means++ on a random sample that is large enough to hold k distinct seeds */
+    FeatureMatrix<N> batch(std::max<size_t>(batchSize, std::min<size_t>(pointCount, (size_t)k * 4)));
+    for(size_t i = 0; i < batch.size(); i++)
+    {
+        fetchPoint(batch.size() == pointCount ? i : uniform(rng), &batch[i]);
+    }
+
+    std::vector<std::array<float, N>> centroids = seedKmeansPlusPlus<N>(batch, k, rng(), pParams->threadCount);
+    batch.resize(batchSize);
+
+    /* Number of points assigned to each centroid so far, drives the per-centroid learning rate */
+    std::vector<uint64_t> centroidCounts(k, 0);
+    std::vector<uint32_t> batchClusters(batchSize);
+
+    const uint64_t iterations = pParams->maxIterations > 0 ? pParams->maxIterations : 100;
+    const size_t partitionCount = kmeansPartitionCount(batchSize);
+
+    for(uint64_t iteration = 0; iteration < iterations; iteration++)
+    {
+        /* Draw the mini-batch */
+        for(size_t i = 0; i < batchSize; i++)
+        {
+            fetchPoint(uniform(rng), &batch[i]);
+        }
+
+        /* Assign the mini-batch points to their closest centroid */
+        parallelFor(partitionCount, pParams->threadCount, [&](size_t p)
+        {
+            size_t begin, end;
+            kmeansPartitionRange(batchSize, partitionCount, p, &begin, &end);
+
+            for(size_t i = begin; i < end; i++)
+            {
+                batchClusters[i] = closestCentroid<N>(batch[i], centroids);
+            }
+        });
+
+        /* Move the centroids towards their assigned points, in draw order */
+        for(size_t i = 0; i < batchSize; i++)
+        {
+            const uint32_t c = batchClusters[i];
+            moveCentroid<N>(&centroids[c], batch[i], 1.0f / (float)(++centroidCounts[c]));
+        }
+    }
+
+    if(pStats != NULL)
+    {
+        pStats->iterations = iterations;
+        pStats->inertia = kmeansInertia<N>(pointCount, fetchPoint, centroids, batchSize, pParams->threadCount);
+        pStats->distanceEvaluations = iterations * batchSize * k;
+        pStats->skippedDistanceEvaluations = 0;
+    }
+
+    return centroids;
+}
+
+#endif
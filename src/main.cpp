@@ -1,61 +1,33 @@
 #include <iostream>
+#include <fstream>
 #include <vector>
-#include <dirent.h>
 #include <cstring>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <dkm.hpp>
 #include <dkm_utils.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize.h"
-
 #include "mkdir_p.hpp"
+#include "error_codes.hpp"
+#include "feature_store.hpp"
+#include "ingest.hpp"
+#include "options.hpp"
+#include "kmeans.hpp"
+#include "geometry.hpp"
+#include "model.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "quantized_model.hpp"
+#include "centroid_file.hpp"
+#include "sweep.hpp"
+#include "feature_cache.hpp"
+#include "watch.hpp"
+#include "relocate.hpp"
+#include "projection.hpp"
 
 using namespace std;
 
-/** 
- * Flag indicating whether or not the pixel values should be normalized or not.
- * In terms of clustering there seems to be no obvious advantages or disadvantages to normalizing or not.
- */
-#define NORMALIZE                                                                                     1
-
-/** 
- * Training image dimension.
- * The images that will be used as training inputs will be resized to this dimension
- */
-#define KMEANS_IMAGE_WIDTH                                                                           20
-#define KMEANS_IMAGE_HEIGHT                                                                          20
-
-/** 
- * Training image channels.
- * The images that will be used as trainig inputs will be have their channels changed to this.
- * Options are defined in stb_image.h: STBI_default, STBI_grey, STBI_grey_alpha, and STBI_rgb_alpha
- */
-#define KMEANS_IMAGE_CHANNELS                                                                 STBI_grey
-
-/** 
- * Training image size.
- * The images that will be used as trainig inputs will be resized to this size
- */
-#define KMEANS_IMAGE_SIZE        KMEANS_IMAGE_WIDTH * KMEANS_IMAGE_HEIGHT * KMEANS_IMAGE_CHANNELS
-
-typedef enum _error_codes {
-    NO_ERROR               = 0, /* No error */
-    ERROR_ARGS             = 1, /* Error: invalid program arguments */
-    ERROR_MODE             = 2, /* Error: invalid program mode selected */
-    ERROR_OPENING_DIR      = 3, /* Error: opening directory */
-    ERROR_NO_IMAGES        = 4, /* Error: no images in given directory */
-    ERROR_LOADING_IMAGE    = 5, /* Error: loading image */
-    ERROR_RESIZING_IMAGE   = 6, /* Error: resizing the images */
-    ERROR_WRITING_CENTROID = 7, /* Error: writing CSV output file for centroids */
-    ERROR_UNKNOWN          = 8  /* Error: unknown */
-} errorCodes;
-
-
 /**
  * Invokes mkdir_p but with some extra checks.
  * Create clustered centroids CSV file path directories if they don't exist already.
@@ -67,658 +39,1604 @@ int mkdir_p_x(string filepath)
     if (filepath.find("/") != string::npos)
     {
         string dirPath = filepath.substr(0, filepath.find_last_of("\\/"));
+
+        uint64_t mkdirBegin = statsStageBegin();
         int mkdirRes = mkdir_p(dirPath.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-        
+        statsStageEnd(STATS_STAGE_MKDIR, mkdirBegin);
+
         return mkdirRes;
     }
 
     return NO_ERROR;
 }
 
-int createImgDataBuffer(const char *inputImgFilePath, int imgWidth, int imgHeight, int imgChannels, uint8_t* pImgDataBuffer)
+template <typename G, typename M>
+int createTrainingDataVector(string inputImgDirPath, int normalize, int workerCount, vector<string> *pImgFilePathVector,\
+    M *pTrainingImgVector)
 {
-    int inputImgWidth;
-    int inputImgHeight;
-    int intputImgChannels;
+    /* The downsampled images of the input directory, archive, or list */
+    ImgBatch imgBatch;
+
+    /* Decode all the images of the source */
+    int ingestRes = ingestImgSource(inputImgDirPath, G::width, G::height, G::channels, G::extractor, workerCount, &imgBatch);
+    if(ingestRes != NO_ERROR)
+    {
+        /* Could not open directory */
+        /* Terminate app with failure */
+        return ingestRes;
+    }
 
-    /* Decode the image file */
-    /* Note that the desired number of channels is the value fixed for the training and prediction image data input */
-    uint8_t *inputImgData = (uint8_t*)stbi_load(inputImgFilePath, &inputImgWidth, &inputImgHeight, &intputImgChannels, imgChannels);
+    /* Every listed image has its row allocated up front, the corrupt ones only leave unused capacity */
+    pTrainingImgVector->reserve(pTrainingImgVector->size() + imgBatch.imgFileNameVector.size());
+    pImgFilePathVector->reserve(pImgFilePathVector->size() + imgBatch.imgFileNameVector.size());
 
-    /* NULL on an allocation failure or if the image is corrupt or invalid */
-    if(inputImgData == NULL)
+    for(size_t f = 0; f < imgBatch.imgFileNameVector.size(); f++)
     {
-        std::cout << "Error: allocation failure of image file is corrupt or invalid: " << inputImgFilePath << endl;
-        return ERROR_LOADING_IMAGE;
+        const string &imgFileName = imgBatch.imgFileNameVector[f];
+
+        /* If input image was successfully decoded then transform it into a training data point */
+        if(imgBatch.imgDecodeResVector[f] == NO_ERROR)
+        {
+            /* Put image data into the next row of the matrix */
+            pTrainingImgVector->emplace_back();
+            imgDataBufferToArray<G>(imgBatchDataBuffer(&imgBatch, f), normalize, &pTrainingImgVector->back());
+
+            /* Keep track of all the image file paths being processed */
+            pImgFilePathVector->push_back(imgBatchFilePath(&imgBatch, f));
+        }
+        else
+        {
+            /* Skip problematic image file */
+            printImgDecodeError(imgBatchFilePath(&imgBatch, f).c_str(), imgBatch.imgDecodeResVector[f]);
+            std::cout << "Skipping invalid or corrupt image: " << imgFileName << endl;
+        }
     }
 
-    /* Downsample the image i.e., resize the image to a smaller dimension */
-    int resizeRes = stbir_resize_uint8(inputImgData, inputImgWidth, inputImgHeight, 0, pImgDataBuffer, imgWidth, imgHeight, 0, imgChannels);
+    return NO_ERROR;
+}
 
-    /* Free the input image data buffer */
-    stbi_image_free(inputImgData);
+/**
+ * Pairs each trained image file path with the cluster it was assigned to.
+ */
+template <typename G>
+void labelRelocations(tuple<vector<array<float, G::size>>, vector<uint32_t>> *pClusterData, vector<string> *pImgFilePathVector,\
+    vector<Relocation> *pRelocations)
+{
+    const vector<uint32_t> &labels = std::get<1>(*pClusterData);
+    pRelocations->resize(labels.size());
 
-    /* Return error code in case of resize error */
-    if(resizeRes == 0)
+    for(size_t i = 0; i < labels.size(); i++)
     {
-        return ERROR_RESIZING_IMAGE;
+        (*pRelocations)[i].inputImgFilePath = pImgFilePathVector->at(i);
+        (*pRelocations)[i].imgFileName = imgFileBaseName(pImgFilePathVector->at(i));
+        (*pRelocations)[i].clusterId = labels[i];
     }
 
-    return NO_ERROR;
+    /* Listed files of different directories may share a file name */
+    disambiguateRelocations(pRelocations);
 }
 
-int createTrainingDataVector(int trainingImgWidth, int trainingImgHeight, int trainingImgChannels,\
-    string inputImgDirPath, vector<string> *pImgFileNameVector,\
-    vector<array<float, KMEANS_IMAGE_SIZE>> *pTrainingImgVector)
+template <typename G>
+int appendTrainingDataToFeatureStore(string inputImgDirPath, int normalize, int workerCount, string trainingDataFilePath, int *pNewTrainingDataCount)
 {
-    /* Error code returned after decoding the input image */
-    int imgDecodeRes;
+    /* The downsampled images of the input directory, archive, or list */
+    ImgBatch imgBatch;
 
-    /* The data buffer that will contain a downsampled image data to be used as a training data point */
-    const int trainingImgSize = trainingImgWidth * trainingImgHeight * trainingImgChannels;
-    uint8_t trainingImgDataBuffer[trainingImgSize];
+    /* The raw pixel rows that will be appended to the training data file */
+    vector<uint8_t> trainingDataRows;
 
-    /* The array that will contain a downsampled image data to use as a training data point */
-    array<float, KMEANS_IMAGE_SIZE> trainingImgDataArray;
+    /* Decode all the images of the source */
+    int ingestRes = ingestImgSource(inputImgDirPath, G::width, G::height, G::channels, G::extractor, workerCount, &imgBatch);
+    if(ingestRes != NO_ERROR)
+    {
+        /* Could not open directory */
+        /* Terminate app with failure */
+        return ingestRes;
+    }
 
-    DIR *dir;
-    struct dirent *ent;
+    for(size_t f = 0; f < imgBatch.imgFileNameVector.size(); f++)
+    {
+        const string &imgFileName = imgBatch.imgFileNameVector[f];
 
-    if((dir = opendir(inputImgDirPath.c_str())) != NULL)
-    {   
-        /* Print all the files and directories within directory */
-        while((ent = readdir(dir)) != NULL)
+        /* If input image was successfully decoded then keep its raw pixel values as a training data row */
+        if(imgBatch.imgDecodeResVector[f] == NO_ERROR)
         {
-            /* Only process regular image files */
-            if(ent->d_type == DT_REG)
-            {
+            const uint8_t *trainingImgDataBuffer = imgBatchDataBuffer(&imgBatch, f);
+            trainingDataRows.insert(trainingDataRows.end(), trainingImgDataBuffer, trainingImgDataBuffer + imgBatch.imgSize);
+
+            /* Count number of training data appended to the training data file */
+            *pNewTrainingDataCount = *pNewTrainingDataCount + 1;
+        }
+        else
+        {
+            /* Skip problematic image file */
+            printImgDecodeError(imgBatchFilePath(&imgBatch, f).c_str(), imgBatch.imgDecodeResVector[f]);
+            std::cout << "Skipping invalid or corrupt image: " << imgFileName << endl;
+        }
+    }
 
-                string inputImgFilePath(inputImgDirPath.c_str());
-                inputImgFilePath.append("/");
-                inputImgFilePath.append(ent->d_name);
+    /* Append the raw pixel rows to the training data file in one go */
+    /* Normalization is recorded in the header and applied when the training data is loaded */
+    FeatureStoreHeader header;
+    initFeatureStoreHeader(&header, G::width, G::height, G::channels, G::extractor, normalize, FEATURE_STORE_DTYPE_UINT8);
 
-                /* Create buffer containing image training data */
-                imgDecodeRes = createImgDataBuffer(inputImgFilePath.c_str(), trainingImgWidth, trainingImgHeight, trainingImgChannels, trainingImgDataBuffer);
+    return appendToFeatureStore(trainingDataFilePath, &header, trainingDataRows.data(), *pNewTrainingDataCount);
+}
 
-                /* If input image was successfully decoded then transform it into an array */
-                if(imgDecodeRes == NO_ERROR)
-                {
-                    /* Put image data into array */
-                    for(int i = 0; i < trainingImgSize; i++)
-                    {
-                        trainingImgDataArray.at(i) = (NORMALIZE == 1) ? ((int)trainingImgDataBuffer[i]) / 255.0 : (float)trainingImgDataBuffer[i];
-                    }
+template <typename G>
+int exportTrainingDataToCsvFile(string trainingDataFilePath, int normalize, string trainingDataCsvFilePath, int *pExportedTrainingDataCount)
+{
+    /* Map the training data file */
+    FeatureStoreMap featureStoreMap;
+    int mapRes = mapFeatureStore(trainingDataFilePath, &featureStoreMap);
+    if(mapRes != NO_ERROR)
+    {
+        return mapRes;
+    }
 
-                    /* Put array into vector */
-                    pTrainingImgVector->push_back(trainingImgDataArray);
+    /* Read the training data rows */
+    FeatureMatrix<G::size> trainingImgVector;
+    int readRes = featureStoreToVector<G>(&featureStoreMap, normalize, &trainingImgVector);
+    unmapFeatureStore(&featureStoreMap);
 
-                    /* Keep track of all the image file names being processed */
-                    pImgFileNameVector->push_back(ent->d_name);
-                }
-                else
-                {
-                    /* Skip problematic image file */
-                    std::cout << "Skipping invalid or corrupt image: " << ent->d_name << endl;
-                }
-            }
+    if(readRes != NO_ERROR)
+    {
+        return readRes;
+    }
+
+    /* Create a new CSV file */
+    ofstream trainingDataCsvFile(trainingDataCsvFilePath.c_str());
+
+    for(const auto& trainingImgDataArray : trainingImgVector)
+    {
+        /* Initialize the CSV data row */
+        string csvRow("");
+
+        /* Create CSV row containing all pixel values */
+        for(float pixel : trainingImgDataArray)
+        {
+            csvRow.append(to_string(pixel));
+            csvRow.append(",");
         }
 
-        /* Close opened directory */
-        closedir(dir);
+        /* Write row to the CSV file */
+        csvRow.append("\n");
+        trainingDataCsvFile << csvRow;
     }
-    else
+
+    /* Close CSV file */
+    trainingDataCsvFile.close();
+    if(trainingDataCsvFile.fail())
     {
-        /* Could not open directory */
-        /* Terminate app with failure */
-        return ERROR_OPENING_DIR;
+        return ERROR_WRITING_TRAINING_DATA;
     }
 
+    *pExportedTrainingDataCount = trainingImgVector.size();
+
     return NO_ERROR;
 }
 
-int cpyImgsToLabelDirs(tuple<vector<array<float, KMEANS_IMAGE_SIZE>>, vector<uint32_t>> *pClusterData,\
-    vector<string> *pImgFileNameVector, string inputImgDirPath, string labelDirPath)
+template <typename G>
+int importTrainingDataFromCsvFile(string trainingDataCsvFilePath, int normalize, string trainingDataFilePath, int *pImportedTrainingDataCount)
 {
-    int i = 0;
-    for (const int label : std::get<1>(*pClusterData))
+    /* Read training data CSV and create the training data matrix */
+    FeatureMatrix<G::size> trainingImgVector;
+    int loadRes = loadFeatureMatrixFromCsvFile<G::size>(trainingDataCsvFilePath, &trainingImgVector);
+    if(loadRes != NO_ERROR)
     {
-        /* Path of the input image file */
-        string inputImgFilePath(inputImgDirPath.c_str());
-        inputImgFilePath.append("/");
-        inputImgFilePath.append(pImgFileNameVector->at(i).c_str());
+        return loadRes;
+    }
 
-        /* Path of the cluster label directory */
-        string clusteredImgFilePath(labelDirPath);
-        clusteredImgFilePath.append("/");
-        clusteredImgFilePath.append(to_string(label));
-        clusteredImgFilePath.append("/");
+    /* The CSV values are used as they are so they are stored as float rows */
+    FeatureStoreHeader header;
+    initFeatureStoreHeader(&header, G::width, G::height, G::channels, G::extractor, normalize, FEATURE_STORE_DTYPE_FLOAT);
 
-        /* Create cluster parent directory if it doesn't exist already */
-        /* Create CSV file path directories if they don't exist already */
-        int mkdirRes = mkdir_p_x(clusteredImgFilePath);
+    /* std::array is contiguous so the vector data can be written as packed rows */
+    int appendRes = appendToFeatureStore(trainingDataFilePath, &header, (const uint8_t*)trainingImgVector.data(), trainingImgVector.size());
+    if(appendRes != NO_ERROR)
+    {
+        return appendRes;
+    }
 
-        /* Exit program if directories were not created as expected */
-        if(mkdirRes != NO_ERROR)
+    *pImportedTrainingDataCount = trainingImgVector.size();
+
+    return NO_ERROR;
+}
+
+/**
+ * Fills the parameters of the multithreaded engines from the command-line options, seeded randomly unless a seed was given.
+ */
+void kmeansParamsFromOptions(int K, const Options *pOptions, KmeansParams *pParams)
+{
+    pParams->k = K;
+    pParams->seed = pOptions->hasSeed ? pOptions->seed : random_device()();
+    pParams->threadCount = pOptions->trainThreadCount;
+    pParams->maxIterations = (pOptions->engine == TRAINING_ENGINE_MINIBATCH) ? pOptions->iterations : 0;
+    pParams->batchSize = pOptions->batchSize;
+    pParams->abandonAfter = pOptions->abandonAfter;
+    pParams->abandonInertia = 0;
+    pParams->init = pOptions->init;
+    pParams->oversampling = pOptions->oversampling;
+}
+
+/**
+ * Trains with the mini-batch engine over points provided by fetchPoint(index, pPoint).
+ * With --compare-lloyd, the full training data is also clustered with the parallel Lloyd engine and same seed,
+ * and both inertias are printed.
+ */
+template <typename G, typename FetchPoint>
+vector<array<float, G::size>> trainMiniBatch(size_t pointCount, FetchPoint fetchPoint, int K, const Options *pOptions)
+{
+    KmeansParams params;
+    kmeansParamsFromOptions(K, pOptions, &params);
+
+    KmeansStats miniBatchStats;
+    vector<array<float, G::size>> centroids = kmeansMiniBatch<G::size>(pointCount, fetchPoint, &params, &miniBatchStats);
+
+    std::cout << "Mini-batch inertia: " << miniBatchStats.inertia << " (" << miniBatchStats.iterations << " batches of " << params.batchSize << ")" << endl;
+
+    if(pOptions->compareLloyd)
+    {
+        /* The comparison needs the whole training data in memory */
+        FeatureMatrix<G::size> trainingImgVector(pointCount);
+        for(size_t i = 0; i < pointCount; i++)
         {
-            std::cout << "Error: failed to create directory for file path: " << clusteredImgFilePath << endl;
-            return mkdirRes;
+            fetchPoint(i, &trainingImgVector[i]);
         }
 
-        /* Path of the labeled image */
-        clusteredImgFilePath.append(pImgFileNameVector->at(i).c_str());
+        params.maxIterations = 0;
 
-        /* Copy image file from input image directory into cluster/label directory */
-        std::ifstream src(inputImgFilePath.c_str());
-        std::ofstream dst(clusteredImgFilePath.c_str());
-        dst << src.rdbuf();
+        KmeansStats lloydStats;
+        kmeansLloydParallel<G::size>(trainingImgVector, &params, &lloydStats);
 
-        i++;
+        std::cout << "Lloyd inertia: " << lloydStats.inertia << " (" << lloydStats.iterations << " iterations)" << endl;
+        std::cout << "Mini-batch / Lloyd inertia ratio: " << (lloydStats.inertia > 0 ? miniBatchStats.inertia / lloydStats.inertia : 1.0) << endl;
     }
 
-    return NO_ERROR;
+    return centroids;
 }
 
-
-int appendTrainingDataToCsvFile(int trainingImgWidth, int trainingImgHeight, int trainingImgChannels, string inputImgDirPath, string trainingDataCsvFilePath, int *pNewTrainingDataCount)
+template <typename G>
+int trainClusters(const FeatureMatrix<G::size> *pTrainingImgVector, int K, const Options *pOptions,\
+    tuple<vector<array<float, G::size>>, vector<uint32_t>> *pClusterData)
 {
-    /* Error code returned after decoding the input image */
-    int imgDecodeRes;
+    /* There must be at least one training data point per cluster */
+    if(K < 1 || (size_t)K > pTrainingImgVector->size())
+    {
+        std::cerr << "Error: K must be between 1 and the number of training data points (" << pTrainingImgVector->size() << "): " << K << endl;
+        return ERROR_ARGS;
+    }
 
-    /* The training data is made out of image pixe values */
-    float pixel;
+    uint64_t clusterBegin = statsStageBegin();
 
-    /* The data buffer that will contain a downsampled image data to be used as a training data point */
-    const int trainingImgSize = trainingImgWidth * trainingImgHeight * trainingImgChannels;
-    uint8_t trainingImgDataBuffer[trainingImgSize];
+    if(pOptions->engine == TRAINING_ENGINE_PARALLEL || pOptions->engine == TRAINING_ENGINE_HAMERLY)
+    {
+        /* Use the multithreaded K-Means Lloyd algorithm, with triangle inequality bounds for the Hamerly engine */
+        const bool useBounds = pOptions->engine == TRAINING_ENGINE_HAMERLY;
 
-    DIR *dir;
-    struct dirent *ent;
+        KmeansParams params;
+        kmeansParamsFromOptions(K, pOptions, &params);
 
-    if((dir = opendir(inputImgDirPath.c_str())) != NULL)
-    {
-        /* Create a new CSV file if it doesn't exist or append to it if it already exists */
-        ofstream trainingDataCsvFile(trainingDataCsvFilePath.c_str(), std::ios::app);
+        /* Keep the lowest inertia of the restarts, a single restart is a plain run */
+        KmeansStats stats;
+        vector<KmeansStats> restartStats;
+        uint32_t bestRestart;
+        *pClusterData = kmeansLloydRestarts<G::size>(*pTrainingImgVector, &params, pOptions->restarts, useBounds, &stats, &restartStats, &bestRestart);
 
-        /* Print all the files and directories within directory */
-        while((ent = readdir(dir)) != NULL)
+        if(pOptions->restarts > 1)
         {
-            /* Initialize the CSV data row */
-            string csvRow("");
-
-            /* Only process regular image files */
-            if(ent->d_type == DT_REG)
+            for(size_t r = 0; r < restartStats.size(); r++)
             {
-                string inputImgFilePath(inputImgDirPath.c_str());
-                inputImgFilePath.append("/");
-                inputImgFilePath.append(ent->d_name);
-
-                imgDecodeRes = createImgDataBuffer(inputImgFilePath.c_str(), trainingImgWidth, trainingImgHeight, trainingImgChannels, trainingImgDataBuffer);
-
-                /* If input image was successfully decoded then transform it into an array */
-                if(imgDecodeRes == NO_ERROR)
-                {
-                    /* Create CSV row containing all pixel values */
-                    for(int i = 0; i < trainingImgSize; i++)
-                    {
-                        pixel = (NORMALIZE == 1) ? ((int)trainingImgDataBuffer[i]) / 255.0 : (float)trainingImgDataBuffer[i];
-                        csvRow.append(to_string(pixel));
-                        csvRow.append(",");
-                    }
-
-                    /* Write row to the CSV file */
-                    csvRow.append("\n");
-                    trainingDataCsvFile << csvRow;
-
-                    /* Count number of training data appended to the CSV file */
-                    *pNewTrainingDataCount = *pNewTrainingDataCount + 1;
-                }
-                else
-                {
-                    /* Skip problematic image file */
-                    std::cout << "Skipping invalid or corrupt image: " << ent->d_name << endl;
-                }
+                std::cout << "Restart " << r << " inertia: " << restartStats[r].inertia << " (" << restartStats[r].iterations << " iterations"
+                    << (restartStats[r].abandoned ? ", abandoned" : "") << ")" << endl;
             }
+            std::cout << "Best restart: " << bestRestart << endl;
         }
 
-        /* Close CSV file */
-        trainingDataCsvFile.close();
+        if(useBounds)
+        {
+            const uint64_t plainEvaluations = stats.distanceEvaluations + stats.skippedDistanceEvaluations;
+            std::cout << "Distance evaluations: " << stats.distanceEvaluations << ", skipped: " << stats.skippedDistanceEvaluations
+                << " (" << (plainEvaluations > 0 ? 100.0 * stats.skippedDistanceEvaluations / plainEvaluations : 0.0) << "%)" << endl;
+        }
+    }
+    else if(pOptions->engine == TRAINING_ENGINE_MINIBATCH)
+    {
+        /* Use the mini-batch K-Means algorithm over the in-memory training data */
+        vector<array<float, G::size>> centroids = trainMiniBatch<G>(pTrainingImgVector->size(),
+            [pTrainingImgVector](size_t index, array<float, G::size> *pPoint) { *pPoint = (*pTrainingImgVector)[index]; },
+            K, pOptions);
+
+        /* Mini-batches only visit a sample of the points, label all of them with the final centroids */
+        vector<uint32_t> clusters(pTrainingImgVector->size());
+        for(size_t i = 0; i < clusters.size(); i++)
+        {
+            clusters[i] = closestCentroid<G::size>((*pTrainingImgVector)[i], centroids);
+        }
 
-        /* Close opened directory */
-        closedir(dir);
+        *pClusterData = std::make_tuple(centroids, clusters);
     }
     else
     {
-        /* Could not open directory */
-        /* Terminate app with failure */
-        return ERROR_OPENING_DIR;
+        /* Use K-Means Lloyd algorithm to build clusters, dkm only takes standard vectors */
+        /* Only the projected training data and --compare-full are copied, the pixels are loaded as one otherwise */
+        const vector<array<float, G::size>> dkmTrainingImgVector(pTrainingImgVector->begin(), pTrainingImgVector->end());
+        *pClusterData = dkm::kmeans_lloyd<float, G::size>(dkmTrainingImgVector, K);
     }
 
+    statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
+
     return NO_ERROR;
 }
 
+/**
+ * Trains with the dkm engine on training data that is already a standard vector.
+ */
+template <typename G>
+int trainDkmClusters(const vector<array<float, G::size>> *pTrainingImgVector, int K,\
+    tuple<vector<array<float, G::size>>, vector<uint32_t>> *pClusterData)
+{
+    /* There must be at least one training data point per cluster */
+    if(K < 1 || (size_t)K > pTrainingImgVector->size())
+    {
+        std::cerr << "Error: K must be between 1 and the number of training data points (" << pTrainingImgVector->size() << "): " << K << endl;
+        return ERROR_ARGS;
+    }
+
+    uint64_t clusterBegin = statsStageBegin();
+
+    /* Use K-Means Lloyd algorithm to build clusters */
+    *pClusterData = dkm::kmeans_lloyd<float, G::size>(*pTrainingImgVector, K);
+
+    statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
 
-int writeCentroidsToCsvFile(tuple<vector<array<float, KMEANS_IMAGE_SIZE>>, vector<uint32_t>> *pClusterData, string clusterCentroidsCsvFilePath)
+    return NO_ERROR;
+}
+
+/**
+ * Trains on the projection of the training data on its D principal components, then maps the centroids back to pixel
+ * space. The projection is written beside the centroids file.
+ * With --compare-full, the training data is also clustered on the pixels and the agreement of both labelings and the
+ * speedup are printed.
+ */
+template <typename G, size_t D>
+int trainProjectedClusters(const FeatureMatrix<G::size> *pTrainingImgVector, int K, const Options *pOptions,\
+    tuple<vector<array<float, G::size>>, vector<uint32_t>> *pClusterData, string clusterCentroidsCsvFilePath)
 {
-    try{
-        /* Create a new CSV file and write centroid rows to it */
-        ofstream clusterCentroidsCsvFile(clusterCentroidsCsvFilePath.c_str());
+    /* There must be at least one training data point per cluster */
+    if(K < 1 || (size_t)K > pTrainingImgVector->size())
+    {
+        std::cerr << "Error: K must be between 1 and the number of training data points (" << pTrainingImgVector->size() << "): " << K << endl;
+        return ERROR_ARGS;
+    }
 
-        /* For each means vector */
-        for (const auto& means : std::get<0>(*pClusterData))
-        {
-            /* Initialize the CSV data row */
-            string csvRow("");
+    uint64_t projectedBegin = statsClock();
 
-            /* Write all mean values in a CSV row */
-            for(float m : means)
-            {
-                csvRow.append(to_string(m));
-                csvRow.append(",");
-            }
+    /* Fit the components and project the training data on them */
+    Projection<G::size> projection;
+    fitProjection<G::size, D>(*pTrainingImgVector, pOptions->hasSeed ? pOptions->seed : random_device()(), pOptions->trainThreadCount, &projection);
+
+    FeatureMatrix<D> projectedImgVector;
+    projectFeatureMatrix<G::size, D>(&projection, *pTrainingImgVector, pOptions->trainThreadCount, &projectedImgVector);
+
+    std::cout << "PCA: " << D << " components, explained variance: " << projectionExplainedVariance<G::size>(&projection) << endl;
+
+    /* Train with the selected engine in D dimensions */
+    tuple<vector<array<float, D>>, vector<uint32_t>> projectedClusterData;
+    int trainRes = trainClusters<ProjectedGeometry<D>>(&projectedImgVector, K, pOptions, &projectedClusterData);
+    if(trainRes != NO_ERROR)
+    {
+        return trainRes;
+    }
+
+    *pClusterData = std::make_tuple(unprojectCentroids<G::size, D>(&projection, std::get<0>(projectedClusterData)), std::get<1>(projectedClusterData));
 
-            /* Write row to the CSV file */
-            csvRow.append("\n");
-            clusterCentroidsCsvFile << csvRow;
+    const double projectedSeconds = (statsClock() - projectedBegin) / 1e9;
+
+    if(pOptions->compareFull)
+    {
+        uint64_t fullBegin = statsClock();
+
+        tuple<vector<array<float, G::size>>, vector<uint32_t>> fullClusterData;
+        trainRes = trainClusters<G>(pTrainingImgVector, K, pOptions, &fullClusterData);
+        if(trainRes != NO_ERROR)
+        {
+            return trainRes;
         }
 
-        /* Close CSV file */
-        clusterCentroidsCsvFile.close();
+        const double fullSeconds = (statsClock() - fullBegin) / 1e9;
+
+        /* Both inertias in pixel space, each point counted against its closest centroid */
+        auto fetchPoint = [pTrainingImgVector](size_t index, array<float, G::size> *pPoint) { *pPoint = (*pTrainingImgVector)[index]; };
+        double projectedInertia = kmeansInertia<G::size>(pTrainingImgVector->size(), fetchPoint, std::get<0>(*pClusterData), pTrainingImgVector->size(), pOptions->trainThreadCount);
+        double fullInertia = kmeansInertia<G::size>(pTrainingImgVector->size(), fetchPoint, std::get<0>(fullClusterData), pTrainingImgVector->size(), pOptions->trainThreadCount);
+
+        std::cout << "PCA agreement with the pixel clustering (adjusted Rand index): "
+            << adjustedRandIndex(std::get<1>(*pClusterData), std::get<1>(fullClusterData), K) << endl;
+        std::cout << "PCA inertia: " << projectedInertia << ", pixel inertia: " << fullInertia << endl;
+        std::cout << "PCA time: " << projectedSeconds << " s, pixel time: " << fullSeconds << " s (speedup " << fullSeconds / projectedSeconds << "x)" << endl;
     }
-    catch(...)
+
+    /* Keep the projection beside the centroids */
+    int projectionRes = writeProjectionToCsvFile<G>(&projection, pOptions->normalize, clusterCentroidsCsvFilePath);
+    if(projectionRes != NO_ERROR)
     {
-        std::cout << "Error: an unknown error occured while writing the CSV output file for the cluster centroids: " << clusterCentroidsCsvFilePath << endl;
-        return ERROR_WRITING_CENTROID;
+        std::cerr << "Error: failed to write the projection file: " << clusterCentroidsCsvFilePath << PROJECTION_FILE_SUFFIX << endl;
+        return projectionRes;
     }
 
     return NO_ERROR;
 }
 
-int batchPredict(string inputImgDirPath, string outputImgDirPath, int imgWidth, int imgHeight, int imgChannels, string clusterCentroidsCsvFilePath)
+/**
+ * Trains on the pixels, or on their projection when --pca is given.
+ */
+template <typename G>
+int trainModelClusters(const FeatureMatrix<G::size> *pTrainingImgVector, int K, const Options *pOptions,\
+    tuple<vector<array<float, G::size>>, vector<uint32_t>> *pClusterData, string clusterCentroidsCsvFilePath)
+{
+    switch(pOptions->pcaDimensions)
+    {
+        /* Extracted features can have fewer values than the projection, --pca is rejected for them */
+        case 16:
+            return trainProjectedClusters<G, (16 < G::size) ? 16 : G::size>(pTrainingImgVector, K, pOptions, pClusterData, clusterCentroidsCsvFilePath);
+        case 32:
+            return trainProjectedClusters<G, (32 < G::size) ? 32 : G::size>(pTrainingImgVector, K, pOptions, pClusterData, clusterCentroidsCsvFilePath);
+        case 64:
+            return trainProjectedClusters<G, (64 < G::size) ? 64 : G::size>(pTrainingImgVector, K, pOptions, pClusterData, clusterCentroidsCsvFilePath);
+        default:
+            return trainClusters<G>(pTrainingImgVector, K, pOptions, pClusterData);
+    }
+}
+
+/**
+ * Loads the training data with loadTrainingData(pTrainingImgVector) and trains on it.
+ * dkm only takes standard vectors, so with the dkm engine on the pixels the training data is loaded directly as one
+ * instead of as a training data matrix that would have to be copied, which would double the peak memory.
+ */
+template <typename G, typename LoadTrainingData>
+int loadAndTrainModelClusters(LoadTrainingData loadTrainingData, int K, const Options *pOptions,\
+    tuple<vector<array<float, G::size>>, vector<uint32_t>> *pClusterData, string clusterCentroidsCsvFilePath)
 {
-    /* Error code returned after decoding the input image */
-    int imgDecodeRes;
+    if(pOptions->engine == TRAINING_ENGINE_DKM && pOptions->pcaDimensions == 0)
+    {
+        vector<array<float, G::size>> trainingImgVector;
+        int loadRes = loadTrainingData(&trainingImgVector);
+        if(loadRes != NO_ERROR)
+        {
+            return loadRes;
+        }
+
+        return trainDkmClusters<G>(&trainingImgVector, K, pClusterData);
+    }
+
+    FeatureMatrix<G::size> trainingImgVector;
+    int loadRes = loadTrainingData(&trainingImgVector);
+    if(loadRes != NO_ERROR)
+    {
+        return loadRes;
+    }
 
-    /* Error code moving the image file from the input directory to the label output directory */
-    int renameRes;
+    return trainModelClusters<G>(&trainingImgVector, K, pOptions, pClusterData, clusterCentroidsCsvFilePath);
+}
 
-    /* Error code returned after creating the directories for the labeled image output file path */
-    int mkdirRes;
+template <typename G>
+int batchPredict(string inputImgDirPath, string outputImgDirPath, string clusterCentroidsCsvFilePath, const Options *pOptions)
+{
+    const int normalize = pOptions->normalize;
 
     /* The cluster id that an image will be labeld with */
     int clusterId;
 
-    /* Read the cluster centroids CSV file */
-    std::vector<std::array<float, KMEANS_IMAGE_SIZE>> clusterCentroidsVector;
-    clusterCentroidsVector = dkm::load_csv<float, KMEANS_IMAGE_SIZE>(clusterCentroidsCsvFilePath.c_str());
+    /* The images to move once they are all labeled, or to list in the manifest */
+    vector<Relocation> relocations;
+
+    /* Quantized models are compared to the downsampled pixels directly */
+    QuantizedModel quantizedModel;
+    const bool quantized = isQuantizedModelFile(clusterCentroidsCsvFilePath);
+
+    if(quantized && pOptions->onlineUpdate != ONLINE_UPDATE_NONE)
+    {
+        std::cout << "Error: online updates require a float centroids file: " << clusterCentroidsCsvFilePath << endl;
+        return ERROR_ARGS;
+    }
+
+    /* Read the cluster centroids file, rejecting centroids trained with another geometry */
+    std::vector<std::array<float, G::size>> clusterCentroidsVector;
+    int loadRes = quantized ? loadQuantizedModelFile<G>(clusterCentroidsCsvFilePath, normalize, &quantizedModel)
+        : loadCentroidsFromFile<G>(clusterCentroidsCsvFilePath, normalize, &clusterCentroidsVector);
+    if(loadRes != NO_ERROR)
+    {
+        std::cout << "Error: failed to read the cluster centroids file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << clusterCentroidsCsvFilePath << endl;
+        return loadRes;
+    }
 
+    /* The images are moved, they cannot be entries of an archive unless they are only listed in a manifest */
+    if(imgSourceKindOf(inputImgDirPath) == IMG_SOURCE_TAR && pOptions->manifestFilePath.empty())
+    {
+        std::cout << "Error: batch predict moves the images, they must be given as a directory or a list: " << inputImgDirPath << endl;
+        return ERROR_ARGS;
+    }
 
-    /* The data buffer that will contain a downsampled image data to process */
-    const int imgSize = imgWidth * imgHeight * imgChannels;
-    uint8_t imgDataBuffer[imgSize];
+    /* The downsampled images of the input directory or list */
+    ImgBatch imgBatch;
 
     /* The array that will contain a downsampled image data to process */
-    array<float, KMEANS_IMAGE_SIZE> imgDataArray;
+    array<float, G::size> imgDataArray;
+
+    /* Decode all the images of the source */
+    int ingestRes = ingestImgSource(inputImgDirPath, G::width, G::height, G::channels, G::extractor, pOptions->workerCount, &imgBatch);
+    if(ingestRes != NO_ERROR)
+    {
+        /* Could not open directory */
+        /* Terminate app with failure */
+        return ingestRes;
+    }
 
-    DIR *dir;
-    struct dirent *ent;
+    /* Distances between the centroids, lets the prediction skip the centroids that cannot be the closest one */
+    CentroidDistanceTable centroidDistanceTable;
+    buildCentroidDistanceTable<G::size>(clusterCentroidsVector, &centroidDistanceTable);
 
-    if((dir = opendir(inputImgDirPath.c_str())) != NULL)
-    {   
-        /* Print all the files and directories within directory */
-        while((ent = readdir(dir)) != NULL)
+    /* Number of distance evaluations run and skipped */
+    uint64_t distanceCount = 0;
+    uint64_t skippedDistanceCount = 0;
+
+    /* Number of points assigned to each centroid during this run, drives the running mean online update */
+    vector<uint64_t> centroidCounts(clusterCentroidsVector.size(), 0);
+
+    for(size_t f = 0; f < imgBatch.imgFileNameVector.size(); f++)
+    {
+        const string &imgFileName = imgBatch.imgFileNameVector[f];
+        string inputImgFilePath = imgBatchFilePath(&imgBatch, f);
+
+        /* If input image was successfully decoded then transform it into an array */
+        if(imgBatch.imgDecodeResVector[f] == NO_ERROR)
         {
-            /* Only process regular image files */
-            if(ent->d_type == DT_REG)
-            {
+            uint64_t clusterBegin = statsStageBegin();
 
-                string inputImgFilePath(inputImgDirPath.c_str());
-                inputImgFilePath.append("/");
-                inputImgFilePath.append(ent->d_name);
+            if(quantized)
+            {
+                /* Compare the downsampled pixels to the quantized centroids, without converting them */
+                clusterId = closestQuantizedCentroid(imgBatchDataBuffer(&imgBatch, f), &quantizedModel);
+            }
+            else
+            {
+                /* Put image data into array */
+                imgDataBufferToArray<G>(imgBatchDataBuffer(&imgBatch, f), normalize, &imgDataArray);
 
-                /* Create buffer containing image data */
-                imgDecodeRes = createImgDataBuffer(inputImgFilePath.c_str(), imgWidth, imgHeight, imgChannels, imgDataBuffer);
+                /* Use the centroids data to predict which cluster/label applies to the image */
+                /* Return the cluster id to which the input image belongs to */
+                clusterId = closestCentroidPruned<G::size>(imgDataArray, clusterCentroidsVector, &centroidDistanceTable, NULL, &distanceCount, &skippedDistanceCount);
 
-                /* If input image was successfully decoded then transform it into an array */
-                if(imgDecodeRes == NO_ERROR)
+                /* Move the assigned centroid towards the image, in listing order so that the result is reproducible */
+                if(pOptions->onlineUpdate == ONLINE_UPDATE_MEAN)
                 {
-                    /* Put image data into array */
-                    for(int i = 0; i < imgSize; i++)
-                    {
-                        imgDataArray.at(i) = (NORMALIZE == 1) ? ((int)imgDataBuffer[i]) / 255.0 : (float)imgDataBuffer[i];
-                    }
-
-                    /* Use the centroids data to predict which cluster/label applies to the image */
-                    /* Return the cluster id to which the input image belongs to */
-                    clusterId = dkm::predict<float, KMEANS_IMAGE_SIZE>(clusterCentroidsVector, imgDataArray);
-
-                    /* Build file path of output image (located in cluster/label directory) */
-                    string outputImgFilePath(outputImgDirPath.c_str());
-                    outputImgFilePath.append("/");
-                    outputImgFilePath.append(to_string(clusterId));
-                    outputImgFilePath.append("/");
-                    outputImgFilePath.append(ent->d_name);
-
-                    /* Create the directories for the labeled image output file path (if they don't exist) */
-                    mkdirRes = mkdir_p_x(outputImgFilePath);
-
-                    /* Check for error creating directories */
-                    if(mkdirRes != NO_ERROR)
-                    {
-                        std::cout << "Error: failed to create directory for file path: " << outputImgFilePath << endl;
-                        return mkdirRes;
-                    }
-
-                    /* Move the image to its label directory */
-                    /* Check for errors */
-                    renameRes = rename(inputImgFilePath.c_str(), outputImgFilePath.c_str());
-                    if(renameRes != NO_ERROR)
-                    {
-                        /* Skip problematic image file */
-                        std::cout << "Error: failed to move file: " << inputImgFilePath << " --> " << outputImgFilePath << endl;
-                    }
+                    uint64_t weight = (uint64_t)pOptions->onlineWeight + (++centroidCounts[clusterId]);
+                    moveCentroid<G::size>(&clusterCentroidsVector[clusterId], imgDataArray, 1.0f / (float)weight);
+                    updateCentroidDistanceTable<G::size>(clusterCentroidsVector, clusterId, &centroidDistanceTable);
                 }
-                else
+                else if(pOptions->onlineUpdate == ONLINE_UPDATE_DECAY)
                 {
-                    /* Skip problematic image file */
-                    std::cout << "Skipping invalid or corrupt image: " << ent->d_name << endl;
+                    moveCentroid<G::size>(&clusterCentroidsVector[clusterId], imgDataArray, pOptions->learningRate);
+                    updateCentroidDistanceTable<G::size>(clusterCentroidsVector, clusterId, &centroidDistanceTable);
                 }
             }
+
+            statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
+
+            /* The image is moved to its cluster/label directory once all the images are labeled */
+            Relocation relocation;
+            relocation.inputImgFilePath = inputImgFilePath;
+            relocation.imgFileName = imgFileBaseName(imgFileName);
+            relocation.clusterId = clusterId;
+            relocations.push_back(relocation);
+        }
+        else
+        {
+            /* Skip problematic image file */
+            printImgDecodeError(inputImgFilePath.c_str(), imgBatch.imgDecodeResVector[f]);
+            std::cout << "Skipping invalid or corrupt image: " << imgFileName << endl;
         }
+    }
+
+    statsCount(STATS_COUNTER_DISTANCES, distanceCount);
+    statsCount(STATS_COUNTER_DISTANCES_SKIPPED, skippedDistanceCount);
 
-        /* Close opened directory */
-        closedir(dir);
+    /* Listed files of different directories may share a file name */
+    disambiguateRelocations(&relocations);
+
+    if(!pOptions->manifestFilePath.empty())
+    {
+        /* Record the label of every image instead of moving it */
+        int manifestRes = writeRelocationManifest(pOptions->manifestFilePath, relocations);
+        if(manifestRes != NO_ERROR)
+        {
+            std::cout << "Error: failed to write the manifest file: " << pOptions->manifestFilePath << endl;
+            return manifestRes;
+        }
     }
     else
     {
-        /* Could not open directory */
-        /* Terminate app with failure */
-        return ERROR_OPENING_DIR;
+        /* Move the images to their label directories, creating each directory once */
+        int relocateRes = relocateImgs(relocations, outputImgDirPath, RELOCATE_OP_MOVE, pOptions->workerCount);
+        if(relocateRes != NO_ERROR)
+        {
+            return relocateRes;
+        }
+    }
+
+    /* Write the updated centroids back in place of the ones that were loaded */
+    if(pOptions->onlineUpdate != ONLINE_UPDATE_NONE)
+    {
+        int replaceRes = replaceCentroidsFile<G>(&clusterCentroidsVector, normalize, clusterCentroidsCsvFilePath);
+        if(replaceRes != NO_ERROR)
+        {
+            std::cout << "Error: failed to write the updated cluster centroids file: " << clusterCentroidsCsvFilePath << endl;
+            return replaceRes;
+        }
     }
 
     return NO_ERROR;
 }
 
 /**
- * There are 4 modes: train now, collect, train, and predict.
- *      mode 0 -  train now: train with the available images without persisting the training data in a .txt file.
- *                           in practical terms this mode only really serves for testing and debugging during development.
- *                           can optionally enable copying the input image files into clustered directors in kmeans/clusters/<label>/
- *      mode 1 -    collect: save training data in a .txt file in kmeans/<label>/training_data.txt
- *      mode 2 -      train: read training_data.txt and build clusters. Write centroids in a .txt file in kmeans/<label>/centroids.txt
- *      mode 3 -    predict: calculate distances from each centroid apply nearest cluster to the image ipunt.
+ * Runs the selected mode with the given image geometry.
  */
-int main(int argc, char **argv)
+template <typename G>
+int runMode(int argc, char **argv, const Options *pOptions)
 {
-    try
+    /* Get the mode id */
+    int mode = atoi(argv[1]);
+
+    /* Process the selected mode */
+    if(mode == 0)
     {
-        /* Check that at least the "mode" argument is given */
-        if(argc < 2)
+        /** 
+         * Mode: train now.
+         * 
+         * A total of 4 or 5 arguments are expected:
+         *  - the mode id i.e., the "train now" mode in this case.
+         *  - the K number of clusters.
+         *  - the output CSV file where the cluster centroids will be written to.
+         *  - the image directory, tar archive, or "-" to read a list of image file paths from stdin, where the images to be clustered are located.
+         *  - (Optional) the cluster directory where the images will be copied to.
+         */
+
+        if(argc < 5 && argc > 6)
         {
-            std::cerr << "Error: command-line argument count mismatch." << endl;
+            std::cerr << "Error: command-line argument count mismatch for \"train now\" mode." << endl;
             return ERROR_ARGS;
         }
 
-        /* Get the mode id */
-        int mode = atoi(argv[1]);
-
-        /* Process the selected mode */
-        if(mode == 0)
-        {
-            /** 
-             * Mode: train now.
-             * 
-             * A total of 4 or 5 arguments are expected:
-             *  - the mode id i.e., the "train now" mode in this case.
-             *  - the K number of clusters.
-             *  - the output CSV file where the cluster centroids will be written to.
-             *  - the image directory where the images to be clustered are located.
-             *  - (Optional) the cluster directory where the images will be copied to.
-             */
-
-            if(argc < 5 && argc > 6)
-            {
-                std::cerr << "Error: command-line argument count mismatch for \"train now\" mode." << endl;
-                return ERROR_ARGS;
-            }
-
-            /* Fetch arguments */
-            int K = atoi(argv[2]);
-            string clusterCentroidsCsvFilePath = argv[3];
-            string inputImgDirPath = argv[4];
+        /* Fetch arguments */
+        int K = atoi(argv[2]);
+        string clusterCentroidsCsvFilePath = argv[3];
+        string inputImgDirPath = argv[4];
 
-            /* Create clustered centroids CSV file path directories if they don't exist already */
-            int mkdirRes = mkdir_p_x(clusterCentroidsCsvFilePath);
+        /* Create clustered centroids CSV file path directories if they don't exist already */
+        int mkdirRes = mkdir_p_x(clusterCentroidsCsvFilePath);
 
-            /* Exit program if directories were not created as expected */
-            if(mkdirRes != NO_ERROR)
-            {
-                std::cerr << "Error: failed to create directory for file path: " << clusterCentroidsCsvFilePath << endl;
-                return mkdirRes;
-            }
+        /* Exit program if directories were not created as expected */
+        if(mkdirRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to create directory for file path: " << clusterCentroidsCsvFilePath << endl;
+            return mkdirRes;
+        }
 
-            /* The vector that will contain all the filenames */
-            vector<string> imgFileNameVector;
+        /* The images are copied, they cannot be entries of an archive (they can be listed in a manifest though) */
+        if(argc == 6 && imgSourceKindOf(inputImgDirPath) == IMG_SOURCE_TAR)
+        {
+            std::cerr << "Error: copying the images to the cluster directories requires a directory or a list: " << inputImgDirPath << endl;
+            return ERROR_ARGS;
+        }
 
-            /* The vector that will contain all the downsampled image data points as training data points */
-            vector<array<float, KMEANS_IMAGE_SIZE>> trainingImgVector;
+        /* The vector that will contain all the file paths */
+        vector<string> imgFilePathVector;
 
-            /* Populate the training image data vector */
-            createTrainingDataVector(KMEANS_IMAGE_WIDTH, KMEANS_IMAGE_HEIGHT, KMEANS_IMAGE_CHANNELS, inputImgDirPath, &imgFileNameVector, &trainingImgVector);
+        /* Populate the matrix or vector that will contain all the downsampled image data points as training data points */
+        auto loadTrainingData = [&](auto *pTrainingImgVector)
+        {
+            createTrainingDataVector<G>(inputImgDirPath, pOptions->normalize, pOptions->workerCount, &imgFilePathVector, pTrainingImgVector);
 
             /* Check if images were loaded or not */
-            if(trainingImgVector.size() == 0)
+            if(pTrainingImgVector->size() == 0)
             {
                 std::cerr << "Error: No image files found in given directory: " << inputImgDirPath << endl;
                 return ERROR_NO_IMAGES;
             }
 
-            /* Use K-Means Lloyd algorithm to build clusters */
-            tuple<std::vector<std::array<float, KMEANS_IMAGE_SIZE>>, vector<uint32_t>> clusterData;
-            clusterData = dkm::kmeans_lloyd<float, KMEANS_IMAGE_SIZE>(trainingImgVector, K);
-
-            /* Copy the input images to their respective cluster image directory (if this option has been selected by providing a label directory path). */
-            if(argc == 6)
-            {
-                /* The cluster/label directory path */
-                string labelDirPath = argv[5];
-
-                /* Copye images to cluster/label directories */
-                int cpyRes = cpyImgsToLabelDirs(&clusterData, &imgFileNameVector, inputImgDirPath, labelDirPath);
-
-                /* Exit program if images were not copied to cluster/label directories */
-                if(cpyRes != NO_ERROR)
-                {
-                    std::cerr << "Error: failed to create directory for file path: " << clusterCentroidsCsvFilePath << endl;
-                    return cpyRes;
-                }
-            }
+            return NO_ERROR;
+        };
 
-            /* Write CSV output file for cluster centroids */
-            int centroidsRes = writeCentroidsToCsvFile(&clusterData, clusterCentroidsCsvFilePath);
-            if(centroidsRes != NO_ERROR)
-            {
-                std::cerr << "Error: an unknown error occured while writing the CSV output file for the cluster centroids: " << clusterCentroidsCsvFilePath << endl;
-                return centroidsRes;
-            }
+        /* Use the selected K-Means Lloyd engine to build clusters */
+        tuple<std::vector<std::array<float, G::size>>, vector<uint32_t>> clusterData;
+        int trainRes = loadAndTrainModelClusters<G>(loadTrainingData, K, pOptions, &clusterData, clusterCentroidsCsvFilePath);
+        if(trainRes != NO_ERROR)
+        {
+            return trainRes;
         }
-        else if(mode == 1)
-        {
-            /** 
-             * Mode: collect.
-             * 
-             * A total of 4 arguments are expected:
-             *  - the mode id i.e., the "collect" mode in this case.
-             *  - the image directory where the images to be clustered are located.
-             *  - the CSV file path where training data will be written to.
-             */
-            if(argc != 4)
-            {
-                std::cerr << "Error: command-line argument count mismatch for \"collect\" mode." << endl;
-                return ERROR_ARGS;
-            }
-
-            /* Fetch arguments */
-            string inputImgDirPath = argv[2];
-            string trainingDataCsvFilePath = argv[3];
 
-            /* Create CSV file path directories if they don't exist already */
-            int mkdirRes = mkdir_p_x(trainingDataCsvFilePath);
+        /* The cluster each image was assigned to */
+        vector<Relocation> relocations;
+        labelRelocations<G>(&clusterData, &imgFilePathVector, &relocations);
 
-            /* Exit program if directories were not created as expected */
-            if(mkdirRes != NO_ERROR)
-            {
-                std::cerr << "Error: failed to create directory for file path: " << trainingDataCsvFilePath << endl;
-                return mkdirRes;
-            }
+        /* Copy the input images to their respective cluster image directory (if this option has been selected by providing a label directory path). */
+        if(argc == 6)
+        {
+            /* The cluster/label directory path */
+            string labelDirPath = argv[5];
 
-            /* Decode all images and write their pixel data into a CSV file */
-            int newTrainingDataCount;
-            int appendRes = appendTrainingDataToCsvFile(KMEANS_IMAGE_WIDTH, KMEANS_IMAGE_HEIGHT, KMEANS_IMAGE_CHANNELS, inputImgDirPath, trainingDataCsvFilePath, &newTrainingDataCount);
+            /* Copy or hard link the images to cluster/label directories */
+            int cpyRes = relocateImgs(relocations, labelDirPath, pOptions->link ? RELOCATE_OP_LINK : RELOCATE_OP_COPY, pOptions->workerCount);
 
-            /* Exit program if no training data was written (e.g. image folder is empty) */
-            if(appendRes != NO_ERROR)
+            /* Exit program if images were not copied to cluster/label directories */
+            if(cpyRes != NO_ERROR)
             {
-                std::cerr << "Error: failed to create training data CSV file, maybe the image directory is empty: " << inputImgDirPath << endl;
-                return appendRes;
+                std::cerr << "Error: failed to create directory for file path: " << clusterCentroidsCsvFilePath << endl;
+                return cpyRes;
             }
-
-            std::cout << newTrainingDataCount;
         }
-        else if(mode == 2)
+
+        /* Record the cluster of every image */
+        if(!pOptions->manifestFilePath.empty())
         {
-            /** 
-             * Mode: train.
-             * 
-             * A total of 4 arguments are expected:
-             *  - the mode id i.e., the "train" mode in this case.
-             *  - the K number of clusters.
-             *  - the training data CSV file.
-             *  - the training output CSV file where the cluster centroids will be written to.
-             */
-            if(argc != 5)
+            int manifestRes = writeRelocationManifest(pOptions->manifestFilePath, relocations);
+            if(manifestRes != NO_ERROR)
             {
-                std::cerr << "Error: command-line argument count mismatch for \"train\" mode." << endl;
-                return ERROR_ARGS;
+                std::cerr << "Error: failed to write the manifest file: " << pOptions->manifestFilePath << endl;
+                return manifestRes;
             }
+        }
 
-            /* Fetch arguments */
-            int K = atoi(argv[2]);
-            string trainingDataCsvFilePath = argv[3];
-            string clusterCentroidsCsvFilePath = argv[4];
+        /* Write CSV output file for cluster centroids */
+        int centroidsRes = writeCentroidsToCsvFile<G>(&clusterData, pOptions->normalize, clusterCentroidsCsvFilePath);
+        if(centroidsRes != NO_ERROR)
+        {
+            std::cerr << "Error: an unknown error occured while writing the CSV output file for the cluster centroids: " << clusterCentroidsCsvFilePath << endl;
+            return centroidsRes;
+        }
+    }
+    else if(mode == 1)
+    {
+        /** 
+         * Mode: collect.
+         * 
+         * A total of 4 arguments are expected:
+         *  - the mode id i.e., the "collect" mode in this case.
+         *  - the image directory, tar archive, or "-" to read a list of image file paths from stdin, where the images to be clustered are located.
+         *  - the binary training data file path where training data will be appended to.
+         */
+        if(argc != 4)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"collect\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        string inputImgDirPath = argv[2];
+        string trainingDataFilePath = argv[3];
+
+        /* Create training data file path directories if they don't exist already */
+        int mkdirRes = mkdir_p_x(trainingDataFilePath);
+
+        /* Exit program if directories were not created as expected */
+        if(mkdirRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to create directory for file path: " << trainingDataFilePath << endl;
+            return mkdirRes;
+        }
 
-            /* Create clustered centroids CSV file path directories if they don't exist already */
-            int mkdirRes = mkdir_p_x(clusterCentroidsCsvFilePath);
+        /* Decode all images and append their pixel data to the training data file */
+        int newTrainingDataCount = 0;
+        int appendRes = appendTrainingDataToFeatureStore<G>(inputImgDirPath, pOptions->normalize, pOptions->workerCount, trainingDataFilePath, &newTrainingDataCount);
 
-            /* Exit program if directories were not created as expected */
-            if(mkdirRes != NO_ERROR)
+        /* Exit program if no training data was written (e.g. image folder is empty) */
+        if(appendRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to append to training data file, maybe the image directory is empty or the file has a different format: " << trainingDataFilePath << endl;
+            return appendRes;
+        }
+
+        std::cout << newTrainingDataCount;
+    }
+    else if(mode == 2)
+    {
+        /** 
+         * Mode: train.
+         * 
+         * A total of 4 arguments are expected:
+         *  - the mode id i.e., the "train" mode in this case.
+         *  - the K number of clusters.
+         *  - the binary training data file.
+         *  - the training output CSV file where the cluster centroids will be written to.
+         */
+        if(argc != 5)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"train\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        int K = atoi(argv[2]);
+        string trainingDataFilePath = argv[3];
+        string clusterCentroidsCsvFilePath = argv[4];
+
+        /* Create clustered centroids CSV file path directories if they don't exist already */
+        int mkdirRes = mkdir_p_x(clusterCentroidsCsvFilePath);
+
+        /* Exit program if directories were not created as expected */
+        if(mkdirRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to create directory for file path: " << clusterCentroidsCsvFilePath << endl;
+            return mkdirRes;
+        }
+
+        /* Memory map the training data file */
+        FeatureStoreMap featureStoreMap;
+        int mapRes = mapFeatureStore(trainingDataFilePath, &featureStoreMap);
+        if(mapRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to read training data file: " << trainingDataFilePath << endl;
+            return mapRes;
+        }
+
+        /* The mini-batch engine reads the mapped rows directly so the training data never has to fit in memory */
+        if(pOptions->engine == TRAINING_ENGINE_MINIBATCH)
+        {
+            int trainRes = NO_ERROR;
+
+            if(checkFeatureStoreGeometry<G>(&featureStoreMap, pOptions->normalize) != NO_ERROR)
             {
-                std::cerr << "Error: failed to create directory for file path: " << clusterCentroidsCsvFilePath << endl;
-                return mkdirRes;
+                std::cerr << "Error: training data file does not match the expected image geometry: " << trainingDataFilePath << endl;
+                trainRes = ERROR_TRAINING_DATA_MISMATCH;
+            }
+            else if(featureStoreMap.header.sampleCount == 0)
+            {
+                std::cerr << "Error: No training data found in training data file: " << trainingDataFilePath << endl;
+                trainRes = ERROR_NO_IMAGES;
+            }
+            else if(K < 1 || (uint64_t)K > featureStoreMap.header.sampleCount)
+            {
+                std::cerr << "Error: K must be between 1 and the number of training data points (" << featureStoreMap.header.sampleCount << "): " << K << endl;
+                trainRes = ERROR_ARGS;
             }
 
-            /* Read training data CSV and create the training data vector */
-            std::vector<std::array<float, KMEANS_IMAGE_SIZE>> trainingImgVector;
-            trainingImgVector = dkm::load_csv<float, KMEANS_IMAGE_SIZE>(trainingDataCsvFilePath.c_str());
+            tuple<std::vector<std::array<float, G::size>>, vector<uint32_t>> clusterData;
+            if(trainRes == NO_ERROR)
+            {
+                /* Mini-batches are drawn at random across the whole file */
+                madvise(featureStoreMap.pAddr, featureStoreMap.length, MADV_RANDOM);
+
+                uint64_t clusterBegin = statsStageBegin();
+                std::get<0>(clusterData) = trainMiniBatch<G>(featureStoreMap.header.sampleCount,
+                    [&featureStoreMap](size_t index, array<float, G::size> *pPoint) { featureStoreRowToArray<G>(&featureStoreMap, index, pPoint); },
+                    K, pOptions);
+                statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
+            }
 
-            /* Use K-Means Lloyd algorithm to build clusters */
-            tuple<std::vector<std::array<float, KMEANS_IMAGE_SIZE>>, vector<uint32_t>> clusterData;
-            clusterData = dkm::kmeans_lloyd<float, KMEANS_IMAGE_SIZE>(trainingImgVector, K);
+            unmapFeatureStore(&featureStoreMap);
 
-            /* Write the cluster centroids to a CSV file */
-            int centroidsRes = writeCentroidsToCsvFile(&clusterData, clusterCentroidsCsvFilePath);
-            if(centroidsRes != NO_ERROR)
+            if(trainRes != NO_ERROR)
             {
-                return centroidsRes;
+                return trainRes;
             }
+
+            /* Write the cluster centroids to a CSV file */
+            return writeCentroidsToCsvFile<G>(&clusterData, pOptions->normalize, clusterCentroidsCsvFilePath);
         }
-        else if(mode == 3)
-        {
-            /** 
-             * Mode: predict.
-             * 
-             * A total of 3 arguments are expected:
-             *  - the mode id i.e., the "predict" mode in this case.
-             *  - the file path of the image to label.
-             *  - the centroid CSV file used to determine the label to apply to the given image.
-             */
-            if(argc != 4)
+
+        /* Create the training data matrix or vector from the mapped rows */
+        auto loadTrainingData = [&](auto *pTrainingImgVector)
+        {
+            int readRes = featureStoreToVector<G>(&featureStoreMap, pOptions->normalize, pTrainingImgVector);
+            unmapFeatureStore(&featureStoreMap);
+
+            if(readRes != NO_ERROR)
             {
-                std::cerr << "Error: command-line argument count mismatch for \"predict\" mode." << endl;
-                return ERROR_ARGS;
+                std::cerr << "Error: training data file does not match the expected image geometry: " << trainingDataFilePath << endl;
+                return readRes;
+            }
+
+            /* Check if there is anything to train with */
+            if(pTrainingImgVector->size() == 0)
+            {
+                std::cerr << "Error: No training data found in training data file: " << trainingDataFilePath << endl;
+                return (int)ERROR_NO_IMAGES;
             }
 
-            /* Fetch arguments */
-            string inputImgFilePath = argv[2];
-            string clusterCentroidsCsvFilePath = argv[3];
+            return (int)NO_ERROR;
+        };
+
+        /* Use the selected K-Means Lloyd engine to build clusters */
+        tuple<std::vector<std::array<float, G::size>>, vector<uint32_t>> clusterData;
+        int trainRes = loadAndTrainModelClusters<G>(loadTrainingData, K, pOptions, &clusterData, clusterCentroidsCsvFilePath);
+        if(trainRes != NO_ERROR)
+        {
+            return trainRes;
+        }
+
+        /* Write the cluster centroids to a CSV file */
+        int centroidsRes = writeCentroidsToCsvFile<G>(&clusterData, pOptions->normalize, clusterCentroidsCsvFilePath);
+        if(centroidsRes != NO_ERROR)
+        {
+            return centroidsRes;
+        }
+    }
+    else if(mode == 3)
+    {
+        /** 
+         * Mode: predict.
+         * 
+         * A total of 3 arguments are expected:
+         *  - the mode id i.e., the "predict" mode in this case.
+         *  - the file path of the image to label.
+         *  - the centroid CSV file used to determine the label to apply to the given image, or a quantized model file.
+         */
+        if(argc != 4)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"predict\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        string inputImgFilePath = argv[2];
+        string clusterCentroidsCsvFilePath = argv[3];
 
-            /* Create buffer containing image input data */
-            uint8_t imgDataBuffer[KMEANS_IMAGE_SIZE];
-            int imgDecodeRes = createImgDataBuffer(inputImgFilePath.c_str(), KMEANS_IMAGE_WIDTH, KMEANS_IMAGE_HEIGHT, KMEANS_IMAGE_CHANNELS, imgDataBuffer);
+        /* Create buffer containing image input data */
+        uint8_t imgDataBuffer[G::size];
+        int imgDecodeRes = createImgDataBuffer(inputImgFilePath.c_str(), G::width, G::height, G::channels, G::extractor, imgDataBuffer);
 
-            /* Exit program if failed to load input image. */
-            if(imgDecodeRes != NO_ERROR)
+        /* Exit program if failed to load input image. */
+        if(imgDecodeRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to load input image: " << inputImgFilePath << endl;
+            return imgDecodeRes;
+        }
+
+        /* Compare the downsampled pixels to the centroids of a quantized model directly */
+        if(isQuantizedModelFile(clusterCentroidsCsvFilePath))
+        {
+            QuantizedModel quantizedModel;
+            int loadRes = loadQuantizedModelFile<G>(clusterCentroidsCsvFilePath, pOptions->normalize, &quantizedModel);
+            if(loadRes != NO_ERROR)
             {
-                std::cerr << "Error: failed to load input image: " << inputImgFilePath << endl;
-                return imgDecodeRes;
+                std::cerr << "Error: failed to read the quantized model file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << clusterCentroidsCsvFilePath << endl;
+                return loadRes;
             }
 
-            /* Need to put the image data buffer into an array */
-            array<float, KMEANS_IMAGE_SIZE> imgDataArray;
+            uint64_t clusterBegin = statsStageBegin();
+            int clusterId = closestQuantizedCentroid(imgDataBuffer, &quantizedModel);
+            statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
+
+            std::cout << clusterId;
+            return NO_ERROR;
+        }
 
-            /* Put image data into array */
-            for(int i = 0; i < KMEANS_IMAGE_SIZE; i++)
+        /* Need to put the image data buffer into an array */
+        array<float, G::size> imgDataArray;
+
+        /* Put image data into array */
+        imgDataBufferToArray<G>(imgDataBuffer, pOptions->normalize, &imgDataArray);
+
+        /* Compare the features to the rows of a binary centroids file in place */
+        if(isCentroidFile(clusterCentroidsCsvFilePath))
+        {
+            CentroidFileMap centroidFileMap;
+            int mapRes = mapCentroidFileChecked<G>(clusterCentroidsCsvFilePath, pOptions->normalize, &centroidFileMap);
+            if(mapRes != NO_ERROR)
             {
-                imgDataArray.at(i) = (NORMALIZE == 1) ? ((int)imgDataBuffer[i]) / 255.0 : (float)imgDataBuffer[i];
+                std::cerr << "Error: failed to read the cluster centroids file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << clusterCentroidsCsvFilePath << endl;
+                return mapRes;
             }
 
-            /* Read the cluster centroids CSV file */
-            std::vector<std::array<float, KMEANS_IMAGE_SIZE>> clusterCentroidsVector;
-            clusterCentroidsVector = dkm::load_csv<float, KMEANS_IMAGE_SIZE>(clusterCentroidsCsvFilePath.c_str());
+            uint64_t clusterBegin = statsStageBegin();
+            int clusterId = closestMappedCentroid(imgDataArray.data(), &centroidFileMap);
+            statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
 
-            /* Return the cluster id to which the input image belongs to */
-            int clusterId = dkm::predict<float, KMEANS_IMAGE_SIZE>(clusterCentroidsVector, imgDataArray);
+            unmapCentroidFile(&centroidFileMap);
 
-            /* Return the cluster id label applied to the input image */
             std::cout << clusterId;
+            return NO_ERROR;
+        }
+
+        /* Read the cluster centroids CSV file, rejecting centroids trained with another geometry */
+        std::vector<std::array<float, G::size>> clusterCentroidsVector;
+        int loadRes = loadCentroidsFromCsvFile<G>(clusterCentroidsCsvFilePath, pOptions->normalize, &clusterCentroidsVector);
+        if(loadRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to read the cluster centroids file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << clusterCentroidsCsvFilePath << endl;
+            return loadRes;
+        }
+
+        /* Return the cluster id to which the input image belongs to */
+        uint64_t clusterBegin = statsStageBegin();
+        int clusterId = closestCentroid<G::size>(imgDataArray, clusterCentroidsVector);
+        statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
+
+        /* Return the cluster id label applied to the input image */
+        std::cout << clusterId;
+    }
+    else if(mode == 4)
+    {
+        /** 
+         * Mode: batch predict.
+         * 
+         * A total of 4 arguments are expected:
+         *  - the mode id i.e., the "batch predict" mode in this case.
+         *  - the directory path of images to label, or "-" to read a list of image file paths from stdin.
+         *  - the directory path to move the labeled imaged to.
+         *  - the CSV file of the centroid file used to determine the labels to apply to the given images, or a quantized model file.
+         */
+        if(argc != 5)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"batch predict\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        string inputImgDirPath = argv[2];
+        string outputImgDirPath = argv[3];
+        string clusterCentroidsCsvFilePath = argv[4];
+
+        /* Cluster all images in the given directory */
+        int batchPredRes = batchPredict<G>(inputImgDirPath, outputImgDirPath, clusterCentroidsCsvFilePath, pOptions);
+
+        /* Exit program if failed to load input image. */
+        if(batchPredRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to cluster images in: " << inputImgDirPath << endl;
+            return batchPredRes;
+        }
+    }
+    else if(mode == 5)
+    {
+        /** 
+         * Mode: export.
+         * 
+         * A total of 3 arguments are expected:
+         *  - the mode id i.e., the "export" mode in this case.
+         *  - the binary training data file to read from.
+         *  - the CSV file path where the training data will be written to.
+         */
+        if(argc != 4)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"export\" mode." << endl;
+            return ERROR_ARGS;
         }
-        else if(mode == 4)
-        {
-            /** 
-             * Mode: batch predict.
-             * 
-             * A total of 4 arguments are expected:
-             *  - the mode id i.e., the "batch predict" mode in this case.
-             *  - the directory path of images to label.
-             *  - the directory path to move the labeled imaged to.
-             *  - the CSV file of the centroid file used to determine the labels to apply to the given images.
-             */
-            if(argc != 5)
+
+        /* Fetch arguments */
+        string trainingDataFilePath = argv[2];
+        string trainingDataCsvFilePath = argv[3];
+
+        /* Create CSV file path directories if they don't exist already */
+        int mkdirRes = mkdir_p_x(trainingDataCsvFilePath);
+
+        /* Exit program if directories were not created as expected */
+        if(mkdirRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to create directory for file path: " << trainingDataCsvFilePath << endl;
+            return mkdirRes;
+        }
+
+        /* Write all training data rows into the CSV file */
+        int exportedTrainingDataCount = 0;
+        int exportRes = exportTrainingDataToCsvFile<G>(trainingDataFilePath, pOptions->normalize, trainingDataCsvFilePath, &exportedTrainingDataCount);
+        if(exportRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to export training data file: " << trainingDataFilePath << " --> " << trainingDataCsvFilePath << endl;
+            return exportRes;
+        }
+
+        std::cout << exportedTrainingDataCount;
+    }
+    else if(mode == 6)
+    {
+        /** 
+         * Mode: import.
+         * 
+         * A total of 3 arguments are expected:
+         *  - the mode id i.e., the "import" mode in this case.
+         *  - the training data CSV file to read from.
+         *  - the binary training data file path where the training data will be appended to.
+         */
+        if(argc != 4)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"import\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        string trainingDataCsvFilePath = argv[2];
+        string trainingDataFilePath = argv[3];
+
+        /* Create training data file path directories if they don't exist already */
+        int mkdirRes = mkdir_p_x(trainingDataFilePath);
+
+        /* Exit program if directories were not created as expected */
+        if(mkdirRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to create directory for file path: " << trainingDataFilePath << endl;
+            return mkdirRes;
+        }
+
+        /* Append all CSV rows to the training data file */
+        int importedTrainingDataCount = 0;
+        int importRes = importTrainingDataFromCsvFile<G>(trainingDataCsvFilePath, pOptions->normalize, trainingDataFilePath, &importedTrainingDataCount);
+        if(importRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to import training data CSV file: " << trainingDataCsvFilePath << " --> " << trainingDataFilePath << endl;
+            return importRes;
+        }
+
+        std::cout << importedTrainingDataCount;
+    }
+    else if(mode == 7)
+    {
+        /** 
+         * Mode: serve.
+         * 
+         * A total of 2 or 3 arguments are expected:
+         *  - the mode id i.e., the "serve" mode in this case.
+         *  - the centroid CSV file used to determine the labels to apply to the images, or a quantized model file.
+         *  - (Optional) the UNIX domain socket path to listen on. Image paths are read from stdin if not given.
+         */
+        if(argc < 3 || argc > 4)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"serve\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        string clusterCentroidsCsvFilePath = argv[2];
+        string socketPath = (argc == 4) ? argv[3] : "";
+
+        /* Answer prediction requests until stdin is closed or the server is stopped */
+        int serveRes = runPredictServer<G>(clusterCentroidsCsvFilePath, pOptions->normalize, socketPath);
+        if(serveRes != NO_ERROR)
+        {
+            return serveRes;
+        }
+    }
+    else if(mode == 8)
+    {
+        /**
+         * Mode: quantize.
+         *
+         * A total of 3 or 4 arguments are expected:
+         *  - the mode id i.e., the "quantize" mode in this case.
+         *  - the centroids CSV or binary file to quantize.
+         *  - the quantized model file to write.
+         *  - (Optional) a directory, tar archive, or list of images to compare the float and quantized predictions on.
+         */
+        if(argc != 4 && argc != 5)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"quantize\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        string clusterCentroidsCsvFilePath = argv[2];
+        string quantizedModelFilePath = argv[3];
+
+        /* Read the cluster centroids file, rejecting centroids trained with another geometry */
+        std::vector<std::array<float, G::size>> clusterCentroidsVector;
+        int loadRes = loadCentroidsFromFile<G>(clusterCentroidsCsvFilePath, pOptions->normalize, &clusterCentroidsVector);
+        if(loadRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to read the cluster centroids file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << clusterCentroidsCsvFilePath << endl;
+            return loadRes;
+        }
+
+        /* Quantize and write the model */
+        QuantizedModel quantizedModel;
+        quantizeCentroids<G>(&clusterCentroidsVector, pOptions->normalize, pOptions->quantizeDtype, &quantizedModel);
+
+        int mkdirRes = mkdir_p_x(quantizedModelFilePath);
+        int writeRes = (mkdirRes != NO_ERROR) ? mkdirRes : writeQuantizedModelFile(quantizedModelFilePath, &quantizedModel);
+        if(writeRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to write the quantized model file: " << quantizedModelFilePath << endl;
+            return writeRes;
+        }
+
+        struct stat csvStat, modelStat;
+        if(stat(clusterCentroidsCsvFilePath.c_str(), &csvStat) == 0 && stat(quantizedModelFilePath.c_str(), &modelStat) == 0)
+        {
+            std::cout << "Model size: " << modelStat.st_size << " bytes (centroids CSV file: " << csvStat.st_size << " bytes)" << endl;
+        }
+
+        /* Compare the quantized predictions to the float ones */
+        if(argc == 5)
+        {
+            string validationImgDirPath = argv[4];
+
+            ImgBatch imgBatch;
+            int ingestRes = ingestImgSource(validationImgDirPath, G::width, G::height, G::channels, G::extractor, pOptions->workerCount, &imgBatch);
+            if(ingestRes != NO_ERROR)
             {
-                std::cerr << "Error: command-line argument count mismatch for \"batch predict\" mode." << endl;
-                return ERROR_ARGS;
+                std::cerr << "Error: failed to open the validation image directory: " << validationImgDirPath << endl;
+                return ingestRes;
+            }
+
+            size_t imgCount = 0;
+            size_t matchCount = 0;
+            array<float, G::size> imgDataArray;
+
+            for(size_t f = 0; f < imgBatch.imgFileNameVector.size(); f++)
+            {
+                if(imgBatch.imgDecodeResVector[f] != NO_ERROR)
+                {
+                    continue;
+                }
+
+                imgDataBufferToArray<G>(imgBatchDataBuffer(&imgBatch, f), pOptions->normalize, &imgDataArray);
+                uint32_t floatClusterId = closestCentroid<G::size>(imgDataArray, clusterCentroidsVector);
+                uint32_t quantizedClusterId = closestQuantizedCentroid(imgBatchDataBuffer(&imgBatch, f), &quantizedModel);
+
+                imgCount++;
+                if(floatClusterId == quantizedClusterId)
+                {
+                    matchCount++;
+                }
+                else
+                {
+                    std::cout << "Prediction mismatch: " << imgBatch.imgFileNameVector[f] << ": float " << floatClusterId << ", quantized " << quantizedClusterId << endl;
+                }
             }
 
-            /* Fetch arguments */
-            string inputImgDirPath = argv[2];
-            string outputImgDirPath = argv[3];
-            string clusterCentroidsCsvFilePath = argv[4];
+            std::cout << "Quantized predictions matching the float model: " << matchCount << " / " << imgCount << endl;
+        }
+    }
+    else if(mode == 9)
+    {
+        /**
+         * Mode: convert.
+         *
+         * A total of 3 arguments are expected:
+         *  - the mode id i.e., the "convert" mode in this case.
+         *  - the centroids file to read, either a CSV or a binary centroids file.
+         *  - the centroids file to write, in the other format.
+         */
+        if(argc != 4)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"convert\" mode." << endl;
+            return ERROR_ARGS;
+        }
 
-            /* Cluster all images in the given directory */
-            int batchPredRes = batchPredict(inputImgDirPath, outputImgDirPath, KMEANS_IMAGE_WIDTH, KMEANS_IMAGE_HEIGHT, KMEANS_IMAGE_CHANNELS, clusterCentroidsCsvFilePath);
+        /* Fetch arguments */
+        string inputCentroidsFilePath = argv[2];
+        string outputCentroidsFilePath = argv[3];
 
-            /* Exit program if failed to load input image. */
-            if(batchPredRes != NO_ERROR)
+        /* Read the cluster centroids file, rejecting centroids trained with another geometry */
+        const bool toCsv = isCentroidFile(inputCentroidsFilePath);
+        std::vector<std::array<float, G::size>> clusterCentroidsVector;
+        int loadRes = loadCentroidsFromFile<G>(inputCentroidsFilePath, pOptions->normalize, &clusterCentroidsVector);
+        if(loadRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to read the cluster centroids file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << inputCentroidsFilePath << endl;
+            return loadRes;
+        }
+
+        /* Write the centroids in the other format */
+        int mkdirRes = mkdir_p_x(outputCentroidsFilePath);
+        int writeRes = mkdirRes;
+        if(mkdirRes == NO_ERROR)
+        {
+            writeRes = toCsv ? replaceCentroidsCsvFile<G>(&clusterCentroidsVector, pOptions->normalize, outputCentroidsFilePath)
+                : writeCentroidFileFromVector<G>(&clusterCentroidsVector, pOptions->normalize, outputCentroidsFilePath);
+        }
+
+        if(writeRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to write the cluster centroids file: " << outputCentroidsFilePath << endl;
+            return writeRes;
+        }
+
+        std::cout << "Converted " << clusterCentroidsVector.size() << " centroids to a " << (toCsv ? "CSV" : "binary") << " centroids file" << endl;
+    }
+    else if(mode == 10)
+    {
+        /**
+         * Mode: sweep.
+         *
+         * A total of 5 or 6 arguments are expected:
+         *  - the mode id i.e., the "sweep" mode in this case.
+         *  - the smallest K number of clusters.
+         *  - the largest K number of clusters.
+         *  - the binary training data file.
+         *  - the training output CSV file where the cluster centroids of the selected K will be written to.
+         *  - (Optional) the JSON report file where the scores of every K will be written to.
+         */
+        if(argc != 6 && argc != 7)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"sweep\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        int minK = atoi(argv[2]);
+        int maxK = atoi(argv[3]);
+        string trainingDataFilePath = argv[4];
+        string clusterCentroidsCsvFilePath = argv[5];
+
+        /* Create clustered centroids CSV file path directories if they don't exist already */
+        int mkdirRes = mkdir_p_x(clusterCentroidsCsvFilePath);
+
+        /* Exit program if directories were not created as expected */
+        if(mkdirRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to create directory for file path: " << clusterCentroidsCsvFilePath << endl;
+            return mkdirRes;
+        }
+
+        /* Memory map the training data file */
+        FeatureStoreMap featureStoreMap;
+        int mapRes = mapFeatureStore(trainingDataFilePath, &featureStoreMap);
+        if(mapRes != NO_ERROR)
+        {
+            std::cerr << "Error: failed to read training data file: " << trainingDataFilePath << endl;
+            return mapRes;
+        }
+
+        /* Create the training data vector from the mapped rows, shared by all the runs */
+        FeatureMatrix<G::size> trainingImgVector;
+        int readRes = featureStoreToVector<G>(&featureStoreMap, pOptions->normalize, &trainingImgVector);
+        unmapFeatureStore(&featureStoreMap);
+
+        if(readRes != NO_ERROR)
+        {
+            std::cerr << "Error: training data file does not match the expected image geometry: " << trainingDataFilePath << endl;
+            return readRes;
+        }
+
+        /* Every K of the range needs at least one training data point per cluster */
+        if(minK < 2 || maxK < minK || (size_t)maxK > trainingImgVector.size())
+        {
+            std::cerr << "Error: K must range from 2 to the number of training data points (" << trainingImgVector.size() << "): " << minK << " to " << maxK << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Train and score every K */
+        SweepParams params;
+        params.minK = minK;
+        params.maxK = maxK;
+        params.seed = pOptions->hasSeed ? pOptions->seed : random_device()();
+        params.threadCount = pOptions->trainThreadCount;
+        params.useBounds = pOptions->engine == TRAINING_ENGINE_HAMERLY;
+        params.sampleSize = pOptions->sampleSize;
+
+        uint64_t clusterBegin = statsStageBegin();
+        vector<SweepResult> results;
+        vector<vector<array<float, G::size>>> centroidsPerK = kmeansSweep<G::size>(trainingImgVector, &params, &results);
+        statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
+
+        size_t selected = selectSweepResult(results, pOptions->sweepScore);
+
+        for(const SweepResult& result : results)
+        {
+            std::cout << "K: " << result.k << ", iterations: " << result.iterations << ", inertia: " << result.inertia
+                << ", silhouette: " << result.silhouette << ", davies-bouldin: " << result.daviesBouldin << endl;
+        }
+        std::cout << "Selected K (" << sweepScoreName(pOptions->sweepScore) << "): " << results[selected].k << endl;
+
+        /* Write the report file */
+        if(argc == 7)
+        {
+            string reportFilePath = argv[6];
+            int reportRes = writeSweepReport(reportFilePath, results, selected, pOptions->sweepScore);
+            if(reportRes != NO_ERROR)
             {
-                std::cerr << "Error: failed to cluster images in: " << inputImgDirPath << endl;
-                return batchPredRes;
+                std::cerr << "Error: failed to write the report file: " << reportFilePath << endl;
+                return reportRes;
             }
         }
-        else
+
+        /* Write the cluster centroids of the selected K to a CSV file */
+        tuple<std::vector<std::array<float, G::size>>, vector<uint32_t>> clusterData;
+        std::get<0>(clusterData) = centroidsPerK[selected];
+
+        int centroidsRes = writeCentroidsToCsvFile<G>(&clusterData, pOptions->normalize, clusterCentroidsCsvFilePath);
+        if(centroidsRes != NO_ERROR)
         {
-            std::cerr << "Error: invalid mode id." << endl;
-            return ERROR_MODE;
+            return centroidsRes;
         }
     }
+    else if(mode == 11)
+    {
+        /**
+         * Mode: watch.
+         *
+         * A total of 4 arguments are expected:
+         *  - the mode id i.e., the "watch" mode in this case.
+         *  - the input directory path to watch for new images.
+         *  - the output directory path where the labeled images will be moved to.
+         *  - the centroid CSV file used to determine the labels to apply to the images, or a quantized model file.
+         */
+        if(argc != 5)
+        {
+            std::cerr << "Error: command-line argument count mismatch for \"watch\" mode." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Fetch arguments */
+        string inputImgDirPath = argv[2];
+        string outputImgDirPath = argv[3];
+        string clusterCentroidsCsvFilePath = argv[4];
+
+        /* Label the images as they arrive until the watch is stopped */
+        int watchRes = runWatchPredict<G>(inputImgDirPath, outputImgDirPath, clusterCentroidsCsvFilePath, pOptions->normalize,
+            pOptions->workerCount, pOptions->watchBatch, pOptions->watchQueue);
+        if(watchRes != NO_ERROR)
+        {
+            return watchRes;
+        }
+    }
+    else
+    {
+        std::cerr << "Error: invalid mode id." << endl;
+        return ERROR_MODE;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * There are 12 modes: train now, collect, train, predict, batch predict, export, import, serve, quantize, convert, sweep, and watch.
+ *      mode 0 -  train now: train with the available images without persisting the training data in a .txt file.
+ *                           in practical terms this mode only really serves for testing and debugging during development.
+ *                           can optionally enable copying the input image files into clustered directors in kmeans/clusters/<label>/
+ *      mode 1 -    collect: append training data to a binary training data file.
+ *      mode 2 -      train: memory map the binary training data file and build clusters. Write centroids in a CSV file.
+ *      mode 3 -    predict: calculate distances from each centroid apply nearest cluster to the image ipunt.
+ *      mode 4 - batch predict: predict and move all images of a directory into their cluster directories.
+ *      mode 5 -     export: write the content of a binary training data file into a CSV file.
+ *      mode 6 -     import: append the content of a training data CSV file to a binary training data file.
+ *      mode 7 -      serve: load the centroids once and predict the images whose paths are received on stdin or on a UNIX domain socket.
+ *      mode 8 -   quantize: write a uint8 or uint16 quantized model of a centroids CSV file, used by the prediction modes.
+ *      mode 9 -    convert: convert a centroids CSV file to a memory mappable binary centroids file, or back.
+ *      mode 10 -     sweep: train a range of K concurrently from a binary training data file and keep the best scoring centroids.
+ *      mode 11 -     watch: label the images of a directory as they are written and move them into their cluster directories.
+ */
+int main(int argc, char **argv)
+{
+    try
+    {
+        /* Check that at least the "mode" argument is given */
+        if(argc < 2)
+        {
+            std::cerr << "Error: command-line argument count mismatch." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Parse and remove the optional flags, the remaining arguments are positional */
+        Options options;
+        initOptions(&options);
+
+        int parseRes = parseOptions(&argc, argv, &options);
+        if(parseRes != NO_ERROR)
+        {
+            return parseRes;
+        }
+
+        /* Check that the "mode" argument is still given */
+        if(argc < 2)
+        {
+            std::cerr << "Error: command-line argument count mismatch." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Only the parallel and hamerly engines can be seeded per restart */
+        if(options.restarts != 1 && options.engine != TRAINING_ENGINE_PARALLEL && options.engine != TRAINING_ENGINE_HAMERLY)
+        {
+            std::cerr << "Error: --restarts requires the parallel or hamerly engine." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* The extractors write their own geometry */
+        if(options.hasGeometry && options.featureExtractor != FEATURE_EXTRACTOR_PIXELS)
+        {
+            std::cerr << "Error: --geometry is only supported on the pixels, not with --features." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* The extracted features are already a handful of values */
+        if(options.pcaDimensions != 0 && options.featureExtractor != FEATURE_EXTRACTOR_PIXELS)
+        {
+            std::cerr << "Error: --pca is only supported on the pixels, not with --features." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* The mini-batch engine streams the training data file, it cannot be projected as a whole */
+        if(options.pcaDimensions != 0 && options.engine == TRAINING_ENGINE_MINIBATCH)
+        {
+            std::cerr << "Error: --pca is not supported with the minibatch engine." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* The other engines always seed with k-means++ */
+        if(options.init != KMEANS_INIT_PLUS_PLUS && options.engine != TRAINING_ENGINE_PARALLEL && options.engine != TRAINING_ENGINE_HAMERLY)
+        {
+            std::cerr << "Error: --init requires the parallel or hamerly engine." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Serve and watch run until stopped and label images that are not seen again: the cache would only grow */
+        const int mode = atoi(argv[1]);
+        if(!options.cacheFilePath.empty() && (mode == 7 || mode == 11))
+        {
+            std::cerr << "Error: --cache is not supported in the serve and watch modes." << endl;
+            return ERROR_ARGS;
+        }
+
+        /* Select the downsampler of the decoded images */
+        setImgResizeFilter(options.resizeFilter);
+
+        /* Read the image files ahead of the decoders if asked for */
+        setImgReadAhead(options.readAhead, options.readEngine);
+
+        /* Record the per-stage timings and counters if asked for */
+        if(options.stats || !options.statsFilePath.empty())
+        {
+            enableStats();
+        }
+
+        /* Read the unchanged images from the feature cache instead of decoding them */
+        if(!options.cacheFilePath.empty() && openFeatureCache(options.cacheFilePath, (uint64_t)options.cacheSize * 1024 * 1024) != NO_ERROR)
+        {
+            std::cerr << "Error: failed to read the feature cache file: " << options.cacheFilePath << endl;
+            return ERROR_READING_CACHE;
+        }
+
+        /* Run the selected mode with the selected image geometry, or with the geometry of the selected features */
+        int modeRes;
+        switch(featureGeometryId(options.featureExtractor, options.geometryId))
+        {
+            case GEOMETRY_16X16_GREY:
+                modeRes = runMode<Geometry16x16Grey>(argc, argv, &options);
+                break;
+            case GEOMETRY_20X20_GREY:
+                modeRes = runMode<Geometry20x20Grey>(argc, argv, &options);
+                break;
+            case GEOMETRY_32X32_GREY:
+                modeRes = runMode<Geometry32x32Grey>(argc, argv, &options);
+                break;
+            case GEOMETRY_20X20_RGB:
+                modeRes = runMode<Geometry20x20Rgb>(argc, argv, &options);
+                break;
+            case GEOMETRY_COLOUR_HISTOGRAM:
+                modeRes = runMode<GeometryColourHistogram>(argc, argv, &options);
+                break;
+            case GEOMETRY_EDGE_HISTOGRAM:
+                modeRes = runMode<GeometryEdgeHistogram>(argc, argv, &options);
+                break;
+            case GEOMETRY_TEXTURE:
+                modeRes = runMode<GeometryTexture>(argc, argv, &options);
+                break;
+            default:
+                std::cerr << "Error: invalid geometry." << endl;
+                return ERROR_ARGS;
+        }
+
+        /* Keep the decoded images for the next runs, a cache that cannot be written only costs decoding them again */
+        if(saveFeatureCache() != NO_ERROR)
+        {
+            std::cerr << "Error: failed to write the feature cache file: " << options.cacheFilePath << endl;
+        }
+
+        /* Report the stats, on stderr so that they don't mix with the predicted labels */
+        if(options.stats)
+        {
+            printStatsSummary(std::cerr);
+        }
+
+        if(!options.statsFilePath.empty() && writeStatsFile(options.statsFilePath, options.statsFormat) != NO_ERROR)
+        {
+            std::cerr << "Error: failed to write the stats file: " << options.statsFilePath << endl;
+            return (modeRes != NO_ERROR) ? modeRes : ERROR_WRITING_STATS;
+        }
+
+        return modeRes;
+    }
     catch(const std::exception& e)
     {
         /* Unknown exception */
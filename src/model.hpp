@@ -0,0 +1,197 @@
+/**
+ * Cluster centroids CSV file (model).
+ *
+ * The first line records the image geometry and normalization the centroids were trained with:
+ *      #width=20,height=20,channels=1,normalize=1
+ * Centroids of extracted features also record the extractor and its parameters, e.g.:
+ *      #width=16,height=4,channels=1,normalize=1,features=colour-histogram,bins=16,working_size=64
+ * It is followed by one row of comma separated values per centroid.
+ * Files written before the geometry line was introduced are still accepted as long as their rows
+ * have the expected number of values.
+ */
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <tuple>
+
+#include "error_codes.hpp"
+#include "geometry.hpp"
+
+/* Prefix of the geometry line of a centroids file */
+#define MODEL_GEOMETRY_LINE_PREFIX                                                                    "#"
+
+/**
+ * Builds the geometry line of a centroids file, without the line break.
+ */
+template <typename G>
+std::string modelGeometryLine(int normalize)
+{
+    char line[192];
+    int length = snprintf(line, sizeof(line), MODEL_GEOMETRY_LINE_PREFIX "width=%d,height=%d,channels=%d,normalize=%d",
+        G::width, G::height, G::channels, normalize);
+
+    /* The line of pixel centroids is unchanged so that existing models still load */
+    if(G::extractor != FEATURE_EXTRACTOR_PIXELS)
+    {
+        snprintf(line + length, sizeof(line) - length, ",features=%s,bins=%d,working_size=%d",
+            featureExtractorName(G::extractor), G::width, FEATURE_EXTRACTOR_WORKING_SIZE);
+    }
+
+    return std::string(line);
+}
+
+template <typename G>
+int writeCentroidsToCsvFile(std::tuple<std::vector<std::array<float, G::size>>, std::vector<uint32_t>> *pClusterData, int normalize, std::string clusterCentroidsCsvFilePath)
+{
+    try{
+        /* Create a new CSV file and write centroid rows to it */
+        std::ofstream clusterCentroidsCsvFile(clusterCentroidsCsvFilePath.c_str());
+
+        /* Record the geometry the centroids were trained with */
+        clusterCentroidsCsvFile << modelGeometryLine<G>(normalize) << "\n";
+
+        /* For each means vector */
+        for (const auto& means : std::get<0>(*pClusterData))
+        {
+            /* Initialize the CSV data row */
+            std::string csvRow("");
+
+            /* Write all mean values in a CSV row */
+            for(float m : means)
+            {
+                csvRow.append(std::to_string(m));
+                csvRow.append(",");
+            }
+
+            /* Write row to the CSV file */
+            csvRow.append("\n");
+            clusterCentroidsCsvFile << csvRow;
+        }
+
+        /* Close CSV file */
+        clusterCentroidsCsvFile.close();
+    }
+    catch(...)
+    {
+        std::cout << "Error: an unknown error occured while writing the CSV output file for the cluster centroids: " << clusterCentroidsCsvFilePath << std::endl;
+        return ERROR_WRITING_CENTROID;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Replaces a centroids CSV file atomically: the centroids are written to a temporary file in the same directory,
+ * flushed to disk, then renamed over the original file. Readers such as the predict server either see the old
+ * or the new centroids, never a partially written file.
+ */
+template <typename G>
+int replaceCentroidsCsvFile(const std::vector<std::array<float, G::size>> *pClusterCentroidsVector, int normalize, std::string clusterCentroidsCsvFilePath)
+{
+    std::string tmpFilePath = clusterCentroidsCsvFilePath + ".tmp." + std::to_string(getpid());
+
+    std::tuple<std::vector<std::array<float, G::size>>, std::vector<uint32_t>> clusterData(*pClusterCentroidsVector, std::vector<uint32_t>());
+    int writeRes = writeCentroidsToCsvFile<G>(&clusterData, normalize, tmpFilePath);
+
+    /* Make sure the content is on disk before it becomes visible under the original name */
+    int fd = (writeRes == NO_ERROR) ? open(tmpFilePath.c_str(), O_RDONLY) : -1;
+    if(fd < 0 || fsync(fd) != 0 || rename(tmpFilePath.c_str(), clusterCentroidsCsvFilePath.c_str()) != 0)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        unlink(tmpFilePath.c_str());
+        return ERROR_WRITING_CENTROID;
+    }
+
+    close(fd);
+    return NO_ERROR;
+}
+
+/**
+ * Reads a centroids CSV file.
+ * Rejects files trained with a different geometry or normalization than the expected one.
+ */
+template <typename G>
+int loadCentroidsFromCsvFile(std::string clusterCentroidsCsvFilePath, int normalize, std::vector<std::array<float, G::size>> *pClusterCentroidsVector)
+{
+    std::ifstream clusterCentroidsCsvFile(clusterCentroidsCsvFilePath.c_str());
+    if(!clusterCentroidsCsvFile.is_open())
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    pClusterCentroidsVector->clear();
+
+    std::string line;
+    while(std::getline(clusterCentroidsCsvFile, line))
+    {
+        /* Check the geometry line against the expected geometry */
+        if(line.compare(0, sizeof(MODEL_GEOMETRY_LINE_PREFIX) - 1, MODEL_GEOMETRY_LINE_PREFIX) == 0)
+        {
+            if(line != modelGeometryLine<G>(normalize))
+            {
+                return ERROR_MODEL_MISMATCH;
+            }
+            continue;
+        }
+
+        /* Skip blank lines */
+        if(line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+
+        /* Parse the comma separated centroid values */
+        std::array<float, G::size> centroid;
+        const char *p = line.c_str();
+        size_t i = 0;
+
+        while(*p != '\0' && *p != '\r')
+        {
+            char *end;
+            float value = strtof(p, &end);
+            if(end == p)
+            {
+                return ERROR_READING_CENTROID;
+            }
+
+            /* A row with more values than expected was trained with another geometry */
+            if(i == G::size)
+            {
+                return ERROR_MODEL_MISMATCH;
+            }
+
+            centroid[i++] = value;
+            p = (*end == ',') ? end + 1 : end;
+        }
+
+        /* A row with fewer values than expected was trained with another geometry */
+        if(i != G::size)
+        {
+            return ERROR_MODEL_MISMATCH;
+        }
+
+        pClusterCentroidsVector->push_back(centroid);
+    }
+
+    if(pClusterCentroidsVector->size() == 0)
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    return NO_ERROR;
+}
+
+#endif
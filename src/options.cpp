@@ -0,0 +1,563 @@
+#include "options.hpp"
+
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+
+#include "error_codes.hpp"
+#include "geometry.hpp"
+#include "stats.hpp"
+#include "downsample.hpp"
+#include "quantized_model.hpp"
+#include "sweep.hpp"
+#include "kmeans.hpp"
+#include "read_ahead.hpp"
+
+using namespace std;
+
+void initOptions(Options *pOptions)
+{
+    /* Decode images serially unless told otherwise */
+    pOptions->workerCount = 1;
+
+    /* Train with dkm unless told otherwise */
+    pOptions->engine = TRAINING_ENGINE_DKM;
+    pOptions->trainThreadCount = 0;
+    pOptions->seed = 0;
+    pOptions->hasSeed = 0;
+    pOptions->restarts = 1;
+    pOptions->abandonAfter = 0;
+    pOptions->init = KMEANS_INIT_PLUS_PLUS;
+    pOptions->oversampling = 2.0f;
+
+    /* The 20x20 greyscale normalized pixels the project was built around */
+    pOptions->geometryId = DEFAULT_GEOMETRY;
+    pOptions->hasGeometry = 0;
+    pOptions->normalize = 1;
+    pOptions->featureExtractor = FEATURE_EXTRACTOR_PIXELS;
+
+    /* Mini-batch engine settings */
+    pOptions->batchSize = 1024;
+    pOptions->iterations = 100;
+    pOptions->compareLloyd = 0;
+
+    /* Train on the pixels unless told otherwise */
+    pOptions->pcaDimensions = 0;
+    pOptions->compareFull = 0;
+
+    /* Batch predict only reads the centroids unless told otherwise */
+    pOptions->onlineUpdate = ONLINE_UPDATE_NONE;
+    pOptions->learningRate = 0.01f;
+    pOptions->onlineWeight = 100;
+
+    /* No stats unless asked for */
+    pOptions->stats = 0;
+    pOptions->statsFilePath = "";
+    pOptions->statsFormat = STATS_FORMAT_JSON;
+
+    /* Downsample with stb_image_resize unless told otherwise */
+    pOptions->resizeFilter = IMG_RESIZE_FILTER_STB;
+
+    /* Smallest quantized models unless told otherwise */
+    pOptions->quantizeDtype = QUANTIZED_MODEL_DTYPE_UINT8;
+
+    /* Select K with the silhouette of a sample unless told otherwise */
+    pOptions->sweepScore = SWEEP_SCORE_SILHOUETTE;
+    pOptions->sampleSize = 1000;
+
+    /* Decode every image unless a feature cache is given */
+    pOptions->cacheFilePath = "";
+    pOptions->cacheSize = 64;
+
+    /* Each decoder reads its own files unless told otherwise */
+    pOptions->readAhead = 0;
+    pOptions->readEngine = READ_ENGINE_IO_URING;
+
+    /* Images are copied or moved into the cluster directories unless told otherwise */
+    pOptions->link = 0;
+    pOptions->manifestFilePath = "";
+
+    /* Watch mode batching and backpressure */
+    pOptions->watchBatch = 64;
+    pOptions->watchQueue = 1024;
+}
+
+/**
+ * Parses a non-negative integer flag value.
+ */
+static int parseCountValue(const char *flag, const char *value, int *pCount)
+{
+    char *end;
+    long count = strtol(value, &end, 10);
+
+    if(*value == '\0' || *end != '\0' || count < 0)
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    *pCount = (int)count;
+    return NO_ERROR;
+}
+
+/**
+ * Parses an unsigned 64-bit integer flag value.
+ */
+static int parseSeedValue(const char *flag, const char *value, uint64_t *pSeed)
+{
+    char *end;
+    unsigned long long seed = strtoull(value, &end, 10);
+
+    if(*value == '\0' || *value == '-' || *end != '\0')
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    *pSeed = (uint64_t)seed;
+    return NO_ERROR;
+}
+
+/**
+ * Parses a training engine name.
+ */
+static int parseEngineValue(const char *flag, const char *value, int *pEngine)
+{
+    if(strcmp(value, "dkm") == 0)
+    {
+        *pEngine = TRAINING_ENGINE_DKM;
+    }
+    else if(strcmp(value, "parallel") == 0)
+    {
+        *pEngine = TRAINING_ENGINE_PARALLEL;
+    }
+    else if(strcmp(value, "minibatch") == 0)
+    {
+        *pEngine = TRAINING_ENGINE_MINIBATCH;
+    }
+    else if(strcmp(value, "hamerly") == 0)
+    {
+        *pEngine = TRAINING_ENGINE_HAMERLY;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses an online update name.
+ */
+static int parseOnlineUpdateValue(const char *flag, const char *value, int *pOnlineUpdate)
+{
+    if(strcmp(value, "mean") == 0)
+    {
+        *pOnlineUpdate = ONLINE_UPDATE_MEAN;
+    }
+    else if(strcmp(value, "decay") == 0)
+    {
+        *pOnlineUpdate = ONLINE_UPDATE_DECAY;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses a stats file format name.
+ */
+static int parseStatsFormatValue(const char *flag, const char *value, int *pStatsFormat)
+{
+    if(strcmp(value, "json") == 0)
+    {
+        *pStatsFormat = STATS_FORMAT_JSON;
+    }
+    else if(strcmp(value, "prometheus") == 0)
+    {
+        *pStatsFormat = STATS_FORMAT_PROMETHEUS;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses an image downsampler name.
+ */
+static int parseResizeFilterValue(const char *flag, const char *value, int *pResizeFilter)
+{
+    if(strcmp(value, "stb") == 0)
+    {
+        *pResizeFilter = IMG_RESIZE_FILTER_STB;
+    }
+    else if(strcmp(value, "box") == 0)
+    {
+        *pResizeFilter = IMG_RESIZE_FILTER_BOX;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses a read-ahead engine name.
+ */
+static int parseReadEngineValue(const char *flag, const char *value, int *pReadEngine)
+{
+    if(strcmp(value, "io_uring") == 0)
+    {
+        *pReadEngine = READ_ENGINE_IO_URING;
+    }
+    else if(strcmp(value, "threads") == 0)
+    {
+        *pReadEngine = READ_ENGINE_THREADS;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses a quantized model data type name.
+ */
+static int parseQuantizeDtypeValue(const char *flag, const char *value, int *pQuantizeDtype)
+{
+    if(strcmp(value, "uint8") == 0)
+    {
+        *pQuantizeDtype = QUANTIZED_MODEL_DTYPE_UINT8;
+    }
+    else if(strcmp(value, "uint16") == 0)
+    {
+        *pQuantizeDtype = QUANTIZED_MODEL_DTYPE_UINT16;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses a K sweep score name.
+ */
+static int parseSweepScoreValue(const char *flag, const char *value, int *pSweepScore)
+{
+    if(strcmp(value, "elbow") == 0)
+    {
+        *pSweepScore = SWEEP_SCORE_ELBOW;
+    }
+    else if(strcmp(value, "silhouette") == 0)
+    {
+        *pSweepScore = SWEEP_SCORE_SILHOUETTE;
+    }
+    else if(strcmp(value, "davies-bouldin") == 0)
+    {
+        *pSweepScore = SWEEP_SCORE_DAVIES_BOULDIN;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses a rate flag value in (0, 1].
+ */
+static int parseRateValue(const char *flag, const char *value, float *pRate)
+{
+    char *end;
+    float rate = strtof(value, &end);
+
+    if(*value == '\0' || *end != '\0' || !(rate > 0.0f && rate <= 1.0f))
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    *pRate = rate;
+    return NO_ERROR;
+}
+
+/**
+ * Parses a Lloyd engine initialization name.
+ */
+static int parseInitValue(const char *flag, const char *value, int *pInit)
+{
+    if(strcmp(value, "kmeans++") == 0)
+    {
+        *pInit = KMEANS_INIT_PLUS_PLUS;
+    }
+    else if(strcmp(value, "kmeans||") == 0)
+    {
+        *pInit = KMEANS_INIT_PARALLEL;
+    }
+    else
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Parses a positive factor flag value.
+ */
+static int parseFactorValue(const char *flag, const char *value, float *pFactor)
+{
+    char *end;
+    float factor = strtof(value, &end);
+
+    if(*value == '\0' || *end != '\0' || !(factor > 0.0f && factor < 1e6f))
+    {
+        std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+        return ERROR_ARGS;
+    }
+
+    *pFactor = factor;
+    return NO_ERROR;
+}
+
+/* Flags followed by a value */
+static const char *valueFlags[] = {
+    "-j", "-t", "--engine", "--seed", "--geometry", "--features", "--normalize", "--batch-size", "--iterations",
+    "--online", "--learning-rate", "--online-weight",
+    "--stats-file", "--stats-format", "--resize",
+    "--quantize", "--score", "--sample-size", "--restarts", "--abandon-after", "--init", "--oversampling", "--pca",
+    "--cache", "--cache-size", "--watch-batch", "--watch-queue", "--manifest", "--read-ahead", "--read-engine"
+};
+
+/* Flags on their own */
+static const char *switchFlags[] = {
+    "--compare-lloyd", "--stats", "--link", "--compare-full"
+};
+
+/**
+ * Whether or not the argument is one of the given flags.
+ */
+static bool isOneOf(const char *arg, const char **flags, size_t flagCount)
+{
+    for(size_t f = 0; f < flagCount; f++)
+    {
+        if(strcmp(arg, flags[f]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int parseOptions(int *pArgc, char **argv, Options *pOptions)
+{
+    /* Positional arguments are compacted to the front of argv */
+    int positionalCount = 1;
+
+    for(int i = 1; i < *pArgc; i++)
+    {
+        const char *flag = argv[i];
+        int parseRes = NO_ERROR;
+
+        if(isOneOf(flag, switchFlags, sizeof(switchFlags) / sizeof(switchFlags[0])))
+        {
+            if(strcmp(flag, "--compare-lloyd") == 0)
+            {
+                pOptions->compareLloyd = 1;
+            }
+            else if(strcmp(flag, "--stats") == 0)
+            {
+                pOptions->stats = 1;
+            }
+            else if(strcmp(flag, "--link") == 0)
+            {
+                pOptions->link = 1;
+            }
+            else if(strcmp(flag, "--compare-full") == 0)
+            {
+                pOptions->compareFull = 1;
+            }
+            continue;
+        }
+
+        if(!isOneOf(flag, valueFlags, sizeof(valueFlags) / sizeof(valueFlags[0])))
+        {
+            argv[positionalCount++] = argv[i];
+            continue;
+        }
+
+        if(i + 1 >= *pArgc)
+        {
+            std::cerr << "Error: missing value for " << flag << endl;
+            return ERROR_ARGS;
+        }
+
+        const char *value = argv[++i];
+
+        if(strcmp(flag, "-j") == 0)
+        {
+            parseRes = parseCountValue(flag, value, &pOptions->workerCount);
+        }
+        else if(strcmp(flag, "-t") == 0)
+        {
+            parseRes = parseCountValue(flag, value, &pOptions->trainThreadCount);
+        }
+        else if(strcmp(flag, "--engine") == 0)
+        {
+            parseRes = parseEngineValue(flag, value, &pOptions->engine);
+        }
+        else if(strcmp(flag, "--seed") == 0)
+        {
+            parseRes = parseSeedValue(flag, value, &pOptions->seed);
+            pOptions->hasSeed = 1;
+        }
+        else if(strcmp(flag, "--geometry") == 0)
+        {
+            parseRes = parseGeometryName(value, &pOptions->geometryId);
+            pOptions->hasGeometry = 1;
+            if(parseRes != NO_ERROR)
+            {
+                std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+            }
+        }
+        else if(strcmp(flag, "--features") == 0)
+        {
+            parseRes = parseFeatureExtractorName(value, &pOptions->featureExtractor);
+            if(parseRes != NO_ERROR)
+            {
+                std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+            }
+        }
+        else if(strcmp(flag, "--normalize") == 0)
+        {
+            parseRes = parseCountValue(flag, value, &pOptions->normalize);
+            if(parseRes == NO_ERROR && pOptions->normalize > 1)
+            {
+                std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+                parseRes = ERROR_ARGS;
+            }
+        }
+        else if(strcmp(flag, "--batch-size") == 0 || strcmp(flag, "--iterations") == 0 || strcmp(flag, "--sample-size") == 0
+            || strcmp(flag, "--restarts") == 0 || strcmp(flag, "--watch-batch") == 0 || strcmp(flag, "--watch-queue") == 0)
+        {
+            int *pCount = (strcmp(flag, "--batch-size") == 0) ? &pOptions->batchSize
+                : (strcmp(flag, "--iterations") == 0) ? &pOptions->iterations
+                : (strcmp(flag, "--sample-size") == 0) ? &pOptions->sampleSize
+                : (strcmp(flag, "--restarts") == 0) ? &pOptions->restarts
+                : (strcmp(flag, "--watch-batch") == 0) ? &pOptions->watchBatch : &pOptions->watchQueue;
+            parseRes = parseCountValue(flag, value, pCount);
+            if(parseRes == NO_ERROR && *pCount == 0)
+            {
+                std::cerr << "Error: invalid value for " << flag << ": " << value << endl;
+                parseRes = ERROR_ARGS;
+            }
+        }
+        else if(strcmp(flag, "--online") == 0)
+        {
+            parseRes = parseOnlineUpdateValue(flag, value, &pOptions->onlineUpdate);
+        }
+        else if(strcmp(flag, "--learning-rate") == 0)
+        {
+            parseRes = parseRateValue(flag, value, &pOptions->learningRate);
+        }
+        else if(strcmp(flag, "--online-weight") == 0)
+        {
+            parseRes = parseCountValue(flag, value, &pOptions->onlineWeight);
+        }
+        else if(strcmp(flag, "--abandon-after") == 0)
+        {
+            parseRes = parseCountValue(flag, value, &pOptions->abandonAfter);
+        }
+        else if(strcmp(flag, "--pca") == 0)
+        {
+            /* The projected training data is clustered with fixed-size arrays, like the geometries */
+            parseRes = parseCountValue(flag, value, &pOptions->pcaDimensions);
+            if(parseRes == NO_ERROR && pOptions->pcaDimensions != 16 && pOptions->pcaDimensions != 32 && pOptions->pcaDimensions != 64)
+            {
+                std::cerr << "Error: invalid value for " << flag << " (16, 32, or 64): " << value << endl;
+                parseRes = ERROR_ARGS;
+            }
+        }
+        else if(strcmp(flag, "--init") == 0)
+        {
+            parseRes = parseInitValue(flag, value, &pOptions->init);
+        }
+        else if(strcmp(flag, "--oversampling") == 0)
+        {
+            parseRes = parseFactorValue(flag, value, &pOptions->oversampling);
+        }
+        else if(strcmp(flag, "--manifest") == 0)
+        {
+            pOptions->manifestFilePath = value;
+        }
+        else if(strcmp(flag, "--cache") == 0)
+        {
+            pOptions->cacheFilePath = value;
+        }
+        else if(strcmp(flag, "--cache-size") == 0)
+        {
+            parseRes = parseCountValue(flag, value, &pOptions->cacheSize);
+        }
+        else if(strcmp(flag, "--read-ahead") == 0)
+        {
+            parseRes = parseCountValue(flag, value, &pOptions->readAhead);
+        }
+        else if(strcmp(flag, "--read-engine") == 0)
+        {
+            parseRes = parseReadEngineValue(flag, value, &pOptions->readEngine);
+        }
+        else if(strcmp(flag, "--stats-file") == 0)
+        {
+            pOptions->statsFilePath = value;
+        }
+        else if(strcmp(flag, "--stats-format") == 0)
+        {
+            parseRes = parseStatsFormatValue(flag, value, &pOptions->statsFormat);
+        }
+        else if(strcmp(flag, "--resize") == 0)
+        {
+            parseRes = parseResizeFilterValue(flag, value, &pOptions->resizeFilter);
+        }
+        else if(strcmp(flag, "--quantize") == 0)
+        {
+            parseRes = parseQuantizeDtypeValue(flag, value, &pOptions->quantizeDtype);
+        }
+        else if(strcmp(flag, "--score") == 0)
+        {
+            parseRes = parseSweepScoreValue(flag, value, &pOptions->sweepScore);
+        }
+
+        if(parseRes != NO_ERROR)
+        {
+            return parseRes;
+        }
+    }
+
+    argv[positionalCount] = NULL;
+    *pArgc = positionalCount;
+
+    return NO_ERROR;
+}
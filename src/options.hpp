@@ -0,0 +1,79 @@
+/**
+ * Optional command-line flags.
+ *
+ * Flags can be given anywhere on the command line, either on their own or followed by a value. They are removed from the argument list
+ * so that the positional arguments of each mode keep their documented positions.
+ */
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdint.h>
+#include <string>
+
+/* K-Means training engines */
+typedef enum _training_engine {
+    TRAINING_ENGINE_DKM       = 0, /* dkm::kmeans_lloyd, single-threaded */
+    TRAINING_ENGINE_PARALLEL  = 1, /* kmeansLloydParallel, multithreaded and reproducible for a given seed */
+    TRAINING_ENGINE_MINIBATCH = 2, /* kmeansMiniBatch, bounded memory */
+    TRAINING_ENGINE_HAMERLY   = 3  /* kmeansHamerlyParallel, same result as the parallel engine with fewer distance evaluations */
+} trainingEngine;
+
+/* Online centroid updates of batch predict */
+typedef enum _online_update {
+    ONLINE_UPDATE_NONE  = 0, /* The centroids are only read */
+    ONLINE_UPDATE_MEAN  = 1, /* Running mean: learning rate of 1 / (prior weight + points assigned so far) */
+    ONLINE_UPDATE_DECAY = 2  /* Constant learning rate, older points decay exponentially */
+} onlineUpdate;
+
+typedef struct _options {
+    int workerCount;        /* -j N: number of image decoding workers, 0 for one per available core */
+    int engine;             /* --engine dkm|parallel|minibatch|hamerly: training engine, one of trainingEngine */
+    int trainThreadCount;   /* -t N: number of training threads of the parallel engine, 0 for one per available core */
+    uint64_t seed;          /* --seed S: seed of the parallel engine initialization */
+    int hasSeed;            /* Whether or not --seed was given, a random seed is used otherwise */
+    int restarts;           /* --restarts N: number of trainings of the parallel and hamerly engines, the lowest inertia one is kept */
+    int abandonAfter;       /* --abandon-after N: Lloyd iteration after which a restart that is not below the best inertia stops, 0 to never abandon */
+    int init;               /* --init kmeans++|kmeans||: initialization of the parallel and hamerly engines, one of kmeansInit */
+    float oversampling;     /* --oversampling F: candidates per round of the kmeans|| initialization, as a multiple of K */
+    int geometryId;         /* --geometry NAME: image geometry, one of geometryIds */
+    int hasGeometry;        /* Whether or not --geometry was given, the extractors have their own geometry */
+    int normalize;          /* --normalize 0|1: whether or not the pixel values are normalized */
+    int featureExtractor;   /* --features NAME: features of the images instead of the pixels of the geometry, one of featureExtractors */
+    int batchSize;          /* --batch-size N: number of points per mini-batch of the minibatch engine */
+    int iterations;         /* --iterations N: number of mini-batches of the minibatch engine */
+    int compareLloyd;       /* --compare-lloyd: also train with the parallel Lloyd engine and report both inertias */
+    int pcaDimensions;      /* --pca D: train on the projection of the training data on its D principal components, 0 to train on the pixels */
+    int compareFull;        /* --compare-full: with --pca, also train on the pixels and report the agreement and the speedup */
+    int onlineUpdate;       /* --online mean|decay: batch predict updates the centroids, one of onlineUpdate */
+    float learningRate;     /* --learning-rate R: learning rate of the decay online update, in (0, 1] */
+    int onlineWeight;       /* --online-weight N: number of points the loaded centroids weigh in the running mean online update */
+    int stats;              /* --stats: print a summary of the per-stage timings and counters */
+    std::string statsFilePath; /* --stats-file PATH: also write the stats to a file, empty if not given */
+    int statsFormat;        /* --stats-format json|prometheus: format of the stats file, one of statsFormats */
+    int resizeFilter;       /* --resize stb|box: downsampler of the decoded images, one of imgResizeFilters */
+    int quantizeDtype;      /* --quantize uint8|uint16: data type of the quantized model, one of quantizedModelDtype */
+    int sweepScore;         /* --score elbow|silhouette|davies-bouldin: score the sweep mode selects K with, one of sweepScore */
+    int sampleSize;         /* --sample-size N: number of points of the silhouette sample of the sweep mode */
+    std::string cacheFilePath; /* --cache PATH: feature cache file of the decoded images, empty if not given */
+    int cacheSize;          /* --cache-size MB: size cap of the feature cache file */
+    int readAhead;          /* --read-ahead N: number of image file reads kept in flight ahead of the decoders, 0 for none */
+    int readEngine;         /* --read-engine io_uring|threads: engine of the read-ahead stage, one of readEngines */
+    int link;               /* --link: train now hard links the images into the cluster directories instead of copying them */
+    std::string manifestFilePath; /* --manifest PATH: write the cluster of every image to a CSV file, batch predict then leaves the images in place */
+    int watchBatch;         /* --watch-batch N: number of images the watch mode decodes at a time */
+    int watchQueue;         /* --watch-queue N: number of images waiting to be labeled before the watch mode stops reading events */
+} Options;
+
+/**
+ * Initializes the options with their default values.
+ */
+void initOptions(Options *pOptions);
+
+/**
+ * Parses and removes the optional flags from the command-line arguments.
+ * Updates argc to the number of remaining positional arguments.
+ */
+int parseOptions(int *pArgc, char **argv, Options *pOptions);
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * Minimal parallel loop helper.
+ *
+ * Runs a number of independent tasks on a set of threads. Tasks are claimed one at a time so that uneven
+ * tasks balance out. Callers that need deterministic results write each task's output into its own slot.
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+/**
+ * Resolves a requested thread count: 0 means one thread per available core.
+ */
+inline int resolveThreadCount(int threadCount)
+{
+    if(threadCount <= 0)
+    {
+        threadCount = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    }
+
+    return threadCount;
+}
+
+/**
+ * Calls fn(taskIndex) for every task index in [0, taskCount) using up to threadCount threads.
+ * With a single thread (or a single task) everything runs in the calling thread.
+ */
+template <typename F>
+void parallelFor(size_t taskCount, int threadCount, F fn)
+{
+    threadCount = resolveThreadCount(threadCount);
+
+    /* No need for more threads than tasks */
+    if((size_t)threadCount > taskCount)
+    {
+        threadCount = taskCount > 0 ? (int)taskCount : 1;
+    }
+
+    std::atomic<size_t> nextTaskIndex(0);
+    auto worker = [&]()
+    {
+        size_t i;
+        while((i = nextTaskIndex.fetch_add(1)) < taskCount)
+        {
+            fn(i);
+        }
+    };
+
+    if(threadCount == 1)
+    {
+        /* Serial mode: run in the calling thread */
+        worker();
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threadCount; t++)
+    {
+        workers.push_back(std::thread(worker));
+    }
+
+    for(std::thread &w : workers)
+    {
+        w.join();
+    }
+}
+
+#endif
@@ -0,0 +1,413 @@
+/**
+ * PCA projection stage.
+ *
+ * Fits the D principal components of the training data and projects the training data points on them, so that the
+ * engines cluster D values per point instead of one value per pixel. The trained centroids are mapped back to pixel
+ * space (mean + sum of their coordinates times the components), which keeps the centroids file format and every
+ * prediction path unchanged. Since the mapped back centroids lie in the projection subspace, the squared distance from
+ * an image to any of them is the squared distance between the projected image and the projected centroid plus the same
+ * residual for all of them: predicting with the mapped back centroids gives the labels a prediction in D dimensions
+ * would give.
+ *
+ * The components are fitted on a sample of the points: the covariance matrix of the sample is computed in parallel,
+ * then its leading eigenvectors are found by orthogonal (subspace) iteration.
+ *
+ * The projection is written beside the centroids file, see writeProjectionToCsvFile.
+ */
+
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <fstream>
+
+#include "error_codes.hpp"
+#include "parallel.hpp"
+#include "kmeans.hpp"
+#include "sweep.hpp"
+#include "model.hpp"
+
+/* Number of points the components are fitted on */
+#define PROJECTION_SAMPLE_SIZE                                                                      4096
+
+/* Number of orthogonal iterations of the eigenvector search */
+#define PROJECTION_ITERATIONS                                                                         30
+
+/* Suffix appended to the centroids file path to name the projection file */
+#define PROJECTION_FILE_SUFFIX                                                                    ".pca"
+
+/**
+ * Geometry of the projected training data: only the number of values per point is known.
+ */
+template <size_t D>
+struct ProjectedGeometry
+{
+    static const size_t size = D;
+};
+
+/* Principal components of training data points of N values */
+template <size_t N>
+struct Projection
+{
+    std::array<float, N> mean;                    /* Mean of the training data points */
+    std::vector<std::array<float, N>> components; /* Unit length components, by decreasing variance */
+    std::vector<double> variances;                /* Variance of the training data along each component */
+    double totalVariance;                         /* Sum of the variances along every pixel */
+};
+
+/**
+ * Dot product of two rows of n values, accumulated in double precision.
+ * Four independent sums so that the compiler can vectorize the loop without reordering a single sum.
+ */
+inline double projectionDot(const double *a, const double *b, size_t n)
+{
+    double sums[4] = {0, 0, 0, 0};
+
+    const size_t blockEnd = n - n % 4;
+    for(size_t i = 0; i < blockEnd; i += 4)
+    {
+        sums[0] += a[i] * b[i];
+        sums[1] += a[i + 1] * b[i + 1];
+        sums[2] += a[i + 2] * b[i + 2];
+        sums[3] += a[i + 3] * b[i + 3];
+    }
+    for(size_t i = blockEnd; i < n; i++)
+    {
+        sums[0] += a[i] * b[i];
+    }
+
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+/**
+ * Fits the D leading principal components of the training data.
+ * The mean is computed over all the points, the covariance over a sample of PROJECTION_SAMPLE_SIZE points drawn with
+ * the seed. The sums are reduced in a fixed order so that the result does not depend on the number of threads.
+ */
+template <size_t N, size_t D>
+void fitProjection(const FeatureMatrix<N>& data, uint64_t seed, int threadCount, Projection<N> *pProjection)
+{
+    static_assert(D <= N, "the projection cannot have more dimensions than the points");
+
+    /* Mean, per partition sums reduced in partition order */
+    const size_t partitionCount = kmeansPartitionCount(data.size());
+    std::vector<std::array<double, N>> partitionSums(partitionCount);
+
+    parallelFor(partitionCount, threadCount, [&](size_t p)
+    {
+        size_t begin, end;
+        kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+        std::array<double, N>& sum = partitionSums[p];
+        sum.fill(0.0);
+        for(size_t i = begin; i < end; i++)
+        {
+            for(size_t j = 0; j < N; j++)
+            {
+                sum[j] += data[i][j];
+            }
+        }
+    });
+
+    std::vector<double> mean(N, 0.0);
+    for(const std::array<double, N>& sum : partitionSums)
+    {
+        for(size_t j = 0; j < N; j++)
+        {
+            mean[j] += sum[j];
+        }
+    }
+    for(size_t j = 0; j < N; j++)
+    {
+        mean[j] /= (double)data.size();
+        pProjection->mean[j] = (float)mean[j];
+    }
+
+    /* Centered sample, one row per pixel so that the covariance entries are dot products of contiguous rows */
+    std::vector<size_t> sampleIndices = silhouetteSampleIndices(data.size(), PROJECTION_SAMPLE_SIZE, seed);
+    const size_t s = sampleIndices.size();
+
+    std::vector<double> samplePixels(N * s);
+    for(size_t i = 0; i < s; i++)
+    {
+        for(size_t j = 0; j < N; j++)
+        {
+            samplePixels[j * s + i] = data[sampleIndices[i]][j] - mean[j];
+        }
+    }
+
+    /* Covariance matrix, each task fills one row and its mirrored column */
+    std::vector<double> covariance(N * N);
+    parallelFor(N, threadCount, [&](size_t i)
+    {
+        for(size_t j = i; j < N; j++)
+        {
+            double c = projectionDot(&samplePixels[i * s], &samplePixels[j * s], s) / (double)s;
+            covariance[i * N + j] = c;
+            covariance[j * N + i] = c;
+        }
+    });
+
+    /* Orthogonal iteration from a random basis: multiply by the covariance, then orthonormalize in component order */
+    std::mt19937_64 rng(seed);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    std::vector<double> basis(D * N);
+    for(double& value : basis)
+    {
+        value = normal(rng);
+    }
+
+    std::vector<double> product(D * N);
+    for(int iteration = 0; iteration <= PROJECTION_ITERATIONS; iteration++)
+    {
+        /* Modified Gram-Schmidt, a component that vanished is replaced by a fresh random direction */
+        for(size_t d = 0; d < D; d++)
+        {
+            double *q = &basis[d * N];
+            for(int attempt = 0; attempt < 2; attempt++)
+            {
+                for(size_t e = 0; e < d; e++)
+                {
+                    double projection = projectionDot(q, &basis[e * N], N);
+                    for(size_t j = 0; j < N; j++)
+                    {
+                        q[j] -= projection * basis[e * N + j];
+                    }
+                }
+
+                double norm = std::sqrt(projectionDot(q, q, N));
+                if(norm > 1e-12)
+                {
+                    for(size_t j = 0; j < N; j++)
+                    {
+                        q[j] /= norm;
+                    }
+                    break;
+                }
+
+                for(size_t j = 0; j < N; j++)
+                {
+                    q[j] = normal(rng);
+                }
+            }
+        }
+
+        if(iteration == PROJECTION_ITERATIONS)
+        {
+            break;
+        }
+
+        parallelFor(N, threadCount, [&](size_t i)
+        {
+            for(size_t d = 0; d < D; d++)
+            {
+                product[d * N + i] = projectionDot(&covariance[i * N], &basis[d * N], N);
+            }
+        });
+
+        basis.swap(product);
+    }
+
+    /* Variance along each component, the components are sorted by decreasing variance */
+    std::vector<double> variances(D);
+    parallelFor(D, threadCount, [&](size_t d)
+    {
+        double variance = 0;
+        for(size_t i = 0; i < N; i++)
+        {
+            variance += basis[d * N + i] * projectionDot(&covariance[i * N], &basis[d * N], N);
+        }
+        variances[d] = variance;
+    });
+
+    std::vector<size_t> order(D);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&variances](size_t a, size_t b) { return variances[a] > variances[b]; });
+
+    pProjection->components.assign(D, std::array<float, N>());
+    pProjection->variances.assign(D, 0.0);
+    for(size_t d = 0; d < D; d++)
+    {
+        for(size_t j = 0; j < N; j++)
+        {
+            pProjection->components[d][j] = (float)basis[order[d] * N + j];
+        }
+        pProjection->variances[d] = variances[order[d]];
+    }
+
+    pProjection->totalVariance = 0;
+    for(size_t j = 0; j < N; j++)
+    {
+        pProjection->totalVariance += covariance[j * N + j];
+    }
+}
+
+/**
+ * Fraction of the variance of the training data that the projection keeps.
+ */
+template <size_t N>
+double projectionExplainedVariance(const Projection<N> *pProjection)
+{
+    double kept = std::accumulate(pProjection->variances.begin(), pProjection->variances.end(), 0.0);
+    return pProjection->totalVariance > 0 ? kept / pProjection->totalVariance : 1.0;
+}
+
+/**
+ * Coordinates of a point along the components.
+ */
+template <size_t N, size_t D>
+inline void projectPoint(const Projection<N> *pProjection, const std::array<float, N>& point, std::array<float, D> *pProjected)
+{
+    std::array<float, N> centered;
+    for(size_t j = 0; j < N; j++)
+    {
+        centered[j] = point[j] - pProjection->mean[j];
+    }
+
+    for(size_t d = 0; d < D; d++)
+    {
+        const std::array<float, N>& component = pProjection->components[d];
+
+        float sum = 0;
+        for(size_t j = 0; j < N; j++)
+        {
+            sum += component[j] * centered[j];
+        }
+        (*pProjected)[d] = sum;
+    }
+}
+
+/**
+ * Projects every training data point, in parallel.
+ */
+template <size_t N, size_t D>
+void projectFeatureMatrix(const Projection<N> *pProjection, const FeatureMatrix<N>& data, int threadCount, FeatureMatrix<D> *pProjected)
+{
+    pProjected->resize(data.size());
+
+    const size_t partitionCount = kmeansPartitionCount(data.size());
+    parallelFor(partitionCount, threadCount, [&](size_t p)
+    {
+        size_t begin, end;
+        kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+        for(size_t i = begin; i < end; i++)
+        {
+            projectPoint<N, D>(pProjection, data[i], &(*pProjected)[i]);
+        }
+    });
+}
+
+/**
+ * Maps projected centroids back to pixel space.
+ */
+template <size_t N, size_t D>
+std::vector<std::array<float, N>> unprojectCentroids(const Projection<N> *pProjection, const std::vector<std::array<float, D>>& projectedCentroids)
+{
+    std::vector<std::array<float, N>> centroids(projectedCentroids.size(), pProjection->mean);
+
+    for(size_t c = 0; c < projectedCentroids.size(); c++)
+    {
+        for(size_t d = 0; d < D; d++)
+        {
+            const float coordinate = projectedCentroids[c][d];
+            for(size_t j = 0; j < N; j++)
+            {
+                centroids[c][j] += coordinate * pProjection->components[d][j];
+            }
+        }
+    }
+
+    return centroids;
+}
+
+/**
+ * Adjusted Rand index of two labelings of the same points with k clusters each: 1 when they group the points the same
+ * way whatever their cluster ids, around 0 for unrelated labelings.
+ */
+inline double adjustedRandIndex(const std::vector<uint32_t>& labels, const std::vector<uint32_t>& otherLabels, uint32_t k)
+{
+    std::vector<uint64_t> contingency((size_t)k * k, 0);
+    std::vector<uint64_t> counts(k, 0);
+    std::vector<uint64_t> otherCounts(k, 0);
+
+    for(size_t i = 0; i < labels.size(); i++)
+    {
+        contingency[(size_t)labels[i] * k + otherLabels[i]]++;
+        counts[labels[i]]++;
+        otherCounts[otherLabels[i]]++;
+    }
+
+    auto pairs = [](uint64_t n) { return n > 1 ? (double)n * (double)(n - 1) / 2.0 : 0.0; };
+
+    double index = 0;
+    for(uint64_t n : contingency)
+    {
+        index += pairs(n);
+    }
+
+    double pairSum = 0;
+    double otherPairSum = 0;
+    for(uint32_t c = 0; c < k; c++)
+    {
+        pairSum += pairs(counts[c]);
+        otherPairSum += pairs(otherCounts[c]);
+    }
+
+    const double expected = pairSum * otherPairSum / std::max(1.0, pairs(labels.size()));
+    const double maximum = (pairSum + otherPairSum) / 2.0;
+
+    return (maximum - expected) != 0 ? (index - expected) / (maximum - expected) : 1.0;
+}
+
+/**
+ * Writes the projection next to the centroids file, at the centroids file path followed by PROJECTION_FILE_SUFFIX:
+ *      #width=20,height=20,channels=1,normalize=1
+ *      #components=32,explained_variance=0.912
+ * followed by the mean row and one row per component, by decreasing variance.
+ */
+template <typename G>
+int writeProjectionToCsvFile(const Projection<G::size> *pProjection, int normalize, std::string clusterCentroidsCsvFilePath)
+{
+    std::ofstream projectionFile((clusterCentroidsCsvFilePath + PROJECTION_FILE_SUFFIX).c_str());
+    if(!projectionFile.is_open())
+    {
+        return ERROR_WRITING_PROJECTION;
+    }
+
+    projectionFile << modelGeometryLine<G>(normalize) << "\n";
+    projectionFile << MODEL_GEOMETRY_LINE_PREFIX "components=" << pProjection->components.size()
+        << ",explained_variance=" << projectionExplainedVariance<G::size>(pProjection) << "\n";
+
+    /* Full float precision, the components are small values */
+    auto writeRow = [&projectionFile](const std::array<float, G::size>& row)
+    {
+        char value[32];
+        for(size_t j = 0; j < G::size; j++)
+        {
+            snprintf(value, sizeof(value), "%.9g", row[j]);
+            projectionFile << value << (j + 1 < G::size ? "," : "\n");
+        }
+    };
+
+    writeRow(pProjection->mean);
+    for(const std::array<float, G::size>& component : pProjection->components)
+    {
+        writeRow(component);
+    }
+
+    projectionFile.close();
+    return projectionFile.fail() ? ERROR_WRITING_PROJECTION : NO_ERROR;
+}
+
+#endif
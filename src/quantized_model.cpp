@@ -0,0 +1,136 @@
+#include "quantized_model.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits>
+#include <fstream>
+
+/* Check that the header layout is the documented 64 bytes */
+static_assert(sizeof(QuantizedModelHeader) == 64, "Unexpected quantized model header size");
+
+/**
+ * Size in bytes of the centroid rows described by the given header.
+ */
+static size_t quantizedModelRowsSize(const QuantizedModelHeader *pHeader)
+{
+    size_t valueSize = (pHeader->dtype == QUANTIZED_MODEL_DTYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint8_t);
+    return (size_t)pHeader->k * pHeader->width * pHeader->height * pHeader->channels * valueSize;
+}
+
+/**
+ * Writes exactly length bytes, false on a short write.
+ */
+static bool writeFully(int fd, const void *pBuffer, size_t length)
+{
+    const uint8_t *p = (const uint8_t*)pBuffer;
+    while(length > 0)
+    {
+        ssize_t n = write(fd, p, length);
+        if(n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+bool isQuantizedModelFile(std::string modelFilePath)
+{
+    std::ifstream modelFile(modelFilePath.c_str(), std::ios::binary);
+
+    char magic[4];
+    return modelFile.read(magic, sizeof(magic)) && memcmp(magic, QUANTIZED_MODEL_MAGIC, sizeof(magic)) == 0;
+}
+
+int writeQuantizedModelFile(std::string modelFilePath, const QuantizedModel *pModel)
+{
+    const char *pRows = (pModel->header.dtype == QUANTIZED_MODEL_DTYPE_UINT16) ? (const char*)pModel->rowsU16.data() : (const char*)pModel->rowsU8.data();
+
+    std::string tmpFilePath = modelFilePath + ".tmp." + std::to_string(getpid());
+    int fd = open(tmpFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        return ERROR_WRITING_CENTROID;
+    }
+
+    bool written = writeFully(fd, &pModel->header, sizeof(QuantizedModelHeader))
+        && writeFully(fd, pRows, quantizedModelRowsSize(&pModel->header))
+        && fsync(fd) == 0;
+
+    if(close(fd) != 0 || !written || rename(tmpFilePath.c_str(), modelFilePath.c_str()) != 0)
+    {
+        unlink(tmpFilePath.c_str());
+        return ERROR_WRITING_CENTROID;
+    }
+
+    return NO_ERROR;
+}
+
+int readQuantizedModelFile(std::string modelFilePath, QuantizedModel *pModel)
+{
+    std::ifstream modelFile(modelFilePath.c_str(), std::ios::binary);
+    if(!modelFile.is_open())
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    QuantizedModelHeader *pHeader = &pModel->header;
+    if(!modelFile.read((char*)pHeader, sizeof(QuantizedModelHeader)))
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    if(memcmp(pHeader->magic, QUANTIZED_MODEL_MAGIC, sizeof(pHeader->magic)) != 0 || pHeader->version != QUANTIZED_MODEL_VERSION
+        || (pHeader->dtype != QUANTIZED_MODEL_DTYPE_UINT8 && pHeader->dtype != QUANTIZED_MODEL_DTYPE_UINT16) || pHeader->k == 0
+        || pHeader->extractor >= FEATURE_EXTRACTOR_COUNT)
+    {
+        return ERROR_MODEL_MISMATCH;
+    }
+
+    const size_t valueCount = (size_t)pHeader->k * quantizedModelRowSize(pModel);
+    char *pRows;
+    if(pHeader->dtype == QUANTIZED_MODEL_DTYPE_UINT16)
+    {
+        pModel->rowsU16.resize(valueCount);
+        pModel->rowsU8.clear();
+        pRows = (char*)pModel->rowsU16.data();
+    }
+    else
+    {
+        pModel->rowsU8.resize(valueCount);
+        pModel->rowsU16.clear();
+        pRows = (char*)pModel->rowsU8.data();
+    }
+
+    if(!modelFile.read(pRows, quantizedModelRowsSize(pHeader)))
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    return NO_ERROR;
+}
+
+uint32_t closestQuantizedCentroid(const uint8_t *pImgDataBuffer, const QuantizedModel *pModel)
+{
+    const size_t rowSize = quantizedModelRowSize(pModel);
+    uint64_t bestDistance = std::numeric_limits<uint64_t>::max();
+    uint32_t bestIndex = 0;
+
+    for(uint32_t c = 0; c < pModel->header.k; c++)
+    {
+        uint64_t d = (pModel->header.dtype == QUANTIZED_MODEL_DTYPE_UINT16)
+            ? distanceSquaredU8U16(pImgDataBuffer, &pModel->rowsU16[c * rowSize], rowSize)
+            : distanceSquaredU8(pImgDataBuffer, &pModel->rowsU8[c * rowSize], rowSize);
+
+        if(d < bestDistance)
+        {
+            bestDistance = d;
+            bestIndex = c;
+        }
+    }
+
+    return bestIndex;
+}
@@ -0,0 +1,167 @@
+/**
+ * Quantized centroids model file.
+ *
+ * A compact binary alternative to the centroids CSV file for the predict modes. The centroids are stored on the
+ * scale of the downsampled pixels, either rounded to uint8 or as uint16 with 8 fractional bits, so that the
+ * downsampled image data buffers are compared to them directly with an integer distance kernel, without being
+ * converted to float features first.
+ *
+ * Rounding the centroids can change the label of an image that is almost equally distant from two centroids:
+ * the quantize mode reports how many predictions of a validation directory match the float model.
+ *
+ * Layout (little endian, as written by the host):
+ *  - 64 bytes header, see QuantizedModelHeader.
+ *  - k rows of width * height * channels values of the header's data type.
+ *
+ * The header also records the feature extractor, see feature_extractor.hpp.
+ */
+
+#ifndef QUANTIZED_MODEL_H
+#define QUANTIZED_MODEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <array>
+
+#include "error_codes.hpp"
+#include "geometry.hpp"
+#include "distance.hpp"
+
+/* Magic bytes at the start of every quantized model file */
+#define QUANTIZED_MODEL_MAGIC                                                                     "KMQM"
+
+/* Version of the quantized model file format */
+#define QUANTIZED_MODEL_VERSION                                                                        1
+
+/* Data type of the centroid values */
+typedef enum _quantized_model_dtype {
+    QUANTIZED_MODEL_DTYPE_UINT8  = 0, /* Pixel values rounded to the nearest integer */
+    QUANTIZED_MODEL_DTYPE_UINT16 = 1  /* Pixel values with 8 fractional bits */
+} quantizedModelDtype;
+
+typedef struct _quantized_model_header {
+    char magic[4];          /* QUANTIZED_MODEL_MAGIC */
+    uint16_t version;       /* QUANTIZED_MODEL_VERSION */
+    uint16_t dtype;         /* One of quantizedModelDtype */
+    uint32_t width;         /* Downsampled image width */
+    uint32_t height;        /* Downsampled image height */
+    uint32_t channels;      /* Downsampled image channels */
+    uint32_t normalize;     /* Whether or not the float centroids were normalized */
+    uint32_t k;             /* Number of centroids */
+    uint32_t extractor;     /* One of featureExtractors, zero for the pixels */
+    uint32_t bins;          /* Number of bins of each histogram of the extractor, zero for the pixels */
+    uint32_t workingSize;   /* Largest side of the image the extractor reads, zero for the pixels */
+    uint8_t reserved[24];   /* Pads the header to 64 bytes */
+} QuantizedModelHeader;
+
+/* A quantized model loaded in memory, only the rows of the header's data type are used */
+typedef struct _quantized_model {
+    QuantizedModelHeader header;
+    std::vector<uint8_t> rowsU8;   /* k rows of uint8 values */
+    std::vector<uint16_t> rowsU16; /* k rows of uint16 values */
+} QuantizedModel;
+
+/**
+ * Whether or not the file at the given path starts with the quantized model magic bytes.
+ */
+bool isQuantizedModelFile(std::string modelFilePath);
+
+/**
+ * Writes a quantized model file.
+ * The file is written to a temporary file that is flushed and renamed over the given path, so that a server or a watch
+ * reading it either sees the old or the new model.
+ */
+int writeQuantizedModelFile(std::string modelFilePath, const QuantizedModel *pModel);
+
+/**
+ * Reads a quantized model file and validates its header.
+ */
+int readQuantizedModelFile(std::string modelFilePath, QuantizedModel *pModel);
+
+/**
+ * Number of values per centroid of a quantized model.
+ */
+inline size_t quantizedModelRowSize(const QuantizedModel *pModel)
+{
+    return (size_t)pModel->header.width * pModel->header.height * pModel->header.channels;
+}
+
+/**
+ * Index of the quantized centroid closest to the given downsampled image data buffer.
+ * Ties go to the lowest index, like closestCentroid.
+ */
+uint32_t closestQuantizedCentroid(const uint8_t *pImgDataBuffer, const QuantizedModel *pModel);
+
+/**
+ * Quantizes float centroids trained with the given geometry and normalization.
+ */
+template <typename G>
+void quantizeCentroids(const std::vector<std::array<float, G::size>> *pClusterCentroidsVector, int normalize, int dtype, QuantizedModel *pModel)
+{
+    QuantizedModelHeader *pHeader = &pModel->header;
+    memset(pHeader, 0, sizeof(QuantizedModelHeader));
+    memcpy(pHeader->magic, QUANTIZED_MODEL_MAGIC, sizeof(pHeader->magic));
+    pHeader->version = QUANTIZED_MODEL_VERSION;
+    pHeader->dtype = (uint16_t)dtype;
+    pHeader->width = G::width;
+    pHeader->height = G::height;
+    pHeader->channels = G::channels;
+    pHeader->extractor = G::extractor;
+    pHeader->bins = (uint32_t)featureExtractorBins(G::extractor);
+    pHeader->workingSize = (uint32_t)featureExtractorWorkingSize(G::extractor);
+    pHeader->normalize = (uint32_t)normalize;
+    pHeader->k = (uint32_t)pClusterCentroidsVector->size();
+
+    pModel->rowsU8.clear();
+    pModel->rowsU16.clear();
+
+    for(const std::array<float, G::size> &centroid : *pClusterCentroidsVector)
+    {
+        for(float value : centroid)
+        {
+            /* Back to the scale of the downsampled pixels */
+            double pixel = (normalize == 1) ? value * 255.0 : value;
+
+            if(dtype == QUANTIZED_MODEL_DTYPE_UINT16)
+            {
+                double fixed = std::round(pixel * 256.0);
+                pModel->rowsU16.push_back((uint16_t)std::min(65535.0, std::max(0.0, fixed)));
+            }
+            else
+            {
+                double rounded = std::round(pixel);
+                pModel->rowsU8.push_back((uint8_t)std::min(255.0, std::max(0.0, rounded)));
+            }
+        }
+    }
+}
+
+/**
+ * Reads a quantized model file, rejecting models quantized from centroids of another geometry, features, or normalization.
+ */
+template <typename G>
+int loadQuantizedModelFile(std::string modelFilePath, int normalize, QuantizedModel *pModel)
+{
+    int readRes = readQuantizedModelFile(modelFilePath, pModel);
+    if(readRes != NO_ERROR)
+    {
+        return readRes;
+    }
+
+    const QuantizedModelHeader *pHeader = &pModel->header;
+    if(pHeader->width != (uint32_t)G::width || pHeader->height != (uint32_t)G::height || pHeader->channels != (uint32_t)G::channels
+        || pHeader->normalize != (uint32_t)normalize || pHeader->extractor != (uint32_t)G::extractor
+        || pHeader->bins != (uint32_t)featureExtractorBins(G::extractor) || pHeader->workingSize != (uint32_t)featureExtractorWorkingSize(G::extractor))
+    {
+        return ERROR_MODEL_MISMATCH;
+    }
+
+    return NO_ERROR;
+}
+
+#endif
@@ -0,0 +1,648 @@
+#include "read_ahead.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include "error_codes.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+
+/* io_uring needs the system call numbers and the OPENAT operation, i.e. the kernel headers of Linux 5.6 or later */
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_RW_CUR_POS)
+#define READ_AHEAD_IO_URING                                                                           1
+#endif
+#endif
+
+/* Largest number of reads in flight, i.e. of open files and of reader threads */
+#define READ_AHEAD_MAX_IN_FLIGHT                                                                      256
+
+/* Largest read handed to the kernel at once, reads of larger files are resubmitted from where they stopped */
+#define READ_AHEAD_CHUNK_SIZE                                                                         (1 << 30)
+
+/* User data of the cancel operations, told apart from the slot indexes of the other operations */
+#define READ_AHEAD_CANCEL_USER_DATA                                                                   UINT64_MAX
+
+void initReadAheadQueue(ReadAheadQueue *pQueue, size_t capacity)
+{
+    pQueue->files.clear();
+    pQueue->capacity = (capacity > 0) ? capacity : 1;
+    pQueue->closed = false;
+}
+
+void pushReadAheadQueue(ReadAheadQueue *pQueue, ReadFile *pFile)
+{
+    std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+    pQueue->notFull.wait(lock, [pQueue]() { return pQueue->files.size() < pQueue->capacity; });
+
+    pQueue->files.push_back(std::move(*pFile));
+    pQueue->notEmpty.notify_one();
+}
+
+bool popReadAheadQueue(ReadAheadQueue *pQueue, ReadFile *pFile)
+{
+    std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+    pQueue->notEmpty.wait(lock, [pQueue]() { return pQueue->closed || !pQueue->files.empty(); });
+    if(pQueue->files.empty())
+    {
+        return false;
+    }
+
+    *pFile = std::move(pQueue->files.front());
+    pQueue->files.pop_front();
+    pQueue->notFull.notify_one();
+
+    return true;
+}
+
+void closeReadAheadQueue(ReadAheadQueue *pQueue)
+{
+    std::lock_guard<std::mutex> lock(pQueue->mutex);
+
+    pQueue->closed = true;
+    pQueue->notEmpty.notify_all();
+}
+
+/**
+ * Sizes the buffer of an open file, returns false if the file is not to be read.
+ */
+static bool prepareReadFile(int fd, ReadFile *pFile, const std::function<bool(size_t, const struct stat*)> &skip)
+{
+    if(fstat(fd, &pFile->st) != 0 || !S_ISREG(pFile->st.st_mode))
+    {
+        pFile->readRes = ERROR_LOADING_IMAGE;
+        return true;
+    }
+
+    if(skip(pFile->index, &pFile->st))
+    {
+        return false;
+    }
+
+    pFile->data.resize(pFile->st.st_size);
+    return true;
+}
+
+/**
+ * Opens and reads a whole file with blocking calls, returns false if the file is not to be read.
+ */
+static bool readFileBlocking(const std::string &filePath, size_t index, ReadFile *pFile,
+    const std::function<bool(size_t, const struct stat*)> &skip)
+{
+    uint64_t readBegin = statsStageBegin();
+
+    pFile->index = index;
+    pFile->readRes = NO_ERROR;
+    pFile->data.clear();
+
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        pFile->readRes = ERROR_LOADING_IMAGE;
+        statsStageEnd(STATS_STAGE_READ, readBegin);
+        return true;
+    }
+
+    bool read = prepareReadFile(fd, pFile, skip);
+
+    size_t offset = 0;
+    while(read && pFile->readRes == NO_ERROR && offset < pFile->data.size())
+    {
+        ssize_t n = pread(fd, pFile->data.data() + offset, pFile->data.size() - offset, offset);
+        if(n < 0 && errno != EINTR)
+        {
+            pFile->readRes = ERROR_LOADING_IMAGE;
+        }
+
+        /* The file shrank since it was sized */
+        if(n == 0)
+        {
+            pFile->data.resize(offset);
+        }
+
+        offset += (n > 0) ? n : 0;
+    }
+
+    close(fd);
+    statsStageEnd(STATS_STAGE_READ, readBegin);
+
+    return read;
+}
+
+/**
+ * Thread pool engine: every thread opens, reads and queues the next file with blocking calls.
+ */
+static void readFilesWithThreads(const std::vector<std::string> &filePaths, int inFlight, ReadAheadQueue *pQueue,
+    const std::function<bool(size_t, const struct stat*)> &skip)
+{
+    parallelFor(filePaths.size(), inFlight, [&](size_t i)
+    {
+        ReadFile file;
+        if(readFileBlocking(filePaths[i], i, &file, skip))
+        {
+            pushReadAheadQueue(pQueue, &file);
+        }
+    });
+}
+
+#ifdef READ_AHEAD_IO_URING
+
+/* A mapped io_uring instance */
+typedef struct _uring {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    void *pSqRing;
+    size_t sqRingSize;
+    void *pCqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned pendingCount; /* Entries queued in the submission ring since the last io_uring_enter */
+} Uring;
+
+/* State of a read in flight */
+typedef enum _uring_slot_states {
+    URING_SLOT_FREE    = 0,
+    URING_SLOT_OPENING = 1,
+    URING_SLOT_READING = 2
+} uringSlotStates;
+
+/* A read in flight */
+typedef struct _uring_slot {
+    int state;          /* One of uringSlotStates */
+    int fd;             /* Open file, once opened */
+    size_t offset;      /* Bytes read so far */
+    uint64_t readBegin; /* Start of the read stage of the file */
+    std::string path;   /* Path of the open, owned by the slot so that it lives as long as the open is in flight */
+    ReadFile file;
+} UringSlot;
+
+/**
+ * Slots of the rings that could not be drained. The kernel may still write into them and read their paths, so they
+ * are kept for the lifetime of the process rather than released. Moving a vector in keeps its elements in place.
+ */
+static std::mutex abandonedUringSlotsMutex;
+static std::list<std::vector<UringSlot>> abandonedUringSlots;
+
+/**
+ * Unmaps and closes a ring set up by setupUring().
+ */
+static void teardownUring(Uring *pRing)
+{
+    if(pRing->sqes != MAP_FAILED)
+    {
+        munmap(pRing->sqes, pRing->sqesSize);
+    }
+    if(pRing->pCqRing != MAP_FAILED && pRing->pCqRing != pRing->pSqRing)
+    {
+        munmap(pRing->pCqRing, pRing->cqRingSize);
+    }
+    if(pRing->pSqRing != MAP_FAILED)
+    {
+        munmap(pRing->pSqRing, pRing->sqRingSize);
+    }
+    close(pRing->fd);
+}
+
+/**
+ * Sets up a ring of at least entryCount submission entries, and twice as many completion entries.
+ * Fails if io_uring is not available or if the kernel predates the OPENAT operation (Linux 5.6).
+ */
+static bool setupUring(unsigned entryCount, Uring *pRing)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    pRing->fd = (int)syscall(__NR_io_uring_setup, entryCount, &params);
+    if(pRing->fd < 0)
+    {
+        return false;
+    }
+
+    pRing->pSqRing = MAP_FAILED;
+    pRing->pCqRing = MAP_FAILED;
+    pRing->sqes = (struct io_uring_sqe*)MAP_FAILED;
+    pRing->pendingCount = 0;
+
+    /* The current file position feature came with the OPENAT operation */
+    if(!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        teardownUring(pRing);
+        return false;
+    }
+
+    pRing->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    pRing->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    /* Both rings share a single mapping on the kernels that support it */
+    const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(singleMap)
+    {
+        pRing->sqRingSize = (pRing->cqRingSize > pRing->sqRingSize) ? pRing->cqRingSize : pRing->sqRingSize;
+        pRing->cqRingSize = pRing->sqRingSize;
+    }
+
+    pRing->pSqRing = mmap(NULL, pRing->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_SQ_RING);
+    pRing->pCqRing = singleMap ? pRing->pSqRing
+        : mmap(NULL, pRing->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_CQ_RING);
+
+    pRing->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    pRing->sqes = (struct io_uring_sqe*)mmap(NULL, pRing->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        pRing->fd, IORING_OFF_SQES);
+
+    if(pRing->pSqRing == MAP_FAILED || pRing->pCqRing == MAP_FAILED || pRing->sqes == MAP_FAILED)
+    {
+        teardownUring(pRing);
+        return false;
+    }
+
+    uint8_t *pSq = (uint8_t*)pRing->pSqRing;
+    pRing->sqHead = (unsigned*)(pSq + params.sq_off.head);
+    pRing->sqTail = (unsigned*)(pSq + params.sq_off.tail);
+    pRing->sqMask = *(unsigned*)(pSq + params.sq_off.ring_mask);
+    pRing->sqArray = (unsigned*)(pSq + params.sq_off.array);
+
+    uint8_t *pCq = (uint8_t*)pRing->pCqRing;
+    pRing->cqHead = (unsigned*)(pCq + params.cq_off.head);
+    pRing->cqTail = (unsigned*)(pCq + params.cq_off.tail);
+    pRing->cqMask = *(unsigned*)(pCq + params.cq_off.ring_mask);
+    pRing->cqes = (struct io_uring_cqe*)(pCq + params.cq_off.cqes);
+
+    return true;
+}
+
+/**
+ * Queues a submission entry, to be submitted by the next enterUring().
+ * There is always room: the ring has two submission entries per slot, one for its operation and one to cancel it.
+ */
+static struct io_uring_sqe* queueUringEntry(Uring *pRing, uint8_t opcode, uint64_t userData)
+{
+    const unsigned tail = *pRing->sqTail;
+    const unsigned index = tail & pRing->sqMask;
+
+    struct io_uring_sqe *pSqe = &pRing->sqes[index];
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode = opcode;
+    pSqe->user_data = userData;
+
+    pRing->sqArray[index] = index;
+    __atomic_store_n(pRing->sqTail, tail + 1, __ATOMIC_RELEASE);
+    pRing->pendingCount++;
+
+    return pSqe;
+}
+
+/**
+ * Submits the queued entries and waits for at least one completion.
+ */
+static bool enterUring(Uring *pRing)
+{
+    while(true)
+    {
+        int res = (int)syscall(__NR_io_uring_enter, pRing->fd, pRing->pendingCount, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(res >= 0)
+        {
+            pRing->pendingCount -= (unsigned)res;
+            return true;
+        }
+
+        /* Interrupted, or short of kernel memory: retry, the completions that are already there free some */
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * Queues the open of the file of a free slot.
+ */
+static void queueUringOpen(Uring *pRing, const std::vector<std::string> &filePaths, size_t i, UringSlot *pSlot, size_t slotIndex)
+{
+    pSlot->state = URING_SLOT_OPENING;
+    pSlot->fd = -1;
+    pSlot->offset = 0;
+    pSlot->readBegin = statsStageBegin();
+    pSlot->file.index = i;
+    pSlot->file.readRes = NO_ERROR;
+    pSlot->file.data.clear();
+    pSlot->path = filePaths[i];
+
+    struct io_uring_sqe *pSqe = queueUringEntry(pRing, IORING_OP_OPENAT, slotIndex);
+    pSqe->fd = AT_FDCWD;
+    pSqe->addr = (uint64_t)(uintptr_t)pSlot->path.c_str();
+    pSqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+/**
+ * Queues the read of the rest of the file of a slot.
+ */
+static void queueUringRead(Uring *pRing, UringSlot *pSlot, size_t slotIndex)
+{
+    pSlot->state = URING_SLOT_READING;
+
+    const size_t remaining = pSlot->file.data.size() - pSlot->offset;
+
+    struct io_uring_sqe *pSqe = queueUringEntry(pRing, IORING_OP_READ, slotIndex);
+    pSqe->fd = pSlot->fd;
+    pSqe->addr = (uint64_t)(uintptr_t)(pSlot->file.data.data() + pSlot->offset);
+    pSqe->len = (remaining < READ_AHEAD_CHUNK_SIZE) ? (unsigned)remaining : READ_AHEAD_CHUNK_SIZE;
+    pSqe->off = pSlot->offset;
+}
+
+/**
+ * Closes the file of a slot, queues it unless it was skipped, and frees the slot.
+ */
+static void completeUringSlot(UringSlot *pSlot, bool skipped, ReadAheadQueue *pQueue)
+{
+    if(pSlot->fd >= 0)
+    {
+        close(pSlot->fd);
+    }
+
+    statsStageEnd(STATS_STAGE_READ, pSlot->readBegin);
+
+    if(!skipped)
+    {
+        pushReadAheadQueue(pQueue, &pSlot->file);
+    }
+
+    pSlot->state = URING_SLOT_FREE;
+}
+
+/**
+ * Cancels the operations of the activeCount slots that are not free and waits until all of them completed, so that
+ * the kernel no longer writes into the slots. The files opened by the operations are left in the slots to be closed.
+ * Returns false if the ring cannot be entered anymore, in which case operations may still be in flight.
+ */
+static bool drainUring(Uring *pRing, std::vector<UringSlot> *pSlots, size_t activeCount)
+{
+    for(size_t s = 0; s < pSlots->size(); s++)
+    {
+        if((*pSlots)[s].state != URING_SLOT_FREE)
+        {
+            struct io_uring_sqe *pSqe = queueUringEntry(pRing, IORING_OP_ASYNC_CANCEL, READ_AHEAD_CANCEL_USER_DATA);
+            pSqe->addr = (uint64_t)s;
+        }
+    }
+
+    while(activeCount > 0)
+    {
+        if(!enterUring(pRing))
+        {
+            return false;
+        }
+
+        unsigned head = *pRing->cqHead;
+        const unsigned tail = __atomic_load_n(pRing->cqTail, __ATOMIC_ACQUIRE);
+
+        for(; head != tail; head++)
+        {
+            const struct io_uring_cqe *pCqe = &pRing->cqes[head & pRing->cqMask];
+            if(pCqe->user_data == READ_AHEAD_CANCEL_USER_DATA)
+            {
+                continue;
+            }
+
+            /* Whether it was canceled or not, the operation is over: an open that still succeeded is closed later */
+            UringSlot *pSlot = &(*pSlots)[(size_t)pCqe->user_data];
+            if(pSlot->state == URING_SLOT_OPENING && pCqe->res >= 0)
+            {
+                pSlot->fd = pCqe->res;
+            }
+            activeCount--;
+        }
+
+        __atomic_store_n(pRing->cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+/**
+ * io_uring engine: keeps up to inFlight files being opened or read, the calling thread submits and reaps.
+ * Returns false without reading any file if io_uring is not available.
+ */
+static bool readFilesWithUring(const std::vector<std::string> &filePaths, int inFlight, ReadAheadQueue *pQueue,
+    const std::function<bool(size_t, const struct stat*)> &skip)
+{
+    /* Room for an operation and its cancel per slot */
+    Uring ring;
+    if(!setupUring(2 * (unsigned)inFlight, &ring))
+    {
+        return false;
+    }
+
+    std::vector<UringSlot> slots(inFlight);
+    for(UringSlot &slot : slots)
+    {
+        slot.state = URING_SLOT_FREE;
+    }
+
+    size_t nextIndex = 0;
+    size_t activeCount = 0;
+    bool ringFailed = false;
+
+    while(nextIndex < filePaths.size() || activeCount > 0)
+    {
+        /* Start opening the next files in the free slots */
+        for(size_t s = 0; s < slots.size() && nextIndex < filePaths.size(); s++)
+        {
+            if(slots[s].state == URING_SLOT_FREE)
+            {
+                queueUringOpen(&ring, filePaths, nextIndex++, &slots[s], s);
+                activeCount++;
+            }
+        }
+
+        if(!enterUring(&ring))
+        {
+            ringFailed = true;
+            break;
+        }
+
+        /* Move every completed operation of a slot to its next one */
+        unsigned head = *ring.cqHead;
+        const unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+        for(; head != tail; head++)
+        {
+            const struct io_uring_cqe *pCqe = &ring.cqes[head & ring.cqMask];
+            const size_t s = (size_t)pCqe->user_data;
+            UringSlot *pSlot = &slots[s];
+            const int res = pCqe->res;
+
+            if(pSlot->state == URING_SLOT_OPENING)
+            {
+                if(res < 0)
+                {
+                    pSlot->file.readRes = ERROR_LOADING_IMAGE;
+                }
+                else
+                {
+                    pSlot->fd = res;
+                    if(!prepareReadFile(pSlot->fd, &pSlot->file, skip))
+                    {
+                        completeUringSlot(pSlot, true, pQueue);
+                        activeCount--;
+                        continue;
+                    }
+                }
+            }
+            else if(res < 0 && res != -EINTR && res != -EAGAIN)
+            {
+                pSlot->file.readRes = ERROR_LOADING_IMAGE;
+            }
+            else if(res == 0)
+            {
+                /* The file shrank since it was sized */
+                pSlot->file.data.resize(pSlot->offset);
+            }
+            else if(res > 0)
+            {
+                pSlot->offset += res;
+            }
+
+            if(pSlot->file.readRes == NO_ERROR && pSlot->offset < pSlot->file.data.size())
+            {
+                queueUringRead(&ring, pSlot, s);
+            }
+            else
+            {
+                completeUringSlot(pSlot, false, pQueue);
+                activeCount--;
+            }
+        }
+
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    /* The ring stopped accepting submissions: read the files that were not completed with blocking reads */
+    if(ringFailed)
+    {
+        std::vector<size_t> remainingIndexes;
+        for(const UringSlot &slot : slots)
+        {
+            if(slot.state != URING_SLOT_FREE)
+            {
+                remainingIndexes.push_back(slot.file.index);
+            }
+        }
+        for(size_t i = nextIndex; i < filePaths.size(); i++)
+        {
+            remainingIndexes.push_back(i);
+        }
+
+        /* The operations in flight write into the slots until they complete: wait for them before releasing the slots.
+         * If the ring cannot even do that, the slots are kept in abandonedUringSlots while the operations finish in
+         * the background. */
+        const bool drained = drainUring(&ring, &slots, activeCount);
+
+        for(UringSlot &slot : slots)
+        {
+            if(slot.state != URING_SLOT_FREE && slot.fd >= 0)
+            {
+                close(slot.fd);
+            }
+        }
+
+        if(!drained)
+        {
+            std::lock_guard<std::mutex> lock(abandonedUringSlotsMutex);
+            abandonedUringSlots.push_back(std::move(slots));
+        }
+
+        for(size_t i : remainingIndexes)
+        {
+            ReadFile file;
+            if(readFileBlocking(filePaths[i], i, &file, skip))
+            {
+                pushReadAheadQueue(pQueue, &file);
+            }
+        }
+    }
+
+    /* No operation is in flight anymore, or the slots it writes into are kept */
+    teardownUring(&ring);
+
+    return true;
+}
+
+#endif
+
+bool readAheadIoUringAvailable()
+{
+#ifdef READ_AHEAD_IO_URING
+    Uring ring;
+    if(setupUring(1, &ring))
+    {
+        teardownUring(&ring);
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+int readFilesAhead(const std::vector<std::string> &filePaths, int readEngine, int inFlight, int consumerCount,
+    const std::function<bool(size_t, const struct stat*)> &skip, const std::function<void(ReadFile*)> &consume)
+{
+    inFlight = (inFlight < 1) ? 1 : (inFlight > READ_AHEAD_MAX_IN_FLIGHT) ? READ_AHEAD_MAX_IN_FLIGHT : inFlight;
+
+    ReadAheadQueue queue;
+    initReadAheadQueue(&queue, inFlight);
+
+    /* The consumers run while the files are read */
+    std::vector<std::thread> consumers;
+    for(int t = 0; t < resolveThreadCount(consumerCount); t++)
+    {
+        consumers.push_back(std::thread([&]()
+        {
+            ReadFile file;
+            while(popReadAheadQueue(&queue, &file))
+            {
+                consume(&file);
+            }
+        }));
+    }
+
+    int usedReadEngine = READ_ENGINE_THREADS;
+
+#ifdef READ_AHEAD_IO_URING
+    if(readEngine == READ_ENGINE_IO_URING && readFilesWithUring(filePaths, inFlight, &queue, skip))
+    {
+        usedReadEngine = READ_ENGINE_IO_URING;
+    }
+#endif
+
+    if(usedReadEngine == READ_ENGINE_THREADS)
+    {
+        readFilesWithThreads(filePaths, inFlight, &queue, skip);
+    }
+
+    closeReadAheadQueue(&queue);
+    for(std::thread &consumer : consumers)
+    {
+        consumer.join();
+    }
+
+    return usedReadEngine;
+}
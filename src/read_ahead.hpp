@@ -0,0 +1,90 @@
+/**
+ * Read-ahead stage.
+ *
+ * Reads whole files ahead of the threads that consume them, with many reads in flight, so that slow storage is kept
+ * busy while the files that were already read are decoded. On io_uring a single submission thread opens, sizes, and
+ * reads the files, all asynchronously but for one fstat per file on the already open file. The ring is set up with
+ * raw system calls so that liburing is not needed. Where io_uring is not available, e.g. kernels before 5.6 or
+ * system call filters in containers, a pool of threads doing blocking reads takes its place, one read in flight
+ * per thread.
+ *
+ * The files that were read go through a bounded queue to the consumer threads: when the consumers fall behind, the
+ * read stage stops starting new reads. At most inFlight files are being read, inFlight are queued, and one per
+ * consumer is being consumed, whatever the number of files. The consumers get the files in completion order, each
+ * file carries its index in the list so that the consumers can write their results in list order.
+ */
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/* Engines of the read-ahead stage */
+typedef enum _read_engines {
+    READ_ENGINE_IO_URING = 0, /* io_uring, falls back to the threads if it is not available */
+    READ_ENGINE_THREADS  = 1  /* Blocking reads on a pool of threads */
+} readEngines;
+
+/* A file read by the read-ahead stage */
+typedef struct _read_file {
+    size_t index;              /* Index of the file in the list of files to read */
+    int readRes;               /* NO_ERROR, or ERROR_LOADING_IMAGE if the file could not be opened or read */
+    struct stat st;            /* Status of the file once opened, valid if readRes is NO_ERROR */
+    std::vector<uint8_t> data; /* Content of the file */
+} ReadFile;
+
+/* Bounded queue of the files read ahead, waiting to be consumed */
+typedef struct _read_ahead_queue {
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<ReadFile> files;
+    size_t capacity;
+    bool closed;
+} ReadAheadQueue;
+
+/**
+ * Initializes an empty queue holding up to capacity files.
+ */
+void initReadAheadQueue(ReadAheadQueue *pQueue, size_t capacity);
+
+/**
+ * Queues a file, moving its content, waiting for room if the queue is full.
+ */
+void pushReadAheadQueue(ReadAheadQueue *pQueue, ReadFile *pFile);
+
+/**
+ * Takes the oldest queued file, waiting for one.
+ * Returns false once the queue is closed and empty.
+ */
+bool popReadAheadQueue(ReadAheadQueue *pQueue, ReadFile *pFile);
+
+/**
+ * Wakes up the consumers so that they return once the queue is empty.
+ */
+void closeReadAheadQueue(ReadAheadQueue *pQueue);
+
+/**
+ * Whether or not io_uring can be used by the read-ahead stage on this system.
+ */
+bool readAheadIoUringAvailable();
+
+/**
+ * Reads the given files with up to inFlight reads in flight and calls consume() on consumerCount threads (0 for one
+ * per available core) for each file that was read, or could not be opened or read.
+ * Once a file is open, skip(index, &st) can decide not to read it, e.g. if its content is already known, in which
+ * case it is not consumed either.
+ * Returns the engine that read the files, i.e. the threads if io_uring was asked for but is not available.
+ */
+int readFilesAhead(const std::vector<std::string> &filePaths, int readEngine, int inFlight, int consumerCount,
+    const std::function<bool(size_t, const struct stat*)> &skip, const std::function<void(ReadFile*)> &consume);
+
+#endif
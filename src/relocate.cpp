@@ -0,0 +1,334 @@
+#include "relocate.hpp"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <iostream>
+#include <fstream>
+#include <set>
+
+#include "error_codes.hpp"
+#include "mkdir_p.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+/* Largest chunk handed to the kernel per copy call */
+#define RELOCATE_COPY_CHUNK_SIZE                                                              (1 << 30)
+
+/* renameat2() flag failing the rename if the destination exists, for C libraries that do not define it */
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE                                                                      (1 << 0)
+#endif
+
+/* Outcome of the relocation of a file */
+typedef enum _relocate_status {
+    RELOCATE_STATUS_DONE   = 0, /* Relocated */
+    RELOCATE_STATUS_FAILED = 1, /* Could not be read, written, or renamed */
+    RELOCATE_STATUS_EXISTS = 2  /* Another file already has its name in the cluster directory, neither was touched */
+} relocateStatus;
+
+/* Ways of copying a file, tried in this order */
+typedef enum _copy_method {
+    COPY_METHOD_COPY_FILE_RANGE = 0, /* In the kernel, possibly a reflink on filesystems that support it */
+    COPY_METHOD_SENDFILE        = 1, /* In the kernel, for filesystems or kernels without copy_file_range */
+    COPY_METHOD_READ_WRITE      = 2  /* Through a user space buffer */
+} copyMethod;
+
+/**
+ * Copies the content of one open file into another from their current offsets to the end of the input file.
+ */
+static bool copyFileContent(int inFd, int outFd)
+{
+    int method = COPY_METHOD_COPY_FILE_RANGE;
+    char buffer[64 * 1024];
+
+    while(true)
+    {
+        ssize_t n;
+        if(method == COPY_METHOD_COPY_FILE_RANGE)
+        {
+            n = copy_file_range(inFd, NULL, outFd, NULL, RELOCATE_COPY_CHUNK_SIZE, 0);
+        }
+        else if(method == COPY_METHOD_SENDFILE)
+        {
+            n = sendfile(outFd, inFd, NULL, RELOCATE_COPY_CHUNK_SIZE);
+        }
+        else
+        {
+            n = read(inFd, buffer, sizeof(buffer));
+            for(ssize_t written = 0; n > 0 && written < n; )
+            {
+                ssize_t w = write(outFd, buffer + written, n - written);
+                if(w == 0 || (w < 0 && errno != EINTR))
+                {
+                    return false;
+                }
+                written += (w > 0) ? w : 0;
+            }
+        }
+
+        if(n == 0)
+        {
+            return true;
+        }
+
+        if(n < 0 && errno != EINTR)
+        {
+            /* Not supported for these files, the file offsets are where the failed method left them */
+            if(method == COPY_METHOD_READ_WRITE)
+            {
+                return false;
+            }
+            method++;
+        }
+    }
+}
+
+/**
+ * Copies a file, never replacing an existing output file. A partially written output file is removed.
+ */
+static int copyImgFile(const char *inputImgFilePath, const char *outputImgFilePath)
+{
+    int inFd = open(inputImgFilePath, O_RDONLY | O_CLOEXEC);
+    if(inFd < 0)
+    {
+        return RELOCATE_STATUS_FAILED;
+    }
+
+    struct stat st;
+    int outFd = (fstat(inFd, &st) == 0) ? open(outputImgFilePath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777) : -1;
+    if(outFd < 0)
+    {
+        int status = (errno == EEXIST) ? RELOCATE_STATUS_EXISTS : RELOCATE_STATUS_FAILED;
+        close(inFd);
+        return status;
+    }
+
+    bool copied = copyFileContent(inFd, outFd);
+    copied = (close(outFd) == 0) && copied;
+    close(inFd);
+
+    if(!copied)
+    {
+        unlink(outputImgFilePath);
+    }
+
+    return copied ? RELOCATE_STATUS_DONE : RELOCATE_STATUS_FAILED;
+}
+
+/**
+ * Hard links a file, never replacing an existing output file. Falls back to a copy if the file cannot be linked.
+ */
+static int linkImgFile(const char *inputImgFilePath, const char *outputImgFilePath)
+{
+    if(link(inputImgFilePath, outputImgFilePath) == 0)
+    {
+        return RELOCATE_STATUS_DONE;
+    }
+
+    if(errno == EEXIST)
+    {
+        return RELOCATE_STATUS_EXISTS;
+    }
+
+    return copyImgFile(inputImgFilePath, outputImgFilePath);
+}
+
+/**
+ * Renames a file, never replacing an existing output file: rename() would silently drop it.
+ * Kernels without renameat2 (before 3.15) link the file to its new name and unlink the old one instead.
+ */
+static int moveImgFile(const char *inputImgFilePath, const char *outputImgFilePath)
+{
+#ifdef SYS_renameat2
+    if(syscall(SYS_renameat2, AT_FDCWD, inputImgFilePath, AT_FDCWD, outputImgFilePath, RENAME_NOREPLACE) == 0)
+    {
+        return RELOCATE_STATUS_DONE;
+    }
+
+    if(errno != ENOSYS && errno != EINVAL)
+    {
+        return (errno == EEXIST) ? RELOCATE_STATUS_EXISTS : RELOCATE_STATUS_FAILED;
+    }
+#endif
+
+    if(link(inputImgFilePath, outputImgFilePath) != 0)
+    {
+        return (errno == EEXIST) ? RELOCATE_STATUS_EXISTS : RELOCATE_STATUS_FAILED;
+    }
+
+    if(unlink(inputImgFilePath) != 0)
+    {
+        unlink(outputImgFilePath);
+        return RELOCATE_STATUS_FAILED;
+    }
+
+    return RELOCATE_STATUS_DONE;
+}
+
+/**
+ * Verb of a relocation operation, as printed in messages.
+ */
+static const char* relocateOpName(int op)
+{
+    return (op == RELOCATE_OP_MOVE) ? "move" : (op == RELOCATE_OP_LINK) ? "link" : "copy";
+}
+
+/**
+ * Path of a cluster directory.
+ */
+static string clusterDirPath(const string &labelDirPath, uint32_t clusterId)
+{
+    return labelDirPath + "/" + to_string(clusterId);
+}
+
+void disambiguateRelocations(vector<Relocation> *pRelocations)
+{
+    /* Every name given so far, keyed by cluster */
+    set<pair<uint32_t, string>> takenNames;
+    for(const Relocation &relocation : *pRelocations)
+    {
+        takenNames.insert(make_pair(relocation.clusterId, relocation.imgFileName));
+    }
+
+    set<pair<uint32_t, string>> usedNames;
+    for(Relocation &relocation : *pRelocations)
+    {
+        if(usedNames.insert(make_pair(relocation.clusterId, relocation.imgFileName)).second)
+        {
+            continue;
+        }
+
+        /* Number the duplicate before its extension, if any */
+        size_t dot = relocation.imgFileName.find_last_of('.');
+        if(dot == 0 || dot == string::npos)
+        {
+            dot = relocation.imgFileName.size();
+        }
+        string stem = relocation.imgFileName.substr(0, dot);
+        string extension = relocation.imgFileName.substr(dot);
+
+        string imgFileName;
+        for(uint64_t n = 1; ; n++)
+        {
+            imgFileName = stem + "-" + to_string(n) + extension;
+            if(takenNames.insert(make_pair(relocation.clusterId, imgFileName)).second)
+            {
+                break;
+            }
+        }
+
+        usedNames.insert(make_pair(relocation.clusterId, imgFileName));
+        relocation.imgFileName = imgFileName;
+    }
+}
+
+int relocateImgs(const vector<Relocation> &relocations, string labelDirPath, int op, int workerCount)
+{
+    /* Create every cluster directory once instead of checking the directories of every file */
+    set<uint32_t> clusterIds;
+    for(const Relocation &relocation : relocations)
+    {
+        clusterIds.insert(relocation.clusterId);
+    }
+
+    for(uint32_t clusterId : clusterIds)
+    {
+        string dirPath = clusterDirPath(labelDirPath, clusterId);
+
+        uint64_t mkdirBegin = statsStageBegin();
+        int mkdirRes = mkdir_p(dirPath.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+        statsStageEnd(STATS_STAGE_MKDIR, mkdirBegin);
+
+        if(mkdirRes != NO_ERROR)
+        {
+            std::cout << "Error: failed to create directory for file path: " << dirPath << endl;
+            return mkdirRes;
+        }
+    }
+
+    /* Each worker relocates the next file and records the outcome in that file's own slot */
+    vector<char> relocateStatuses(relocations.size(), RELOCATE_STATUS_FAILED);
+
+    parallelFor(relocations.size(), workerCount, [&](size_t i)
+    {
+        const Relocation &relocation = relocations[i];
+        string outputImgFilePath = clusterDirPath(labelDirPath, relocation.clusterId) + "/" + relocation.imgFileName;
+
+        uint64_t relocateBegin = statsStageBegin();
+
+        if(op == RELOCATE_OP_MOVE)
+        {
+            relocateStatuses[i] = moveImgFile(relocation.inputImgFilePath.c_str(), outputImgFilePath.c_str());
+        }
+        else if(op == RELOCATE_OP_LINK)
+        {
+            relocateStatuses[i] = linkImgFile(relocation.inputImgFilePath.c_str(), outputImgFilePath.c_str());
+        }
+        else
+        {
+            relocateStatuses[i] = copyImgFile(relocation.inputImgFilePath.c_str(), outputImgFilePath.c_str());
+        }
+
+        statsStageEnd(STATS_STAGE_RELOCATE, relocateBegin);
+    });
+
+    /* Report the failures in the order the files were given */
+    for(size_t i = 0; i < relocations.size(); i++)
+    {
+        if(relocateStatuses[i] != RELOCATE_STATUS_DONE)
+        {
+            statsCount(STATS_COUNTER_IMAGES_SKIPPED, 1);
+
+            /* Skip problematic image file */
+            std::cout << "Error: failed to " << relocateOpName(op) << " file: " << relocations[i].inputImgFilePath
+                << " --> " << clusterDirPath(labelDirPath, relocations[i].clusterId) << "/" << relocations[i].imgFileName
+                << (relocateStatuses[i] == RELOCATE_STATUS_EXISTS ? " (destination already exists)" : "") << endl;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Quotes a CSV field if it holds a separator, a quote, or a line break.
+ */
+static string csvField(const string &value)
+{
+    if(value.find_first_of(",\"\r\n") == string::npos)
+    {
+        return value;
+    }
+
+    string quoted = "\"";
+    for(char c : value)
+    {
+        quoted += (c == '"') ? "\"\"" : string(1, c);
+    }
+
+    return quoted + "\"";
+}
+
+int writeRelocationManifest(string manifestFilePath, const vector<Relocation> &relocations)
+{
+    ofstream out(manifestFilePath.c_str());
+    if(!out.is_open())
+    {
+        return ERROR_WRITING_MANIFEST;
+    }
+
+    out << "path,cluster\n";
+    for(const Relocation &relocation : relocations)
+    {
+        out << csvField(relocation.inputImgFilePath) << "," << relocation.clusterId << "\n";
+    }
+
+    out.close();
+    return out.fail() ? ERROR_WRITING_MANIFEST : NO_ERROR;
+}
@@ -0,0 +1,53 @@
+/**
+ * Relocation stage.
+ *
+ * Moves or copies labeled images into <label directory>/<clusterId>/. Every cluster directory is created once, up
+ * front, then the files are relocated by a pool of workers: moves are renames, copies are hard links if asked for,
+ * and otherwise are made in the kernel with copy_file_range, falling back to sendfile and then to read/write.
+ * An existing file of a cluster directory is never replaced: an image whose name is taken is left where it is.
+ * Failures are reported per file, in the order the files were given.
+ *
+ * Instead of relocating the files, a manifest CSV file mapping each image file path to its cluster id can be written.
+ */
+
+#ifndef RELOCATE_H
+#define RELOCATE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* How the images are put in their cluster directory */
+typedef enum _relocate_op {
+    RELOCATE_OP_MOVE = 0, /* Rename, the image leaves its input directory */
+    RELOCATE_OP_COPY = 1, /* Copy of the file content */
+    RELOCATE_OP_LINK = 2  /* Hard link, or a copy if the file cannot be linked e.g. across filesystems */
+} relocateOp;
+
+/* An image to put in its cluster directory */
+typedef struct _relocation {
+    std::string inputImgFilePath; /* Path of the image file */
+    std::string imgFileName;      /* File name of the image in its cluster directory */
+    uint32_t clusterId;           /* Cluster the image was labeled with */
+} Relocation;
+
+/**
+ * Renames the images that would land in the same cluster directory under the same file name, e.g. listed files
+ * of different directories, so that none of them replaces another: the second "x.jpg" of a cluster becomes "x-1.jpg",
+ * the third "x-2.jpg", and so on, skipping the names taken by other images of the cluster.
+ */
+void disambiguateRelocations(std::vector<Relocation> *pRelocations);
+
+/**
+ * Creates the cluster directories of the given relocations, then moves, copies, or links the images into them
+ * with workerCount workers (0 for one per available core).
+ * Files that could not be relocated are reported and skipped, a cluster directory that cannot be created is an error.
+ */
+int relocateImgs(const std::vector<Relocation> &relocations, std::string labelDirPath, int op, int workerCount);
+
+/**
+ * Writes a "path,cluster" CSV file with one line per relocation, without touching the images.
+ */
+int writeRelocationManifest(std::string manifestFilePath, const std::vector<Relocation> &relocations);
+
+#endif
@@ -0,0 +1,190 @@
+#include "server.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+
+/* Number of pending connections the listening socket queues */
+#define SERVER_BACKLOG                                                                                16
+
+/* Pause before accepting again when out of file descriptors or memory, in milliseconds */
+#define SERVER_ACCEPT_BACKOFF_MS                                                                      100
+
+int openServerSocket(std::string socketPath, int *pServerFd)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(socketPath.size() >= sizeof(addr.sun_path))
+    {
+        return ERROR_ARGS;
+    }
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    /* Writing to a client that disconnected must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        return ERROR_UNKNOWN;
+    }
+
+    /* Replace a stale socket file left behind by a previous server */
+    unlink(socketPath.c_str());
+
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SERVER_BACKLOG) != 0)
+    {
+        close(fd);
+        return ERROR_UNKNOWN;
+    }
+
+    *pServerFd = fd;
+    return NO_ERROR;
+}
+
+int acceptServerClient(int serverFd, int *pClientFd)
+{
+    while(true)
+    {
+        int fd = accept(serverFd, NULL, NULL);
+        if(fd >= 0)
+        {
+            *pClientFd = fd;
+            return NO_ERROR;
+        }
+
+        /* Interrupted or aborted connections are not fatal */
+        if(errno == EINTR || errno == ECONNABORTED)
+        {
+            continue;
+        }
+
+        /* Neither is a burst of clients exhausting the descriptors or memory: wait for some to be released */
+        if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_ACCEPT_BACKOFF_MS));
+            continue;
+        }
+
+        return ERROR_UNKNOWN;
+    }
+}
+
+void initServerClients(ServerClients *pClients)
+{
+    pClients->activeCount = 0;
+}
+
+void beginServerClient(ServerClients *pClients)
+{
+    std::unique_lock<std::mutex> lock(pClients->mutex);
+    pClients->changed.wait(lock, [pClients]() { return pClients->activeCount < SERVER_MAX_CLIENTS; });
+    pClients->activeCount++;
+}
+
+void endServerClient(ServerClients *pClients)
+{
+    /* Notify while locked: the waiter may release the clients as soon as it sees the count drop */
+    std::lock_guard<std::mutex> lock(pClients->mutex);
+    pClients->activeCount--;
+    pClients->changed.notify_all();
+}
+
+void waitServerClients(ServerClients *pClients)
+{
+    std::unique_lock<std::mutex> lock(pClients->mutex);
+    pClients->changed.wait(lock, [pClients]() { return pClients->activeCount == 0; });
+}
+
+int readServerLine(int fd, std::string *pPending, std::string *pLine)
+{
+    char buffer[4096];
+
+    while(true)
+    {
+        size_t eol = pPending->find('\n');
+        if(eol != std::string::npos)
+        {
+            pLine->assign(*pPending, 0, eol);
+            pPending->erase(0, eol + 1);
+
+            /* Tolerate CRLF line breaks */
+            if(!pLine->empty() && pLine->back() == '\r')
+            {
+                pLine->pop_back();
+            }
+
+            return 1;
+        }
+
+        ssize_t readCount = read(fd, buffer, sizeof(buffer));
+        if(readCount < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if(readCount <= 0)
+        {
+            /* End of stream: hand out the last unterminated line, if any */
+            if(!pPending->empty())
+            {
+                pLine->swap(*pPending);
+                pPending->clear();
+                return 1;
+            }
+
+            return 0;
+        }
+
+        pPending->append(buffer, readCount);
+    }
+}
+
+int writeServerLine(int fd, std::string line)
+{
+    line.append("\n");
+
+    const char *p = line.c_str();
+    size_t length = line.size();
+
+    while(length > 0)
+    {
+        ssize_t written = write(fd, p, length);
+        if(written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if(written <= 0)
+        {
+            return ERROR_UNKNOWN;
+        }
+
+        p += written;
+        length -= written;
+    }
+
+    return NO_ERROR;
+}
+
+int fileSignature(std::string filePath, struct stat *pSignature)
+{
+    if(stat(filePath.c_str(), pSignature) != 0)
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    return NO_ERROR;
+}
+
+bool fileSignatureChanged(const struct stat *pA, const struct stat *pB)
+{
+    return pA->st_ino != pB->st_ino || pA->st_size != pB->st_size
+        || pA->st_mtim.tv_sec != pB->st_mtim.tv_sec || pA->st_mtim.tv_nsec != pB->st_mtim.tv_nsec;
+}
@@ -0,0 +1,302 @@
+/**
+ * Persistent predict server.
+ *
+ * Loads the cluster centroids once and labels images whose file paths are received line by line, either on stdin
+ * or from any number of concurrent clients connected to a UNIX domain socket. Each request line is answered with
+ * a line holding the cluster id of the image, or -1 if the image could not be labeled.
+ * The centroids file, or a quantized model file, is reloaded when it changes on disk, requests keep using the previous
+ * centroids until the new ones are loaded.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "error_codes.hpp"
+#include "geometry.hpp"
+#include "model.hpp"
+#include "centroid_file.hpp"
+#include "quantized_model.hpp"
+#include "ingest.hpp"
+#include "kmeans.hpp"
+
+/* Answer sent for an image that could not be labeled */
+#define SERVER_NO_LABEL                                                                               -1
+
+/* Largest number of socket clients served at once, the next connections wait in the listen backlog */
+#define SERVER_MAX_CLIENTS                                                                            64
+
+/* Socket clients being served, counted so that the server waits for them before releasing the model */
+typedef struct _server_clients {
+    std::mutex mutex;
+    std::condition_variable changed;
+    int activeCount;
+} ServerClients;
+
+/**
+ * Opens a listening UNIX domain socket at the given path, replacing any stale socket file.
+ */
+int openServerSocket(std::string socketPath, int *pServerFd);
+
+/**
+ * Accepts the next client connection, retrying on interruptions and backing off while the process or the system is
+ * out of file descriptors or memory.
+ */
+int acceptServerClient(int serverFd, int *pClientFd);
+
+/**
+ * Initializes the count of the clients being served.
+ */
+void initServerClients(ServerClients *pClients);
+
+/**
+ * Counts a new client, waiting until fewer than SERVER_MAX_CLIENTS are being served.
+ */
+void beginServerClient(ServerClients *pClients);
+
+/**
+ * Uncounts a client whose thread is done with the served model.
+ */
+void endServerClient(ServerClients *pClients);
+
+/**
+ * Waits until no client is being served anymore.
+ */
+void waitServerClients(ServerClients *pClients);
+
+/**
+ * Reads the next line from the file descriptor, without the line break.
+ * Returns 0 once the end of the stream is reached and no line is left.
+ */
+int readServerLine(int fd, std::string *pPending, std::string *pLine);
+
+/**
+ * Writes a whole line to the file descriptor, adding the line break.
+ */
+int writeServerLine(int fd, std::string line);
+
+/**
+ * Modification signature of a file, used to detect centroid file changes.
+ */
+int fileSignature(std::string filePath, struct stat *pSignature);
+
+/**
+ * Whether or not two file signatures differ.
+ */
+bool fileSignatureChanged(const struct stat *pA, const struct stat *pB);
+
+/* Centroids of a served model, either floats or a quantized model compared to the downsampled pixels directly */
+template <typename G>
+struct ServedCentroids
+{
+    bool quantized;
+    std::vector<std::array<float, G::size>> centroids; /* Empty for a quantized model */
+    QuantizedModel quantizedModel;
+};
+
+/* Centroids served to the clients, swapped as a whole when the centroids file is reloaded */
+template <typename G>
+struct ServedModel
+{
+    std::string clusterCentroidsCsvFilePath;
+    int normalize;
+
+    std::mutex mutex;
+    std::shared_ptr<const ServedCentroids<G>> pCentroids;
+    struct stat signature;
+};
+
+/**
+ * Loads the centroids file, or the quantized model file, into the served model.
+ */
+template <typename G>
+int loadServedModel(ServedModel<G> *pModel)
+{
+    struct stat signature;
+    if(fileSignature(pModel->clusterCentroidsCsvFilePath, &signature) != NO_ERROR)
+    {
+        return ERROR_READING_CENTROID;
+    }
+
+    /* The file may be replaced by a model of the other kind, so it is recognized on every load */
+    std::shared_ptr<ServedCentroids<G>> pCentroids(new ServedCentroids<G>());
+    pCentroids->quantized = isQuantizedModelFile(pModel->clusterCentroidsCsvFilePath);
+    int loadRes = pCentroids->quantized
+        ? loadQuantizedModelFile<G>(pModel->clusterCentroidsCsvFilePath, pModel->normalize, &pCentroids->quantizedModel)
+        : loadCentroidsFromFile<G>(pModel->clusterCentroidsCsvFilePath, pModel->normalize, &pCentroids->centroids);
+
+    std::lock_guard<std::mutex> lock(pModel->mutex);
+
+    /* Remember the signature even on failure so that a broken file is only reported once */
+    pModel->signature = signature;
+
+    if(loadRes == NO_ERROR)
+    {
+        pModel->pCentroids = pCentroids;
+    }
+
+    return loadRes;
+}
+
+/**
+ * Returns the current centroids, reloading them first if the centroids file changed.
+ */
+template <typename G>
+std::shared_ptr<const ServedCentroids<G>> currentServedCentroids(ServedModel<G> *pModel)
+{
+    struct stat signature;
+    bool changed = false;
+
+    if(fileSignature(pModel->clusterCentroidsCsvFilePath, &signature) == NO_ERROR)
+    {
+        std::lock_guard<std::mutex> lock(pModel->mutex);
+        changed = fileSignatureChanged(&signature, &pModel->signature);
+    }
+
+    if(changed)
+    {
+        int loadRes = loadServedModel<G>(pModel);
+        if(loadRes == NO_ERROR)
+        {
+            std::cerr << "Reloaded cluster centroids: " << pModel->clusterCentroidsCsvFilePath << std::endl;
+        }
+        else
+        {
+            std::cerr << "Error: failed to reload cluster centroids, keeping the previous ones: " << pModel->clusterCentroidsCsvFilePath << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(pModel->mutex);
+    return pModel->pCentroids;
+}
+
+/**
+ * Answers the requests of a single client until it closes its input stream.
+ */
+template <typename G>
+void serveClient(int inFd, int outFd, ServedModel<G> *pModel)
+{
+    std::string pending;
+    std::string inputImgFilePath;
+
+    /* The data buffer and array that will contain a downsampled image data to process */
+    uint8_t imgDataBuffer[G::size];
+    std::array<float, G::size> imgDataArray;
+
+    while(readServerLine(inFd, &pending, &inputImgFilePath) > 0)
+    {
+        /* Ignore empty lines */
+        if(inputImgFilePath.empty())
+        {
+            continue;
+        }
+
+        int clusterId = SERVER_NO_LABEL;
+
+        /* Decode the image and label it with the current centroids */
+        if(decodeImgDataBuffer(inputImgFilePath.c_str(), G::width, G::height, G::channels, G::extractor, imgDataBuffer) == NO_ERROR)
+        {
+            std::shared_ptr<const ServedCentroids<G>> pCentroids = currentServedCentroids<G>(pModel);
+
+            if(pCentroids->quantized)
+            {
+                /* Compare the downsampled pixels to the quantized centroids, without converting them */
+                clusterId = closestQuantizedCentroid(imgDataBuffer, &pCentroids->quantizedModel);
+            }
+            else
+            {
+                imgDataBufferToArray<G>(imgDataBuffer, pModel->normalize, &imgDataArray);
+                clusterId = closestCentroid<G::size>(imgDataArray, pCentroids->centroids);
+            }
+        }
+
+        if(writeServerLine(outFd, std::to_string(clusterId)) != NO_ERROR)
+        {
+            /* Client is gone */
+            break;
+        }
+    }
+}
+
+/**
+ * Serves predictions on stdin/stdout if the socket path is empty, or on a UNIX domain socket otherwise.
+ * Socket clients are served concurrently, one thread per client and up to SERVER_MAX_CLIENTS at once.
+ * Returns once the socket can no longer accept connections and all the clients are served.
+ */
+template <typename G>
+int runPredictServer(std::string clusterCentroidsCsvFilePath, int normalize, std::string socketPath)
+{
+    ServedModel<G> model;
+    model.clusterCentroidsCsvFilePath = clusterCentroidsCsvFilePath;
+    model.normalize = normalize;
+
+    /* Load the centroids once, up front */
+    int loadRes = loadServedModel<G>(&model);
+    if(loadRes != NO_ERROR)
+    {
+        std::cerr << "Error: failed to read the cluster centroids or quantized model file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << clusterCentroidsCsvFilePath << std::endl;
+        return loadRes;
+    }
+
+    if(socketPath.empty())
+    {
+        /* Single client: stdin/stdout */
+        serveClient<G>(0, 1, &model);
+        return NO_ERROR;
+    }
+
+    int serverFd;
+    int openRes = openServerSocket(socketPath, &serverFd);
+    if(openRes != NO_ERROR)
+    {
+        std::cerr << "Error: failed to listen on socket: " << socketPath << std::endl;
+        return openRes;
+    }
+
+    /* The client threads use the model: wait for all of them before it goes out of scope */
+    ServerClients clients;
+    initServerClients(&clients);
+
+    int clientFd;
+    int acceptRes;
+    while(true)
+    {
+        beginServerClient(&clients);
+
+        acceptRes = acceptServerClient(serverFd, &clientFd);
+        if(acceptRes != NO_ERROR)
+        {
+            endServerClient(&clients);
+            break;
+        }
+
+        ServerClients *pClients = &clients;
+        std::thread([clientFd, &model, pClients]()
+        {
+            serveClient<G>(clientFd, clientFd, &model);
+            close(clientFd);
+            endServerClient(pClients);
+        }).detach();
+    }
+
+    std::cerr << "Error: failed to accept connections on socket: " << socketPath << std::endl;
+
+    close(serverFd);
+    waitServerClients(&clients);
+
+    return acceptRes;
+}
+
+#endif
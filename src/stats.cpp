@@ -0,0 +1,259 @@
+#include "stats.hpp"
+
+#include <time.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+
+#include "error_codes.hpp"
+
+using namespace std;
+
+bool statsEnabledFlag = false;
+
+/* Recorded values, updated with relaxed atomics since they are only read once the run is over */
+static atomic<uint64_t> stageNanoseconds[STATS_STAGE_COUNT];
+static atomic<uint64_t> stageCalls[STATS_STAGE_COUNT];
+static atomic<uint64_t> counterValues[STATS_COUNTER_COUNT];
+static atomic<uint64_t> latencyBuckets[STATS_LATENCY_BUCKET_COUNT];
+static atomic<uint64_t> latencyNanoseconds;
+static atomic<uint64_t> latencyCount;
+
+/* Names used in the summary and files */
+static const char *stageNames[STATS_STAGE_COUNT] = {
+    "list", "load", "resize", "convert", "cluster", "mkdir", "relocate", "extract", "read"
+};
+
+static const char *counterNames[STATS_COUNTER_COUNT] = {
+    "images_decoded", "images_corrupt", "images_skipped", "bytes_read", "distances", "distances_skipped",
+    "cache_hits", "cache_misses", "feature_allocations"
+};
+
+void enableStats()
+{
+    statsEnabledFlag = true;
+}
+
+uint64_t statsClock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t addStageTimeSince(int stage, uint64_t beginTime)
+{
+    uint64_t elapsed = statsClock() - beginTime;
+
+    stageNanoseconds[stage].fetch_add(elapsed, memory_order_relaxed);
+    stageCalls[stage].fetch_add(1, memory_order_relaxed);
+
+    return elapsed;
+}
+
+void addStatsCounterValue(int counter, uint64_t value)
+{
+    counterValues[counter].fetch_add(value, memory_order_relaxed);
+}
+
+void addImgLatency(uint64_t nanoseconds)
+{
+    if(!statsEnabled())
+    {
+        return;
+    }
+
+    /* Bucket i holds latencies of at most 2^i microseconds, the last one everything above */
+    int bucket = 0;
+    while(bucket < STATS_LATENCY_BUCKET_COUNT - 1 && nanoseconds > (1ULL << bucket) * 1000)
+    {
+        bucket++;
+    }
+
+    latencyBuckets[bucket].fetch_add(1, memory_order_relaxed);
+    latencyNanoseconds.fetch_add(nanoseconds, memory_order_relaxed);
+    latencyCount.fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * Latency percentile, as the bucket it falls in.
+ */
+static int latencyPercentileBucket(double percentile)
+{
+    uint64_t count = latencyCount.load();
+    uint64_t rank = (uint64_t)(percentile * count);
+    uint64_t seen = 0;
+
+    for(int b = 0; b < STATS_LATENCY_BUCKET_COUNT; b++)
+    {
+        seen += latencyBuckets[b].load();
+        if(seen > rank)
+        {
+            return b;
+        }
+    }
+
+    return STATS_LATENCY_BUCKET_COUNT - 1;
+}
+
+/**
+ * Bounds of a latency bucket for the summary: its upper bound, or the lower bound of the last one which is unbounded.
+ */
+static string latencyBucketBounds(int bucket)
+{
+    if(bucket == STATS_LATENCY_BUCKET_COUNT - 1)
+    {
+        return "> " + to_string(1ULL << (bucket - 1)) + " us";
+    }
+
+    return "<= " + to_string(1ULL << bucket) + " us";
+}
+
+/**
+ * Peak resident set size of the process so far, in bytes.
+ */
+static uint64_t peakRssBytes()
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+
+    /* Reported in kilobytes on Linux */
+    return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+void printStatsSummary(ostream &out)
+{
+    out << "Stats:" << endl;
+
+    for(int s = 0; s < STATS_STAGE_COUNT; s++)
+    {
+        if(stageCalls[s].load() > 0)
+        {
+            out << "  " << stageNames[s] << ": " << stageNanoseconds[s].load() / 1e6 << " ms in " << stageCalls[s].load() << " calls" << endl;
+        }
+    }
+
+    for(int c = 0; c < STATS_COUNTER_COUNT; c++)
+    {
+        out << "  " << counterNames[c] << ": " << counterValues[c].load() << endl;
+    }
+
+    out << "  peak rss: " << peakRssBytes() / (1024 * 1024) << " MB" << endl;
+
+    if(latencyCount.load() > 0)
+    {
+        out << "  image latency: mean " << latencyNanoseconds.load() / latencyCount.load() / 1000 << " us"
+            << ", p50 " << latencyBucketBounds(latencyPercentileBucket(0.50))
+            << ", p90 " << latencyBucketBounds(latencyPercentileBucket(0.90))
+            << ", p99 " << latencyBucketBounds(latencyPercentileBucket(0.99)) << endl;
+    }
+}
+
+/**
+ * Writes the stats as a JSON document.
+ */
+static void writeStatsJson(ofstream &out)
+{
+    out << "{\n  \"stages\": {";
+    for(int s = 0; s < STATS_STAGE_COUNT; s++)
+    {
+        out << (s == 0 ? "\n" : ",\n") << "    \"" << stageNames[s] << "\": {\"seconds\": " << stageNanoseconds[s].load() / 1e9
+            << ", \"calls\": " << stageCalls[s].load() << "}";
+    }
+
+    out << "\n  },\n  \"counters\": {";
+    for(int c = 0; c < STATS_COUNTER_COUNT; c++)
+    {
+        out << (c == 0 ? "\n" : ",\n") << "    \"" << counterNames[c] << "\": " << counterValues[c].load();
+    }
+
+    out << "\n  },\n  \"peak_rss_bytes\": " << peakRssBytes();
+
+    out << ",\n  \"image_latency\": {\n    \"count\": " << latencyCount.load() << ",\n    \"sum_seconds\": " << latencyNanoseconds.load() / 1e9
+        << ",\n    \"buckets\": [";
+    for(int b = 0; b < STATS_LATENCY_BUCKET_COUNT; b++)
+    {
+        /* The last bucket is unbounded, labeled like the Prometheus one */
+        out << (b == 0 ? "" : ", ") << "{\"le_microseconds\": ";
+        if(b == STATS_LATENCY_BUCKET_COUNT - 1)
+        {
+            out << "\"+Inf\"";
+        }
+        else
+        {
+            out << (1ULL << b);
+        }
+        out << ", \"count\": " << latencyBuckets[b].load() << "}";
+    }
+    out << "]\n  }\n}\n";
+}
+
+/**
+ * Writes the stats in the Prometheus text exposition format.
+ */
+static void writeStatsPrometheus(ofstream &out)
+{
+    out << "# HELP kmeans_stage_seconds_total Time spent in each stage, summed over all threads.\n";
+    out << "# TYPE kmeans_stage_seconds_total counter\n";
+    for(int s = 0; s < STATS_STAGE_COUNT; s++)
+    {
+        out << "kmeans_stage_seconds_total{stage=\"" << stageNames[s] << "\"} " << stageNanoseconds[s].load() / 1e9 << "\n";
+    }
+
+    out << "# HELP kmeans_stage_calls_total Number of times each stage ran.\n";
+    out << "# TYPE kmeans_stage_calls_total counter\n";
+    for(int s = 0; s < STATS_STAGE_COUNT; s++)
+    {
+        out << "kmeans_stage_calls_total{stage=\"" << stageNames[s] << "\"} " << stageCalls[s].load() << "\n";
+    }
+
+    for(int c = 0; c < STATS_COUNTER_COUNT; c++)
+    {
+        out << "# TYPE kmeans_" << counterNames[c] << "_total counter\n";
+        out << "kmeans_" << counterNames[c] << "_total " << counterValues[c].load() << "\n";
+    }
+
+    out << "# HELP kmeans_peak_rss_bytes Peak resident set size of the process.\n";
+    out << "# TYPE kmeans_peak_rss_bytes gauge\n";
+    out << "kmeans_peak_rss_bytes " << peakRssBytes() << "\n";
+
+    /* Prometheus histogram buckets are cumulative */
+    out << "# HELP kmeans_image_latency_seconds Decode and downsample latency per image.\n";
+    out << "# TYPE kmeans_image_latency_seconds histogram\n";
+    uint64_t cumulative = 0;
+    for(int b = 0; b < STATS_LATENCY_BUCKET_COUNT - 1; b++)
+    {
+        cumulative += latencyBuckets[b].load();
+        /* Bounds are at most 2^22 microseconds, i.e. 7 significant digits in seconds */
+        out << "kmeans_image_latency_seconds_bucket{le=\"" << setprecision(7) << (1ULL << b) / 1e6 << setprecision(6) << "\"} " << cumulative << "\n";
+    }
+    out << "kmeans_image_latency_seconds_bucket{le=\"+Inf\"} " << latencyCount.load() << "\n";
+    out << "kmeans_image_latency_seconds_sum " << latencyNanoseconds.load() / 1e9 << "\n";
+    out << "kmeans_image_latency_seconds_count " << latencyCount.load() << "\n";
+}
+
+int writeStatsFile(string statsFilePath, int format)
+{
+    ofstream out(statsFilePath.c_str());
+    if(!out.is_open())
+    {
+        return ERROR_WRITING_STATS;
+    }
+
+    if(format == STATS_FORMAT_PROMETHEUS)
+    {
+        writeStatsPrometheus(out);
+    }
+    else
+    {
+        writeStatsJson(out);
+    }
+
+    out.close();
+    return out.fail() ? ERROR_WRITING_STATS : NO_ERROR;
+}
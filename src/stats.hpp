@@ -0,0 +1,130 @@
+/**
+ * Run statistics: per-stage wall time, per-image latency histogram, and counters.
+ *
+ * Statistics are only recorded once enableStats() has been called (--stats or --stats-file). When they are not
+ * enabled, statsStageBegin() returns without reading the clock and the other recording functions return after
+ * testing a single flag, so the instrumentation can stay in the hot paths.
+ *
+ * Stage times are summed over all threads, so a stage that runs on a worker pool can add up to more than the
+ * wall time of the run. The peak resident set size of the process is read when the stats are printed or written.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <string>
+#include <iostream>
+
+/* Instrumented stages */
+typedef enum _stats_stages {
+    STATS_STAGE_LIST     = 0, /* Listing the input directory (readdir) */
+    STATS_STAGE_LOAD     = 1, /* Decoding the image files (stbi_load) */
+    STATS_STAGE_RESIZE   = 2, /* Downsampling the decoded images (stbir_resize_uint8) */
+    STATS_STAGE_CONVERT  = 3, /* Converting the downsampled pixels into features */
+    STATS_STAGE_CLUSTER  = 4, /* Training the clusters or predicting the labels */
+    STATS_STAGE_MKDIR    = 5, /* Creating the output directories (mkdir_p_x) */
+    STATS_STAGE_RELOCATE = 6, /* Moving or copying the images into their label directories */
+    STATS_STAGE_EXTRACT  = 7, /* Extracting the features of the downsampled images, with --features */
+    STATS_STAGE_READ     = 8, /* Reading the image files ahead of decoding, with --read-ahead, overlapping reads all count */
+    STATS_STAGE_COUNT    = 9
+} statsStages;
+
+/* Counters */
+typedef enum _stats_counters {
+    STATS_COUNTER_IMAGES_DECODED      = 0, /* Images successfully decoded and downsampled */
+    STATS_COUNTER_IMAGES_CORRUPT      = 1, /* Images that could not be decoded or downsampled */
+    STATS_COUNTER_IMAGES_SKIPPED      = 2, /* Decoded images that could not be moved or copied to their label directory */
+    STATS_COUNTER_BYTES_READ          = 3, /* Bytes of image files read */
+    STATS_COUNTER_DISTANCES           = 4, /* Point to centroid distances computed when predicting */
+    STATS_COUNTER_DISTANCES_SKIPPED   = 5, /* Point to centroid distances skipped thanks to the centroid distance table */
+    STATS_COUNTER_CACHE_HITS          = 6, /* Images read from the feature cache instead of being decoded */
+    STATS_COUNTER_CACHE_MISSES        = 7, /* Images looked up in the feature cache and decoded */
+    STATS_COUNTER_FEATURE_ALLOCATIONS = 8, /* Allocations of training data matrices, including the reallocations when they grow, not with dkm */
+    STATS_COUNTER_COUNT               = 9
+} statsCounters;
+
+/* Stats file formats */
+typedef enum _stats_formats {
+    STATS_FORMAT_JSON       = 0,
+    STATS_FORMAT_PROMETHEUS = 1
+} statsFormats;
+
+/* Number of buckets of the per-image latency histogram, bucket i counts latencies of at most 2^i microseconds and the
+ * last one all the longer latencies */
+#define STATS_LATENCY_BUCKET_COUNT                                                                    24
+
+/* Whether or not stats are recorded, only set through enableStats() */
+extern bool statsEnabledFlag;
+
+/**
+ * Starts recording stats.
+ */
+void enableStats();
+
+/**
+ * Whether or not stats are recorded.
+ */
+inline bool statsEnabled()
+{
+    return statsEnabledFlag;
+}
+
+/**
+ * Monotonic clock in nanoseconds.
+ */
+uint64_t statsClock();
+
+/**
+ * Start time of a stage, 0 when stats are not enabled.
+ */
+inline uint64_t statsStageBegin()
+{
+    return statsEnabled() ? statsClock() : 0;
+}
+
+/**
+ * Adds the time elapsed since statsStageBegin() to a stage, returns the elapsed nanoseconds.
+ */
+uint64_t addStageTimeSince(int stage, uint64_t beginTime);
+
+/**
+ * Ends a stage started with statsStageBegin().
+ */
+inline uint64_t statsStageEnd(int stage, uint64_t beginTime)
+{
+    return statsEnabled() ? addStageTimeSince(stage, beginTime) : 0;
+}
+
+/**
+ * Adds a value to a counter.
+ */
+void addStatsCounterValue(int counter, uint64_t value);
+
+/**
+ * Adds a value to a counter if stats are enabled.
+ */
+inline void statsCount(int counter, uint64_t value)
+{
+    if(statsEnabled())
+    {
+        addStatsCounterValue(counter, value);
+    }
+}
+
+/**
+ * Records the decode and downsample latency of an image.
+ */
+void addImgLatency(uint64_t nanoseconds);
+
+/**
+ * Prints a human readable summary of the recorded stats.
+ */
+void printStatsSummary(std::ostream &out);
+
+/**
+ * Writes the recorded stats to a JSON or Prometheus text exposition file.
+ */
+int writeStatsFile(std::string statsFilePath, int format);
+
+#endif
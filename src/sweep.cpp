@@ -0,0 +1,185 @@
+#include "sweep.hpp"
+
+#include <fstream>
+
+#include "error_codes.hpp"
+
+using namespace std;
+
+/* Names of the scores, indexed by score */
+static const char *sweepScoreNames[] = {
+    "elbow", "silhouette", "davies-bouldin"
+};
+
+const char* sweepScoreName(int score)
+{
+    if(score < 0 || score >= (int)(sizeof(sweepScoreNames) / sizeof(sweepScoreNames[0])))
+    {
+        return "unknown";
+    }
+
+    return sweepScoreNames[score];
+}
+
+vector<size_t> silhouetteSampleIndices(size_t pointCount, size_t sampleSize, uint64_t seed)
+{
+    vector<size_t> indices(pointCount);
+    for(size_t i = 0; i < pointCount; i++)
+    {
+        indices[i] = i;
+    }
+
+    if(sampleSize < pointCount)
+    {
+        /* Partial Fisher-Yates shuffle, with its own generator so that it does not disturb the k-means++ draws */
+        mt19937_64 rng(seed ^ 0x9e3779b97f4a7c15ULL);
+        for(size_t i = 0; i < sampleSize; i++)
+        {
+            uniform_int_distribution<size_t> uniform(i, pointCount - 1);
+            swap(indices[i], indices[uniform(rng)]);
+        }
+
+        indices.resize(sampleSize);
+        sort(indices.begin(), indices.end());
+    }
+
+    return indices;
+}
+
+double silhouetteScore(const vector<float>& sampleDistances, const vector<uint32_t>& sampleClusters, uint32_t k, int threadCount)
+{
+    const size_t s = sampleClusters.size();
+    const size_t partitionCount = kmeansPartitionCount(s);
+
+    /* Number of sample points per cluster */
+    vector<size_t> counts(k, 0);
+    for(uint32_t c : sampleClusters)
+    {
+        counts[c]++;
+    }
+
+    /* Per partition sums of the coefficients, reduced in partition order */
+    vector<double> partitionSums(partitionCount, 0.0);
+
+    parallelFor(partitionCount, threadCount, [&](size_t p)
+    {
+        size_t begin, end;
+        kmeansPartitionRange(s, partitionCount, p, &begin, &end);
+
+        vector<double> clusterDistances(k);
+        double sum = 0;
+
+        for(size_t i = begin; i < end; i++)
+        {
+            const uint32_t own = sampleClusters[i];
+            if(counts[own] < 2)
+            {
+                continue;
+            }
+
+            /* Sum of the distances from the point to the sample points of each cluster */
+            fill(clusterDistances.begin(), clusterDistances.end(), 0.0);
+            const float *pRow = &sampleDistances[i * s];
+            for(size_t j = 0; j < s; j++)
+            {
+                clusterDistances[sampleClusters[j]] += pRow[j];
+            }
+
+            /* Mean distance to the own cluster and to the nearest other cluster */
+            double a = clusterDistances[own] / (counts[own] - 1);
+            double b = numeric_limits<double>::max();
+            for(uint32_t c = 0; c < k; c++)
+            {
+                if(c != own && counts[c] > 0)
+                {
+                    b = min(b, clusterDistances[c] / counts[c]);
+                }
+            }
+
+            if(b != numeric_limits<double>::max() && max(a, b) > 0)
+            {
+                sum += (b - a) / max(a, b);
+            }
+        }
+
+        partitionSums[p] = sum;
+    });
+
+    double score = 0;
+    for(double sum : partitionSums)
+    {
+        score += sum;
+    }
+
+    return s > 0 ? score / s : 0;
+}
+
+size_t selectSweepResult(const vector<SweepResult>& results, int score)
+{
+    size_t selected = 0;
+
+    if(score == SWEEP_SCORE_SILHOUETTE)
+    {
+        for(size_t r = 1; r < results.size(); r++)
+        {
+            if(results[r].silhouette > results[selected].silhouette)
+            {
+                selected = r;
+            }
+        }
+    }
+    else if(score == SWEEP_SCORE_DAVIES_BOULDIN)
+    {
+        for(size_t r = 1; r < results.size(); r++)
+        {
+            if(results[r].daviesBouldin < results[selected].daviesBouldin)
+            {
+                selected = r;
+            }
+        }
+    }
+    else if(results.size() > 2)
+    {
+        /* Normalize the curve to the unit square and pick the K furthest below the chord from the first to the last K */
+        const SweepResult& first = results.front();
+        const SweepResult& last = results.back();
+        const double kRange = (double)last.k - first.k;
+        const double inertiaRange = first.inertia - last.inertia;
+
+        double bestGap = 0;
+        for(size_t r = 1; r + 1 < results.size(); r++)
+        {
+            double x = (results[r].k - first.k) / kRange;
+            double y = inertiaRange > 0 ? (results[r].inertia - last.inertia) / inertiaRange : 0;
+            double gap = (1.0 - x) - y;
+            if(gap > bestGap)
+            {
+                bestGap = gap;
+                selected = r;
+            }
+        }
+    }
+
+    return selected;
+}
+
+int writeSweepReport(string reportFilePath, const vector<SweepResult>& results, size_t selected, int score)
+{
+    ofstream out(reportFilePath.c_str());
+    if(!out.is_open())
+    {
+        return ERROR_WRITING_REPORT;
+    }
+
+    out << "{\n  \"score\": \"" << sweepScoreName(score) << "\",\n  \"selected_k\": " << results[selected].k << ",\n  \"runs\": [";
+    for(size_t r = 0; r < results.size(); r++)
+    {
+        out << (r == 0 ? "\n" : ",\n") << "    {\"k\": " << results[r].k << ", \"iterations\": " << results[r].iterations
+            << ", \"inertia\": " << results[r].inertia << ", \"silhouette\": " << results[r].silhouette
+            << ", \"davies_bouldin\": " << results[r].daviesBouldin << "}";
+    }
+    out << "\n  ]\n}\n";
+
+    out.close();
+    return out.fail() ? ERROR_WRITING_REPORT : NO_ERROR;
+}
@@ -0,0 +1,237 @@
+/**
+ * Automatic K selection.
+ *
+ * Trains every K of a range concurrently and scores each clustering, so that K does not have to be chosen by
+ * training several times by hand. The runs share the training data and a single k-means++ initialization:
+ * k-means++ picks its seeds one after the other, so the first K seeds drawn for the largest K are the seeds that
+ * would be drawn for K. A sweep run therefore produces the same centroids as the parallel engine with the same seed.
+ *
+ * Scores:
+ *  - elbow: inertia (sum of the squared distances of the points to their centroid). The selected K is the one
+ *    furthest below the straight line between the inertias of the smallest and largest K.
+ *  - silhouette: mean silhouette coefficient of a random sample of the points, higher is better. The pairwise
+ *    distances of the sample are computed once and shared by all the runs.
+ *  - davies-bouldin: Davies-Bouldin index of all the points, lower is better.
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.hpp"
+#include "kmeans.hpp"
+
+/* Scores used to select K */
+typedef enum _sweep_score {
+    SWEEP_SCORE_ELBOW          = 0, /* Knee of the inertia curve */
+    SWEEP_SCORE_SILHOUETTE     = 1, /* Highest mean silhouette coefficient of a sample */
+    SWEEP_SCORE_DAVIES_BOULDIN = 2  /* Lowest Davies-Bouldin index */
+} sweepScore;
+
+typedef struct _sweep_params {
+    uint32_t minK;            /* Smallest K, at least 2 */
+    uint32_t maxK;            /* Largest K */
+    uint64_t seed;            /* Seed of the shared k-means++ initialization and of the silhouette sample */
+    int threadCount;          /* Number of threads, 0 for one per available core */
+    bool useBounds;           /* Whether or not the runs use the Hamerly bounds */
+    size_t sampleSize;        /* Number of points of the silhouette sample */
+} SweepParams;
+
+typedef struct _sweep_result {
+    uint32_t k;               /* Number of clusters */
+    uint64_t iterations;      /* Number of Lloyd iterations run */
+    double inertia;           /* Sum of the squared distances from each point to its centroid */
+    double silhouette;        /* Mean silhouette coefficient of the sample */
+    double daviesBouldin;     /* Davies-Bouldin index */
+} SweepResult;
+
+/**
+ * Name of a score, as used on the command line and in the report.
+ */
+const char* sweepScoreName(int score);
+
+/**
+ * Distinct point indices of the silhouette sample, in increasing order. All the points when there are fewer than sampleSize.
+ */
+std::vector<size_t> silhouetteSampleIndices(size_t pointCount, size_t sampleSize, uint64_t seed);
+
+/**
+ * Mean silhouette coefficient of the sample given the pairwise distances of its points and their clusters.
+ * A point alone in its cluster within the sample has a coefficient of 0.
+ */
+double silhouetteScore(const std::vector<float>& sampleDistances, const std::vector<uint32_t>& sampleClusters, uint32_t k, int threadCount);
+
+/**
+ * Index of the selected result for the given score.
+ */
+size_t selectSweepResult(const std::vector<SweepResult>& results, int score);
+
+/**
+ * Writes the scores of every K and the selected K as a JSON document.
+ */
+int writeSweepReport(std::string reportFilePath, const std::vector<SweepResult>& results, size_t selected, int score);
+
+/**
+ * Euclidean distances between every pair of sample points, sampleDistances[i * s + j] = d(i, j).
+ */
+template <size_t N>
+std::vector<float> sampleDistanceMatrix(const FeatureMatrix<N>& data, const std::vector<size_t>& sampleIndices, int threadCount)
+{
+    const size_t s = sampleIndices.size();
+    std::vector<float> sampleDistances(s * s, 0.0f);
+
+    /* Each row only fills the upper triangle so that every distance is computed once */
+    parallelFor(s, threadCount, [&](size_t i)
+    {
+        for(size_t j = i + 1; j < s; j++)
+        {
+            float d = std::sqrt(distanceSquared<N>(data[sampleIndices[i]], data[sampleIndices[j]]));
+            sampleDistances[i * s + j] = d;
+            sampleDistances[j * s + i] = d;
+        }
+    });
+
+    return sampleDistances;
+}
+
+/**
+ * Davies-Bouldin index: mean over the clusters of the largest (S_a + S_b) / d(a, b), where S is the mean distance of
+ * the points of a cluster to its centroid. Empty clusters are left out.
+ */
+template <size_t N>
+double daviesBouldinIndex(const FeatureMatrix<N>& data, const std::vector<std::array<float, N>>& centroids,
+    const std::vector<uint32_t>& clusters, int threadCount)
+{
+    const uint32_t k = (uint32_t)centroids.size();
+    const size_t partitionCount = kmeansPartitionCount(data.size());
+
+    /* Per partition sums of the distances to the centroids, reduced in partition order */
+    std::vector<double> partitionScatters(partitionCount * k, 0.0);
+    std::vector<uint64_t> partitionCounts(partitionCount * k, 0);
+
+    parallelFor(partitionCount, threadCount, [&](size_t p)
+    {
+        size_t begin, end;
+        kmeansPartitionRange(data.size(), partitionCount, p, &begin, &end);
+
+        for(size_t i = begin; i < end; i++)
+        {
+            partitionScatters[p * k + clusters[i]] += std::sqrt(distanceSquared<N>(data[i], centroids[clusters[i]]));
+            partitionCounts[p * k + clusters[i]]++;
+        }
+    });
+
+    std::vector<double> scatters(k, 0.0);
+    std::vector<uint64_t> counts(k, 0);
+    for(size_t p = 0; p < partitionCount; p++)
+    {
+        for(uint32_t c = 0; c < k; c++)
+        {
+            scatters[c] += partitionScatters[p * k + c];
+            counts[c] += partitionCounts[p * k + c];
+        }
+    }
+
+    double index = 0;
+    uint32_t nonEmpty = 0;
+
+    for(uint32_t a = 0; a < k; a++)
+    {
+        if(counts[a] == 0)
+        {
+            continue;
+        }
+
+        double worst = 0;
+        for(uint32_t b = 0; b < k; b++)
+        {
+            if(b == a || counts[b] == 0)
+            {
+                continue;
+            }
+
+            double separation = std::sqrt(distanceSquared<N>(centroids[a], centroids[b]));
+            double similarity = (separation > 0)
+                ? (scatters[a] / counts[a] + scatters[b] / counts[b]) / separation
+                : std::numeric_limits<double>::max();
+            worst = std::max(worst, similarity);
+        }
+
+        index += worst;
+        nonEmpty++;
+    }
+
+    return nonEmpty > 0 ? index / nonEmpty : 0;
+}
+
+/**
+ * Trains and scores every K in [minK, maxK].
+ *
+ * The runs are spread over the threads, each run getting an equal share of them. Every run is reproducible for a
+ * given seed whatever the number of threads, so the results and the selection do not depend on it either.
+ * Returns the centroids of every K, in increasing K order.
+ */
+template <size_t N>
+std::vector<std::vector<std::array<float, N>>> kmeansSweep(const FeatureMatrix<N>& data,
+    const SweepParams *pParams, std::vector<SweepResult> *pResults)
+{
+    const size_t runCount = pParams->maxK - pParams->minK + 1;
+    const int threadCount = resolveThreadCount(pParams->threadCount);
+    const int runThreadCount = std::max(1, threadCount / (int)std::min<size_t>(runCount, threadCount));
+
+    /* Shared by all the runs: the seeds of the largest K, and the distances between the silhouette sample points */
+    std::vector<std::array<float, N>> seeds = seedKmeansPlusPlus<N>(data, pParams->maxK, pParams->seed, threadCount);
+
+    std::vector<size_t> sampleIndices = silhouetteSampleIndices(data.size(), pParams->sampleSize, pParams->seed);
+    std::vector<float> sampleDistances = sampleDistanceMatrix<N>(data, sampleIndices, threadCount);
+
+    std::vector<std::vector<std::array<float, N>>> centroidsPerK(runCount);
+    pResults->assign(runCount, SweepResult());
+
+    parallelFor(runCount, threadCount / runThreadCount, [&](size_t r)
+    {
+        KmeansParams params;
+        params.k = pParams->minK + (uint32_t)r;
+        params.seed = pParams->seed;
+        params.threadCount = runThreadCount;
+        params.maxIterations = 0;
+        params.batchSize = 0;
+        params.abandonAfter = 0;
+        params.abandonInertia = 0;
+        params.init = KMEANS_INIT_PLUS_PLUS;
+        params.oversampling = 2.0f;
+
+        KmeansStats stats;
+        std::tuple<std::vector<std::array<float, N>>, std::vector<uint32_t>> clusterData =
+            kmeansLloydRun<N>(data, &params, pParams->useBounds, &stats, &seeds);
+
+        const std::vector<uint32_t>& clusters = std::get<1>(clusterData);
+        std::vector<uint32_t> sampleClusters(sampleIndices.size());
+        for(size_t i = 0; i < sampleIndices.size(); i++)
+        {
+            sampleClusters[i] = clusters[sampleIndices[i]];
+        }
+
+        SweepResult *pResult = &(*pResults)[r];
+        pResult->k = params.k;
+        pResult->iterations = stats.iterations;
+        pResult->inertia = stats.inertia;
+        pResult->silhouette = silhouetteScore(sampleDistances, sampleClusters, params.k, runThreadCount);
+        pResult->daviesBouldin = daviesBouldinIndex<N>(data, std::get<0>(clusterData), clusters, runThreadCount);
+
+        centroidsPerK[r] = std::move(std::get<0>(clusterData));
+    });
+
+    return centroidsPerK;
+}
+
+#endif
@@ -0,0 +1,296 @@
+#include "tar_archive.hpp"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error_codes.hpp"
+
+using namespace std;
+
+/* Offsets and lengths of the ustar header fields used */
+#define TAR_NAME_OFFSET                                                                                0
+#define TAR_NAME_LENGTH                                                                              100
+#define TAR_SIZE_OFFSET                                                                              124
+#define TAR_SIZE_LENGTH                                                                               12
+#define TAR_CHECKSUM_OFFSET                                                                          148
+#define TAR_CHECKSUM_LENGTH                                                                            8
+#define TAR_TYPEFLAG_OFFSET                                                                          156
+#define TAR_MAGIC_OFFSET                                                                             257
+#define TAR_PREFIX_OFFSET                                                                            345
+#define TAR_PREFIX_LENGTH                                                                            155
+
+/**
+ * Parses a numeric header field: octal digits, or big endian base-256 if the high bit of the first byte is set.
+ * Returns false if the value does not fit.
+ */
+static bool parseTarNumber(const uint8_t *pField, size_t length, uint64_t *pValue)
+{
+    uint64_t value = 0;
+
+    if(pField[0] & 0x80)
+    {
+        value = pField[0] & 0x7f;
+        for(size_t i = 1; i < length; i++)
+        {
+            if(value > (UINT64_MAX >> 8))
+            {
+                return false;
+            }
+            value = (value << 8) | pField[i];
+        }
+
+        *pValue = value;
+        return true;
+    }
+
+    size_t i = 0;
+    while(i < length && (pField[i] == ' ' || pField[i] == '\0'))
+    {
+        i++;
+    }
+
+    for(; i < length && pField[i] >= '0' && pField[i] <= '7'; i++)
+    {
+        if(value > (UINT64_MAX >> 3))
+        {
+            return false;
+        }
+        value = (value << 3) | (pField[i] - '0');
+    }
+
+    *pValue = value;
+    return true;
+}
+
+/**
+ * Whether or not the header checksum matches, summing the bytes as unsigned or, like some old writers, as signed.
+ */
+static bool isTarHeaderValid(const uint8_t *pHeader)
+{
+    uint64_t expected;
+    if(!parseTarNumber(pHeader + TAR_CHECKSUM_OFFSET, TAR_CHECKSUM_LENGTH, &expected))
+    {
+        return false;
+    }
+
+    /* The checksum field itself counts as spaces */
+    int64_t unsignedSum = 0;
+    int64_t signedSum = 0;
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        bool inChecksum = i >= TAR_CHECKSUM_OFFSET && i < TAR_CHECKSUM_OFFSET + TAR_CHECKSUM_LENGTH;
+        unsignedSum += inChecksum ? ' ' : pHeader[i];
+        signedSum += inChecksum ? ' ' : (int8_t)pHeader[i];
+    }
+
+    return (int64_t)expected == unsignedSum || (int64_t)expected == signedSum;
+}
+
+/**
+ * Whether or not the block is all zeros, i.e. marks the end of the archive.
+ */
+static bool isTarZeroBlock(const uint8_t *pBlock)
+{
+    for(size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        if(pBlock[i] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * A NUL padded string field.
+ */
+static string tarString(const uint8_t *pField, size_t length)
+{
+    return string((const char*)pField, strnlen((const char*)pField, length));
+}
+
+/**
+ * Path of the entry given by the "path" record of pax extended header data, if any.
+ */
+static bool parsePaxPath(const uint8_t *pData, size_t length, string *pPath)
+{
+    bool found = false;
+    size_t pos = 0;
+
+    /* Each record is "<length> <key>=<value>\n", the length counting the whole record */
+    while(pos < length)
+    {
+        size_t recordLength = 0;
+        size_t i = pos;
+        while(i < length && pData[i] >= '0' && pData[i] <= '9')
+        {
+            recordLength = recordLength * 10 + (pData[i] - '0');
+            i++;
+        }
+
+        if(i >= length || pData[i] != ' ' || recordLength == 0 || pos + recordLength > length)
+        {
+            break;
+        }
+
+        string record((const char*)pData + i + 1, pos + recordLength - (i + 1));
+        if(!record.empty() && record.back() == '\n')
+        {
+            record.pop_back();
+        }
+
+        if(record.compare(0, 5, "path=") == 0)
+        {
+            *pPath = record.substr(5);
+            found = true;
+        }
+
+        pos += recordLength;
+    }
+
+    return found;
+}
+
+int mapTarArchive(string tarFilePath, TarArchiveMap *pMap, vector<TarEntry> *pEntries)
+{
+    memset(pMap, 0, sizeof(TarArchiveMap));
+    pEntries->clear();
+
+    int fd = open(tarFilePath.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return ERROR_READING_ARCHIVE;
+    }
+
+    struct stat sb;
+    if(fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || (size_t)sb.st_size < TAR_BLOCK_SIZE)
+    {
+        close(fd);
+        return ERROR_READING_ARCHIVE;
+    }
+
+    void *pAddr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* The mapping stays valid after the file descriptor is closed */
+    close(fd);
+
+    if(pAddr == MAP_FAILED)
+    {
+        return ERROR_READING_ARCHIVE;
+    }
+
+    pMap->pAddr = pAddr;
+    pMap->length = sb.st_size;
+    pMap->pData = (const uint8_t*)pAddr;
+
+    /* Entries are decoded in archive order */
+    madvise(pAddr, pMap->length, MADV_SEQUENTIAL);
+
+    /* Name given by a GNU long name or pax extended header to the entry that follows it */
+    string nextName;
+    bool hasNextName = false;
+
+    size_t pos = 0;
+    bool ended = false;
+    while(pos + TAR_BLOCK_SIZE <= pMap->length)
+    {
+        const uint8_t *pHeader = pMap->pData + pos;
+
+        /* Two zero blocks end the archive, one is enough to stop reading */
+        if(isTarZeroBlock(pHeader))
+        {
+            ended = true;
+            break;
+        }
+
+        uint64_t entrySize;
+        if(!isTarHeaderValid(pHeader) || !parseTarNumber(pHeader + TAR_SIZE_OFFSET, TAR_SIZE_LENGTH, &entrySize))
+        {
+            unmapTarArchive(pMap);
+            pEntries->clear();
+            return ERROR_READING_ARCHIVE;
+        }
+
+        size_t dataOffset = pos + TAR_BLOCK_SIZE;
+        if(entrySize > pMap->length - dataOffset)
+        {
+            unmapTarArchive(pMap);
+            pEntries->clear();
+            return ERROR_READING_ARCHIVE;
+        }
+
+        const uint8_t *pEntryData = pMap->pData + dataOffset;
+        char typeflag = (char)pHeader[TAR_TYPEFLAG_OFFSET];
+
+        if(typeflag == 'L')
+        {
+            /* GNU long name of the next entry */
+            nextName = tarString(pEntryData, entrySize);
+            hasNextName = true;
+        }
+        else if(typeflag == 'x')
+        {
+            /* pax extended header of the next entry, only its path matters */
+            hasNextName = parsePaxPath(pEntryData, entrySize, &nextName) || hasNextName;
+        }
+        else if(typeflag == 'g')
+        {
+            /* pax global header, nothing that matters here */
+        }
+        else
+        {
+            /* Regular files, including the contiguous files of some writers */
+            if(typeflag == '0' || typeflag == '\0' || typeflag == '7')
+            {
+                TarEntry entry;
+                entry.offset = dataOffset;
+                entry.size = entrySize;
+
+                if(hasNextName)
+                {
+                    entry.name = nextName;
+                }
+                else
+                {
+                    /* The ustar prefix holds the leading directories of names longer than the name field */
+                    string prefix = (memcmp(pHeader + TAR_MAGIC_OFFSET, "ustar", 5) == 0)
+                        ? tarString(pHeader + TAR_PREFIX_OFFSET, TAR_PREFIX_LENGTH) : "";
+                    string name = tarString(pHeader + TAR_NAME_OFFSET, TAR_NAME_LENGTH);
+                    entry.name = prefix.empty() ? name : prefix + "/" + name;
+                }
+
+                pEntries->push_back(entry);
+            }
+
+            nextName.clear();
+            hasNextName = false;
+        }
+
+        /* Entry data is padded to whole blocks */
+        pos = dataOffset + ((entrySize + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE) * TAR_BLOCK_SIZE;
+    }
+
+    /* Archives are made of whole blocks, anything else left at the end is a truncated archive */
+    if(!ended && pos != pMap->length)
+    {
+        unmapTarArchive(pMap);
+        pEntries->clear();
+        return ERROR_READING_ARCHIVE;
+    }
+
+    return NO_ERROR;
+}
+
+void unmapTarArchive(TarArchiveMap *pMap)
+{
+    if(pMap->pAddr != NULL)
+    {
+        munmap(pMap->pAddr, pMap->length);
+    }
+
+    memset(pMap, 0, sizeof(TarArchiveMap));
+}
@@ -0,0 +1,57 @@
+/**
+ * Read-only tar archive of images.
+ *
+ * Maps a whole archive in memory and indexes its regular file entries, so that many small images can be read
+ * with a single open instead of one open per image. The image data of an entry is used in place, inside the
+ * mapping, without extracting it.
+ *
+ * Supports POSIX ustar archives, with the GNU long name and pax path extensions, e.g. as written by GNU tar
+ * and bsdtar. Compressed archives are not supported. Entries other than regular files (directories, links,
+ * devices) are skipped.
+ */
+
+#ifndef TAR_ARCHIVE_H
+#define TAR_ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* Size of a tar header and of the blocks the entry data is padded to */
+#define TAR_BLOCK_SIZE                                                                               512
+
+/* A regular file entry of the archive */
+typedef struct _tar_entry {
+    std::string name;         /* Path of the file within the archive */
+    size_t offset;            /* Offset of the file data from the start of the archive */
+    size_t size;              /* Size of the file data */
+} TarEntry;
+
+/* A read-only memory mapped tar archive */
+typedef struct _tar_archive_map {
+    const uint8_t *pData;     /* Start of the archive, inside the mapping */
+    void *pAddr;              /* Start of the mapping */
+    size_t length;            /* Length of the mapping */
+} TarArchiveMap;
+
+/**
+ * Memory maps the archive and lists its regular file entries in archive order.
+ * Fails if a header is corrupt or if the archive is truncated.
+ */
+int mapTarArchive(std::string tarFilePath, TarArchiveMap *pMap, std::vector<TarEntry> *pEntries);
+
+/**
+ * Unmaps an archive mapped by mapTarArchive().
+ */
+void unmapTarArchive(TarArchiveMap *pMap);
+
+/**
+ * Pointer to the data of an entry of the archive.
+ */
+inline const uint8_t* tarEntryData(const TarArchiveMap *pMap, const TarEntry *pEntry)
+{
+    return pMap->pData + pEntry->offset;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include "watch.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/inotify.h>
+
+/* Set by the SIGINT and SIGTERM handler */
+static volatile sig_atomic_t stopRequested = 0;
+
+void initWatchQueue(WatchQueue *pQueue, size_t capacity)
+{
+    pQueue->imgFileNames.clear();
+    pQueue->pendingImgFileNames.clear();
+    pQueue->capacity = capacity;
+    pQueue->closed = false;
+}
+
+bool pushWatchQueue(WatchQueue *pQueue, const std::string &imgFileName)
+{
+    std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+    /* Already waiting to be labeled, e.g. written again or listed by a rescan */
+    if(pQueue->pendingImgFileNames.count(imgFileName) > 0)
+    {
+        return !pQueue->closed;
+    }
+
+    pQueue->notFull.wait(lock, [pQueue]() { return pQueue->closed || pQueue->imgFileNames.size() < pQueue->capacity; });
+    if(pQueue->closed)
+    {
+        return false;
+    }
+
+    pQueue->imgFileNames.push_back(imgFileName);
+    pQueue->pendingImgFileNames.insert(imgFileName);
+    pQueue->notEmpty.notify_one();
+
+    return true;
+}
+
+bool popWatchBatch(WatchQueue *pQueue, size_t maxCount, std::vector<std::string> *pImgFileNames)
+{
+    std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+    pQueue->notEmpty.wait(lock, [pQueue]() { return pQueue->closed || !pQueue->imgFileNames.empty(); });
+    if(pQueue->imgFileNames.empty())
+    {
+        return false;
+    }
+
+    pImgFileNames->clear();
+    while(pImgFileNames->size() < maxCount && !pQueue->imgFileNames.empty())
+    {
+        pImgFileNames->push_back(pQueue->imgFileNames.front());
+        pQueue->pendingImgFileNames.erase(pQueue->imgFileNames.front());
+        pQueue->imgFileNames.pop_front();
+    }
+    pQueue->notFull.notify_all();
+
+    return true;
+}
+
+void closeWatchQueue(WatchQueue *pQueue)
+{
+    std::lock_guard<std::mutex> lock(pQueue->mutex);
+
+    pQueue->closed = true;
+    pQueue->notEmpty.notify_all();
+    pQueue->notFull.notify_all();
+}
+
+int openDirWatch(std::string inputImgDirPath, int *pWatchFd)
+{
+    int fd = inotify_init1(IN_CLOEXEC);
+    if(fd < 0)
+    {
+        return ERROR_UNKNOWN;
+    }
+
+    /* Only report files once they are complete: closed after writing, or renamed into the directory */
+    if(inotify_add_watch(fd, inputImgDirPath.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0)
+    {
+        close(fd);
+        return ERROR_OPENING_DIR;
+    }
+
+    *pWatchFd = fd;
+    return NO_ERROR;
+}
+
+int readDirWatchEvents(int watchFd, int timeoutMs, std::vector<std::string> *pImgFileNames, bool *pOverflow)
+{
+    struct pollfd pfd;
+    pfd.fd = watchFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int pollRes = poll(&pfd, 1, timeoutMs);
+    if(pollRes < 0)
+    {
+        /* Interrupted by a signal, the caller checks whether it asked to stop */
+        return (errno == EINTR) ? NO_ERROR : ERROR_UNKNOWN;
+    }
+    if(pollRes == 0)
+    {
+        return NO_ERROR;
+    }
+
+    /* Large enough for at least one event with the longest file name */
+    alignas(struct inotify_event) char buffer[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+    ssize_t length = read(watchFd, buffer, sizeof(buffer));
+    if(length < 0)
+    {
+        return (errno == EINTR || errno == EAGAIN) ? NO_ERROR : ERROR_UNKNOWN;
+    }
+
+    for(ssize_t offset = 0; offset < length; )
+    {
+        const struct inotify_event *pEvent = (const struct inotify_event*)(buffer + offset);
+        offset += sizeof(struct inotify_event) + pEvent->len;
+
+        if(pEvent->mask & IN_Q_OVERFLOW)
+        {
+            *pOverflow = true;
+        }
+        else if(pEvent->len > 0 && !(pEvent->mask & IN_ISDIR))
+        {
+            pImgFileNames->push_back(std::string(pEvent->name));
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Asks the watch to stop, the queued images are still labeled.
+ */
+static void handleWatchStop(int signum)
+{
+    (void)signum;
+    stopRequested = 1;
+}
+
+void installWatchStopHandler()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleWatchStop;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
+
+bool watchStopRequested()
+{
+    return stopRequested != 0;
+}
@@ -0,0 +1,304 @@
+/**
+ * Watch mode: continuous batch prediction.
+ *
+ * Loads the cluster centroids once, subscribes to the inotify events of an input directory, and labels every image
+ * as soon as it is fully written, i.e. closed after writing or moved into the directory. Each labeled image is moved
+ * to <output>/<clusterId>/ like batch predict does. Files whose name starts with a dot are ignored so that partially
+ * written files can be renamed into place.
+ *
+ * The inotify reader and the labeling run on separate threads connected by a bounded queue. The labeling thread takes
+ * up to a batch of queued file names at a time and decodes them on a worker pool. When images arrive faster than they
+ * are labeled the queue fills up and the reader stops draining inotify, the kernel keeps queueing the events and, if
+ * its own queue overflows, the input directory is rescanned once there is room again.
+ *
+ * The centroids file is reloaded when it changes on disk, like in the serve mode. SIGINT and SIGTERM stop the watch
+ * once the queued images are labeled.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_set>
+
+#include "error_codes.hpp"
+#include "geometry.hpp"
+#include "ingest.hpp"
+#include "kmeans.hpp"
+#include "parallel.hpp"
+#include "relocate.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+
+/* Time the inotify reader waits for events before checking whether it was asked to stop */
+#define WATCH_POLL_TIMEOUT_MS                                                                        500
+
+/* Bounded queue of file names waiting to be labeled, each name queued at most once */
+typedef struct _watch_queue {
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<std::string> imgFileNames;
+    std::unordered_set<std::string> pendingImgFileNames;
+    size_t capacity;
+    bool closed;
+} WatchQueue;
+
+/**
+ * Initializes an empty queue holding up to capacity file names.
+ */
+void initWatchQueue(WatchQueue *pQueue, size_t capacity);
+
+/**
+ * Queues a file name, waiting for room if the queue is full. A name that is already queued is not queued twice.
+ * Returns false if the queue was closed.
+ */
+bool pushWatchQueue(WatchQueue *pQueue, const std::string &imgFileName);
+
+/**
+ * Takes up to maxCount file names, waiting for at least one.
+ * Returns false once the queue is closed and empty.
+ */
+bool popWatchBatch(WatchQueue *pQueue, size_t maxCount, std::vector<std::string> *pImgFileNames);
+
+/**
+ * Wakes up the labeling thread so that it returns once the queue is empty, and the reader if it waits for room.
+ */
+void closeWatchQueue(WatchQueue *pQueue);
+
+/**
+ * Starts watching the input directory for files that are closed after writing or moved into it.
+ */
+int openDirWatch(std::string inputImgDirPath, int *pWatchFd);
+
+/**
+ * Waits up to timeoutMs for inotify events and appends the names of the files they report.
+ * Sets pOverflow if the kernel dropped events, in which case the directory has to be rescanned.
+ */
+int readDirWatchEvents(int watchFd, int timeoutMs, std::vector<std::string> *pImgFileNames, bool *pOverflow);
+
+/**
+ * Makes SIGINT and SIGTERM request the watch to stop instead of terminating the process.
+ */
+void installWatchStopHandler();
+
+/**
+ * Whether or not SIGINT or SIGTERM was received.
+ */
+bool watchStopRequested();
+
+/**
+ * Whether or not the file name is one of an image to label, i.e. not a hidden or partially written file.
+ */
+inline bool isWatchedImgFileName(const std::string &imgFileName)
+{
+    return !imgFileName.empty() && imgFileName[0] != '.';
+}
+
+/**
+ * Labels and moves a batch of images of the input directory.
+ * Files that are gone, e.g. queued twice around a rescan, are skipped silently.
+ */
+template <typename G>
+int labelWatchBatch(const std::vector<std::string> &imgFileNames, std::string inputImgDirPath, std::string outputImgDirPath,
+    ServedModel<G> *pModel, int workerCount)
+{
+    std::vector<uint8_t> imgDataBuffers(imgFileNames.size() * G::size);
+    std::vector<int> imgDecodeRes(imgFileNames.size(), NO_ERROR);
+    std::vector<char> imgFound(imgFileNames.size(), 0);
+
+    /* Decode the batch on the worker pool, each worker writing into its file's own slot */
+    parallelFor(imgFileNames.size(), workerCount, [&](size_t i)
+    {
+        std::string inputImgFilePath = inputImgDirPath + "/" + imgFileNames[i];
+
+        struct stat st;
+        if(stat(inputImgFilePath.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            imgFound[i] = 1;
+            imgDecodeRes[i] = decodeImgDataBuffer(inputImgFilePath.c_str(), G::width, G::height, G::channels, G::extractor,
+                &imgDataBuffers[i * G::size]);
+        }
+    });
+
+    /* The whole batch is labeled with the same centroids */
+    std::shared_ptr<const ServedCentroids<G>> pCentroids = currentServedCentroids<G>(pModel);
+
+    CentroidDistanceTable centroidDistanceTable;
+    if(!pCentroids->quantized)
+    {
+        buildCentroidDistanceTable<G::size>(pCentroids->centroids, &centroidDistanceTable);
+    }
+
+    std::array<float, G::size> imgDataArray;
+    uint64_t distanceCount = 0;
+    uint64_t skippedDistanceCount = 0;
+
+    std::vector<Relocation> relocations;
+
+    for(size_t i = 0; i < imgFileNames.size(); i++)
+    {
+        std::string inputImgFilePath = inputImgDirPath + "/" + imgFileNames[i];
+
+        if(!imgFound[i])
+        {
+            continue;
+        }
+
+        if(imgDecodeRes[i] != NO_ERROR)
+        {
+            /* Skip problematic image file */
+            printImgDecodeError(inputImgFilePath.c_str(), imgDecodeRes[i]);
+            std::cout << "Skipping invalid or corrupt image: " << imgFileNames[i] << std::endl;
+            continue;
+        }
+
+        uint64_t clusterBegin = statsStageBegin();
+        uint32_t clusterId;
+        if(pCentroids->quantized)
+        {
+            /* Compare the downsampled pixels to the quantized centroids, without converting them */
+            clusterId = closestQuantizedCentroid(&imgDataBuffers[i * G::size], &pCentroids->quantizedModel);
+        }
+        else
+        {
+            imgDataBufferToArray<G>(&imgDataBuffers[i * G::size], pModel->normalize, &imgDataArray);
+            clusterId = closestCentroidPruned<G::size>(imgDataArray, pCentroids->centroids, &centroidDistanceTable, NULL, &distanceCount, &skippedDistanceCount);
+        }
+        statsStageEnd(STATS_STAGE_CLUSTER, clusterBegin);
+
+        Relocation relocation;
+        relocation.inputImgFilePath = inputImgFilePath;
+        relocation.imgFileName = imgFileNames[i];
+        relocation.clusterId = clusterId;
+        relocations.push_back(relocation);
+    }
+
+    statsCount(STATS_COUNTER_DISTANCES, distanceCount);
+    statsCount(STATS_COUNTER_DISTANCES_SKIPPED, skippedDistanceCount);
+
+    /* Move the batch into the label directories, creating each directory once */
+    return relocateImgs(relocations, outputImgDirPath, RELOCATE_OP_MOVE, workerCount);
+}
+
+/**
+ * Queues the images already in the input directory, e.g. the ones that arrived while the watch was not running.
+ */
+inline int queueWatchedDir(std::string inputImgDirPath, WatchQueue *pQueue)
+{
+    std::vector<std::string> imgFileNames;
+    int listRes = listImgFiles(inputImgDirPath, &imgFileNames);
+    if(listRes != NO_ERROR)
+    {
+        return listRes;
+    }
+
+    for(const std::string &imgFileName : imgFileNames)
+    {
+        if(isWatchedImgFileName(imgFileName) && !pushWatchQueue(pQueue, imgFileName))
+        {
+            break;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/**
+ * Labels the images of the input directory as they arrive, until SIGINT or SIGTERM is received.
+ * At most batchSize images are decoded at a time, on workerCount workers, and at most queueCapacity file names
+ * wait to be labeled.
+ */
+template <typename G>
+int runWatchPredict(std::string inputImgDirPath, std::string outputImgDirPath, std::string clusterCentroidsCsvFilePath,
+    int normalize, int workerCount, size_t batchSize, size_t queueCapacity)
+{
+    ServedModel<G> model;
+    model.clusterCentroidsCsvFilePath = clusterCentroidsCsvFilePath;
+    model.normalize = normalize;
+
+    /* Load the centroids once, up front */
+    int loadRes = loadServedModel<G>(&model);
+    if(loadRes != NO_ERROR)
+    {
+        std::cerr << "Error: failed to read the cluster centroids or quantized model file or it was trained with another geometry than " << G::width << "x" << G::height << "x" << G::channels << ": " << clusterCentroidsCsvFilePath << std::endl;
+        return loadRes;
+    }
+
+    /* Watch before listing so that no image arriving in between is missed */
+    int watchFd;
+    int watchRes = openDirWatch(inputImgDirPath, &watchFd);
+    if(watchRes != NO_ERROR)
+    {
+        std::cerr << "Error: failed to watch directory: " << inputImgDirPath << std::endl;
+        return watchRes;
+    }
+
+    installWatchStopHandler();
+
+    WatchQueue queue;
+    initWatchQueue(&queue, queueCapacity);
+
+    /* Label the queued images in batches */
+    int labelRes = NO_ERROR;
+    std::thread labeler([&]()
+    {
+        std::vector<std::string> imgFileNames;
+        while(popWatchBatch(&queue, batchSize, &imgFileNames))
+        {
+            labelRes = labelWatchBatch<G>(imgFileNames, inputImgDirPath, outputImgDirPath, &model, workerCount);
+            if(labelRes != NO_ERROR)
+            {
+                /* Stops the reader */
+                closeWatchQueue(&queue);
+                break;
+            }
+        }
+    });
+
+    int res = queueWatchedDir(inputImgDirPath, &queue);
+
+    /* Queue the images as they are fully written, pushing blocks while the labeler is behind */
+    std::vector<std::string> imgFileNames;
+    bool open = true;
+    while(res == NO_ERROR && open && !watchStopRequested())
+    {
+        bool overflow = false;
+        imgFileNames.clear();
+        res = readDirWatchEvents(watchFd, WATCH_POLL_TIMEOUT_MS, &imgFileNames, &overflow);
+
+        for(size_t i = 0; open && i < imgFileNames.size(); i++)
+        {
+            if(isWatchedImgFileName(imgFileNames[i]))
+            {
+                open = pushWatchQueue(&queue, imgFileNames[i]);
+            }
+        }
+
+        /* Events were dropped, pick the missed images up from the directory listing */
+        if(res == NO_ERROR && overflow)
+        {
+            std::cerr << "Watch event queue overflowed, rescanning: " << inputImgDirPath << std::endl;
+            res = queueWatchedDir(inputImgDirPath, &queue);
+        }
+    }
+
+    closeWatchQueue(&queue);
+    labeler.join();
+    close(watchFd);
+
+    return (res != NO_ERROR) ? res : labelRes;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * Checks the distance kernels against their references.
+ *
+ * Usage: K_Means_test
+ *
+ * Compares each float kernel compiled in and supported by the running CPU with a double precision sum and with the
+ * scalar reference, and the 8-bit kernels with exact integer sums, for every length from 0 to DISTANCE_TEST_MAX_LENGTH
+ * so that all the vector tails are covered, and from unaligned starting offsets. Each mismatch is written to stderr.
+ * Exits with 0 if all the checks pass, 1 otherwise.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include "distance.hpp"
+
+using namespace std;
+
+/* Largest length of the compared vectors */
+#define DISTANCE_TEST_MAX_LENGTH                                                                      1200
+
+/* Largest starting offset of the compared vectors, in elements */
+#define DISTANCE_TEST_MAX_OFFSET                                                                      3
+
+/* Relative tolerance of the float kernels, which sum in another order and may fuse the multiply-adds */
+#define DISTANCE_TEST_RELATIVE_TOLERANCE                                                              1e-5
+
+/* Seed of the test vectors */
+#define DISTANCE_TEST_SEED                                                                            42
+
+/**
+ * Squared Euclidean distance summed in double precision.
+ */
+static double distanceSquaredReference(const float *a, const float *b, size_t n)
+{
+    double sum = 0.0;
+    for(size_t i = 0; i < n; i++)
+    {
+        double d = (double)a[i] - (double)b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+/**
+ * Whether or not a float distance matches the double precision reference within the relative tolerance.
+ */
+static bool matchesReference(float distance, double reference)
+{
+    return fabs((double)distance - reference) <= DISTANCE_TEST_RELATIVE_TOLERANCE * reference;
+}
+
+/**
+ * Checks a float kernel against the double precision sum and the scalar reference.
+ * Returns the number of mismatches.
+ */
+static int checkFloatKernel(const DistanceKernelInfo &kernel, const vector<float> &a, const vector<float> &b)
+{
+    int failures = 0;
+    for(size_t offset = 0; offset <= DISTANCE_TEST_MAX_OFFSET; offset++)
+    {
+        for(size_t n = 0; n <= DISTANCE_TEST_MAX_LENGTH; n++)
+        {
+            double reference = distanceSquaredReference(&a[offset], &b[offset], n);
+            float scalar = distanceSquaredScalar(&a[offset], &b[offset], n);
+            float distance = kernel.kernel(&a[offset], &b[offset], n);
+            if(!matchesReference(distance, reference) || !matchesReference(distance, scalar))
+            {
+                fprintf(stderr, "%s: n=%zu offset=%zu: %.9g, scalar %.9g, expected %.9g\n", kernel.name, n, offset,
+                    distance, scalar, reference);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+/**
+ * Checks the 8-bit kernels against exact integer sums, on random bytes and on the largest differences.
+ * Returns the number of mismatches.
+ */
+static int checkU8Kernels(mt19937 &rng)
+{
+    uniform_int_distribution<int> value(0, 255);
+    vector<uint8_t> a(DISTANCE_TEST_MAX_LENGTH + DISTANCE_TEST_MAX_OFFSET);
+    vector<uint8_t> b(DISTANCE_TEST_MAX_LENGTH + DISTANCE_TEST_MAX_OFFSET);
+    vector<uint16_t> c(DISTANCE_TEST_MAX_LENGTH + DISTANCE_TEST_MAX_OFFSET);
+
+    int failures = 0;
+    for(int extremes = 0; extremes < 2; extremes++)
+    {
+        for(size_t i = 0; i < a.size(); i++)
+        {
+            a[i] = extremes ? (uint8_t)((i & 1) ? 255 : 0) : (uint8_t)value(rng);
+            b[i] = extremes ? (uint8_t)(255 - a[i]) : (uint8_t)value(rng);
+            c[i] = extremes ? (uint16_t)(a[i] ? 0 : 0xffff) : (uint16_t)(value(rng) << 8 | value(rng));
+        }
+        for(size_t offset = 0; offset <= DISTANCE_TEST_MAX_OFFSET; offset++)
+        {
+            for(size_t n = 0; n <= DISTANCE_TEST_MAX_LENGTH; n++)
+            {
+                uint32_t expectedU8 = 0;
+                uint64_t expectedU8U16 = 0;
+                for(size_t i = offset; i < offset + n; i++)
+                {
+                    int32_t d = (int32_t)a[i] - (int32_t)b[i];
+                    int64_t e = (int64_t)a[i] * 256 - (int64_t)c[i];
+                    expectedU8 += (uint32_t)(d * d);
+                    expectedU8U16 += (uint64_t)(e * e);
+                }
+                uint32_t u8 = distanceSquaredU8(&a[offset], &b[offset], n);
+                uint64_t u8u16 = distanceSquaredU8U16(&a[offset], &c[offset], n);
+                if(u8 != expectedU8)
+                {
+                    fprintf(stderr, "u8: n=%zu offset=%zu: %u, expected %u\n", n, offset, u8, expectedU8);
+                    failures++;
+                }
+                if(u8u16 != expectedU8U16)
+                {
+                    fprintf(stderr, "u8u16: n=%zu offset=%zu: %llu, expected %llu\n", n, offset,
+                        (unsigned long long)u8u16, (unsigned long long)expectedU8U16);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main()
+{
+    mt19937 rng(DISTANCE_TEST_SEED);
+
+    uniform_real_distribution<float> value(-255.0f, 255.0f);
+    vector<float> a(DISTANCE_TEST_MAX_LENGTH + DISTANCE_TEST_MAX_OFFSET);
+    vector<float> b(DISTANCE_TEST_MAX_LENGTH + DISTANCE_TEST_MAX_OFFSET);
+    for(size_t i = 0; i < a.size(); i++)
+    {
+        a[i] = value(rng);
+        b[i] = value(rng);
+    }
+
+    int failures = 0;
+    DistanceKernelInfo kernels[DISTANCE_KERNEL_MAX_COUNT];
+    int kernelCount = supportedDistanceKernels(kernels);
+    for(int k = 0; k < kernelCount; k++)
+    {
+        int kernelFailures = checkFloatKernel(kernels[k], a, b);
+        printf("distance %s: %s\n", kernels[k].name, kernelFailures ? "FAILED" : "ok");
+        failures += kernelFailures;
+    }
+
+    int u8Failures = checkU8Kernels(rng);
+    printf("distance u8: %s\n", u8Failures ? "FAILED" : "ok");
+    failures += u8Failures;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}